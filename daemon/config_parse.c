@@ -19,6 +19,7 @@
 #include "config_util.h"
 #include "config_parse.h"
 #include "connections.h"
+#include "ssl_context.h"
 
 static void do_asprintf(char **strp, const char *fmt, ...)
 {
@@ -323,6 +324,38 @@ static bool get_max_packet_size(cJSON *o, struct settings *settings,
     }
 }
 
+static bool get_zerocopy_threshold(cJSON *o, struct settings *settings,
+                                   char **error_msg) {
+    int threshold;
+    if (!get_int_value(o, o->string, &threshold, error_msg)) {
+        return false;
+    }
+    if (threshold < 0) {
+        do_asprintf(error_msg, "Invalid value specified for %s: %d\n",
+                    o->string, threshold);
+        return false;
+    }
+    settings->zerocopy_threshold = (size_t)threshold;
+    settings->has.zerocopy_threshold = true;
+    return true;
+}
+
+static bool get_io_uring_entries(cJSON *o, struct settings *settings,
+                                 char **error_msg) {
+    int entries;
+    if (!get_int_value(o, o->string, &entries, error_msg)) {
+        return false;
+    }
+    if (entries <= 0) {
+        do_asprintf(error_msg, "Invalid value specified for %s: %d\n",
+                    o->string, entries);
+        return false;
+    }
+    settings->io_uring_entries = entries;
+    settings->has.io_uring_entries = true;
+    return true;
+}
+
 static bool get_verbosity(cJSON *o, struct settings *settings,
                           char **error_msg) {
     if (get_int_value(o, o->string, &settings->verbose, error_msg)) {
@@ -383,6 +416,26 @@ static bool get_require_init(cJSON *o, struct settings *settings,
     }
 }
 
+static bool get_reuseport(cJSON *o, struct settings *settings,
+                          char **error_msg) {
+    if (get_bool_value(o, o->string, &settings->reuseport, error_msg)) {
+        settings->has.reuseport = true;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static bool get_io_uring(cJSON *o, struct settings *settings,
+                         char **error_msg) {
+    if (get_bool_value(o, o->string, &settings->io_uring, error_msg)) {
+        settings->has.io_uring = true;
+        return true;
+    } else {
+        return false;
+    }
+}
+
 static bool get_require_sasl(cJSON *o, struct settings *settings,
                              char **error_msg) {
     if (get_bool_value(o, o->string, &settings->require_sasl, error_msg)) {
@@ -553,6 +606,11 @@ static bool get_interface_ssl(int idx, cJSON *r, struct interface* iface,
                                     error_msg)) {
                     return false;
                 }
+            } else if (strcasecmp("ktls", p->string) == 0) {
+                if (!get_bool_value(p, "interface ssl ktls", &iface->ssl.ktls,
+                                    error_msg)) {
+                    return false;
+                }
             } else {
                 do_asprintf(error_msg, "Unknown attribute for ssl: %s\n",
                             p->string);
@@ -1033,6 +1091,54 @@ static bool dyna_validate_require_init(const struct settings *new_settings,
     }
 }
 
+static bool dyna_validate_reuseport(const struct settings *new_settings,
+                                    cJSON* errors)
+{
+    if (!new_settings->has.reuseport) {
+        return true;
+    }
+
+    if (new_settings->reuseport == settings.reuseport) {
+        return true;
+    } else {
+        cJSON_AddItemToArray(errors,
+                             cJSON_CreateString("'reuseport' is not a dynamic setting."));
+        return false;
+    }
+}
+
+static bool dyna_validate_io_uring(const struct settings *new_settings,
+                                   cJSON* errors)
+{
+    if (!new_settings->has.io_uring) {
+        return true;
+    }
+
+    if (new_settings->io_uring == settings.io_uring) {
+        return true;
+    } else {
+        cJSON_AddItemToArray(errors,
+                             cJSON_CreateString("'io_uring' is not a dynamic setting."));
+        return false;
+    }
+}
+
+static bool dyna_validate_io_uring_entries(const struct settings *new_settings,
+                                           cJSON* errors)
+{
+    if (!new_settings->has.io_uring_entries) {
+        return true;
+    }
+
+    if (new_settings->io_uring_entries == settings.io_uring_entries) {
+        return true;
+    } else {
+        cJSON_AddItemToArray(errors,
+                             cJSON_CreateString("'io_uring_entries' is not a dynamic setting."));
+        return false;
+    }
+}
+
 static bool dyna_validate_require_sasl(const struct settings *new_settings,
                                        cJSON* errors)
 {
@@ -1077,6 +1183,13 @@ static bool dyna_validate_reqs_per_event_low_priority(const struct settings *new
     return true;
 }
 
+static bool dyna_validate_zerocopy_threshold(const struct settings *new_settings,
+                                             cJSON* errors)
+{
+    /* zerocopy_threshold *is* dynamic */
+    return true;
+}
+
 static bool dyna_validate_verbosity(const struct settings *new_settings,
                                     cJSON* errors)
 {
@@ -1185,28 +1298,39 @@ static void dyna_reconfig_iface_nodelay(const struct interface *new_if,
     }
 }
 
-static void dyna_reconfig_iface_ssl(const struct interface *new_if,
+static void dyna_reconfig_iface_ssl(int idx, const struct interface *new_if,
                                     struct interface *cur_if) {
+    const char *cert = NULL;
+    const char *key = NULL;
+
     if (cur_if->ssl.cert != NULL && strcmp(new_if->ssl.cert,
                                            cur_if->ssl.cert) != 0) {
-        const char *old_cert = cur_if->ssl.cert;
-        cur_if->ssl.cert = strdup(new_if->ssl.cert);
+        cert = new_if->ssl.cert;
         /* TODO: change to EXTENSION_LOG_INFO */
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
             "Changed ssl.cert for interface %s:%hu from %s to %s",
-            cur_if->host, cur_if->port, old_cert, cur_if->ssl.cert);
-        free((char*)old_cert);
+            cur_if->host, cur_if->port, cur_if->ssl.cert, cert);
     }
 
     if (cur_if->ssl.key != NULL && strcmp(new_if->ssl.key,
                                            cur_if->ssl.key) != 0) {
-        const char *old_key = cur_if->ssl.key;
-        cur_if->ssl.key = strdup(new_if->ssl.key);
+        key = new_if->ssl.key;
         /* TODO: change to EXTENSION_LOG_INFO */
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
             "Changed ssl.key for interface %s:%hu from %s to %s",
-            cur_if->host, cur_if->port, old_key, cur_if->ssl.key);
-        free((char*)old_key);
+            cur_if->host, cur_if->port, cur_if->ssl.key, key);
+    }
+
+    /*
+     * The names are swapped (and the old ones freed) under the lock
+     * ssl_certs_refresh builds the contexts with. New connections use the
+     * new certificate from now on.
+     */
+    if ((cert != NULL || key != NULL) &&
+        !ssl_context_set_files(idx, cert, key)) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+            "Keeping the old SSL certificate for interface %s:%hu",
+            cur_if->host, cur_if->port);
     }
 }
 
@@ -1219,7 +1343,7 @@ static void dyna_reconfig_interfaces(const struct settings *new_settings) {
         dyna_reconfig_iface_maxconns(new_if, cur_if);
         dyna_reconfig_iface_backlog(new_if, cur_if);
         dyna_reconfig_iface_nodelay(new_if, cur_if);
-        dyna_reconfig_iface_ssl(new_if, cur_if);
+        dyna_reconfig_iface_ssl(ii, new_if, cur_if);
     }
 }
 
@@ -1284,6 +1408,18 @@ static void dyna_reconfig_verbosity(const struct settings *new_settings) {
     }
 }
 
+static void dyna_reconfig_zerocopy_threshold(const struct settings *new_settings) {
+    if (new_settings->has.zerocopy_threshold &&
+        new_settings->zerocopy_threshold != settings.zerocopy_threshold) {
+        size_t old_threshold = settings.zerocopy_threshold;
+        settings.zerocopy_threshold = new_settings->zerocopy_threshold;
+        /* TODO: change to EXTENSION_LOG_INFO */
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+            "Changed zerocopy_threshold from %zu to %zu", old_threshold,
+            settings.zerocopy_threshold);
+    }
+}
+
 static void dyna_reconfig_rbac_privilege_debug(const struct settings *new_settings) {
     if (new_settings->has.rbac_privilege_debug) {
         auth_set_privilege_debug(new_settings->rbac_privilege_debug);
@@ -1350,6 +1486,10 @@ struct {
     { "extensions", get_extensions, dyna_validate_extensions, NULL },
     { "engine", get_engine, dyna_validate_engine, NULL },
     { "require_init", get_require_init, dyna_validate_require_init, NULL },
+    { "reuseport", get_reuseport, dyna_validate_reuseport, NULL },
+    { "io_uring", get_io_uring, dyna_validate_io_uring, NULL },
+    { "io_uring_entries", get_io_uring_entries,
+      dyna_validate_io_uring_entries, NULL },
     { "require_sasl", get_require_sasl, dyna_validate_require_sasl, NULL },
     { "default_reqs_per_event", get_default_reqs_per_event,
       dyna_validate_default_reqs_per_event, dyna_reconfig_default_reqs_per_event },
@@ -1360,6 +1500,8 @@ struct {
     { "reqs_per_event_low_priority", get_reqs_per_event_low_priority,
       dyna_validate_reqs_per_event_low_priority, dyna_reconfig_reqs_per_event_low_priority },
     { "verbosity", get_verbosity, dyna_validate_verbosity, dyna_reconfig_verbosity },
+    { "zerocopy_threshold", get_zerocopy_threshold,
+      dyna_validate_zerocopy_threshold, dyna_reconfig_zerocopy_threshold },
     { "bio_drain_buffer_sz", get_bio_drain_sz, dyna_validate_bio_drain_sz, NULL },
     { "datatype_support", get_datatype, dyna_validate_datatype, NULL },
     { "root", get_root, dyna_validate_root, NULL},
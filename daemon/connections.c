@@ -16,6 +16,9 @@
  */
 
 #include "connections.h"
+#include "ssl_context.h"
+#include "zerocopy.h"
+#include "dcp_flow.h"
 
 #include <cJSON.h>
 
@@ -46,6 +49,7 @@ static enum loan_res conn_loan_single_buffer(conn *c, struct net_buf *thread_buf
                                              struct net_buf *conn_buf);
 static void conn_return_single_buffer(conn *c, struct net_buf *thread_buf,
                                       struct net_buf *conn_buf);
+static void conn_loan_read_buffer(conn *c);
 static int conn_constructor(conn *c);
 static void conn_destructor(conn *c);
 static conn *allocate_connection(void);
@@ -99,6 +103,11 @@ void run_event_loop(conn* c) {
          */
         release_connection(c);
         c = NULL;
+    } else if (c->migrate_to != NULL) {
+        /* Another thread takes over once the connection is idle. Unsafe
+         * to dereference c after a successful handoff.
+         */
+        conn_handoff(c);
     }
 }
 
@@ -227,45 +236,22 @@ conn *conn_new(const SOCKET sfd, in_port_t parent_port,
             if (parent_port == settings.interfaces[ii].port) {
                 c->nodelay = settings.interfaces[ii].tcp_nodelay;
                 if (settings.interfaces[ii].ssl.cert != NULL) {
-                    const char *cert = settings.interfaces[ii].ssl.cert;
-                    const char *pkey = settings.interfaces[ii].ssl.key;
-
-                    c->ssl.ctx = SSL_CTX_new(SSLv23_server_method());
-
-                    /* MB-12359 - Disable SSLv2 & SSLv3 due to POODLE */
-                    SSL_CTX_set_options(c->ssl.ctx,
-                                        SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
-
-                    /* @todo don't read files, but use in-memory-copies */
-                    if (!SSL_CTX_use_certificate_chain_file(c->ssl.ctx, cert) ||
-                        !SSL_CTX_use_PrivateKey_file(c->ssl.ctx, pkey, SSL_FILETYPE_PEM)) {
+                    /* Share the context of the interface */
+                    c->ssl.client = ssl_context_new_client(ii);
+                    if (c->ssl.client == NULL) {
                         release_connection(c);
                         return NULL;
                     }
 
                     c->ssl.enabled = true;
-                    c->ssl.error = false;
-                    c->ssl.client = NULL;
 
-                    c->ssl.in.buffer = malloc(settings.bio_drain_buffer_sz);
                     c->ssl.out.buffer = malloc(settings.bio_drain_buffer_sz);
-
-                    if (c->ssl.in.buffer == NULL || c->ssl.out.buffer == NULL) {
+                    if (c->ssl.out.buffer == NULL ||
+                        !SSL_set_fd(c->ssl.client, (int)sfd)) {
                         release_connection(c);
                         return NULL;
                     }
-
-                    c->ssl.in.buffsz = settings.bio_drain_buffer_sz;
                     c->ssl.out.buffsz = settings.bio_drain_buffer_sz;
-                    BIO_new_bio_pair(&c->ssl.application,
-                                     settings.bio_drain_buffer_sz,
-                                     &c->ssl.network,
-                                     settings.bio_drain_buffer_sz);
-
-                    c->ssl.client = SSL_new(c->ssl.ctx);
-                    SSL_set_bio(c->ssl.client,
-                                c->ssl.application,
-                                c->ssl.application);
                 }
             }
         }
@@ -301,6 +287,8 @@ conn *conn_new(const SOCKET sfd, in_port_t parent_port,
     c->iovused = 0;
     c->msgcurr = 0;
     c->msgused = 0;
+    c->nbatched = 0;
+    c->flushing = false;
     c->next = NULL;
     c->list_state = 0;
 
@@ -327,6 +315,14 @@ conn *conn_new(const SOCKET sfd, in_port_t parent_port,
 
     c->aiostat = ENGINE_SUCCESS;
     c->ewouldblock = false;
+    c->io_inflight = false;
+    c->io_completed = false;
+    c->zerocopy.enabled = false;
+    c->zerocopy.unsupported = false;
+    c->zerocopy.sent = false;
+    c->zerocopy.next = c->zerocopy.completed = 0;
+    c->zerocopy.nheld = 0;
+    dcp_flow_reset(c);
     c->refcount = 1;
 
     MEMCACHED_CONN_ALLOCATE(c->sfd);
@@ -338,7 +334,7 @@ conn *conn_new(const SOCKET sfd, in_port_t parent_port,
 
 void conn_cleanup_engine_allocations(conn* c) {
     if (c->item) {
-        settings.engine.v1->release(settings.engine.v0, c, c->item);
+        zerocopy_release_item(c, c->item);
         c->item = 0;
     }
 
@@ -373,6 +369,8 @@ static void conn_cleanup(conn *c) {
     c->read.bytes = 0;
     c->write.curr = c->write.buf;
     c->write.bytes = 0;
+    c->nbatched = 0;
+    c->flushing = false;
 
     /* Return any buffers back to the thread; before we disassociate the
      * connection from the thread. Note we clear TAP / UDP status first, so
@@ -384,18 +382,18 @@ static void conn_cleanup(conn *c) {
 
     c->engine_storage = NULL;
 
+    if (c->thread != NULL) {
+        STATS_BUMP(c->thread->load.released, 1);
+    }
     c->thread = NULL;
+    c->migrate_to = NULL;
     cb_assert(c->next == NULL);
     c->sfd = INVALID_SOCKET;
     c->start = 0;
     if (c->ssl.enabled) {
-        BIO_free_all(c->ssl.network);
         SSL_free(c->ssl.client);
         c->ssl.enabled = false;
-        c->ssl.error = false;
-        free(c->ssl.in.buffer);
         free(c->ssl.out.buffer);
-        SSL_CTX_free(c->ssl.ctx);
         memset(&c->ssl, 0, sizeof(c->ssl));
     }
 }
@@ -407,6 +405,7 @@ void conn_close(conn *c) {
 
     cb_assert(c->thread);
     /* remove from pending-io list */
+    drain_io_notifications(c->thread);
     if (settings.verbose > 1 && list_contains(c->thread->pending_io, c)) {
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
                                         "Current connection was in the pending-io list.. Nuking it\n");
@@ -423,20 +422,8 @@ void conn_shrink(conn *c) {
     cb_assert(c != NULL);
 
     if (c->read.size > READ_BUFFER_HIGHWAT && c->read.bytes < DATA_BUFFER_SIZE) {
-        void *newbuf;
-
-        if (c->read.curr != c->read.buf) {
-            /* Pack the buffer */
-            memmove(c->read.buf, c->read.curr, (size_t)c->read.bytes);
-        }
-
-        newbuf = realloc(c->read.buf, DATA_BUFFER_SIZE);
-
-        if (newbuf) {
-            c->read.buf = newbuf;
-            c->read.size = DATA_BUFFER_SIZE;
-        }
-        c->read.curr = c->read.buf;
+        /* Give the big buffer back to the thread for the next big packet */
+        conn_resize_read_buffer(c, DATA_BUFFER_SIZE);
     }
 
     if (c->msgsize > MSG_LIST_HIGHWAT) {
@@ -489,6 +476,26 @@ void connection_stats(ADD_STAT add_stats, conn *cookie, const int64_t fd) {
     cb_mutex_exit(&connections.mutex);
 }
 
+conn *find_connection(const int64_t fd, LIBEVENT_THREAD **thread) {
+    conn *iter;
+    conn *ret = NULL;
+    cb_mutex_enter(&connections.mutex);
+    for (iter = connections.sentinal.all_next;
+         iter != &connections.sentinal;
+         iter = iter->all_next) {
+        if (iter->sfd == fd && iter->sfd != INVALID_SOCKET &&
+            iter->state != conn_listening &&
+            iter->thread != NULL &&
+            (*thread == NULL || iter->thread == *thread)) {
+            ret = iter;
+            *thread = iter->thread;
+            break;
+        }
+    }
+    cb_mutex_exit(&connections.mutex);
+    return ret;
+}
+
 bool connection_set_nodelay(conn *c, bool enable)
 {
     int flags = 0;
@@ -523,18 +530,14 @@ bool connection_set_nodelay(conn *c, bool enable)
  * returned back to the worker thread.
  *
  * If there is a partial read/write, then the buffer is left loaned to that
- * connection and the worker thread will allocate a new one.
+ * connection and the worker thread will allocate a new one. Read buffers
+ * come from (and go back to) the pool of the thread, so that the buffers
+ * left with such connections are reused as well.
  */
 static void conn_loan_buffers(conn *c) {
     enum loan_res res;
-    res = conn_loan_single_buffer(c, &c->thread->read, &c->read);
-    if (res == loan_allocated) {
-        STATS_NOKEY(c, rbufs_allocated);
-    } else if (res == loan_loaned) {
-        STATS_NOKEY(c, rbufs_loaned);
-    } else if (res == loan_existing) {
-        STATS_NOKEY(c, rbufs_existing);
-    }
+
+    conn_loan_read_buffer(c);
 
     res = conn_loan_single_buffer(c, &c->thread->write, &c->write);
     if (res == loan_allocated) {
@@ -566,7 +569,10 @@ static void conn_return_buffers(conn *c) {
         return;
     }
 
-    conn_return_single_buffer(c, &c->thread->read, &c->read);
+    if ((c->read.curr == c->read.buf) && (c->read.bytes == 0)) {
+        /* Buffer clean (not in the middle of a packet), give it back */
+        rbuf_pool_put(&c->thread->rbufs, &c->read);
+    }
     conn_return_single_buffer(c, &c->thread->write, &c->write);
 }
 
@@ -642,7 +648,9 @@ static int conn_constructor(conn *c) {
     c->auth_context = auth_create(NULL, NULL, NULL);;
     c->state = conn_immediate_close;
     c->sfd = INVALID_SOCKET;
+    c->io_notify = io_notify_node_create(c);
     if (!conn_reset_buffersize(c)) {
+        io_notify_node_destroy(c->io_notify);
         free(c->read.buf);
         free(c->write.buf);
         free(c->ilist);
@@ -654,6 +662,7 @@ static int conn_constructor(conn *c) {
                                         "Failed to allocate buffers for connection\n");
         return 1;
     }
+    dcp_flow_init(c);
 
     STATS_LOCK();
     stats.conn_structs++;
@@ -667,6 +676,9 @@ static int conn_constructor(conn *c) {
  */
 static void conn_destructor(conn *c) {
     auth_destroy(c->auth_context);
+    io_notify_node_destroy(c->io_notify);
+    zerocopy_destroy(c);
+    dcp_flow_destroy(c);
     free(c->peername);
     free(c->sockname);
     free(c->read.buf);
@@ -793,10 +805,58 @@ static void conn_return_single_buffer(conn *c, struct net_buf *thread_buf,
     }
 }
 
+/**
+ * If the connection doesn't already have a read buffer (with partial data),
+ * take one from the pool of the worker thread.
+ */
+static void conn_loan_read_buffer(conn *c) {
+    bool reused;
+
+    if (c->read.buf != NULL) {
+        STATS_NOKEY(c, rbufs_existing);
+        return;
+    }
+
+    if (!rbuf_pool_get(&c->thread->rbufs, &c->read, DATA_BUFFER_SIZE,
+                       &reused)) {
+        if (settings.verbose) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                "%d: Failed to allocate new read buffer.. closing connection\n",
+                c->sfd);
+        }
+        conn_set_state(c, conn_closing);
+        return;
+    }
+
+    if (reused) {
+        STATS_NOKEY(c, rbufs_loaned);
+    } else {
+        STATS_NOKEY(c, rbufs_allocated);
+    }
+}
+
+bool conn_resize_read_buffer(conn *c, uint32_t size) {
+    bool reused;
+
+    if (!rbuf_pool_resize(&c->thread->rbufs, &c->read, size, &reused)) {
+        return false;
+    }
+
+    if (reused) {
+        STATS_NOKEY(c, rbufs_loaned);
+    } else {
+        STATS_NOKEY(c, rbufs_allocated);
+    }
+    return true;
+}
+
 static const char *substate_text(enum bin_substates state) {
     switch (state) {
     case bin_no_state: return "bin_no_state";
     case bin_reading_packet: return "bin_reading_packet";
+    case bin_reading_mutation_header: return "bin_reading_mutation_header";
+    case bin_reading_mutation_value: return "bin_reading_mutation_value";
+    case bin_stored_mutation_value: return "bin_stored_mutation_value";
     default:
         return "illegal";
     }
@@ -946,6 +1006,9 @@ static cJSON* get_connection_stats(const conn *c) {
         json_add_bool_to_object(obj, "ewouldblock", c->ewouldblock);
         json_add_uintptr_to_object(obj, "tap_iterator",
                                    (uintptr_t)c->tap_iterator);
+        if (c->dcp || c->dcp_flow.window != 0) {
+            cJSON_AddItemToObject(obj, "dcp_flow", dcp_flow_stats(c));
+        }
     }
     return obj;
 }
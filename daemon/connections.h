@@ -59,6 +59,13 @@ void conn_close(conn *c);
  */
 void conn_shrink(conn *c);
 
+/*
+ * Move the unparsed data in the read buffer of the connection to a buffer
+ * of at least the given size from the pool of its thread. Returns false
+ * (leaving the buffer alone) if we're out of memory.
+ */
+bool conn_resize_read_buffer(conn *c, uint32_t size);
+
 /**
  * Return the TCP or domain socket listening_port structure that
  * has a given port number
@@ -71,6 +78,14 @@ struct listening_port *get_listening_port_instance(const in_port_t port);
  */
 void connection_stats(ADD_STAT add_stats, conn *c, const int64_t fd);
 
+/*
+ * Look up the client connection using the given fd number. If *thread is
+ * non-NULL only the connections served by that thread are considered,
+ * otherwise *thread is set to the thread serving the connection. The
+ * connection may only be used by the thread serving it.
+ */
+conn *find_connection(const int64_t fd, LIBEVENT_THREAD **thread);
+
 bool connection_set_nodelay(conn *c, bool enable);
 
 /*
@@ -0,0 +1,215 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+#include "config.h"
+#include "dcp_flow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct dcp_flow_segment *dcp_flow_segment(const conn *c, uint32_t idx) {
+    return &c->dcp_flow.segments[(c->dcp_flow.head + idx) % c->dcp_flow.size];
+}
+
+void dcp_flow_init(conn *c) {
+    cb_mutex_initialize(&c->dcp_flow.mutex);
+}
+
+void dcp_flow_reset(conn *c) {
+    cb_mutex_enter(&c->dcp_flow.mutex);
+    c->dcp_flow.window = 0;
+    c->dcp_flow.unacked = c->dcp_flow.sent = c->dcp_flow.acked = 0;
+    c->dcp_flow.paused = false;
+    c->dcp_flow.pauses = 0;
+    c->dcp_flow.head = c->dcp_flow.nsegments = 0;
+    cb_mutex_exit(&c->dcp_flow.mutex);
+}
+
+/* Make room for one more segment, keeping them in order */
+static bool dcp_flow_grow(conn *c) {
+    uint32_t size = c->dcp_flow.size ? c->dcp_flow.size * 2 :
+        DCP_FLOW_SEGMENTS_INITIAL;
+    struct dcp_flow_segment *segments = malloc(size * sizeof(*segments));
+    uint32_t ii;
+
+    if (segments == NULL) {
+        return false;
+    }
+
+    for (ii = 0; ii < c->dcp_flow.nsegments; ++ii) {
+        segments[ii] = *dcp_flow_segment(c, ii);
+    }
+    free(c->dcp_flow.segments);
+    c->dcp_flow.segments = segments;
+    c->dcp_flow.size = size;
+    c->dcp_flow.head = 0;
+    return true;
+}
+
+void dcp_flow_set_window(conn *c, uint32_t window) {
+    cb_mutex_enter(&c->dcp_flow.mutex);
+    c->dcp_flow.window = window;
+    if (window == 0) {
+        c->dcp_flow.unacked = 0;
+        c->dcp_flow.head = c->dcp_flow.nsegments = 0;
+    }
+    if (!dcp_flow_full(c)) {
+        c->dcp_flow.paused = false;
+    }
+    cb_mutex_exit(&c->dcp_flow.mutex);
+}
+
+void dcp_flow_pause(conn *c) {
+    cb_mutex_enter(&c->dcp_flow.mutex);
+    if (!c->dcp_flow.paused) {
+        c->dcp_flow.paused = true;
+        ++c->dcp_flow.pauses;
+    }
+    cb_mutex_exit(&c->dcp_flow.mutex);
+}
+
+bool dcp_flow_full(const conn *c) {
+    return c->dcp_flow.window != 0 &&
+        c->dcp_flow.unacked >= c->dcp_flow.window;
+}
+
+void dcp_flow_sent(conn *c, uint16_t vbucket, uint32_t nbytes) {
+    struct dcp_flow_segment *tail = NULL;
+
+    if (c->dcp_flow.window == 0) {
+        return;
+    }
+
+    cb_mutex_enter(&c->dcp_flow.mutex);
+    c->dcp_flow.unacked += nbytes;
+    c->dcp_flow.sent += nbytes;
+
+    if (c->dcp_flow.nsegments > 0) {
+        tail = dcp_flow_segment(c, c->dcp_flow.nsegments - 1);
+    }
+
+    if (tail != NULL && tail->vbucket == vbucket &&
+        tail->nbytes <= UINT32_MAX - nbytes) {
+        tail->nbytes += nbytes;
+    } else if (c->dcp_flow.nsegments < c->dcp_flow.size || dcp_flow_grow(c)) {
+        tail = dcp_flow_segment(c, c->dcp_flow.nsegments++);
+        tail->vbucket = vbucket;
+        tail->nbytes = nbytes;
+    } else if (tail != NULL && tail->nbytes <= UINT32_MAX - nbytes) {
+        /* The total stays right, only the split per stream is off */
+        tail->nbytes += nbytes;
+    }
+    cb_mutex_exit(&c->dcp_flow.mutex);
+}
+
+void dcp_flow_ack(conn *c, uint32_t nbytes) {
+    cb_mutex_enter(&c->dcp_flow.mutex);
+    if (nbytes > c->dcp_flow.unacked) {
+        /* We don't hold the consumer to more than we sent */
+        nbytes = (uint32_t)c->dcp_flow.unacked;
+    }
+    c->dcp_flow.unacked -= nbytes;
+    c->dcp_flow.acked += nbytes;
+
+    while (nbytes > 0 && c->dcp_flow.nsegments > 0) {
+        struct dcp_flow_segment *head = dcp_flow_segment(c, 0);
+        if (head->nbytes > nbytes) {
+            head->nbytes -= nbytes;
+            break;
+        }
+        nbytes -= head->nbytes;
+        c->dcp_flow.head = (c->dcp_flow.head + 1) % c->dcp_flow.size;
+        --c->dcp_flow.nsegments;
+    }
+
+    if (!dcp_flow_full(c)) {
+        c->dcp_flow.paused = false;
+    }
+    cb_mutex_exit(&c->dcp_flow.mutex);
+}
+
+static int dcp_flow_segment_compare(const void *a, const void *b) {
+    const struct dcp_flow_segment *sa = a;
+    const struct dcp_flow_segment *sb = b;
+    return (int)sa->vbucket - (int)sb->vbucket;
+}
+
+/*
+ * The bytes in flight of each stream, by vBucket. Called with the mutex
+ * held.
+ */
+static cJSON *dcp_flow_stream_stats(const conn *c) {
+    cJSON *obj = cJSON_CreateObject();
+    struct dcp_flow_segment *segments;
+    uint32_t ii, nsegments = c->dcp_flow.nsegments;
+
+    if (nsegments == 0) {
+        return obj;
+    }
+
+    if ((segments = malloc(nsegments * sizeof(*segments))) == NULL) {
+        return obj;
+    }
+    for (ii = 0; ii < nsegments; ++ii) {
+        segments[ii] = *dcp_flow_segment(c, ii);
+    }
+    qsort(segments, nsegments, sizeof(*segments), dcp_flow_segment_compare);
+
+    ii = 0;
+    while (ii < nsegments) {
+        uint16_t vbucket = segments[ii].vbucket;
+        uint64_t nbytes = 0;
+        char name[16];
+
+        for (; ii < nsegments && segments[ii].vbucket == vbucket; ++ii) {
+            nbytes += segments[ii].nbytes;
+        }
+        snprintf(name, sizeof(name), "vb_%u", vbucket);
+        cJSON_AddNumberToObject(obj, name, (double)nbytes);
+    }
+    free(segments);
+
+    return obj;
+}
+
+cJSON *dcp_flow_stats(const conn *c) {
+    cb_mutex_t *mutex = (cb_mutex_t *)&c->dcp_flow.mutex;
+    cJSON *obj = cJSON_CreateObject();
+
+    cb_mutex_enter(mutex);
+    cJSON_AddNumberToObject(obj, "window", c->dcp_flow.window);
+    cJSON_AddNumberToObject(obj, "unacked_bytes",
+                            (double)c->dcp_flow.unacked);
+    cJSON_AddNumberToObject(obj, "sent_bytes", (double)c->dcp_flow.sent);
+    cJSON_AddNumberToObject(obj, "acked_bytes", (double)c->dcp_flow.acked);
+    if (c->dcp_flow.paused) {
+        cJSON_AddTrueToObject(obj, "paused");
+    } else {
+        cJSON_AddFalseToObject(obj, "paused");
+    }
+    cJSON_AddNumberToObject(obj, "pauses", (double)c->dcp_flow.pauses);
+    cJSON_AddItemToObject(obj, "streams", dcp_flow_stream_stats(c));
+    cb_mutex_exit(mutex);
+    return obj;
+}
+
+void dcp_flow_destroy(conn *c) {
+    free(c->dcp_flow.segments);
+    c->dcp_flow.segments = NULL;
+    c->dcp_flow.size = c->dcp_flow.head = c->dcp_flow.nsegments = 0;
+    cb_mutex_destroy(&c->dcp_flow.mutex);
+}
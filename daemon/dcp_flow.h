@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * Flow control of the DCP producer connections.
+ *
+ * A consumer asks for a window with a DCP control message setting
+ * DCP_FLOW_CONTROL_KEY to its size in bytes, and tells us with buffer
+ * acknowledgements how many of the bytes we sent it has processed. We
+ * count the bytes of the stream messages we send, and stop stepping the
+ * engine while the unacknowledged bytes fill the window, so a slow
+ * consumer doesn't make us queue (and pin the items of) more than that.
+ *
+ * The unacknowledged bytes are kept per vBucket in the order we sent
+ * them, so that we can tell how many bytes each stream has in flight (the
+ * consumer acknowledges the bytes in the order it got them).
+ *
+ * Only the thread serving the connection changes its flow control state,
+ * with the mutex of the state held so that the connection stats may look
+ * at it from another thread.
+ */
+#pragma once
+
+#include "memcached.h"
+#include <cJSON.h>
+
+#define DCP_FLOW_CONTROL_KEY "connection_buffer_size"
+
+/* The initial number of entries in the ring of unacknowledged bytes */
+#define DCP_FLOW_SEGMENTS_INITIAL 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* Bytes sent in a row for a vBucket and not yet acknowledged */
+    struct dcp_flow_segment {
+        uint16_t vbucket;
+        uint32_t nbytes;
+    };
+
+    /* Initialize the flow control state of a new connection object */
+    void dcp_flow_init(conn *c);
+
+    /* Turn flow control off and clear the counters for a new connection */
+    void dcp_flow_reset(conn *c);
+
+    /*
+     * Set the window of the connection, 0 turns flow control off (and
+     * forgets the bytes in flight).
+     */
+    void dcp_flow_set_window(conn *c, uint32_t window);
+
+    /* Is the window of the connection full? */
+    bool dcp_flow_full(const conn *c);
+
+    /* The producer waits for an acknowledgement (the window is full) */
+    void dcp_flow_pause(conn *c);
+
+    /* Count a message for the vBucket queued on a flow controlled connection */
+    void dcp_flow_sent(conn *c, uint16_t vbucket, uint32_t nbytes);
+
+    /* The consumer acknowledged that many bytes */
+    void dcp_flow_ack(conn *c, uint32_t nbytes);
+
+    /* The flow control state of the connection, for the connection stats */
+    cJSON *dcp_flow_stats(const conn *c);
+
+    /* Free the flow control state of the connection */
+    void dcp_flow_destroy(conn *c);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+#include "config.h"
+#include "io_notify.h"
+
+#ifdef HAVE_ATOMIC
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
+struct io_notify_node {
+    io_notify_node(struct conn *c) : conn(c), next(NULL), queued(false),
+                                     status(ENGINE_SUCCESS) {
+    }
+
+    struct conn *conn;
+    /* Only touched by the thread which set queued */
+    io_notify_node *next;
+    std::atomic<bool> queued;
+    std::atomic<int> status;
+};
+
+/*
+ * The producers push the nodes to the head of a stack, and the consumer
+ * takes the whole stack in one go. Since the consumer never pops a
+ * single node this doesn't suffer from the ABA problem.
+ */
+struct io_notify_queue {
+    io_notify_queue() : head(NULL), signalled(false) {
+    }
+
+    std::atomic<io_notify_node*> head;
+    std::atomic<bool> signalled;
+};
+
+IO_NOTIFY_QUEUE *io_notify_queue_create(void) {
+    return new io_notify_queue();
+}
+
+void io_notify_queue_destroy(IO_NOTIFY_QUEUE *queue) {
+    delete queue;
+}
+
+IO_NOTIFY_NODE *io_notify_node_create(struct conn *c) {
+    return new io_notify_node(c);
+}
+
+void io_notify_node_destroy(IO_NOTIFY_NODE *node) {
+    delete node;
+}
+
+bool io_notify_push(IO_NOTIFY_QUEUE *queue, IO_NOTIFY_NODE *node,
+                    ENGINE_ERROR_CODE status) {
+    node->status.store(status);
+    if (node->queued.exchange(true)) {
+        /* The consumer picks up the new status when it drains the node */
+        return false;
+    }
+
+    io_notify_node *head = queue->head.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!queue->head.compare_exchange_weak(head, node,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    return true;
+}
+
+void io_notify_drain(IO_NOTIFY_QUEUE *queue,
+                     void (*callback)(struct conn *c,
+                                      ENGINE_ERROR_CODE status,
+                                      void *arg),
+                     void *arg) {
+    if (queue->head.load(std::memory_order_relaxed) == NULL) {
+        return;
+    }
+
+    io_notify_node *node = queue->head.exchange(NULL,
+                                                std::memory_order_acquire);
+    io_notify_node *fifo = NULL;
+
+    /* The stack holds the most recent notification first */
+    while (node != NULL) {
+        io_notify_node *next = node->next;
+        node->next = fifo;
+        fifo = node;
+        node = next;
+    }
+
+    while (fifo != NULL) {
+        node = fifo;
+        fifo = node->next;
+        node->next = NULL;
+        /*
+         * Once we clear the flag the node may be pushed again, and a
+         * status stored before that is either seen here or results in
+         * the node being queued again.
+         */
+        node->queued.store(false);
+        callback(node->conn, ENGINE_ERROR_CODE(node->status.load()), arg);
+    }
+}
+
+bool io_notify_arm(IO_NOTIFY_QUEUE *queue) {
+    return !queue->signalled.exchange(true);
+}
+
+void io_notify_disarm(IO_NOTIFY_QUEUE *queue) {
+    queue->signalled.store(false);
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * A lock-free queue of the connections a worker thread got io completion
+ * notifications for. Any thread may push a connection, but only the
+ * worker thread owning the queue may drain it. The queue also holds the
+ * "wakeup pending" flag of the worker, so that a burst of notifications
+ * results in a single write to its notification channel.
+ *
+ * It is implemented in C++ to get the atomics from the standard library
+ * (see runtime.h).
+ */
+#pragma once
+
+#include <memcached/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    struct conn;
+    typedef struct io_notify_queue IO_NOTIFY_QUEUE;
+    typedef struct io_notify_node IO_NOTIFY_NODE;
+
+    IO_NOTIFY_QUEUE *io_notify_queue_create(void);
+    void io_notify_queue_destroy(IO_NOTIFY_QUEUE *queue);
+
+    /* Every connection owns a node used to link it into the queue */
+    IO_NOTIFY_NODE *io_notify_node_create(struct conn *c);
+    void io_notify_node_destroy(IO_NOTIFY_NODE *node);
+
+    /*
+     * Queue the connection owning the node with the given status. If the
+     * connection is already queued only its status is updated. Returns
+     * true if the connection was added to the queue.
+     */
+    bool io_notify_push(IO_NOTIFY_QUEUE *queue, IO_NOTIFY_NODE *node,
+                        ENGINE_ERROR_CODE status);
+
+    /*
+     * Remove all of the queued connections (in the order they were
+     * queued), and call the callback with each of them and their last
+     * status. May only be called by the consumer.
+     */
+    void io_notify_drain(IO_NOTIFY_QUEUE *queue,
+                         void (*callback)(struct conn *c,
+                                          ENGINE_ERROR_CODE status,
+                                          void *arg),
+                         void *arg);
+
+    /*
+     * Mark the consumer as woken up. Returns true if it wasn't already,
+     * and the caller must signal it.
+     */
+    bool io_notify_arm(IO_NOTIFY_QUEUE *queue);
+
+    /*
+     * Called by the consumer when it wakes up, before it looks for work.
+     */
+    void io_notify_disarm(IO_NOTIFY_QUEUE *queue);
+
+#ifdef __cplusplus
+}
+#endif
@@ -52,6 +52,25 @@ ENGINE_ERROR_CODE ioctl_set_property(conn* c, const char* key, size_t keylen,
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
                 "%d: IOCTL_SET: release_free_memory called\n", c->sfd);
         return ENGINE_SUCCESS;
+    } else if (strncmp("migrate_connection", key, keylen) == 0 &&
+               keylen == strlen("migrate_connection")) {
+        /* value is "<fd> <worker thread>" */
+        char val_buffer[IOCTL_VAL_LENGTH + 1]; /* +1 for terminating '\0' */
+        int64_t fd;
+        int thread;
+        ENGINE_ERROR_CODE ret;
+
+        memcpy(val_buffer, value, vallen);
+        val_buffer[vallen] = '\0';
+        if (sscanf(val_buffer, "%"SCNd64" %d", &fd, &thread) != 2) {
+            return ENGINE_EINVAL;
+        }
+
+        ret = migrate_conn(fd, thread);
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                "%d: IOCTL_SET: migrate_connection %"PRId64" to worker %d: %d\n",
+                c->sfd, fd, thread, ret);
+        return ret;
 #if defined(HAVE_TCMALLOC)
     } else if (strncmp("tcmalloc.aggressive_memory_decommit", key, keylen) == 0 &&
                keylen == strlen("tcmalloc.aggressive_memory_decommit")) {
@@ -29,6 +29,9 @@
 #include "utilities/protocol2text.h"
 #include "breakpad.h"
 #include "runtime.h"
+#include "ssl_context.h"
+#include "zerocopy.h"
+#include "dcp_flow.h"
 
 #include <signal.h>
 #include <fcntl.h>
@@ -59,6 +62,10 @@ static void item_set_cas(const void *cookie, item *it, uint64_t cas) {
 
 #define MAX_SASL_MECH_LEN 32
 
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
 volatile sig_atomic_t memcached_shutdown;
 
 /* Lock for global stats */
@@ -269,7 +276,7 @@ static void settings_init(void) {
     memset(&settings, 0, sizeof(settings));
     settings.num_interfaces = 1;
     settings.interfaces = &default_interface;
-    settings.bio_drain_buffer_sz = 8192;
+    settings.bio_drain_buffer_sz = 16384;
 
     settings.verbose = 0;
     settings.num_threads = get_number_of_worker_threads();
@@ -296,6 +303,10 @@ static void settings_init(void) {
     settings.breakpad.minidump_dir = NULL;
     settings.breakpad.content = CONTENT_DEFAULT;
     settings.require_init = false;
+    settings.reuseport = false;
+    settings.io_uring = false;
+    settings.io_uring_entries = 1024;
+    settings.zerocopy_threshold = 0;
 }
 
 static void settings_init_relocable_files(void)
@@ -394,6 +405,35 @@ static uint64_t get_listen_disabled_num(void) {
     return ret;
 }
 
+static int get_listen_backlog(in_port_t port) {
+    int ii;
+    for (ii = 0; ii < settings.num_interfaces; ++ii) {
+        if (port == settings.interfaces[ii].port) {
+            return settings.interfaces[ii].backlog;
+        }
+    }
+    return 1024;
+}
+
+/*
+ * Stop (or resume) accepting new clients on the listening sockets owned
+ * by a worker thread (see settings.reuseport). Must be called from the
+ * thread owning the sockets.
+ */
+void update_acceptors(LIBEVENT_THREAD *me, bool enable) {
+    int ii;
+    for (ii = 0; ii < me->num_acceptors; ++ii) {
+        conn *c = me->acceptors[ii];
+        int backlog = enable ? get_listen_backlog(c->parent_port) : 1;
+
+        update_event(c, enable ? EV_READ | EV_PERSIST : 0);
+        if (listen(c->sfd, backlog) != 0) {
+            log_socket_error(EXTENSION_LOG_WARNING, NULL,
+                             "listen() failed: %s");
+        }
+    }
+}
+
 static void disable_listen(void) {
     conn *next;
     cb_mutex_enter(&listen_state.mutex);
@@ -731,14 +771,16 @@ static int add_bin_header(conn *c,
 
     cb_assert(c);
 
-    c->msgcurr = 0;
-    c->msgused = 0;
-    c->iovused = 0;
-    if (add_msghdr(c) != 0) {
-        return -1;
+    if (c->nbatched == 0) {
+        c->msgcurr = 0;
+        c->msgused = 0;
+        c->iovused = 0;
+        if (add_msghdr(c) != 0) {
+            return -1;
+        }
     }
 
-    header = (protocol_binary_response_header *)c->write.buf;
+    header = (protocol_binary_response_header *)c->write.curr;
 
     header->response.magic = (uint8_t)PROTOCOL_BINARY_RES;
     header->response.opcode = c->binary_header.request.opcode;
@@ -763,7 +805,7 @@ static int add_bin_header(conn *c,
         }
     }
 
-    return add_iov(c, c->write.buf, sizeof(header->response));
+    return add_iov(c, c->write.curr, sizeof(header->response));
 }
 
 /**
@@ -916,7 +958,7 @@ static void write_bin_response(conn *c, const void *d, int extlen, int keylen,
 
 static void process_bin_get(conn *c) {
     item *it;
-    protocol_binary_response_get* rsp = (protocol_binary_response_get*)c->write.buf;
+    protocol_binary_response_get* rsp = (protocol_binary_response_get*)c->write.curr;
     char* key = binary_get_key(c);
     size_t nkey = c->binary_header.request.keylen;
     uint16_t keylen;
@@ -1009,6 +1051,20 @@ static void process_bin_get(conn *c) {
                 add_iov(c, info.info.key, nkey);
             }
 
+            if (zerocopy_wanted(c, info.info.nbytes)) {
+                /*
+                 * Send the value in a message of its own, as the header
+                 * lives in the write buffer which is reused as soon as
+                 * the response is sent.
+                 */
+                if (add_msghdr(c) != 0) {
+                    settings.engine.v1->release(settings.engine.v0, c, it);
+                    conn_set_state(c, conn_closing);
+                    return;
+                }
+                c->msglist[c->msgused - 1].msg_flags = MSG_ZEROCOPY;
+            }
+
             for (ii = 0; ii < info.info.nvalue; ++ii) {
                 add_iov(c, info.info.value[ii].iov_base,
                         info.info.value[ii].iov_len);
@@ -1027,7 +1083,7 @@ static void process_bin_get(conn *c) {
             conn_set_state(c, conn_new_cmd);
         } else {
             if (c->cmd == PROTOCOL_BINARY_CMD_GETK) {
-                char *ofs = c->write.buf + sizeof(protocol_binary_response_header);
+                char *ofs = c->write.curr + sizeof(protocol_binary_response_header);
                 if (add_bin_header(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
                                    0, (uint16_t)nkey,
                                    (uint32_t)nkey, PROTOCOL_BINARY_RAW_BYTES) == -1) {
@@ -1144,22 +1200,16 @@ static void bin_read_chunk(conn *c,
     /* Ok... do we have room for everything in our buffer? */
     offset = c->read.curr + sizeof(protocol_binary_request_header) - c->read.buf;
     if (c->rlbytes > c->read.size - offset) {
-        size_t nsize = c->read.size;
         size_t size = c->rlbytes + sizeof(protocol_binary_request_header);
 
-        while (size > nsize) {
-            nsize *= 2;
-        }
-
-        if (nsize != c->read.size) {
-            char *newm;
+        if (size > c->read.size) {
+            /* Get a buffer big enough for the whole packet in one go */
             if (settings.verbose > 1) {
                 settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
                         "%d: Need to grow buffer from %lu to %lu\n",
-                        c->sfd, (unsigned long)c->read.size, (unsigned long)nsize);
+                        c->sfd, (unsigned long)c->read.size, (unsigned long)size);
             }
-            newm = realloc(c->read.buf, nsize);
-            if (newm == NULL) {
+            if (!conn_resize_read_buffer(c, (uint32_t)size)) {
                 if (settings.verbose) {
                     settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                             "%d: Failed to grow buffer.. closing connection\n",
@@ -1168,11 +1218,6 @@ static void bin_read_chunk(conn *c,
                 conn_set_state(c, conn_closing);
                 return;
             }
-
-            c->read.buf= newm;
-            /* rcurr should point to the same offset in the packet */
-            c->read.curr = c->read.buf + offset - sizeof(protocol_binary_request_header);
-            c->read.size = (int)nsize;
         }
         if (c->read.buf != c->read.curr) {
             memmove(c->read.buf, c->read.curr, c->read.bytes);
@@ -1810,18 +1855,18 @@ static ENGINE_ERROR_CODE refresh_cbsasl(conn *c)
     return ENGINE_EWOULDBLOCK;
 }
 
-#if 0
 static void ssl_certs_refresh_main(void *c)
 {
-    /* Update the internal certificates */
-
-    notify_io_complete(c, ENGINE_SUCCESS);
+    /* Reread the certificates and keys of all of the interfaces */
+    if (ssl_contexts_refresh()) {
+        notify_io_complete(c, ENGINE_SUCCESS);
+    } else {
+        notify_io_complete(c, ENGINE_EINVAL);
+    }
 }
-#endif
+
 static ENGINE_ERROR_CODE refresh_ssl_certs(conn *c)
 {
-    (void)c;
-#if 0
     cb_thread_t tid;
     int err;
 
@@ -1835,8 +1880,6 @@ static ENGINE_ERROR_CODE refresh_ssl_certs(conn *c)
     }
 
     return ENGINE_EWOULDBLOCK;
-#endif
-    return ENGINE_SUCCESS;
 }
 
 static void process_bin_tap_connect(conn *c) {
@@ -2194,8 +2237,9 @@ static ENGINE_ERROR_CODE dcp_message_stream_end(const void *cookie,
     protocol_binary_request_dcp_stream_end packet;
     conn *c = (void*)cookie;
 
-    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size) {
-        /* We don't have room in the buffer */
+    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size ||
+        dcp_flow_full(c)) {
+        /* We don't have room in the buffer (or the consumer's) */
         return ENGINE_E2BIG;
     }
 
@@ -2212,6 +2256,7 @@ static ENGINE_ERROR_CODE dcp_message_stream_end(const void *cookie,
     add_iov(c, c->write.curr, sizeof(packet.bytes));
     c->write.curr += sizeof(packet.bytes);
     c->write.bytes += sizeof(packet.bytes);
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes));
 
     return ENGINE_SUCCESS;
 }
@@ -2226,8 +2271,9 @@ static ENGINE_ERROR_CODE dcp_message_marker(const void *cookie,
     protocol_binary_request_dcp_snapshot_marker packet;
     conn *c = (void*)cookie;
 
-    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size) {
-        /* We don't have room in the buffer */
+    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size ||
+        dcp_flow_full(c)) {
+        /* We don't have room in the buffer (or the consumer's) */
         return ENGINE_E2BIG;
     }
 
@@ -2246,6 +2292,7 @@ static ENGINE_ERROR_CODE dcp_message_marker(const void *cookie,
     add_iov(c, c->write.curr, sizeof(packet.bytes));
     c->write.curr += sizeof(packet.bytes);
     c->write.bytes += sizeof(packet.bytes);
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes));
 
     return ENGINE_SUCCESS;
 }
@@ -2264,10 +2311,12 @@ static ENGINE_ERROR_CODE dcp_message_mutation(const void* cookie,
     conn *c = (void*)cookie;
     item_info_holder info;
     protocol_binary_request_dcp_mutation packet;
+    size_t nbytes;
     int xx;
 
-    if (c->write.bytes + sizeof(packet.bytes) + nmeta >= c->write.size) {
-        /* We don't have room in the buffer */
+    if (c->write.bytes + sizeof(packet.bytes) + nmeta >= c->write.size ||
+        c->ileft == c->isize || dcp_flow_full(c)) {
+        /* We don't have room in the buffer (or the consumer's) */
         return ENGINE_E2BIG;
     }
 
@@ -2282,6 +2331,15 @@ static ENGINE_ERROR_CODE dcp_message_mutation(const void* cookie,
         return ENGINE_FAILED;
     }
 
+    nbytes = sizeof(packet.bytes) + info.info.nkey + info.info.nbytes + nmeta;
+    if (c->dcp_batch_bytes > 0 &&
+        c->dcp_batch_bytes + nbytes > DCP_BATCH_MAX_BYTES) {
+        /* Send what we've got first */
+        return ENGINE_E2BIG;
+    }
+    c->dcp_batch_bytes += nbytes;
+    dcp_flow_sent(c, vbucket, (uint32_t)nbytes);
+
     memset(packet.bytes, 0, sizeof(packet));
     packet.message.header.request.magic =  (uint8_t)PROTOCOL_BINARY_REQ;
     packet.message.header.request.opcode = (uint8_t)PROTOCOL_BINARY_CMD_DCP_MUTATION;
@@ -2332,7 +2390,8 @@ static ENGINE_ERROR_CODE dcp_message_deletion(const void* cookie,
 {
     conn *c = (void*)cookie;
     protocol_binary_request_dcp_deletion packet;
-    if (c->write.bytes + sizeof(packet.bytes) + nkey + nmeta >= c->write.size) {
+    if (c->write.bytes + sizeof(packet.bytes) + nkey + nmeta >= c->write.size ||
+        dcp_flow_full(c)) {
         return ENGINE_E2BIG;
     }
 
@@ -2359,6 +2418,7 @@ static ENGINE_ERROR_CODE dcp_message_deletion(const void* cookie,
     memcpy(c->write.curr, meta, nmeta);
     c->write.curr += nmeta;
     c->write.bytes += nmeta;
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes) + nkey + nmeta);
 
     return ENGINE_SUCCESS;
 }
@@ -2377,7 +2437,8 @@ static ENGINE_ERROR_CODE dcp_message_expiration(const void* cookie,
     conn *c = (void*)cookie;
     protocol_binary_request_dcp_deletion packet;
 
-    if (c->write.bytes + sizeof(packet.bytes) + nkey + nmeta >= c->write.size) {
+    if (c->write.bytes + sizeof(packet.bytes) + nkey + nmeta >= c->write.size ||
+        dcp_flow_full(c)) {
         return ENGINE_E2BIG;
     }
 
@@ -2404,6 +2465,7 @@ static ENGINE_ERROR_CODE dcp_message_expiration(const void* cookie,
     memcpy(c->write.curr, meta, nmeta);
     c->write.curr += nmeta;
     c->write.bytes += nmeta;
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes) + nkey + nmeta);
 
     return ENGINE_SUCCESS;
 }
@@ -2415,8 +2477,9 @@ static ENGINE_ERROR_CODE dcp_message_flush(const void* cookie,
     protocol_binary_request_dcp_flush packet;
     conn *c = (void*)cookie;
 
-    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size) {
-        /* We don't have room in the buffer */
+    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size ||
+        dcp_flow_full(c)) {
+        /* We don't have room in the buffer (or the consumer's) */
         return ENGINE_E2BIG;
     }
 
@@ -2430,6 +2493,7 @@ static ENGINE_ERROR_CODE dcp_message_flush(const void* cookie,
     add_iov(c, c->write.curr, sizeof(packet.bytes));
     c->write.curr += sizeof(packet.bytes);
     c->write.bytes += sizeof(packet.bytes);
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes));
 
     return ENGINE_SUCCESS;
 }
@@ -2442,8 +2506,9 @@ static ENGINE_ERROR_CODE dcp_message_set_vbucket_state(const void* cookie,
     protocol_binary_request_dcp_set_vbucket_state packet;
     conn *c = (void*)cookie;
 
-    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size) {
-        /* We don't have room in the buffer */
+    if (c->write.bytes + sizeof(packet.bytes) >= c->write.size ||
+        dcp_flow_full(c)) {
+        /* We don't have room in the buffer (or the consumer's) */
         return ENGINE_E2BIG;
     }
 
@@ -2476,6 +2541,7 @@ static ENGINE_ERROR_CODE dcp_message_set_vbucket_state(const void* cookie,
     add_iov(c, c->write.curr, sizeof(packet.bytes));
     c->write.curr += sizeof(packet.bytes);
     c->write.bytes += sizeof(packet.bytes);
+    dcp_flow_sent(c, vbucket, sizeof(packet.bytes));
 
     return ENGINE_SUCCESS;
 }
@@ -2572,6 +2638,22 @@ static ENGINE_ERROR_CODE dcp_message_control(const void* cookie,
     return ENGINE_SUCCESS;
 }
 
+/*
+ * Do we have room for more messages in the sendmsg() ship_dcp_log() is
+ * building (and in the flow control window of the consumer)?
+ */
+static bool dcp_batch_room(const conn *c) {
+    return c->ileft < c->isize &&
+        c->dcp_batch_bytes < DCP_BATCH_MAX_BYTES &&
+        c->write.size - c->write.bytes > DCP_BATCH_WBUF_RESERVE &&
+        !dcp_flow_full(c);
+}
+
+/*
+ * Let the engine fill the iovecs (and item list) with as many messages as
+ * there is room for before we send them with a single sendmsg(), rather
+ * than sending one message per call to the engine.
+ */
 static void ship_dcp_log(conn *c) {
     static struct dcp_message_producers producers = {
         dcp_message_get_failover_log,
@@ -2592,6 +2674,13 @@ static void ship_dcp_log(conn *c) {
     };
     ENGINE_ERROR_CODE ret;
 
+    if (dcp_flow_full(c)) {
+        /* Wait for the consumer to acknowledge what it got so far */
+        dcp_flow_pause(c);
+        c->ewouldblock = true;
+        return;
+    }
+
     c->msgcurr = 0;
     c->msgused = 0;
     c->iovused = 0;
@@ -2617,8 +2706,22 @@ static void ship_dcp_log(conn *c) {
     }
     c->icurr = c->ilist;
 
+    c->dcp_batch_bytes = 0;
     c->ewouldblock = false;
-    ret = settings.engine.v1->dcp.step(settings.engine.v0, c, &producers);
+    do {
+        int iovused = c->iovused;
+        ret = settings.engine.v1->dcp.step(settings.engine.v0, c, &producers);
+        if (c->iovused == iovused) {
+            /* Don't spin on an engine with nothing for us after all */
+            break;
+        }
+    } while (ret == ENGINE_WANT_MORE && dcp_batch_room(c));
+
+    if (ret == ENGINE_E2BIG && c->iovused > 0) {
+        /* We're full, send what we've got and step again */
+        ret = ENGINE_WANT_MORE;
+    }
+
     if (ret == ENGINE_SUCCESS) {
         /* the engine don't have more data to send at this moment */
         c->ewouldblock = true;
@@ -3970,7 +4073,13 @@ static void dcp_buffer_acknowledgement_executor(conn *c, void *packet)
 {
     protocol_binary_request_dcp_buffer_acknowledgement *req = packet;
 
-    if (settings.engine.v1->dcp.buffer_acknowledgement == NULL) {
+    if (c->dcp_flow.window != 0) {
+        /* We do the flow control of the connection, see dcp_flow.h */
+        uint32_t bbytes;
+        memcpy(&bbytes, &req->message.body.buffer_bytes, 4);
+        dcp_flow_ack(c, ntohl(bbytes));
+        conn_set_state(c, conn_new_cmd);
+    } else if (settings.engine.v1->dcp.buffer_acknowledgement == NULL) {
         write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
     } else {
         ENGINE_ERROR_CODE ret = c->aiostat;
@@ -4005,9 +4114,45 @@ static void dcp_buffer_acknowledgement_executor(conn *c, void *packet)
     }
 }
 
+/*
+ * Set the flow control window of the connection from the value of a DCP
+ * control message. Returns false if it isn't a number of bytes.
+ */
+static bool dcp_control_flow_window(conn *c, const uint8_t *value,
+                                    uint32_t nvalue) {
+    char buffer[32];
+    uint32_t window;
+
+    if (nvalue >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, value, nvalue);
+    buffer[nvalue] = '\0';
+    if (!safe_strtoul(buffer, &window)) {
+        return false;
+    }
+
+    dcp_flow_set_window(c, window);
+    return true;
+}
+
 static void dcp_control_executor(conn *c, void *packet)
 {
-    if (settings.engine.v1->dcp.control == NULL) {
+    protocol_binary_request_dcp_control *req = packet;
+    const uint8_t *key = req->bytes + sizeof(req->bytes);
+    uint16_t nkey = ntohs(req->message.header.request.keylen);
+
+    if (nkey == strlen(DCP_FLOW_CONTROL_KEY) &&
+        memcmp(key, DCP_FLOW_CONTROL_KEY, nkey) == 0) {
+        /* The daemon does the flow control, the engine never sees it */
+        const uint8_t *value = key + nkey;
+        uint32_t nvalue = ntohl(req->message.header.request.bodylen) - nkey;
+        if (dcp_control_flow_window(c, value, nvalue)) {
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        } else {
+            write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+        }
+    } else if (settings.engine.v1->dcp.control == NULL) {
         write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
     } else {
         ENGINE_ERROR_CODE ret = c->aiostat;
@@ -4015,9 +4160,6 @@ static void dcp_control_executor(conn *c, void *packet)
         c->ewouldblock = false;
 
         if (ret == ENGINE_SUCCESS) {
-            protocol_binary_request_dcp_control *req = packet;
-            const uint8_t *key = req->bytes + sizeof(req->bytes);
-            uint16_t nkey = ntohs(req->message.header.request.keylen);
             const uint8_t *value = key + nkey;
             uint32_t nvalue = ntohl(req->message.header.request.bodylen) - nkey;
             ret = settings.engine.v1->dcp.control(settings.engine.v0, c,
@@ -4424,6 +4566,23 @@ static void flush_executor(conn *c, void *packet)
     }
 }
 
+/*
+ * Mark the item as JSON if the value is, for clients which don't know
+ * about datatypes.
+ */
+static void detect_json_value(conn *c, item *it, item_info_holder *info) {
+    if (checkUTF8JSON((void*)info->info.value[0].iov_base,
+                      (int)info->info.value[0].iov_len)) {
+        info->info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+        if (!settings.engine.v1->set_item_info(settings.engine.v0, c,
+                                               it, &info->info)) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                    "%d: Failed to set item info",
+                    c->sfd);
+        }
+    }
+}
+
 static void add_set_replace_executor(conn *c, void *packet,
                                      ENGINE_STORE_OPERATION store_op)
 {
@@ -4485,16 +4644,7 @@ static void add_set_replace_executor(conn *c, void *packet,
         memcpy(info.info.value[0].iov_base, key + nkey, vlen);
 
         if (!c->supports_datatype) {
-            if (checkUTF8JSON((void*)info.info.value[0].iov_base,
-                              (int)info.info.value[0].iov_len)) {
-                info.info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
-                if (!settings.engine.v1->set_item_info(settings.engine.v0, c,
-                                                       it, &info.info)) {
-                    settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                            "%d: Failed to set item info",
-                            c->sfd);
-                }
-            }
+            detect_json_value(c, it, &info);
         }
     }
 
@@ -4521,7 +4671,7 @@ static void add_set_replace_executor(conn *c, void *packet,
                 return;
             }
             mutation_descr_t* const extras = (mutation_descr_t*)
-                    (c->write.buf + sizeof(protocol_binary_response_no_extras));
+                    (c->write.curr + sizeof(protocol_binary_response_no_extras));
             extras->vbucket_uuid = htonll(info.info.vbucket_uuid);
             extras->seqno = htonll(info.info.seqno);
             write_bin_response(c, extras, sizeof(*extras), 0, sizeof(*extras));
@@ -4664,16 +4814,7 @@ static void append_prepend_executor(conn *c,
         memcpy(info.info.value[0].iov_base, key + nkey, vlen);
 
         if (!c->supports_datatype) {
-            if (checkUTF8JSON((void*)info.info.value[0].iov_base,
-                              (int)info.info.value[0].iov_len)) {
-                info.info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
-                if (!settings.engine.v1->set_item_info(settings.engine.v0, c,
-                                                       it, &info.info)) {
-                    settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                            "%d: Failed to set item info",
-                            c->sfd);
-                }
-            }
+            detect_json_value(c, it, &info);
         }
     }
 
@@ -4700,7 +4841,7 @@ static void append_prepend_executor(conn *c,
                 return;
             }
             mutation_descr_t* const extras = (mutation_descr_t*)
-                    (c->write.buf + sizeof(protocol_binary_response_no_extras));
+                    (c->write.curr + sizeof(protocol_binary_response_no_extras));
             extras->vbucket_uuid = htonll(info.info.vbucket_uuid);
             extras->seqno = htonll(info.info.seqno);
             write_bin_response(c, extras, sizeof(*extras), 0, sizeof(*extras));
@@ -4828,6 +4969,8 @@ static void stat_executor(conn *c, void *packet)
             return;
         } else if (strncmp(subcommand, "aggregate", 9) == 0) {
             server_stats(&append_stats, c, true);
+        } else if (strncmp(subcommand, "threads", 7) == 0) {
+            thread_load_stats(&append_stats, c);
         } else if (strncmp(subcommand, "connections", 11) == 0) {
             int64_t fd = -1; /* default to all connections */
             /* Check for specific connection number - allow up to 32 chars for FD */
@@ -4981,7 +5124,7 @@ static void arithmetic_executor(conn *c, void *packet)
         c->cas = info.cas;
 
         char* body_buf =
-                (c->write.buf + sizeof(protocol_binary_response_incr));
+                (c->write.curr + sizeof(protocol_binary_response_incr));
         if (c->supports_mutation_extras) {
             /* Response includes vbucket UUID and sequence number (in addition
              * to value) */
@@ -5474,6 +5617,10 @@ static void process_bin_packet(conn *c) {
     bin_package_validate validator = validators[opcode];
     bin_package_execute executor = executors[opcode];
 
+    if (c->thread != NULL) {
+        STATS_BUMP(c->thread->load.ops, 1);
+    }
+
     switch (auth_check_access(c->auth_context, opcode)) {
     case AUTH_FAIL:
         /* @TODO Should go to audit */
@@ -5536,6 +5683,146 @@ static CB_INLINE bool is_initialized(conn *c, uint8_t opcode)
     }
 }
 
+/*
+ * Is this a mutation with a value big enough that we should read it
+ * straight into the item, instead of buffering the whole packet first?
+ */
+static bool stream_bin_value(const protocol_binary_request_header *req) {
+    if (req->request.magic != PROTOCOL_BINARY_REQ ||
+        req->request.bodylen < (uint32_t)req->request.extlen +
+                               req->request.keylen + STREAM_VALUE_MIN) {
+        return false;
+    }
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* The size of the header, extras and key of the current packet */
+static uint32_t bin_mutation_header_size(conn *c) {
+    return sizeof(c->binary_header) + c->binary_header.request.extlen +
+        c->binary_header.request.keylen;
+}
+
+/*
+ * Give up on reading the value straight into the item, and read the rest
+ * of the packet into the read buffer for process_bin_packet().
+ */
+static void bin_read_rest(conn *c) {
+    uint32_t nheader = bin_mutation_header_size(c);
+
+    /* Pretend we're still at the start of the packet */
+    c->read.curr -= nheader;
+    c->read.bytes += nheader;
+    bin_read_chunk(c, bin_reading_packet, c->binary_header.request.bodylen);
+    c->read.curr += sizeof(c->binary_header);
+    c->read.bytes -= sizeof(c->binary_header);
+}
+
+/*
+ * We've read the header, extras and key of a mutation with a big value.
+ * Allocate the item, and let conn_nread read the value straight into it.
+ * Anything out of the ordinary is left to process_bin_packet().
+ */
+static void process_bin_mutation_header(conn *c) {
+    uint32_t nheader = bin_mutation_header_size(c);
+    protocol_binary_request_set *req =
+        (protocol_binary_request_set *)(c->read.curr - nheader);
+    uint8_t opcode = c->binary_header.request.opcode;
+    char *key = (char *)req + sizeof(req->bytes);
+    uint16_t nkey = c->binary_header.request.keylen;
+    uint32_t vlen = c->binary_header.request.bodylen -
+        (nheader - sizeof(c->binary_header));
+    ENGINE_ERROR_CODE ret = c->aiostat;
+    item_info_holder info;
+    item *it;
+
+    c->aiostat = ENGINE_SUCCESS;
+    c->ewouldblock = false;
+
+    if (c->read.bytes >= vlen ||
+        auth_check_access(c->auth_context, opcode) != AUTH_OK ||
+        validators[opcode](req) != 0) {
+        /* We already have the value, or won't store it anyway */
+        bin_read_rest(c);
+        return;
+    }
+
+    if (ret == ENGINE_SUCCESS) {
+        ret = settings.engine.v1->allocate(settings.engine.v0, c,
+                                           &it, key, nkey, vlen,
+                                           req->message.body.flags,
+                                           ntohl(req->message.body.expiration),
+                                           req->message.header.request.datatype);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->ewouldblock = true;
+        return;
+    default:
+        /* Let the executor report the error once the packet is read */
+        bin_read_rest(c);
+        return;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.info.nvalue = 1;
+    if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
+                                           (void*)&info)) {
+        settings.engine.v1->release(settings.engine.v0, c, it);
+        bin_read_rest(c);
+        return;
+    }
+    cb_assert(info.info.value[0].iov_len == vlen);
+    item_set_cas(c, it, ntohll(req->message.header.request.cas));
+    c->item = it;
+
+    /*
+     * Move the part of the value we've got over, and read the rest into
+     * the item. The header stays in the read buffer for the executor.
+     */
+    memcpy(info.info.value[0].iov_base, c->read.curr, c->read.bytes);
+    c->ritem = (char *)info.info.value[0].iov_base + c->read.bytes;
+    c->rlbytes = vlen - c->read.bytes;
+    c->read.bytes = 0;
+    c->substate = bin_reading_mutation_value;
+}
+
+/* The value of a mutation is in the item, store it */
+static void process_bin_mutation_value(conn *c) {
+    char *packet = c->read.curr - bin_mutation_header_size(c);
+
+    if (c->substate == bin_reading_mutation_value && !c->supports_datatype) {
+        item_info_holder info;
+        memset(&info, 0, sizeof(info));
+        info.info.nvalue = 1;
+        if (settings.engine.v1->get_item_info(settings.engine.v0, c, c->item,
+                                              (void*)&info)) {
+            detect_json_value(c, c->item, &info);
+        }
+    }
+
+    if (c->thread != NULL) {
+        STATS_BUMP(c->thread->load.ops, 1);
+    }
+
+    /* Don't check the value again if the engine blocks */
+    c->substate = bin_stored_mutation_value;
+    executors[c->binary_header.request.opcode](c, packet);
+}
+
 static void dispatch_bin_command(conn *c) {
     uint16_t keylen = c->binary_header.request.keylen;
 
@@ -5578,6 +5865,10 @@ static void dispatch_bin_command(conn *c) {
     if (c->binary_header.request.bodylen > settings.max_packet_size) {
         write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
         c->write_and_go = conn_closing;
+    } else if (stream_bin_value(&c->binary_header)) {
+        /* Read up to the value, which we read into the item later */
+        bin_read_chunk(c, bin_reading_mutation_header,
+                       c->binary_header.request.extlen + keylen);
     } else {
         bin_read_chunk(c, bin_reading_packet, c->binary_header.request.bodylen);
     }
@@ -5625,7 +5916,7 @@ static void process_bin_delete(conn *c) {
         if (c->supports_mutation_extras) {
             /* Response includes vbucket UUID and sequence number */
             mutation_descr_t* const extras = (mutation_descr_t*)
-                    (c->write.buf + sizeof(protocol_binary_response_delete));
+                    (c->write.curr + sizeof(protocol_binary_response_delete));
 
             extras->vbucket_uuid = htonll(mut_info.vbucket_uuid);
             extras->seqno = htonll(mut_info.seqno);
@@ -5661,6 +5952,13 @@ static void complete_nread(conn *c) {
     cb_assert(c->cmd >= 0);
 
     switch(c->substate) {
+    case bin_reading_mutation_header:
+        process_bin_mutation_header(c);
+        break;
+    case bin_reading_mutation_value:
+    case bin_stored_mutation_value:
+        process_bin_mutation_value(c);
+        break;
     case bin_reading_packet:
         if (c->binary_header.request.magic == PROTOCOL_BINARY_RES) {
             RESPONSE_HANDLER handler;
@@ -5689,7 +5987,7 @@ static void reset_cmd_handler(conn *c) {
     c->cmd = -1;
     c->substate = bin_no_state;
     if(c->item != NULL) {
-        settings.engine.v1->release(settings.engine.v0, c, c->item);
+        zerocopy_release_item(c, c->item);
         c->item = NULL;
     }
 
@@ -5698,9 +5996,15 @@ static void reset_cmd_handler(conn *c) {
         c->read.curr = c->read.buf;
     }
 
-    conn_shrink(c);
+    if (c->nbatched == 0) {
+        conn_shrink(c);
+    }
     if (c->read.bytes > 0) {
         conn_set_state(c, conn_parse_cmd);
+    } else if (c->nbatched > 0) {
+        /* Send the responses we held back before we wait for more */
+        c->write_and_go = conn_waiting;
+        conn_set_state(c, conn_mwrite);
     } else {
         conn_set_state(c, conn_waiting);
     }
@@ -5710,8 +6014,16 @@ static void reset_cmd_handler(conn *c) {
 static void write_and_free(conn *c, char *buf, size_t bytes) {
     if (buf) {
         c->write_and_free = buf;
-        c->write.curr = buf;
-        c->write.bytes = (uint32_t)bytes;
+        if (c->nbatched > 0) {
+            /* Send it after the responses we held back */
+            if (add_iov(c, buf, bytes) != 0) {
+                conn_set_state(c, conn_closing);
+                return;
+            }
+        } else {
+            c->write.curr = buf;
+            c->write.bytes = (uint32_t)bytes;
+        }
         conn_set_state(c, conn_write);
         c->write_and_go = conn_new_cmd;
     } else {
@@ -5950,6 +6262,10 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
 
     APPEND_STAT("verbosity", "%d", settings.verbose);
     APPEND_STAT("num_threads", "%d", settings.num_threads);
+    APPEND_STAT("reuseport", "%s", settings.reuseport ? "true" : "false");
+    APPEND_STAT("io_uring", "%s", settings.io_uring ? "true" : "false");
+    APPEND_STAT("io_uring_entries", "%d", settings.io_uring_entries);
+    APPEND_STAT("zerocopy_threshold", "%zu", settings.zerocopy_threshold);
     APPEND_STAT("reqs_per_event_high_priority", "%d",
                 settings.reqs_per_event_high_priority);
     APPEND_STAT("reqs_per_event_med_priority", "%d",
@@ -5993,55 +6309,437 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
 }
 
 /*
- * if we have a complete line in the buffer, process it.
+ * May the response to the command be held back to be sent along with the
+ * responses to the next ones? The response of these commands only refers
+ * to the write buffer, the item and static data, and they never switch
+ * the connection to another mode.
  */
-static int try_read_command(conn *c) {
-    cb_assert(c != NULL);
-    cb_assert(c->read.curr <= (c->read.buf + c->read.size));
-    cb_assert(c->read.bytes > 0);
+static bool response_batchable(uint8_t opcode) {
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+    case PROTOCOL_BINARY_CMD_NOOP:
+        return true;
+    default:
+        return false;
+    }
+}
 
-    /* Do we have the complete packet header? */
-    if (c->read.bytes < sizeof(c->binary_header)) {
-        /* need more data! */
-        return 0;
-    } else {
-#ifdef NEED_ALIGN
-        if (((long)(c->read.curr)) % 8 != 0) {
-            /* must realign input buffer */
-            memmove(c->read.buf, c->read.curr, c->read.bytes);
-            c->read.curr = c->read.buf;
-            if (settings.verbose > 1) {
-                settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
-                                                "%d: Realign input buffer\n", c->sfd);
-            }
-        }
-#endif
-        protocol_binary_request_header* req;
-        req = (protocol_binary_request_header*)c->read.curr;
+/*
+ * Is the next packet in the read buffer complete, and a command which may
+ * add its response to the ones held back?
+ */
+static bool next_command_batchable(conn *c) {
+    protocol_binary_request_header req;
 
-        if (settings.verbose > 1) {
-            /* Dump the packet before we convert it to host order */
-            char buffer[1024];
-            ssize_t nw;
-            nw = bytes_to_output_string(buffer, sizeof(buffer), c->sfd,
-                                        true, "Read binary protocol data:",
-                                        (const char*)req->bytes,
-                                        sizeof(req->bytes));
-            if (nw != -1) {
-                settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
-                                                "%s", buffer);
-            }
-        }
+    if (c->read.bytes < sizeof(req)) {
+        return false;
+    }
 
-        c->binary_header = *req;
-        c->binary_header.request.keylen = ntohs(req->request.keylen);
-        c->binary_header.request.bodylen = ntohl(req->request.bodylen);
-        c->binary_header.request.vbucket = ntohs(req->request.vbucket);
-        c->binary_header.request.cas = ntohll(req->request.cas);
+    memcpy(&req, c->read.curr, sizeof(req));
+    return req.request.magic == PROTOCOL_BINARY_REQ &&
+        c->read.bytes - sizeof(req) >= ntohl(req.request.bodylen) &&
+        response_batchable(req.request.opcode);
+}
 
-        if (c->binary_header.request.magic != PROTOCOL_BINARY_REQ &&
-            !(c->binary_header.request.magic == PROTOCOL_BINARY_RES &&
-              response_handlers[c->binary_header.request.opcode])) {
+/*
+ * Hold back the response we just built (instead of sending it right away)
+ * if the next command is already waiting in the read buffer, so that a
+ * pipeline of small commands is answered with a few big sendmsg() calls
+ * rather than one per command. The next response is built in the write
+ * buffer after this one, and the item we send from goes to the item list.
+ *
+ * @return true if the response was held back
+ */
+static bool hold_response(conn *c) {
+    char *end = c->write.curr;
+    size_t nbytes = 0;
+    int ii;
+
+    if (c->write_and_go != conn_new_cmd || c->nevents <= 0 ||
+        c->tap_iterator != NULL || c->dcp ||
+        !response_batchable(c->cmd) ||
+        c->iovused >= RESPONSE_BATCH_MAX_IOV ||
+        (c->msglist[c->msgused - 1].msg_flags & MSG_ZEROCOPY) ||
+        !next_command_batchable(c)) {
+        return false;
+    }
+
+    if (c->item != NULL &&
+        ((c->ileft == 0 && !conn_setup_itemlist(c)) ||
+         c->ileft == c->isize)) {
+        return false;
+    }
+
+    /* Find the end of what the responses use of the write buffer */
+    for (ii = 0; ii < c->iovused; ++ii) {
+        char *base = c->iov[ii].iov_base;
+        size_t len = c->iov[ii].iov_len;
+
+        nbytes += len;
+        if (base >= c->write.buf && base < c->write.buf + c->write.size &&
+            base + len > end) {
+            end = base + len;
+        }
+    }
+
+    /* Keep the headers of the next response aligned */
+    end = c->write.buf + ((end - c->write.buf + 7) & ~(size_t)7);
+    if (nbytes >= RESPONSE_BATCH_MAX_BYTES ||
+        end + RESPONSE_BATCH_WBUF_RESERVE > c->write.buf + c->write.size) {
+        return false;
+    }
+
+    if (c->item != NULL) {
+        c->ilist[c->ileft++] = c->item;
+        c->item = NULL;
+    }
+    c->write.bytes = (uint32_t)(end - c->write.buf);
+    c->write.curr = end;
+    ++c->nbatched;
+    return true;
+}
+
+/*
+ * May the (complete) packet be answered as part of a batch of gets? It
+ * must be a get which process_bin_packet() would execute.
+ */
+static bool bin_get_batchable(conn *c, protocol_binary_request_header *req) {
+    uint8_t opcode = req->request.opcode;
+
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        break;
+    default:
+        return false;
+    }
+
+    return get_validator(req) == 0 &&
+        ntohs(req->request.keylen) <= KEY_MAX_LENGTH &&
+        is_initialized(c, opcode) &&
+        (!settings.require_sasl || authenticated(c)) &&
+        auth_check_access(c->auth_context, opcode) == AUTH_OK;
+}
+
+/*
+ * Add the response for a get which found the item. The response header
+ * is put at *wbuf (in the write buffer), and the item is kept in the
+ * item list until the responses are sent.
+ *
+ * @return false if the get must be processed on its own instead
+ */
+static bool add_bin_get_hit(conn *c, protocol_binary_request_header *req,
+                            item *it, char **wbuf) {
+    protocol_binary_response_get *rsp = (protocol_binary_response_get *)*wbuf;
+    bool getk = req->request.opcode == PROTOCOL_BINARY_CMD_GETK ||
+        req->request.opcode == PROTOCOL_BINARY_CMD_GETKQ;
+    uint16_t nkey = getk ? ntohs(req->request.keylen) : 0;
+    item_info_holder info;
+    uint8_t datatype;
+    int ii;
+
+    memset(&info, 0, sizeof(info));
+    info.info.nvalue = IOV_MAX;
+    if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
+                                           (void*)&info)) {
+        return false;
+    }
+
+    datatype = info.info.datatype;
+    if (!c->supports_datatype) {
+        if ((datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) ==
+            PROTOCOL_BINARY_DATATYPE_COMPRESSED) {
+            /* process_bin_get() inflates it */
+            return false;
+        }
+        datatype = PROTOCOL_BINARY_RAW_BYTES;
+    }
+
+    memset(rsp, 0, sizeof(rsp->bytes));
+    rsp->message.header.response.magic = (uint8_t)PROTOCOL_BINARY_RES;
+    rsp->message.header.response.opcode = req->request.opcode;
+    rsp->message.header.response.keylen = htons(nkey);
+    rsp->message.header.response.extlen = sizeof(rsp->message.body);
+    rsp->message.header.response.datatype = datatype;
+    rsp->message.header.response.bodylen =
+        htonl(sizeof(rsp->message.body) + nkey + info.info.nbytes);
+    rsp->message.header.response.opaque = req->request.opaque;
+    rsp->message.header.response.cas = htonll(info.info.cas);
+    rsp->message.body.flags = info.info.flags;
+
+    add_iov(c, rsp->bytes, sizeof(rsp->bytes));
+    if (getk) {
+        add_iov(c, info.info.key, nkey);
+    }
+    for (ii = 0; ii < info.info.nvalue; ++ii) {
+        add_iov(c, info.info.value[ii].iov_base, info.info.value[ii].iov_len);
+    }
+
+    STATS_HIT(c, get, info.info.key, info.info.nkey);
+    c->ilist[c->ileft++] = it;
+    *wbuf += sizeof(rsp->bytes);
+    return true;
+}
+
+/*
+ * Add the response (if any) for a get which didn't find the item. The
+ * response header is put at *wbuf (in the write buffer).
+ */
+static void add_bin_get_miss(conn *c, protocol_binary_request_header *req,
+                             char **wbuf) {
+    protocol_binary_response_header *rsp =
+        (protocol_binary_response_header *)*wbuf;
+    uint16_t nkey = ntohs(req->request.keylen);
+    const char *errtext = NULL;
+    uint32_t bodylen;
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        return;
+    case PROTOCOL_BINARY_CMD_GETK:
+        bodylen = nkey;
+        break;
+    default:
+        nkey = 0;
+        errtext = memcached_protocol_errcode_2_text(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+        bodylen = errtext ? (uint32_t)strlen(errtext) : 0;
+    }
+
+    memset(rsp, 0, sizeof(rsp->bytes));
+    rsp->response.magic = (uint8_t)PROTOCOL_BINARY_RES;
+    rsp->response.opcode = req->request.opcode;
+    rsp->response.keylen = htons(nkey);
+    rsp->response.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    rsp->response.status = htons(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+    rsp->response.bodylen = htonl(bodylen);
+    rsp->response.opaque = req->request.opaque;
+    *wbuf += sizeof(rsp->bytes);
+
+    add_iov(c, rsp->bytes, sizeof(rsp->bytes));
+    if (nkey > 0) {
+        memcpy(*wbuf, (char *)(req + 1), nkey);
+        add_iov(c, *wbuf, nkey);
+        *wbuf += nkey;
+    } else if (errtext != NULL) {
+        add_iov(c, errtext, bodylen);
+    }
+}
+
+/*
+ * Look up a burst of pipelined gets already in the read buffer in one
+ * call to the engine's get_multi(), and send all of the responses with
+ * a single sendmsg(). Anything out of the ordinary (the engine can't
+ * answer a key right away, the value must be inflated, ...) ends the
+ * batch, and the remaining packets are processed one by one.
+ *
+ * @return true if we took care of the packet(s) at the start of the buffer
+ */
+static bool process_bin_get_batch(conn *c) {
+    protocol_binary_request_header *reqs[GET_BATCH_MAX];
+    item_key keys[GET_BATCH_MAX];
+    item *items[GET_BATCH_MAX];
+    ENGINE_ERROR_CODE status[GET_BATCH_MAX];
+    char *ptr = c->read.curr;
+    uint32_t avail = c->read.bytes;
+    size_t wneeded = 0;
+    char *wbuf;
+    int nkeys = 0;
+    int ii, done;
+
+    if (settings.engine.v1->get_multi == NULL || settings.verbose > 1 ||
+        c->aiostat != ENGINE_SUCCESS) {
+        return false;
+    }
+
+    while (nkeys < GET_BATCH_MAX && avail >= sizeof(*reqs[0])) {
+        protocol_binary_request_header *req =
+            (protocol_binary_request_header *)ptr;
+        uint16_t nkey = ntohs(req->request.keylen);
+        uint32_t size = sizeof(*req) + ntohl(req->request.bodylen);
+
+        if (avail < size || !bin_get_batchable(c, req)) {
+            break;
+        }
+
+        /* We need room in the write buffer for the response */
+        wneeded += sizeof(protocol_binary_response_get) + nkey;
+        if (wneeded > c->write.size - c->write.bytes) {
+            break;
+        }
+
+        reqs[nkeys] = req;
+        keys[nkeys].key = ptr + sizeof(*req);
+        keys[nkeys].nkey = nkey;
+        keys[nkeys].vbucket = ntohs(req->request.vbucket);
+        ++nkeys;
+        ptr += size;
+        avail -= size;
+    }
+
+    /* The items of the responses held back are in the item list already */
+    if (nkeys < 2 || (c->ileft == 0 && !conn_setup_itemlist(c)) ||
+        c->ileft + nkeys > c->isize) {
+        return false;
+    }
+
+    if (settings.engine.v1->get_multi(settings.engine.v0, c, keys, nkeys,
+                                      items, status) != ENGINE_SUCCESS) {
+        return false;
+    }
+
+    if (c->nbatched == 0) {
+        c->msgcurr = 0;
+        c->msgused = 0;
+        c->iovused = 0;
+        if (add_msghdr(c) != 0) {
+            for (ii = 0; ii < nkeys; ++ii) {
+                if (status[ii] == ENGINE_SUCCESS) {
+                    settings.engine.v1->release(settings.engine.v0, c,
+                                                items[ii]);
+                }
+            }
+            conn_set_state(c, conn_closing);
+            return true;
+        }
+    }
+
+    wbuf = c->write.curr;
+    for (done = 0; done < nkeys; ++done) {
+        if (status[done] == ENGINE_SUCCESS) {
+            if (!add_bin_get_hit(c, reqs[done], items[done], &wbuf)) {
+                break;
+            }
+        } else if (status[done] == ENGINE_KEY_ENOENT) {
+            add_bin_get_miss(c, reqs[done], &wbuf);
+            STATS_MISS(c, get, keys[done].key, keys[done].nkey);
+        } else {
+            break;
+        }
+    }
+
+    /* Give back what we're not going to send */
+    for (ii = done; ii < nkeys; ++ii) {
+        if (status[ii] == ENGINE_SUCCESS) {
+            settings.engine.v1->release(settings.engine.v0, c, items[ii]);
+        }
+    }
+
+    if (done == 0) {
+        return false;
+    }
+
+    if (c->thread != NULL) {
+        STATS_BUMP(c->thread->load.ops, done);
+    }
+
+    /* Consume the packets we answered */
+    ptr = (char *)(keys[done - 1].key) + keys[done - 1].nkey;
+    c->read.bytes -= (uint32_t)(ptr - c->read.curr);
+    c->read.curr = ptr;
+
+    c->cmd = reqs[0]->request.opcode;
+    if (c->start == 0) {
+        c->start = gethrtime();
+    }
+    if (c->iovused > 0) {
+        conn_set_state(c, conn_mwrite);
+        c->write_and_go = conn_new_cmd;
+    } else {
+        /* Only quiet misses */
+        conn_set_state(c, conn_new_cmd);
+    }
+    return true;
+}
+
+/*
+ * if we have a complete line in the buffer, process it.
+ */
+static int try_read_command(conn *c) {
+    cb_assert(c != NULL);
+    cb_assert(c->read.curr <= (c->read.buf + c->read.size));
+    cb_assert(c->read.bytes > 0);
+
+    if (c->nbatched > 0) {
+        if (!next_command_batchable(c)) {
+            /* Send the responses we held back before we go on */
+            c->write_and_go = conn_parse_cmd;
+            conn_set_state(c, conn_mwrite);
+            return 1;
+        }
+    } else {
+        c->write.curr = c->write.buf;
+        c->write.bytes = 0;
+    }
+
+    /* Do we have the complete packet header? */
+    if (c->read.bytes < sizeof(c->binary_header)) {
+        /* need more data! */
+        return 0;
+    } else {
+#ifdef NEED_ALIGN
+        if (((long)(c->read.curr)) % 8 != 0) {
+            /* must realign input buffer */
+            memmove(c->read.buf, c->read.curr, c->read.bytes);
+            c->read.curr = c->read.buf;
+            if (settings.verbose > 1) {
+                settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
+                                                "%d: Realign input buffer\n", c->sfd);
+            }
+        }
+#endif
+        protocol_binary_request_header* req;
+
+        if (process_bin_get_batch(c)) {
+            return 1;
+        }
+
+        req = (protocol_binary_request_header*)c->read.curr;
+
+        if (settings.verbose > 1) {
+            /* Dump the packet before we convert it to host order */
+            char buffer[1024];
+            ssize_t nw;
+            nw = bytes_to_output_string(buffer, sizeof(buffer), c->sfd,
+                                        true, "Read binary protocol data:",
+                                        (const char*)req->bytes,
+                                        sizeof(req->bytes));
+            if (nw != -1) {
+                settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
+                                                "%s", buffer);
+            }
+        }
+
+        c->binary_header = *req;
+        c->binary_header.request.keylen = ntohs(req->request.keylen);
+        c->binary_header.request.bodylen = ntohl(req->request.bodylen);
+        c->binary_header.request.vbucket = ntohs(req->request.vbucket);
+        c->binary_header.request.cas = ntohll(req->request.cas);
+
+        if (c->binary_header.request.magic != PROTOCOL_BINARY_REQ &&
+            !(c->binary_header.request.magic == PROTOCOL_BINARY_RES &&
+              response_handlers[c->binary_header.request.opcode])) {
             if (settings.verbose) {
                 if (c->binary_header.request.magic != PROTOCOL_BINARY_RES) {
                     settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
@@ -6059,12 +6757,14 @@ static int try_read_command(conn *c) {
             return -1;
         }
 
-        c->msgcurr = 0;
-        c->msgused = 0;
-        c->iovused = 0;
-        if (add_msghdr(c) != 0) {
-            conn_set_state(c, conn_closing);
-            return -1;
+        if (c->nbatched == 0) {
+            c->msgcurr = 0;
+            c->msgused = 0;
+            c->iovused = 0;
+            if (add_msghdr(c) != 0) {
+                conn_set_state(c, conn_closing);
+                return -1;
+            }
         }
 
         c->cmd = c->binary_header.request.opcode;
@@ -6082,125 +6782,41 @@ static int try_read_command(conn *c) {
     return 1;
 }
 
-static void drain_bio_send_pipe(conn *c) {
-    int n;
-    bool stop = false;
-
-    do {
-        if (c->ssl.out.current < c->ssl.out.total) {
-#ifdef WIN32
-            DWORD error;
-#else
-            int error;
-#endif
-            n = send(c->sfd, c->ssl.out.buffer + c->ssl.out.current,
-                     c->ssl.out.total - c->ssl.out.current, 0);
-            if (n > 0) {
-                c->ssl.out.current += n;
-                if (c->ssl.out.current == c->ssl.out.total) {
-                    c->ssl.out.current = c->ssl.out.total = 0;
-                }
-            } else {
-                if (n == -1) {
-#ifdef WIN32
-                    error = WSAGetLastError();
-#else
-                    error = errno;
-#endif
-                    if (!is_blocking(error)) {
-                        c->ssl.error = true;
-                    }
-                }
-                return ;
-            }
-        }
+/*
+ * Log the error of the failed SSL call (with what OpenSSL has to say
+ * about it)
+ */
+static void log_ssl_error(conn *c, const char *what, int ret) {
+    char errmsg[1024];
+    int error = SSL_get_error(c->ssl.client, ret);
+    int offset = snprintf(errmsg, sizeof(errmsg), "%s returned %d with "
+                          "error %d: ", what, ret, error);
 
-        if (c->ssl.out.total == 0) {
-            n = BIO_read(c->ssl.network, c->ssl.out.buffer, c->ssl.out.buffsz);
-            if (n > 0) {
-                c->ssl.out.total = n;
-            } else {
-                stop = true;
-            }
-        }
-    } while (!stop);
-}
-
-static void drain_bio_recv_pipe(conn *c) {
-    int n;
-    bool stop = false;
-
-    do {
-        if (c->ssl.in.current < c->ssl.in.total) {
-            n = BIO_write(c->ssl.network, c->ssl.in.buffer + c->ssl.in.current,
-                          c->ssl.in.total - c->ssl.in.current);
-            if (n > 0) {
-                c->ssl.in.current += n;
-                if (c->ssl.in.current == c->ssl.in.total) {
-                    c->ssl.in.current = c->ssl.in.total = 0;
-                }
-            } else {
-                /* Our input BIO is full, no need to grab more data from
-                 * the network at this time..
-                 */
-                return ;
-            }
-        }
-
-        if (c->ssl.in.total < c->ssl.in.buffsz) {
-#ifdef WIN32
-            DWORD error;
-#else
-            int error;
-#endif
-            n = recv(c->sfd, c->ssl.in.buffer + c->ssl.in.total,
-                     c->ssl.in.buffsz - c->ssl.in.total, 0);
-            if (n > 0) {
-                c->ssl.in.total += n;
-            } else {
-                stop = true;
-                if (n == 0) {
-                    c->ssl.error = true; /* read end shutdown */
-                } else {
-#ifdef WIN32
-                    error = WSAGetLastError();
-#else
-                    error = errno;
-#endif
-                    if (!is_blocking(error)) {
-                        c->ssl.error = true;
-                    }
-                }
-            }
-        }
-    } while (!stop);
+    ERR_error_string_n(ERR_get_error(), errmsg + offset,
+                       sizeof(errmsg) - offset);
+    settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                    "%d: ERROR: %s", c->sfd, errmsg);
 }
 
 static int do_ssl_pre_connection(conn *c) {
-    int r = SSL_accept(c->ssl.client);
+    int r;
+
+    ERR_clear_error();
+    r = SSL_accept(c->ssl.client);
     if (r == 1) {
-        drain_bio_send_pipe(c);
         c->ssl.connected = true;
+#ifdef BIO_get_ktls_send
+        /* OpenSSL gave the keys to the kernel, so we may use sendmsg() */
+        c->ssl.ktls_send = BIO_get_ktls_send(SSL_get_wbio(c->ssl.client));
+#endif
     } else {
-        if (SSL_get_error(c->ssl.client, r) == SSL_ERROR_WANT_READ) {
-            drain_bio_send_pipe(c);
+        switch (SSL_get_error(c->ssl.client, r)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
             set_ewouldblock();
             return -1;
-        } else {
-            char *errmsg = malloc(8*1024);
-            if (errmsg) {
-                int offset = sprintf(errmsg,
-                                     "SSL_accept() returned %d with error %d\n",
-                                     r, SSL_get_error(c->ssl.client, r));
-
-                ERR_error_string_n(ERR_get_error(), errmsg + offset,
-                                   8192 - offset);
-
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                                "%d: ERROR: %s",
-                                                c->sfd, errmsg);
-                free(errmsg);
-            }
+        default:
+            log_ssl_error(c, "SSL_accept()", r);
             set_econnreset();
             return -1;
         }
@@ -6212,53 +6828,43 @@ static int do_ssl_pre_connection(conn *c) {
 static int do_ssl_read(conn *c, char *dest, size_t nbytes) {
     int ret = 0;
 
+    ERR_clear_error();
     while (ret < nbytes) {
-        int n;
-        drain_bio_recv_pipe(c);
-        if (c->ssl.error) {
-            set_econnreset();
-            return -1;
-        }
-        n = SSL_read(c->ssl.client, dest + ret, (int)(nbytes - ret));
+        int n = SSL_read(c->ssl.client, dest + ret, (int)(nbytes - ret));
         if (n > 0) {
             ret += n;
-        } else {
-            /* n < 0 and n == 0 require a check of SSL error*/
-            int error = SSL_get_error(c->ssl.client, n);
+            continue;
+        }
 
-            switch (error) {
-            case SSL_ERROR_WANT_READ:
-                /*
-                 * Drain the buffers and retry if we've got data in
-                 * our input buffers
-                 */
-                if (c->ssl.in.current < c->ssl.in.total) {
-                    /* our recv buf has data feed the BIO */
-                    drain_bio_recv_pipe(c);
-                } else if (ret > 0) {
-                    /* nothing in our recv buf, return what we have */
-                    return ret;
-                } else {
-                    set_ewouldblock();
-                    return -1;
-                }
-                break;
+        /* n < 0 and n == 0 require a check of SSL error*/
+        switch (SSL_get_error(c->ssl.client, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            if (ret > 0) {
+                /* nothing more in the socket, return what we have */
+                return ret;
+            }
+            set_ewouldblock();
+            return -1;
 
-            case SSL_ERROR_ZERO_RETURN:
-                /* The TLS/SSL connection has been closed (cleanly). */
-                return 0;
+        case SSL_ERROR_ZERO_RETURN:
+            /* The TLS/SSL connection has been closed (cleanly). */
+            return ret;
 
-            default:
-                /*
-                 * @todo I don't know how to gracefully recover from this
-                 * let's just shut down the connection
-                 */
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                                "%d: ERROR: SSL_read returned -1 with error %d",
-                                                c->sfd, error);
-                set_econnreset();
-                return -1;
+        case SSL_ERROR_SYSCALL:
+            if (n == 0 || errno == 0) {
+                /* The client closed the socket without saying goodbye */
+                return ret;
             }
+            /* FALLTHROUGH */
+        default:
+            /*
+             * @todo I don't know how to gracefully recover from this
+             * let's just shut down the connection
+             */
+            log_ssl_error(c, "SSL_read()", n);
+            set_econnreset();
+            return -1;
         }
     }
 
@@ -6268,13 +6874,6 @@ static int do_ssl_read(conn *c, char *dest, size_t nbytes) {
 static int do_data_recv(conn *c, void *dest, size_t nbytes) {
     int res;
     if (c->ssl.enabled) {
-        drain_bio_recv_pipe(c);
-
-        if (c->ssl.error) {
-            set_econnreset();
-            return -1;
-        }
-
         if (!c->ssl.connected) {
             res = do_ssl_pre_connection(c);
             if (res == -1) {
@@ -6282,10 +6881,7 @@ static int do_data_recv(conn *c, void *dest, size_t nbytes) {
             }
         }
 
-        /* The SSL negotiation might be complete at this time */
-        if (c->ssl.connected) {
-            res = do_ssl_read(c, dest, nbytes);
-        }
+        res = do_ssl_read(c, dest, nbytes);
     } else {
 #ifdef WIN32
         res = recv(c->sfd, dest, (int)nbytes, 0);
@@ -6297,87 +6893,127 @@ static int do_data_recv(conn *c, void *dest, size_t nbytes) {
     return res;
 }
 
-static int do_ssl_write(conn *c, char *dest, size_t nbytes) {
-    int ret = 0;
-
-    int chunksize = settings.bio_drain_buffer_sz;
+static int do_ssl_write(conn *c, const char *buf, size_t nbytes) {
+    int n;
 
-    while (ret < nbytes) {
-        int n;
-        int chunk;
+    ERR_clear_error();
+    n = SSL_write(c->ssl.client, buf, (int)nbytes);
+    if (n > 0) {
+        return n;
+    }
 
-        drain_bio_send_pipe(c);
-        if (c->ssl.error) {
-            set_econnreset();
-            return -1;
-        }
+    switch (SSL_get_error(c->ssl.client, n)) {
+    case SSL_ERROR_WANT_WRITE:
+    case SSL_ERROR_WANT_READ:
+        set_ewouldblock();
+        return -1;
 
-        chunk = (int)(nbytes - ret);
-        if (chunk > chunksize) {
-            chunk = chunksize;
-        }
+    default:
+        /*
+         * @todo I don't know how to gracefully recover from this
+         * let's just shut down the connection
+         */
+        log_ssl_error(c, "SSL_write()", n);
+        set_econnreset();
+        return -1;
+    }
+}
 
-        n = SSL_write(c->ssl.client, dest + ret, chunk);
-        if (n > 0) {
-            ret += n;
-        } else {
-            if (ret > 0) {
-                /* We've sent some data.. let the caller have them */
-                return ret;
-            }
+/*
+ * Encrypt and send the message. A run of small iovecs (like the header,
+ * extras and key of a response, or a pipeline of small responses) is
+ * gathered in ssl.out and encrypted into one record rather than one
+ * record (with its own header and MAC) per iovec. Bigger iovecs are
+ * passed to SSL_write() as they are.
+ *
+ * If SSL_write() has to be retried the message hasn't moved, so the next
+ * call gathers the very same bytes again, as OpenSSL requires.
+ */
+static int do_ssl_sendmsg(conn *c, struct msghdr *m) {
+    int res = 0;
+    int ii = 0;
 
-            if (n < 0) {
-                int error = SSL_get_error(c->ssl.client, n);
-                switch (error) {
-                case SSL_ERROR_WANT_WRITE:
-                    set_ewouldblock();
-                    return -1;
+    while (ii < m->msg_iovlen) {
+        const char *buf = m->msg_iov[ii].iov_base;
+        size_t len = m->msg_iov[ii].iov_len;
+        int n;
 
-                default:
-                    /*
-                     * @todo I don't know how to gracefully recover from this
-                     * let's just shut down the connection
-                     */
-                    settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                                    "%d: ERROR: SSL_write returned -1 with error %d",
-                                                    c->sfd, error);
-                    set_econnreset();
-                    return -1;
-                }
+        if (len < c->ssl.out.buffsz) {
+            len = 0;
+            while (ii < m->msg_iovlen &&
+                   len + m->msg_iov[ii].iov_len <= c->ssl.out.buffsz) {
+                memcpy(c->ssl.out.buffer + len, m->msg_iov[ii].iov_base,
+                       m->msg_iov[ii].iov_len);
+                len += m->msg_iov[ii].iov_len;
+                ++ii;
             }
+            buf = c->ssl.out.buffer;
+            if (len == 0) {
+                continue;
+            }
+        } else {
+            ++ii;
+        }
+
+        n = do_ssl_write(c, buf, len);
+        if (n <= 0) {
+            return res > 0 ? res : -1;
+        }
+        res += n;
+        if (n < len) {
+            /* The socket is full, let transmit() move the iovecs */
+            return res;
         }
     }
 
-    return ret;
+    return res;
 }
 
+/*
+ * Is there more to send after the current message? If so we tell the
+ * kernel (with MSG_MORE) to hold back a partial segment for the rest
+ * instead of corking and uncorking the socket.
+ */
+static bool more_to_send(conn *c) {
+    int ii;
+    for (ii = c->msgcurr + 1; ii < c->msgused; ++ii) {
+        if (c->msglist[ii].msg_iovlen > 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
 static int do_data_sendmsg(conn *c, struct msghdr *m) {
-    int res;
-    if (c->ssl.enabled) {
-        int ii;
-        res = 0;
-        for (ii = 0; ii < m->msg_iovlen; ++ii) {
-            int n = do_ssl_write(c,
-                                 m->msg_iov[ii].iov_base,
-                                 m->msg_iov[ii].iov_len);
-            if (n > 0) {
-                res += n;
-            } else {
-                return res > 0 ? res : -1;
-            }
-        }
+    if (c->ssl.enabled && !c->ssl.ktls_send) {
+        return do_ssl_sendmsg(c, m);
+    }
 
-        /* @todo figure out how to drain the rest of the data if we
-         * failed to send all of it...
-         */
-        drain_bio_send_pipe(c);
-        return res;
-    } else {
-        res = sendmsg(c->sfd, m, 0);
+    return sendmsg(c->sfd, m, more_to_send(c) ? MSG_MORE : 0);
+}
+
+/*
+ * How big should the (full) read buffer grow? If it starts with a packet
+ * header we make room for the whole packet at once (unless the value is
+ * read straight into the item), otherwise we double it.
+ */
+static uint32_t read_buffer_wanted(conn *c) {
+    protocol_binary_request_header req;
+    uint32_t size = c->read.size * 2;
+
+    if (c->read.bytes < sizeof(req)) {
+        return size;
     }
 
-    return res;
+    memcpy(&req, c->read.curr, sizeof(req));
+    req.request.keylen = ntohs(req.request.keylen);
+    req.request.bodylen = ntohl(req.request.bodylen);
+    if (req.request.bodylen <= settings.max_packet_size &&
+        req.request.bodylen + sizeof(req) > size &&
+        !stream_bin_value(&req)) {
+        size = req.request.bodylen + sizeof(req);
+    }
+    return size;
 }
 
 /*
@@ -6413,14 +7049,11 @@ static enum try_read_result try_read_network(conn *c) {
 #endif
 
         if (c->read.bytes >= c->read.size) {
-            char *new_rbuf;
-
             if (num_allocs == 4) {
                 return gotdata;
             }
             ++num_allocs;
-            new_rbuf = realloc(c->read.buf, c->read.size * 2);
-            if (!new_rbuf) {
+            if (!conn_resize_read_buffer(c, read_buffer_wanted(c))) {
                 if (settings.verbose > 0) {
                     settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
                                                     "Couldn't realloc input buffer\n");
@@ -6429,8 +7062,6 @@ static enum try_read_result try_read_network(conn *c) {
                 conn_set_state(c, conn_closing);
                 return READ_MEMORY_ERROR;
             }
-            c->read.curr = c->read.buf = new_rbuf;
-            c->read.size *= 2;
         }
 
         avail = c->read.size - c->read.bytes;
@@ -6552,6 +7183,11 @@ bool update_event(conn *c, const int new_flags) {
 static enum transmit_result transmit(conn *c) {
     cb_assert(c != NULL);
 
+    if (c->io_inflight) {
+        /* We'll be called again when the send queued on the ring completes */
+        return TRANSMIT_SOFT_ERROR;
+    }
+
     while (c->msgcurr < c->msgused &&
            c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
@@ -6567,7 +7203,39 @@ static enum transmit_result transmit(conn *c) {
         ssize_t res;
         struct msghdr *m = &c->msglist[c->msgcurr];
 
-        res = do_data_sendmsg(c, m);
+        if (c->io_completed) {
+            /* Pick up the result of the send queued on the ring */
+            c->io_completed = false;
+            res = c->io_result;
+            if (res < 0) {
+                errno = (int)-res;
+                res = -1;
+            }
+        } else if (c->thread != NULL && c->thread->uring != NULL &&
+                   (!c->ssl.enabled || c->ssl.ktls_send) &&
+                   !(m->msg_flags & MSG_ZEROCOPY)) {
+            /*
+             * Queue the send on the ring of the thread, and stop
+             * listening for events until it completes.
+             */
+            if (!update_event(c, EV_PERSIST)) {
+                if (settings.verbose > 0) {
+                    settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
+                            "Couldn't update event\n");
+                }
+                conn_set_state(c, conn_closing);
+                return TRANSMIT_HARD_ERROR;
+            }
+            if (conn_uring_sendmsg(c, m, more_to_send(c) ? MSG_MORE : 0)) {
+                return TRANSMIT_SOFT_ERROR;
+            }
+            /* The ring is full */
+            res = do_data_sendmsg(c, m);
+        } else if (m->msg_flags & MSG_ZEROCOPY) {
+            res = zerocopy_sendmsg(c, m);
+        } else {
+            res = do_data_sendmsg(c, m);
+        }
 #ifdef WIN32
         error = WSAGetLastError();
 #else
@@ -6627,21 +7295,6 @@ static enum transmit_result transmit(conn *c) {
         conn_set_state(c, conn_closing);
         return TRANSMIT_HARD_ERROR;
     } else {
-        if (c->ssl.enabled) {
-            drain_bio_send_pipe(c);
-            if (c->ssl.out.total) {
-                if (!update_event(c, EV_WRITE | EV_PERSIST)) {
-                    if (settings.verbose > 0) {
-                        settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
-                                                        "Couldn't update event");
-                    }
-                    conn_set_state(c, conn_closing);
-                    return TRANSMIT_HARD_ERROR;
-                }
-                return TRANSMIT_SOFT_ERROR;
-            }
-        }
-
         return TRANSMIT_COMPLETE;
     }
 }
@@ -6674,6 +7327,9 @@ bool conn_listening(conn *c)
                                             limit.rlim_cur);
 #endif
             disable_listen();
+            if (c->thread != NULL) {
+                update_acceptors(c->thread, false);
+            }
         } else if (!is_blocking(error)) {
             log_socket_error(EXTENSION_LOG_WARNING, c,
                              "Failed to accept new client: %s");
@@ -6713,8 +7369,30 @@ bool conn_listening(conn *c)
         return false;
     }
 
-    dispatch_conn_new(sfd, c->parent_port, conn_new_cmd, EV_READ | EV_PERSIST,
-                      DATA_BUFFER_SIZE);
+    if (c->thread != NULL) {
+        /* The listening socket is owned by this worker, so serve the
+         * client here rather than going through the dispatcher */
+        conn *client = conn_new(sfd, c->parent_port, conn_new_cmd,
+                                EV_READ | EV_PERSIST, DATA_BUFFER_SIZE,
+                                c->thread->base);
+        if (client == NULL) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                            "Can't listen for events on fd %d",
+                                            sfd);
+            STATS_LOCK();
+            --port_instance->curr_conns;
+            STATS_UNLOCK();
+            safe_close(sfd);
+        } else {
+            client->thread = c->thread;
+            STATS_BUMP(c->thread->load.adopted, 1);
+            STATS_BUMP(c->thread->accepted, 1);
+            MEMCACHED_CONN_DISPATCH(sfd, (uintptr_t)c->thread->thread_id);
+        }
+    } else {
+        dispatch_conn_new(sfd, c->parent_port, conn_new_cmd,
+                          EV_READ | EV_PERSIST, DATA_BUFFER_SIZE);
+    }
 
     return false;
 }
@@ -6842,6 +7520,12 @@ bool conn_new_cmd(conn *c) {
             char dummy;
             ssl_peek = SSL_peek(c->ssl.client, &dummy, 1);
         }
+        if (c->nbatched > 0) {
+            /* Send the responses we held back before we yield */
+            c->write_and_go = conn_new_cmd;
+            conn_set_state(c, conn_mwrite);
+            return true;
+        }
         STATS_NOKEY(c, conn_yields);
         if (c->read.bytes > 0 || ssl_peek > 0) {
             /* We have already read in data into the input buffer,
@@ -6964,22 +7648,41 @@ bool conn_write(conn *c) {
     return conn_mwrite(c);
 }
 
+/* Release what the responses we just sent referred to */
+static void release_sent_responses(conn *c) {
+    while (c->ileft > 0) {
+        item *it = *(c->icurr);
+        settings.engine.v1->release(settings.engine.v0, c, it);
+        c->icurr++;
+        c->ileft--;
+    }
+    while (c->temp_alloc_left > 0) {
+        char *temp_alloc_ = *(c->temp_alloc_curr);
+        free(temp_alloc_);
+        c->temp_alloc_curr++;
+        c->temp_alloc_left--;
+    }
+    if (c->nbatched > 0) {
+        c->nbatched = 0;
+        c->write.curr = c->write.buf;
+        c->write.bytes = 0;
+    }
+}
+
 bool conn_mwrite(conn *c) {
+    if (!c->flushing) {
+        if (c->state == conn_mwrite && hold_response(c)) {
+            conn_set_state(c, conn_new_cmd);
+            return true;
+        }
+        c->flushing = true;
+    }
+
     switch (transmit(c)) {
     case TRANSMIT_COMPLETE:
+        c->flushing = false;
         if (c->state == conn_mwrite) {
-            while (c->ileft > 0) {
-                item *it = *(c->icurr);
-                settings.engine.v1->release(settings.engine.v0, c, it);
-                c->icurr++;
-                c->ileft--;
-            }
-            while (c->temp_alloc_left > 0) {
-                char *temp_alloc_ = *(c->temp_alloc_curr);
-                free(temp_alloc_);
-                c->temp_alloc_curr++;
-                c->temp_alloc_left--;
-            }
+            release_sent_responses(c);
             /* XXX:  I don't know why this wasn't the general case */
             conn_set_state(c, c->write_and_go);
         } else if (c->state == conn_write) {
@@ -6987,6 +7690,7 @@ bool conn_mwrite(conn *c) {
                 free(c->write_and_free);
                 c->write_and_free = 0;
             }
+            release_sent_responses(c);
             conn_set_state(c, c->write_and_go);
         } else {
             if (settings.verbose > 0) {
@@ -7047,8 +7751,15 @@ bool conn_immediate_close(conn *c) {
 }
 
 bool conn_closing(conn *c) {
+    if (zerocopy_linger(c)) {
+        /* The kernel is still sending some of our items */
+        return false;
+    }
+
     /* We don't want any network notifications anymore.. */
-    unregister_event(c);
+    if (c->registered_in_libevent) {
+        unregister_event(c);
+    }
     safe_close(c->sfd);
     c->sfd = INVALID_SOCKET;
 
@@ -7168,9 +7879,15 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
          * object was scheduled to run in the dispatcher before the
          * callback for the worker thread is executed.
          */
+        drain_io_notifications(thr);
         c->thread->pending_io = list_remove(c->thread->pending_io, c);
     }
 
+    if (zerocopy_pending(c)) {
+        /* The completions are signalled as an error on the socket */
+        zerocopy_reap(c);
+    }
+
     c->which = which;
 
     /* sanity */
@@ -7178,10 +7895,13 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
 
     c->nevents = c->max_reqs_per_event;
 
-    run_event_loop(c);
-
     if (thr) {
+        hrtime_t start = gethrtime();
+        run_event_loop(c);
+        STATS_BUMP(thr->load.busy, gethrtime() - start);
         UNLOCK_THREAD(thr);
+    } else {
+        run_event_loop(c);
     }
 }
 
@@ -7204,22 +7924,16 @@ static void dispatch_event_handler(evutil_socket_t fd, short which, void *arg) {
         if (enable) {
             conn *next;
             for (next = listen_conn; next; next = next->next) {
-                int backlog = 1024;
-                int ii;
                 update_event(next, EV_READ | EV_PERSIST);
-                for (ii = 0; ii < settings.num_interfaces; ++ii) {
-                    if (next->parent_port == settings.interfaces[ii].port) {
-                        backlog = settings.interfaces[ii].backlog;
-                        break;
-                    }
-                }
-
-                if (listen(next->sfd, backlog) != 0) {
+                if (listen(next->sfd, get_listen_backlog(next->parent_port)) != 0) {
                     settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
                                                     "listen() failed",
                                                     strerror(errno));
                 }
             }
+            if (settings.reuseport) {
+                resume_acceptors();
+            }
         }
     }
 }
@@ -7283,23 +7997,126 @@ static SOCKET new_socket(struct addrinfo *ai) {
 }
 
 /**
- * Create a socket and bind it to a specific port number
+ * Create a socket for an address of an interface, bind it and start
+ * listening on it.
+ * @param interf the interface to bind to
+ * @param ai the address to bind to
+ * @param fatal set to true if the error should stop us from trying the
+ *              remaining addresses
+ * @return the socket, or INVALID_SOCKET on failure
+ */
+static SOCKET server_socket_listen(struct interface *interf,
+                                   struct addrinfo *ai, bool *fatal) {
+    SOCKET sfd;
+    struct linger ling = {0, 0};
+    int error;
+    int flags =1;
+
+    *fatal = false;
+    if ((sfd = new_socket(ai)) == INVALID_SOCKET) {
+        /* getaddrinfo can return "junk" addresses,
+         * we make sure at least one works before erroring.
+         */
+        return INVALID_SOCKET;
+    }
+
+#ifdef IPV6_V6ONLY
+    if (ai->ai_family == AF_INET6) {
+        error = setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
+        if (error != 0) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                            "setsockopt(IPV6_V6ONLY): %s",
+                                            strerror(errno));
+            safe_close(sfd);
+            return INVALID_SOCKET;
+        }
+    }
+#endif
+
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+    if (settings.reuseport) {
+        error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags));
+        if (error != 0) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                            "setsockopt(SO_REUSEPORT): %s",
+                                            strerror(errno));
+            safe_close(sfd);
+            *fatal = true;
+            return INVALID_SOCKET;
+        }
+    }
+#endif
+    error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    if (error != 0) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "setsockopt(SO_KEEPALIVE): %s",
+                                        strerror(errno));
+    }
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    if (error != 0) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "setsockopt(SO_LINGER): %s",
+                                        strerror(errno));
+    }
+
+    if (interf->tcp_nodelay) {
+        error = setsockopt(sfd, IPPROTO_TCP,
+                           TCP_NODELAY, (void *)&flags, sizeof(flags));
+        if (error != 0) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                            "setsockopt(TCP_NODELAY): %s",
+                                            strerror(errno));
+        }
+    }
+
+    if (bind(sfd, ai->ai_addr, (socklen_t)ai->ai_addrlen) == SOCKET_ERROR) {
+#ifdef WIN32
+        DWORD error = WSAGetLastError();
+#else
+        int error = errno;
+#endif
+        if (!is_addrinuse(error)) {
+            log_errcode_error(EXTENSION_LOG_WARNING, NULL,
+                              "bind(): %s", error);
+            *fatal = true;
+        }
+        safe_close(sfd);
+        return INVALID_SOCKET;
+    }
+
+    if (listen(sfd, interf->backlog) == SOCKET_ERROR) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "listen(): %s",
+                                        strerror(errno));
+        safe_close(sfd);
+        *fatal = true;
+        return INVALID_SOCKET;
+    }
+
+    return sfd;
+}
+
+/**
+ * Create the socket(s) for a specific port number and start accepting
+ * clients on them. By default the dispatcher thread accepts the clients
+ * on a single socket for each address and hands them over to the worker
+ * threads. With reuseport every worker thread gets its own socket bound
+ * to the address (with SO_REUSEPORT), and accepts the clients directly.
  * @param interface the interface to bind to
- * @param port the port number to bind to
  * @param portnumber_file A filepointer to write the port numbers to
  *        when they are successfully added to the list of ports we
  *        listen on.
  */
 static int server_socket(struct interface *interf, FILE *portnumber_file) {
     SOCKET sfd;
-    struct linger ling = {0, 0};
     struct addrinfo *ai;
     struct addrinfo *next;
     struct addrinfo hints;
     char port_buf[NI_MAXSERV];
     int error;
     int success = 0;
-    int flags =1;
     const char *host = NULL;
 
     memset(&hints, 0, sizeof(hints));
@@ -7342,94 +8159,72 @@ static int server_socket(struct interface *interf, FILE *portnumber_file) {
     for (next= ai; next; next= next->ai_next) {
         struct listening_port *port_instance;
         conn *listen_conn_add;
-        if ((sfd = new_socket(next)) == INVALID_SOCKET) {
-            /* getaddrinfo can return "junk" addresses,
-             * we make sure at least one works before erroring.
-             */
-            continue;
-        }
+        bool fatal;
+        int ii;
 
-#ifdef IPV6_V6ONLY
-        if (next->ai_family == AF_INET6) {
-            error = setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
-            if (error != 0) {
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                                "setsockopt(IPV6_V6ONLY): %s",
-                                                strerror(errno));
-                safe_close(sfd);
-                continue;
+        if ((sfd = server_socket_listen(interf, next, &fatal)) == INVALID_SOCKET) {
+            if (fatal) {
+                freeaddrinfo(ai);
+                return 1;
             }
+            continue;
         }
-#endif
 
-        setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
-        error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
-        if (error != 0) {
-            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                            "setsockopt(SO_KEEPALIVE): %s",
-                                            strerror(errno));
+        success++;
+        if (portnumber_file != NULL &&
+            (next->ai_addr->sa_family == AF_INET ||
+             next->ai_addr->sa_family == AF_INET6)) {
+            union {
+                struct sockaddr_in in;
+                struct sockaddr_in6 in6;
+            } my_sockaddr;
+            socklen_t len = sizeof(my_sockaddr);
+            if (getsockname(sfd, (struct sockaddr*)&my_sockaddr, &len)==0) {
+                if (next->ai_addr->sa_family == AF_INET) {
+                    fprintf(portnumber_file, "%s INET: %u\n", "TCP",
+                            ntohs(my_sockaddr.in.sin_port));
+                } else {
+                    fprintf(portnumber_file, "%s INET6: %u\n", "TCP",
+                            ntohs(my_sockaddr.in6.sin6_port));
+                }
+            }
         }
 
-        error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
-        if (error != 0) {
-            settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                            "setsockopt(SO_LINGER): %s",
-                                            strerror(errno));
-        }
+        if (settings.reuseport) {
+            /* The first socket picked the port (it may be ephemeral), the
+             * sockets for the other workers must bind to the same one */
+            struct sockaddr_storage bound;
+            socklen_t len = sizeof(bound);
+            struct addrinfo addr = *next;
 
-        if (interf->tcp_nodelay) {
-            error = setsockopt(sfd, IPPROTO_TCP,
-                               TCP_NODELAY, (void *)&flags, sizeof(flags));
-            if (error != 0) {
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                                "setsockopt(TCP_NODELAY): %s",
-                                                strerror(errno));
+            if (getsockname(sfd, (struct sockaddr*)&bound, &len) == 0) {
+                addr.ai_addr = (struct sockaddr*)&bound;
+                addr.ai_addrlen = len;
             }
-        }
 
-        if (bind(sfd, next->ai_addr, (socklen_t)next->ai_addrlen) == SOCKET_ERROR) {
-#ifdef WIN32
-            DWORD error = WSAGetLastError();
-#else
-            int error = errno;
-#endif
-            if (!is_addrinuse(error)) {
-                log_errcode_error(EXTENSION_LOG_WARNING, NULL,
-                                  "bind(): %s", error);
-                safe_close(sfd);
-                freeaddrinfo(ai);
-                return 1;
-            }
-            safe_close(sfd);
-            continue;
-        } else {
-            success++;
-            if (listen(sfd, interf->backlog) == SOCKET_ERROR) {
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
-                                                "listen(): %s",
-                                                strerror(errno));
-                safe_close(sfd);
-                freeaddrinfo(ai);
-                return 1;
-            }
-            if (portnumber_file != NULL &&
-                (next->ai_addr->sa_family == AF_INET ||
-                 next->ai_addr->sa_family == AF_INET6)) {
-                union {
-                    struct sockaddr_in in;
-                    struct sockaddr_in6 in6;
-                } my_sockaddr;
-                socklen_t len = sizeof(my_sockaddr);
-                if (getsockname(sfd, (struct sockaddr*)&my_sockaddr, &len)==0) {
-                    if (next->ai_addr->sa_family == AF_INET) {
-                        fprintf(portnumber_file, "%s INET: %u\n", "TCP",
-                                ntohs(my_sockaddr.in.sin_port));
-                    } else {
-                        fprintf(portnumber_file, "%s INET6: %u\n", "TCP",
-                                ntohs(my_sockaddr.in6.sin6_port));
-                    }
+            dispatch_listen_conn(sfd, interf->port, 0);
+            for (ii = 1; ii < settings.num_threads; ++ii) {
+                SOCKET acceptor = server_socket_listen(interf, &addr, &fatal);
+                if (acceptor == INVALID_SOCKET) {
+                    settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                                    "Failed to create listening socket for worker %d",
+                                                    ii);
+                    freeaddrinfo(ai);
+                    return 1;
                 }
+                dispatch_listen_conn(acceptor, interf->port, ii);
             }
+
+            STATS_LOCK();
+            stats.curr_conns += settings.num_threads;
+            stats.daemon_conns += settings.num_threads;
+            /* Only count one of them against the port's maxconns, so that
+             * it means the same as with a single listening socket */
+            port_instance = get_listening_port_instance(interf->port);
+            cb_assert(port_instance);
+            ++port_instance->curr_conns;
+            STATS_UNLOCK();
+            continue;
         }
 
         if (!(listen_conn_add = conn_new(sfd, interf->port, conn_listening,
@@ -7460,6 +8255,15 @@ static int server_sockets(FILE *portnumber_file) {
     int ret = 0;
     int ii = 0;
 
+#ifndef SO_REUSEPORT
+    if (settings.reuseport) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "SO_REUSEPORT is not supported on this "
+                                        "platform, using a single acceptor");
+        settings.reuseport = false;
+    }
+#endif
+
     for (ii = 0; ii < settings.num_interfaces; ++ii) {
         stats.listening_ports[ii].port = settings.interfaces[ii].port;
         stats.listening_ports[ii].maxconns = settings.interfaces[ii].maxconn;
@@ -8383,6 +9187,13 @@ int main (int argc, char **argv) {
 
     cbsasl_server_init();
 
+    /* Load the certificates of the SSL interfaces */
+    if (!ssl_contexts_init()) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Failed to allocate the SSL contexts");
+        exit(EXIT_FAILURE);
+    }
+
     /* initialize main thread libevent instance */
     main_base = event_base_new();
 
@@ -8494,6 +9305,7 @@ int main (int argc, char **argv) {
     event_base_free(main_base);
     release_independent_stats(default_independent_stats);
     destroy_connections();
+    ssl_contexts_destroy();
 
     if (get_alloc_hooks_type() == none) {
         unload_engine();
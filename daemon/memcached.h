@@ -17,8 +17,11 @@
 #include <memcached/extension.h>
 
 #include "cache.h"
+#include "io_notify.h"
 #include "rbac.h"
+#include "rbuf_pool.h"
 #include "settings.h"
+#include "uring.h"
 
 /** Maximum length of a key. */
 #define KEY_MAX_LENGTH 250
@@ -33,6 +36,28 @@
 /** Initial size of list of items being returned by "get". */
 #define ITEM_LIST_INITIAL 200
 
+/* The most pipelined gets we look up with a single call to the engine */
+#define GET_BATCH_MAX 32
+
+/*
+ * While the next command of a pipeline is already in the read buffer we
+ * hold back the responses (see hold_response()) until we have this many
+ * bytes or iovecs to send, or less than RESPONSE_BATCH_WBUF_RESERVE bytes
+ * left in the write buffer for the next response.
+ */
+#define RESPONSE_BATCH_MAX_BYTES (64 * 1024)
+#define RESPONSE_BATCH_MAX_IOV 128
+#define RESPONSE_BATCH_WBUF_RESERVE 512
+
+/*
+ * ship_dcp_log() keeps stepping the engine, adding the messages to the
+ * same sendmsg(), until it has this many bytes of mutations to send, the
+ * item list is full, or less than DCP_BATCH_WBUF_RESERVE bytes are left
+ * in the write buffer for the next message.
+ */
+#define DCP_BATCH_MAX_BYTES (256 * 1024)
+#define DCP_BATCH_WBUF_RESERVE 128
+
 /** Initial size of list of temprary auto allocates  */
 #define TEMP_ALLOC_LIST_INITIAL 20
 
@@ -44,6 +69,9 @@
 
 /** High water marks for buffer shrinking */
 #define READ_BUFFER_HIGHWAT 8192
+
+/** Mutations with values this big are read straight into the item */
+#define STREAM_VALUE_MIN READ_BUFFER_HIGHWAT
 #define IOV_LIST_HIGHWAT 50
 #define MSG_LIST_HIGHWAT 20
 
@@ -82,7 +110,10 @@
 
 enum bin_substates {
     bin_no_state,
-    bin_reading_packet
+    bin_reading_packet,
+    bin_reading_mutation_header, /* up to the value we read into the item */
+    bin_reading_mutation_value,  /* the value, straight into the item */
+    bin_stored_mutation_value    /* waiting for the engine to store it */
 };
 
 /** Stats stored per slab (and per thread). */
@@ -95,10 +126,13 @@ struct slab_stats {
 };
 
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread. Only the thread itself updates them (see
+ * stats.h). The structures for all of the threads live in one array, so
+ * the padding keeps the counters of a thread away from the cache lines
+ * holding the tail of the previous thread's slab_stats.
  */
 struct thread_stats {
-    cb_mutex_t   mutex;
+    char              pad[64];
     uint64_t          cmd_get;
     uint64_t          get_misses;
     uint64_t          delete_misses;
@@ -186,7 +220,12 @@ typedef struct {
     cb_thread_t thread_id;      /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
     struct event notify_event;  /* listen event for notify pipe */
-    SOCKET notify[2];           /* notification pipes */
+    URING *uring;               /* batches our sends (see settings.io_uring) */
+    struct event uring_event;   /* listen event for the ring's completions */
+    struct event uring_flush;   /* activated to submit the queued sends */
+    uint64_t uring_full;        /* sends made directly as the ring was full */
+    SOCKET notify[2];           /* notification pipes (or the same eventfd) */
+    IO_NOTIFY_QUEUE *io_notify; /* io completions (see notify_io_complete) */
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
     cb_mutex_t mutex;      /* Mutex to lock protect access to the pending_io */
     bool is_locked;
@@ -196,7 +235,28 @@ typedef struct {
 
     rel_time_t last_checked;
 
-    struct net_buf read; /** Shared read buffer for all connections serviced by this thread. */
+    /* The listening connections owned by this thread (see settings.reuseport) */
+    struct conn **acceptors;
+    int num_acceptors;
+    uint64_t accepted;  /* clients accepted on our listening connections */
+    bool resume_accept; /* set (under the mutex) to re-enable accept */
+
+    /*
+     * The load of this thread, used to place new connections (see
+     * dispatch_conn_new()). Each counter has a single writer: the
+     * dispatcher for "dispatched", and this thread for the others. They
+     * are updated and read with relaxed atomics (STATS_BUMP and STATS_LOAD
+     * in stats.h), as the dispatcher reads them while they change.
+     */
+    struct {
+        uint64_t dispatched; /* connections handed to us by the dispatcher */
+        uint64_t adopted;    /* connections accepted by or migrated to us */
+        uint64_t released;   /* connections closed or migrated away */
+        uint64_t ops;        /* commands executed */
+        hrtime_t busy;       /* time spent running connections */
+    } load;
+
+    RBUF_POOL rbufs; /** Read buffers for the connections serviced by this thread. */
     struct net_buf write; /** Shared write buffer for all connections serviced by this thread. */
 
 } LIBEVENT_THREAD;
@@ -214,6 +274,7 @@ typedef struct {
 extern void notify_thread(LIBEVENT_THREAD *thread);
 extern void notify_dispatcher(void);
 extern bool create_notification_pipe(LIBEVENT_THREAD *me);
+extern bool conn_uring_sendmsg(struct conn *c, struct msghdr *m, int flags);
 
 typedef struct conn conn;
 typedef bool (*STATE_FUNC)(conn *);
@@ -274,6 +335,8 @@ struct conn {
     int    msgused;   /* number of elements used in msglist[] */
     int    msgcurr;   /* element in msglist[] being transmitted now */
     int    msgbytes;  /* number of bytes in current msg */
+    int    nbatched;  /* responses held back to go out with the next one */
+    bool   flushing;  /* transmit() started on what's in msglist[] */
 
     item   **ilist;   /* list of items to write out */
     int    isize;
@@ -322,32 +385,65 @@ struct conn {
 
     int list_state; /* bitmask of list state data for this connection */
     conn   *next;     /* Used for generating a list of conn structures */
+    IO_NOTIFY_NODE *io_notify; /* Links us into the thread's io_notify queue */
     LIBEVENT_THREAD *thread; /* Pointer to the thread object serving this connection */
+    LIBEVENT_THREAD *migrate_to; /* Thread to move to once idle (see migrate_conn()) */
 
     ENGINE_ERROR_CODE aiostat;
     bool ewouldblock;
+    /* A send is queued on the thread's io_uring (see transmit()) */
+    bool io_inflight;
+    /* The queued send completed with io_result */
+    bool io_completed;
+    int io_result;
+
+    /* Values sent without copying them (see zerocopy.h) */
+    struct {
+        bool enabled;     /* SO_ZEROCOPY is set on the socket */
+        bool unsupported; /* ... and we failed to set it */
+        bool sent;        /* The current response was sent without copying */
+        uint32_t next;      /* The id the kernel gives our next send */
+        uint32_t completed; /* The sends before this id have completed */
+        struct zerocopy_item *held; /* Items the kernel may still use */
+        int nheld;
+        int size;
+    } zerocopy;
     TAP_ITERATOR tap_iterator;
     in_port_t parent_port; /* Listening port that creates this connection instance */
 
     int dcp;
+    /* The bytes of mutations queued by the current ship_dcp_log() */
+    size_t dcp_batch_bytes;
 
-    /* Clean up this at one point.. */
+    /* The DCP flow control window (see dcp_flow.h) */
+    struct {
+        cb_mutex_t mutex;
+        uint32_t window;   /* 0 unless the consumer asked for one */
+        uint64_t unacked;  /* Bytes sent and not acknowledged yet */
+        uint64_t sent;
+        uint64_t acked;
+        bool paused;       /* We're waiting for an acknowledgement */
+        uint64_t pauses;
+        /* Ring of the unacknowledged bytes per vBucket, oldest first */
+        struct dcp_flow_segment *segments;
+        uint32_t head;
+        uint32_t nsegments;
+        uint32_t size;
+    } dcp_flow;
+
+    /* The SSL object reads and writes the socket itself */
     struct {
+        /* Small parts of a response are gathered here (see do_ssl_sendmsg) */
         struct {
             char *buffer;
             int buffsz;
-            int total;
-            int current;
-        } in, out;
+        } out;
 
         bool enabled;
-        bool error;
-        SSL_CTX *ctx;
-        SSL *client;
+        SSL *client; /* holds a reference to the context of the interface */
 
         bool connected;
-        BIO *application;
-        BIO *network;
+        bool ktls_send; /* the kernel encrypts what we send (kTLS) */
     } ssl;
 
     auth_context_t *auth_context;
@@ -392,6 +488,12 @@ int  dispatch_event_add(int thread, conn *c);
 void dispatch_conn_new(SOCKET sfd, int parent_port,
                        STATE_FUNC init_state, int event_flags,
                        int read_buffer_size);
+void dispatch_listen_conn(SOCKET sfd, int parent_port, int thread);
+void resume_acceptors(void);
+void update_acceptors(LIBEVENT_THREAD *me, bool enable);
+ENGINE_ERROR_CODE migrate_conn(const int64_t fd, int thread);
+bool conn_handoff(conn *c);
+void thread_load_stats(ADD_STAT add_stats, conn *c);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 void accept_new_conns(const bool do_accept);
@@ -432,6 +534,7 @@ void calculate_maxconns(void);
 bool load_extension(const char *soname, const char *config);
 
 int add_conn_to_pending_io_list(conn *c);
+void drain_io_notifications(LIBEVENT_THREAD *thr);
 
 extern void drop_privileges(void);
 
@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+#include "config.h"
+#include "memcached.h"
+#include "rbuf_pool.h"
+
+#include <string.h>
+
+/* The size of the buffers in each class */
+static const uint32_t rbuf_class_size[RBUF_NUM_CLASSES] = {
+    DATA_BUFFER_SIZE, 16 * 1024, 128 * 1024, 1024 * 1024
+};
+
+/*
+ * How many free buffers we keep in each class. Most connections only
+ * need a small buffer, so we keep more of those.
+ */
+static const int rbuf_class_depth[RBUF_NUM_CLASSES] = {
+    RBUF_POOL_DEPTH, RBUF_POOL_DEPTH / 2, RBUF_POOL_DEPTH / 4, 2
+};
+
+/* The smallest class with buffers of at least the given size, or -1 */
+static int rbuf_class(uint32_t size) {
+    int ii;
+    for (ii = 0; ii < RBUF_NUM_CLASSES; ++ii) {
+        if (size <= rbuf_class_size[ii]) {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+bool rbuf_pool_get(RBUF_POOL *pool, struct net_buf *buf, uint32_t size,
+                   bool *reused) {
+    int cls = rbuf_class(size);
+    char *ptr;
+
+    *reused = false;
+    if (cls == -1) {
+        ptr = malloc(size);
+    } else if (pool->classes[cls].nfree > 0) {
+        ptr = pool->classes[cls].free[--pool->classes[cls].nfree];
+        size = rbuf_class_size[cls];
+        *reused = true;
+    } else {
+        size = rbuf_class_size[cls];
+        ptr = malloc(size);
+    }
+
+    if (ptr == NULL) {
+        return false;
+    }
+
+    buf->buf = buf->curr = ptr;
+    buf->size = size;
+    buf->bytes = 0;
+    return true;
+}
+
+bool rbuf_pool_resize(RBUF_POOL *pool, struct net_buf *buf, uint32_t size,
+                      bool *reused) {
+    struct net_buf old = *buf;
+
+    cb_assert(size >= buf->bytes);
+    if (!rbuf_pool_get(pool, buf, size, reused)) {
+        *buf = old;
+        return false;
+    }
+
+    if (old.bytes > 0) {
+        memcpy(buf->buf, old.curr, old.bytes);
+        buf->bytes = old.bytes;
+    }
+    rbuf_pool_put(pool, &old);
+    return true;
+}
+
+void rbuf_pool_put(RBUF_POOL *pool, struct net_buf *buf) {
+    int cls = rbuf_class(buf->size);
+
+    if (buf->buf == NULL) {
+        return;
+    }
+
+    if (cls != -1 && buf->size == rbuf_class_size[cls] &&
+        pool->classes[cls].nfree < rbuf_class_depth[cls]) {
+        pool->classes[cls].free[pool->classes[cls].nfree++] = buf->buf;
+    } else {
+        free(buf->buf);
+    }
+
+    buf->buf = buf->curr = NULL;
+    buf->size = buf->bytes = 0;
+}
+
+void rbuf_pool_destroy(RBUF_POOL *pool) {
+    int ii;
+    for (ii = 0; ii < RBUF_NUM_CLASSES; ++ii) {
+        while (pool->classes[ii].nfree > 0) {
+            free(pool->classes[ii].free[--pool->classes[ii].nfree]);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * A per-thread pool of read buffers in a few size classes. Connections
+ * take a buffer from the pool of their thread when they have something to
+ * read, and give it back once it is empty, so that a busy thread reuses
+ * the same handful of buffers instead of allocating new ones. A pool is
+ * only used by the thread which owns it.
+ *
+ * Buffers bigger than the largest class are allocated with the exact size
+ * asked for, and freed when given back.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <memcached/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* The number of size classes (see rbuf_class_size in rbuf_pool.c) */
+#define RBUF_NUM_CLASSES 4
+
+    /* The most buffers we keep around for each class */
+#define RBUF_POOL_DEPTH 32
+
+    typedef struct rbuf_pool {
+        struct {
+            char *free[RBUF_POOL_DEPTH];
+            int nfree;
+        } classes[RBUF_NUM_CLASSES];
+    } RBUF_POOL;
+
+    struct net_buf;
+
+    /*
+     * Give the (empty) buffer a block of at least the given size. Returns
+     * false if we're out of memory. Sets *reused if the block came from
+     * the pool.
+     */
+    bool rbuf_pool_get(RBUF_POOL *pool, struct net_buf *buf, uint32_t size,
+                       bool *reused);
+
+    /*
+     * Move the unparsed data of the buffer to a block of at least the
+     * given size, and give the old block back to the pool. Returns false
+     * (leaving the buffer alone) if we're out of memory. Sets *reused if
+     * the new block came from the pool.
+     */
+    bool rbuf_pool_resize(RBUF_POOL *pool, struct net_buf *buf,
+                          uint32_t size, bool *reused);
+
+    /* Give the block of the buffer back to the pool */
+    void rbuf_pool_put(RBUF_POOL *pool, struct net_buf *buf);
+
+    /* Free all of the buffers in the pool */
+    void rbuf_pool_destroy(RBUF_POOL *pool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -28,6 +28,7 @@ struct interface {
     struct {
         const char *key;
         const char *cert;
+        bool ktls; /* Let the kernel do the record encryption */
     } ssl;
     int maxconn;
     int backlog;
@@ -83,7 +84,7 @@ struct settings {
     bool rbac_privilege_debug; /* see manpage */
     bool require_sasl;      /* require SASL auth */
     int verbose;            /* level of versosity to log at. */
-    int bio_drain_buffer_sz; /* size of the SSL bio buffers */
+    int bio_drain_buffer_sz; /* size of the SSL send (gather) buffers */
     bool datatype;          /* is datatype support enabled? */
     const char *root; /* The root directory of the installation */
 
@@ -103,6 +104,10 @@ struct settings {
      */
     uint32_t max_packet_size;
     bool require_init; /* Require init message from ns_server */
+    bool reuseport; /* Let each worker thread accept on its own socket */
+    bool io_uring; /* Let the worker threads batch their sends with io_uring */
+    int io_uring_entries; /* The number of sends each ring can queue */
+    size_t zerocopy_threshold; /* Send values this big without copying them */
 
     /* flags for each of the above config options, indicating if they were
      * specified in a parsed config file.
@@ -128,6 +133,10 @@ struct settings {
         bool breakpad;
         bool max_packet_size;
         bool require_init;
+        bool reuseport;
+        bool io_uring;
+        bool io_uring_entries;
+        bool zerocopy_threshold;
     } has;
     /*************************************************************************
      * These settings are not exposed to the user, and are either derived from
@@ -0,0 +1,240 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+#include "config.h"
+#include "memcached.h"
+#include "ssl_context.h"
+
+/*
+ * Room for the session ticket keys (name, HMAC and AES keys). Their size
+ * depends on the version of OpenSSL.
+ */
+#define SSL_TICKET_KEYS_MAX 80
+
+struct ssl_context {
+    SSL_CTX *ctx;
+    unsigned char ticket_keys[SSL_TICKET_KEYS_MAX];
+    long nticket_keys;
+};
+
+static struct {
+    /* Protects the ctx pointers, the contexts lock themselves */
+    cb_mutex_t mutex;
+    /* Serializes the rebuilds (and the use of the ticket keys) */
+    cb_mutex_t refresh_mutex;
+    struct ssl_context *contexts;
+    int num;
+} ssl_contexts;
+
+/*
+ * Build a new context for the interface, reading the certificate chain
+ * and private key from disk. Returns NULL if we failed to.
+ */
+static SSL_CTX *ssl_context_build(int idx) {
+    const struct interface *iface = &settings.interfaces[idx];
+    struct ssl_context *context = &ssl_contexts.contexts[idx];
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+    long nkeys;
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    /* MB-12359 - Disable SSLv2 & SSLv3 due to POODLE */
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
+    /*
+     * SSL_write() returns after each record it sent, and we retry with
+     * the data where the iovecs are at (see do_ssl_sendmsg())
+     */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                     SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (!SSL_CTX_use_certificate_chain_file(ctx, iface->ssl.cert) ||
+        !SSL_CTX_use_PrivateKey_file(ctx, iface->ssl.key, SSL_FILETYPE_PEM)) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Failed to load the SSL certificate "
+                                        "%s and key %s for port %u",
+                                        iface->ssl.cert, iface->ssl.key,
+                                        iface->port);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    /*
+     * Let the clients resume their sessions, either from the session
+     * cache or with a ticket. The first context of the interface keeps
+     * the ticket keys OpenSSL made up, and the ones built later reuse
+     * them so that the tickets stay valid.
+     */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)&iface->port,
+                                   sizeof(iface->port));
+    nkeys = SSL_CTX_get_tlsext_ticket_keys(ctx, NULL, 0);
+    if (nkeys > 0 && nkeys <= SSL_TICKET_KEYS_MAX) {
+        if (context->nticket_keys == 0) {
+            if (SSL_CTX_get_tlsext_ticket_keys(ctx, context->ticket_keys,
+                                               nkeys) == 1) {
+                context->nticket_keys = nkeys;
+            }
+        } else if (context->nticket_keys == nkeys) {
+            SSL_CTX_set_tlsext_ticket_keys(ctx, context->ticket_keys, nkeys);
+        }
+    }
+
+    if (iface->ssl.ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Kernel TLS is not supported by "
+                                        "this OpenSSL (port %u)",
+                                        iface->port);
+#endif
+    }
+
+    return ctx;
+}
+
+bool ssl_contexts_init(void) {
+    int ii;
+
+    cb_mutex_initialize(&ssl_contexts.mutex);
+    cb_mutex_initialize(&ssl_contexts.refresh_mutex);
+    ssl_contexts.contexts = calloc(settings.num_interfaces,
+                                   sizeof(*ssl_contexts.contexts));
+    if (ssl_contexts.contexts == NULL) {
+        return false;
+    }
+    ssl_contexts.num = settings.num_interfaces;
+
+    for (ii = 0; ii < ssl_contexts.num; ++ii) {
+        if (settings.interfaces[ii].ssl.cert != NULL) {
+            ssl_contexts.contexts[ii].ctx = ssl_context_build(ii);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Replace the context of the interface with one built from its current
+ * files. Called with the refresh mutex held.
+ */
+static bool ssl_context_rebuild(int idx) {
+    SSL_CTX *ctx;
+    SSL_CTX *old;
+
+    if ((ctx = ssl_context_build(idx)) == NULL) {
+        return false;
+    }
+
+    cb_mutex_enter(&ssl_contexts.mutex);
+    old = ssl_contexts.contexts[idx].ctx;
+    ssl_contexts.contexts[idx].ctx = ctx;
+    cb_mutex_exit(&ssl_contexts.mutex);
+
+    /* The connections using the old context hold a reference to it */
+    if (old != NULL) {
+        SSL_CTX_free(old);
+    }
+    return true;
+}
+
+bool ssl_context_refresh(int idx) {
+    bool ret;
+
+    if (idx >= ssl_contexts.num || settings.interfaces[idx].ssl.cert == NULL) {
+        return true;
+    }
+
+    cb_mutex_enter(&ssl_contexts.refresh_mutex);
+    ret = ssl_context_rebuild(idx);
+    cb_mutex_exit(&ssl_contexts.refresh_mutex);
+    return ret;
+}
+
+bool ssl_context_set_files(int idx, const char *cert, const char *key) {
+    struct interface *iface = &settings.interfaces[idx];
+    char *new_cert = NULL;
+    char *new_key = NULL;
+    const char *old_cert = NULL;
+    const char *old_key = NULL;
+    bool ret;
+
+    if ((cert != NULL && (new_cert = strdup(cert)) == NULL) ||
+        (key != NULL && (new_key = strdup(key)) == NULL)) {
+        free(new_cert);
+        return false;
+    }
+
+    /* ssl_context_build() reads the names with the refresh mutex held */
+    cb_mutex_enter(&ssl_contexts.refresh_mutex);
+    if (new_cert != NULL) {
+        old_cert = iface->ssl.cert;
+        iface->ssl.cert = new_cert;
+    }
+    if (new_key != NULL) {
+        old_key = iface->ssl.key;
+        iface->ssl.key = new_key;
+    }
+    ret = idx >= ssl_contexts.num || ssl_context_rebuild(idx);
+    cb_mutex_exit(&ssl_contexts.refresh_mutex);
+
+    free((char*)old_cert);
+    free((char*)old_key);
+    return ret;
+}
+
+bool ssl_contexts_refresh(void) {
+    bool ret = true;
+    int ii;
+
+    for (ii = 0; ii < ssl_contexts.num; ++ii) {
+        if (!ssl_context_refresh(ii)) {
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+SSL *ssl_context_new_client(int idx) {
+    SSL *ssl = NULL;
+
+    cb_mutex_enter(&ssl_contexts.mutex);
+    if (idx < ssl_contexts.num && ssl_contexts.contexts[idx].ctx != NULL) {
+        /* This takes a reference to the context */
+        ssl = SSL_new(ssl_contexts.contexts[idx].ctx);
+    }
+    cb_mutex_exit(&ssl_contexts.mutex);
+
+    return ssl;
+}
+
+void ssl_contexts_destroy(void) {
+    int ii;
+
+    for (ii = 0; ii < ssl_contexts.num; ++ii) {
+        if (ssl_contexts.contexts[ii].ctx != NULL) {
+            SSL_CTX_free(ssl_contexts.contexts[ii].ctx);
+        }
+    }
+    free(ssl_contexts.contexts);
+    ssl_contexts.contexts = NULL;
+    ssl_contexts.num = 0;
+    cb_mutex_destroy(&ssl_contexts.mutex);
+    cb_mutex_destroy(&ssl_contexts.refresh_mutex);
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * The SSL contexts of the interfaces. We build one context per SSL
+ * interface at startup (reading the certificate and key from disk) and
+ * let all of the connections on the interface share it, so accepting a
+ * connection doesn't touch the disk. The contexts are rebuilt by
+ * ssl_certs_refresh (and when the certificate or key of an interface is
+ * changed in the configuration); connections already using the old
+ * context keep it until they close.
+ *
+ * The contexts of an interface keep the same session ticket keys when
+ * rebuilt, so that clients may resume their sessions across a refresh.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <memcached/openssl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+     * Build the contexts of all of the SSL interfaces. An interface we
+     * fail to load the certificate of is logged, and refuses connections
+     * until it is refreshed. Returns false if we're out of memory.
+     */
+    bool ssl_contexts_init(void);
+
+    /*
+     * Rebuild the contexts of all of the SSL interfaces from the files
+     * currently configured. An interface we fail to load the new
+     * certificate of keeps its current context. Returns false if any of
+     * them failed.
+     */
+    bool ssl_contexts_refresh(void);
+
+    /* Rebuild the context of the interface with the given index */
+    bool ssl_context_refresh(int idx);
+
+    /*
+     * Change the certificate and/or key (NULL keeps the current one) of
+     * the SSL interface with the given index, and rebuild its context.
+     * Returns false if we failed to, the interface keeps its current
+     * context then (but uses the new files from now on).
+     */
+    bool ssl_context_set_files(int idx, const char *cert, const char *key);
+
+    /*
+     * Create the SSL object for a new connection on the interface with
+     * the given index, or NULL if the interface has no (usable) context.
+     */
+    SSL *ssl_context_new_client(int idx);
+
+    /* Free all of the contexts */
+    void ssl_contexts_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
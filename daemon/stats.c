@@ -14,22 +14,11 @@ static int num_independent_stats(void) {
 
 void *new_independent_stats(void) {
     int nrecords = num_independent_stats();
-    struct thread_stats *ts = calloc(nrecords, sizeof(struct thread_stats));
-    int ii;
-    for (ii = 0; ii < nrecords; ii++) {
-        cb_mutex_initialize(&ts[ii].mutex);
-    }
-    return ts;
+    return calloc(nrecords, sizeof(struct thread_stats));
 }
 
 void release_independent_stats(void *stats) {
-    int nrecords = num_independent_stats();
-    struct thread_stats *ts = stats;
-    int ii;
-    for (ii = 0; ii < nrecords; ii++) {
-        cb_mutex_destroy(&ts[ii].mutex);
-    }
-    free(ts);
+    free(stats);
 }
 
 struct thread_stats* get_independent_stats(conn *c) {
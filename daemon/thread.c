@@ -15,10 +15,15 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <platform/platform.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #define ITEMS_PER_ALLOC 64
 
+#ifndef HAVE_SYS_EVENTFD_H
 static char devnull[8192];
+#endif
 extern volatile sig_atomic_t memcached_shutdown;
 
 /* An item in the connection queue. */
@@ -29,6 +34,8 @@ struct conn_queue_item {
     STATE_FUNC        init_state;
     int               event_flags;
     int               read_buffer_size;
+    conn             *conn;       /* connection migrated to us */
+    LIBEVENT_THREAD  *migrate_to; /* migrate the connection using sfd there */
     CQ_ITEM          *next;
 };
 
@@ -51,8 +58,9 @@ static cb_mutex_t cqi_freelist_lock;
 static LIBEVENT_THREAD dispatcher_thread;
 
 /*
- * Each libevent instance has a wakeup pipe, which other threads
- * can use to signal that they've put a new connection on its queue.
+ * Each libevent instance has a wakeup pipe (an eventfd where available),
+ * which other threads can use to signal that they've put a new connection
+ * or an io completion on one of its queues.
  */
 static int nthreads;
 static LIBEVENT_THREAD *threads;
@@ -66,6 +74,9 @@ static cb_mutex_t init_lock;
 static cb_cond_t init_cond;
 
 static void thread_libevent_process(evutil_socket_t fd, short which, void *arg);
+static void conn_adopt(LIBEVENT_THREAD *me, conn *c);
+static void uring_completion_handler(evutil_socket_t fd, short which, void *arg);
+static void uring_flush_handler(evutil_socket_t fd, short which, void *arg);
 
 /*
  * Initializes a connection queue.
@@ -204,6 +215,27 @@ bool create_notification_pipe(LIBEVENT_THREAD *me)
     return true;
 }
 
+#ifdef HAVE_SYS_EVENTFD_H
+/*
+ * The worker threads only need to know that they were notified, not how
+ * many times, so they may use an eventfd (one descriptor, and a write
+ * never blocks) instead of a socketpair.
+ */
+static bool create_notification_eventfd(LIBEVENT_THREAD *me)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Can't create notify eventfd: %s",
+                                        strerror(errno));
+        return false;
+    }
+
+    me->notify[0] = me->notify[1] = fd;
+    return true;
+}
+#endif
+
 static void setup_dispatcher(struct event_base *main_base,
                              void (*dispatcher_callback)(evutil_socket_t, short, void *))
 {
@@ -226,6 +258,36 @@ static void setup_dispatcher(struct event_base *main_base,
     }
 }
 
+/*
+ * Create the io_uring the thread queues its sends on. If the kernel doesn't
+ * support it we fall back to sending from the state machine.
+ */
+static void setup_uring(LIBEVENT_THREAD *me) {
+    if ((me->uring = uring_create(settings.io_uring_entries)) == NULL) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Failed to set up io_uring, using "
+                                        "normal sends instead");
+        settings.io_uring = false;
+        return;
+    }
+
+    event_set(&me->uring_event, uring_eventfd(me->uring),
+              EV_READ | EV_PERSIST, uring_completion_handler, me);
+    event_base_set(me->base, &me->uring_event);
+    if (event_add(&me->uring_event, 0) == -1) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Can't monitor io_uring completions\n");
+        exit(1);
+    }
+
+    /*
+     * Activated by conn_uring_sendmsg(), and added with a timeout by
+     * uring_flush() when the kernel asks us to try again later
+     */
+    evtimer_set(&me->uring_flush, uring_flush_handler, me);
+    event_base_set(me->base, &me->uring_flush);
+}
+
 /*
  * Set up a thread's information.
  */
@@ -258,7 +320,12 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     }
     cq_init(me->new_conn_queue);
 
+    me->io_notify = io_notify_queue_create();
     cb_mutex_initialize(&me->mutex);
+
+    if (settings.io_uring) {
+        setup_uring(me);
+    }
 }
 
 /*
@@ -291,6 +358,14 @@ int number_of_pending(conn *c, conn *list) {
 
 static void drain_notification_channel(evutil_socket_t fd)
 {
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Can't read from notify eventfd: %s",
+                                        strerror(errno));
+    }
+#else
     int nread;
     while ((nread = recv(fd, devnull, sizeof(devnull), 0)) == (int)sizeof(devnull)) {
         /* empty */
@@ -300,6 +375,7 @@ static void drain_notification_channel(evutil_socket_t fd)
         log_socket_error(EXTENSION_LOG_WARNING, NULL,
                          "Can't read from libevent pipe: %s");
     }
+#endif
 }
 
 /*
@@ -313,6 +389,8 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
 
     cb_assert(me->type == GENERAL);
     drain_notification_channel(fd);
+    /* Anything queued after this results in a new notification */
+    io_notify_disarm(me->io_notify);
 
     if (memcached_shutdown) {
          event_base_loopbreak(me->base);
@@ -320,9 +398,27 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
     }
 
     while ((item = cq_pop(me->new_conn_queue)) != NULL) {
-        conn *c = conn_new(item->sfd, item->parent_port, item->init_state,
-                           item->event_flags, item->read_buffer_size,
-                           me->base);
+        conn *c;
+
+        if (item->conn != NULL) {
+            conn_adopt(me, item->conn);
+            cqi_free(item);
+            continue;
+        } else if (item->migrate_to != NULL) {
+            LOCK_THREAD(me);
+            c = find_connection(item->sfd, &me);
+            if (c != NULL) {
+                c->migrate_to = item->migrate_to;
+                conn_handoff(c);
+            }
+            UNLOCK_THREAD(me);
+            cqi_free(item);
+            continue;
+        }
+
+        c = conn_new(item->sfd, item->parent_port, item->init_state,
+                     item->event_flags, item->read_buffer_size,
+                     me->base);
         if (c == NULL) {
             if (settings.verbose > 0) {
                 settings.extensions.logger->log(EXTENSION_LOG_INFO, NULL,
@@ -330,18 +426,34 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
                                                 item->sfd);
             }
             closesocket(item->sfd);
+            if (item->init_state != conn_listening) {
+                STATS_BUMP(me->load.released, 1);
+            }
         } else {
             cb_assert(c->thread == NULL);
             c->thread = me;
+            if (item->init_state == conn_listening) {
+                conn **acceptors = realloc(me->acceptors,
+                                           (me->num_acceptors + 1) * sizeof(conn*));
+                cb_assert(acceptors != NULL);
+                acceptors[me->num_acceptors++] = c;
+                me->acceptors = acceptors;
+            }
         }
         cqi_free(item);
     }
 
     LOCK_THREAD(me);
+    if (me->resume_accept) {
+        me->resume_accept = false;
+        update_acceptors(me, true);
+    }
+    drain_io_notifications(me);
     pending = me->pending_io;
     me->pending_io = NULL;
     while (pending != NULL) {
         conn *c = pending;
+        hrtime_t start = gethrtime();
         cb_assert(me == c->thread);
         pending = pending->next;
         c->next = NULL;
@@ -358,10 +470,124 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
          */
         c->nevents = 1;
         run_event_loop(c);
+        STATS_BUMP(me->load.busy, gethrtime() - start);
     }
     UNLOCK_THREAD(me);
 }
 
+/*
+ * Queues a send of the message on the ring of the thread serving the
+ * connection. The sends queued while running the connections with events
+ * are submitted together once they're done (in uring_flush_handler()).
+ * Returns false if the ring is full.
+ */
+bool conn_uring_sendmsg(conn *c, struct msghdr *m, int flags) {
+    LIBEVENT_THREAD *me = c->thread;
+
+    cb_assert(!c->io_inflight && !c->io_completed);
+    if (!uring_prep_sendmsg(me->uring, c->sfd, m, flags, c)) {
+        STATS_BUMP(me->uring_full, 1);
+        return false;
+    }
+
+    if (uring_unsubmitted(me->uring) == 1) {
+        event_active(&me->uring_flush, EV_TIMEOUT, 0);
+    }
+    c->io_inflight = true;
+    return true;
+}
+
+/*
+ * Hand the result of a send queued on the ring back to the connection, and
+ * run it so that transmit() picks it up.
+ */
+static void uring_complete(LIBEVENT_THREAD *me, conn *c, int res) {
+    hrtime_t start = gethrtime();
+
+    cb_assert(c->thread == me && c->io_inflight);
+    c->io_inflight = false;
+    c->io_completed = true;
+    c->io_result = res;
+
+    /* We stopped listening for events when the send was queued */
+    if (!update_event(c, EV_READ | EV_PERSIST)) {
+        conn_set_state(c, conn_closing);
+    }
+    c->nevents = c->max_reqs_per_event;
+    run_event_loop(c);
+    STATS_BUMP(me->load.busy, gethrtime() - start);
+}
+
+/*
+ * Submit the sends queued on the ring of this thread. If the kernel is
+ * short on resources we try again shortly (we can't rely on a completion
+ * to get us going again, there may not be any sends in flight). If the
+ * submit fails the queued sends are failed back to their connections.
+ */
+static void uring_flush(LIBEVENT_THREAD *me) {
+    void *data;
+    int res;
+
+    if (uring_submit(me->uring)) {
+        if (uring_unsubmitted(me->uring) > 0) {
+            struct timeval tv = { .tv_sec = 0, .tv_usec = 1000 };
+            if (evtimer_add(&me->uring_flush, &tv) == -1) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                                "Can't schedule io_uring submit\n");
+            }
+        }
+        return;
+    }
+
+    /*
+     * The connections close on the error rather than queue another send,
+     * so we don't fail sends which weren't queued when the submit failed
+     */
+    res = -errno;
+    LOCK_THREAD(me);
+    while (uring_unqueue(me->uring, &data)) {
+        uring_complete(me, data, res);
+    }
+    UNLOCK_THREAD(me);
+}
+
+static void uring_flush_handler(evutil_socket_t fd, short which, void *arg) {
+    uring_flush(arg);
+}
+
+/*
+ * Called when the kernel completed some of the sends queued on the ring of
+ * this thread. Runs the connections so that transmit() picks up the result.
+ */
+static void uring_completion_handler(evutil_socket_t fd, short which, void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    uint64_t value;
+    void *data;
+    int res;
+
+    if (read(fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "Can't read io_uring eventfd: %s",
+                                        strerror(errno));
+    }
+
+    if (memcached_shutdown) {
+         event_base_loopbreak(me->base);
+         return ;
+    }
+
+    LOCK_THREAD(me);
+    while (uring_reap(me->uring, &data, &res)) {
+        uring_complete(me, data, res);
+    }
+    UNLOCK_THREAD(me);
+
+    /* Submit the sends queued by the connections we just ran */
+    if (uring_unsubmitted(me->uring) > 0) {
+        uring_flush(me);
+    }
+}
+
 extern volatile rel_time_t current_time;
 
 bool has_cycle(conn *c) {
@@ -447,11 +673,35 @@ void finalize_list(conn **list, size_t items) {
     }
 }
 
+static void enlist_io_notification(conn *c, ENGINE_ERROR_CODE status,
+                                   void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    cb_assert(c->thread == me);
+    c->aiostat = status;
+    if (number_of_pending(c, me->pending_io) == 0) {
+        enlist_conn(c, &me->pending_io);
+    }
+}
+
+/*
+ * Moves the connections notified by notify_io_complete() to the pending_io
+ * list of the thread. Must be called by the thread itself with its lock
+ * held, and before a connection is taken off the pending_io list for good
+ * so that it isn't still sitting in the queue.
+ */
+void drain_io_notifications(LIBEVENT_THREAD *me) {
+    io_notify_drain(me->io_notify, enlist_io_notification, me);
+}
+
+/*
+ * Called by the engine (from any thread) when an operation which returned
+ * EWOULDBLOCK completes. This must be cheap: it doesn't take the thread's
+ * lock, and a burst of notifications only wakes up the thread once.
+ */
 void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status)
 {
     struct conn *conn = (struct conn *)cookie;
     LIBEVENT_THREAD *thr;
-    int notify;
 
     cb_assert(conn);
     thr = conn->thread;
@@ -461,13 +711,8 @@ void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status)
                                     "Got notify from %d, status %x\n",
                                     conn->sfd, status);
 
-    LOCK_THREAD(thr);
-    conn->aiostat = status;
-    notify = add_conn_to_pending_io_list(conn);
-    UNLOCK_THREAD(thr);
-
     /* kick the thread in the butt */
-    if (notify) {
+    if (io_notify_push(thr->io_notify, conn->io_notify, status)) {
         notify_thread(thr);
     }
 }
@@ -476,19 +721,97 @@ void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status)
 static int last_thread = -1;
 
 /*
- * Dispatches a new connection to another thread. This is only ever called
- * from the main thread, or because of an incoming connection.
+ * The load of the worker threads as last sampled by the dispatcher. Only
+ * used by the dispatcher.
  */
-void dispatch_conn_new(SOCKET sfd, int parent_port,
-                       STATE_FUNC init_state, int event_flags,
-                       int read_buffer_size) {
-    CQ_ITEM *item = cqi_new();
-    int tid = (last_thread + 1) % settings.num_threads;
+static struct thread_load_sample {
+    uint64_t ops;
+    hrtime_t busy;
+    double ops_rate;   /* commands per second */
+    double busy_ratio; /* fraction of the time spent running connections */
+} *load_samples;
+static hrtime_t load_sampled_at;
+
+/* Resample the ops/sec and busy time of the threads every second */
+#define LOAD_SAMPLE_INTERVAL (1000 * 1000 * 1000)
+
+static uint64_t thread_conns(LIBEVENT_THREAD *thr) {
+    return STATS_LOAD(thr->load.dispatched) + STATS_LOAD(thr->load.adopted) -
+        STATS_LOAD(thr->load.released);
+}
 
-    LIBEVENT_THREAD *thread = threads + tid;
+static void sample_thread_load(void) {
+    hrtime_t now = gethrtime();
+    hrtime_t elapsed = now - load_sampled_at;
+    int ii;
 
-    last_thread = tid;
+    if (elapsed < LOAD_SAMPLE_INTERVAL) {
+        return;
+    }
 
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        struct thread_load_sample *sample = load_samples + ii;
+        uint64_t ops = STATS_LOAD(threads[ii].load.ops);
+        hrtime_t busy = STATS_LOAD(threads[ii].load.busy);
+
+        sample->ops_rate = (double)(ops - sample->ops) * 1e9 / (double)elapsed;
+        sample->busy_ratio = (double)(busy - sample->busy) / (double)elapsed;
+        sample->ops = ops;
+        sample->busy = busy;
+    }
+    load_sampled_at = now;
+}
+
+/*
+ * Pick the least loaded worker thread for a new connection. The load of a
+ * thread is its share of the connections, of the commands per second and
+ * of the busy time of all of the threads. Ties (e.g. when idle) are broken
+ * round robin.
+ */
+static int select_thread(void) {
+    uint64_t total_conns = 0;
+    double total_ops = 0;
+    double total_busy = 0;
+    double min_load = 0;
+    int tid = -1;
+    int ii;
+
+    sample_thread_load();
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        total_conns += thread_conns(threads + ii);
+        total_ops += load_samples[ii].ops_rate;
+        total_busy += load_samples[ii].busy_ratio;
+    }
+
+    for (ii = 1; ii <= settings.num_threads; ++ii) {
+        int candidate = (last_thread + ii) % settings.num_threads;
+        double load = 0;
+
+        if (total_conns > 0) {
+            load += (double)thread_conns(threads + candidate) / (double)total_conns;
+        }
+        if (total_ops > 0) {
+            load += load_samples[candidate].ops_rate / total_ops;
+        }
+        if (total_busy > 0) {
+            load += load_samples[candidate].busy_ratio / total_busy;
+        }
+
+        if (tid == -1 || load < min_load) {
+            tid = candidate;
+            min_load = load;
+        }
+    }
+
+    return tid;
+}
+
+static void dispatch_conn(LIBEVENT_THREAD *thread, SOCKET sfd,
+                          int parent_port, STATE_FUNC init_state,
+                          int event_flags, int read_buffer_size) {
+    CQ_ITEM *item = cqi_new();
+
+    memset(item, 0, sizeof(*item));
     item->sfd = sfd;
     item->parent_port = parent_port;
     item->init_state = init_state;
@@ -501,6 +824,178 @@ void dispatch_conn_new(SOCKET sfd, int parent_port,
     notify_thread(thread);
 }
 
+/*
+ * Dispatches a new connection to the least loaded worker thread. This is
+ * only ever called from the main thread, or because of an incoming
+ * connection.
+ */
+void dispatch_conn_new(SOCKET sfd, int parent_port,
+                       STATE_FUNC init_state, int event_flags,
+                       int read_buffer_size) {
+    int tid = select_thread();
+
+    last_thread = tid;
+    STATS_BUMP(threads[tid].load.dispatched, 1);
+    dispatch_conn(threads + tid, sfd, parent_port, init_state,
+                  event_flags, read_buffer_size);
+}
+
+/*
+ * Hands a listening socket over to a worker thread, which will accept the
+ * clients on it directly (see settings.reuseport).
+ */
+void dispatch_listen_conn(SOCKET sfd, int parent_port, int thread) {
+    cb_assert(thread < settings.num_threads);
+    dispatch_conn(threads + thread, sfd, parent_port, conn_listening,
+                  EV_READ | EV_PERSIST, 1);
+}
+
+/*
+ * Moves the client connection using the given fd over to the worker thread
+ * with the given index. The thread serving the connection hands it over as
+ * soon as it is idle (between two commands), so the caller only learns
+ * that the migration is scheduled.
+ */
+ENGINE_ERROR_CODE migrate_conn(const int64_t fd, int thread) {
+    LIBEVENT_THREAD *owner = NULL;
+    CQ_ITEM *item;
+
+    if (thread < 0 || thread >= settings.num_threads) {
+        return ENGINE_EINVAL;
+    }
+
+    if (find_connection(fd, &owner) == NULL) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (owner == threads + thread) {
+        return ENGINE_SUCCESS;
+    }
+
+    if (owner->type != GENERAL || (item = cqi_new()) == NULL) {
+        return ENGINE_TMPFAIL;
+    }
+
+    /* The owner looks the connection up again, as it may be gone by now */
+    memset(item, 0, sizeof(*item));
+    item->sfd = (SOCKET)fd;
+    item->migrate_to = threads + thread;
+    cq_push(owner->new_conn_queue, item);
+    notify_thread(owner);
+
+    return ENGINE_SUCCESS;
+}
+
+/*
+ * Hands a connection over to the thread it is being migrated to if the
+ * connection is idle. Called by the thread serving the connection with
+ * its lock held. The connection must not be used by the caller if it
+ * was handed over.
+ */
+bool conn_handoff(conn *c) {
+    LIBEVENT_THREAD *me = c->thread;
+    CQ_ITEM *item;
+
+    cb_assert(me != NULL && c->migrate_to != NULL);
+    if ((c->state != conn_read && c->state != conn_new_cmd) ||
+        c->ewouldblock || c->tap_iterator != NULL || c->dcp ||
+        c->refcount != 1 || c->sfd == INVALID_SOCKET) {
+        return false;
+    }
+
+    if ((item = cqi_new()) == NULL) {
+        return false;
+    }
+
+    drain_io_notifications(me);
+    me->pending_io = list_remove(me->pending_io, c);
+    if (c->registered_in_libevent && !unregister_event(c)) {
+        cqi_free(item);
+        return false;
+    }
+
+    settings.extensions.logger->log(EXTENSION_LOG_INFO, c,
+                                    "%d: Migrating connection from worker %d to %d",
+                                    c->sfd, me->index, c->migrate_to->index);
+
+    memset(item, 0, sizeof(*item));
+    item->sfd = c->sfd;
+    item->conn = c;
+    STATS_BUMP(me->load.released, 1);
+    c->thread = NULL;
+    cq_push(c->migrate_to->new_conn_queue, item);
+    notify_thread(c->migrate_to);
+
+    return true;
+}
+
+/*
+ * Starts serving a connection migrated to this thread (see conn_handoff()).
+ */
+static void conn_adopt(LIBEVENT_THREAD *me, conn *c) {
+    cb_assert(c->thread == NULL && c->migrate_to == me);
+
+    c->migrate_to = NULL;
+    c->thread = me;
+    STATS_BUMP(me->load.adopted, 1);
+
+    event_set(&c->event, c->sfd, c->ev_flags, event_handler, (void *)c);
+    event_base_set(me->base, &c->event);
+    if (!register_event(c, NULL)) {
+        /* Close it like conn_closing() does (it was idle) */
+        safe_close(c->sfd);
+        c->sfd = INVALID_SOCKET;
+        conn_cleanup_engine_allocations(c);
+        conn_set_state(c, conn_immediate_close);
+        LOCK_THREAD(me);
+        run_event_loop(c);
+        UNLOCK_THREAD(me);
+    }
+}
+
+void thread_load_stats(ADD_STAT add_stats, conn *c) {
+    int ii;
+
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        char key[80];
+
+        snprintf(key, sizeof(key), "thread_%d:conns", ii);
+        append_stat(key, add_stats, c, "%"PRIu64, thread_conns(threads + ii));
+        snprintf(key, sizeof(key), "thread_%d:ops", ii);
+        append_stat(key, add_stats, c, "%"PRIu64,
+                    STATS_LOAD(threads[ii].load.ops));
+        snprintf(key, sizeof(key), "thread_%d:busy_ms", ii);
+        append_stat(key, add_stats, c, "%"PRIu64,
+                    (uint64_t)(STATS_LOAD(threads[ii].load.busy) / 1000000));
+        if (threads[ii].num_acceptors > 0) {
+            snprintf(key, sizeof(key), "thread_%d:accepted", ii);
+            append_stat(key, add_stats, c, "%"PRIu64,
+                        STATS_LOAD(threads[ii].accepted));
+        }
+        if (threads[ii].uring != NULL) {
+            snprintf(key, sizeof(key), "thread_%d:uring_full", ii);
+            append_stat(key, add_stats, c, "%"PRIu64,
+                        STATS_LOAD(threads[ii].uring_full));
+        }
+    }
+}
+
+/*
+ * Tells the worker threads which stopped accepting clients because we ran
+ * out of file descriptors to start accepting again.
+ */
+void resume_acceptors(void) {
+    int ii;
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        LIBEVENT_THREAD *thr = threads + ii;
+
+        LOCK_THREAD(thr);
+        thr->resume_accept = true;
+        UNLOCK_THREAD(thr);
+        notify_thread(thr);
+    }
+}
+
 /*
  * Returns true if this is the thread that listens for new TCP connections.
  */
@@ -515,87 +1010,93 @@ void notify_dispatcher(void) {
 /******************************* GLOBAL STATS ******************************/
 
 void threadlocal_stats_clear(struct thread_stats *stats) {
-    stats->cmd_get = 0;
-    stats->get_misses = 0;
-    stats->delete_misses = 0;
-    stats->incr_misses = 0;
-    stats->decr_misses = 0;
-    stats->incr_hits = 0;
-    stats->decr_hits = 0;
-    stats->cas_misses = 0;
-    stats->bytes_written = 0;
-    stats->bytes_read = 0;
-    stats->cmd_flush = 0;
-    stats->conn_yields = 0;
-    stats->auth_cmds = 0;
-    stats->auth_errors = 0;
-    stats->rbufs_allocated = 0;
-    stats->rbufs_loaned = 0;
-    stats->rbufs_existing = 0;
-    stats->wbufs_allocated = 0;
-    stats->wbufs_loaned = 0;
-    stats->iovused_high_watermark = 0;
-    stats->msgused_high_watermark = 0;
-
-    memset(stats->slab_stats, 0,
-           sizeof(struct slab_stats) * MAX_NUMBER_OF_SLAB_CLASSES);
+    int sid;
+
+    STATS_STORE(stats->cmd_get, 0);
+    STATS_STORE(stats->get_misses, 0);
+    STATS_STORE(stats->delete_misses, 0);
+    STATS_STORE(stats->incr_misses, 0);
+    STATS_STORE(stats->decr_misses, 0);
+    STATS_STORE(stats->incr_hits, 0);
+    STATS_STORE(stats->decr_hits, 0);
+    STATS_STORE(stats->cas_misses, 0);
+    STATS_STORE(stats->bytes_written, 0);
+    STATS_STORE(stats->bytes_read, 0);
+    STATS_STORE(stats->cmd_flush, 0);
+    STATS_STORE(stats->conn_yields, 0);
+    STATS_STORE(stats->auth_cmds, 0);
+    STATS_STORE(stats->auth_errors, 0);
+    STATS_STORE(stats->rbufs_allocated, 0);
+    STATS_STORE(stats->rbufs_loaned, 0);
+    STATS_STORE(stats->rbufs_existing, 0);
+    STATS_STORE(stats->wbufs_allocated, 0);
+    STATS_STORE(stats->wbufs_loaned, 0);
+    STATS_STORE(stats->iovused_high_watermark, 0);
+    STATS_STORE(stats->msgused_high_watermark, 0);
+
+    for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
+        STATS_STORE(stats->slab_stats[sid].cmd_set, 0);
+        STATS_STORE(stats->slab_stats[sid].get_hits, 0);
+        STATS_STORE(stats->slab_stats[sid].delete_hits, 0);
+        STATS_STORE(stats->slab_stats[sid].cas_hits, 0);
+        STATS_STORE(stats->slab_stats[sid].cas_badval, 0);
+    }
 }
 
 void threadlocal_stats_reset(struct thread_stats *thread_stats) {
     int ii;
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        cb_mutex_enter(&thread_stats[ii].mutex);
         threadlocal_stats_clear(&thread_stats[ii]);
-        cb_mutex_exit(&thread_stats[ii].mutex);
     }
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *thread_stats, struct thread_stats *stats) {
     int ii, sid;
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        cb_mutex_enter(&thread_stats[ii].mutex);
-
-        stats->cmd_get += thread_stats[ii].cmd_get;
-        stats->get_misses += thread_stats[ii].get_misses;
-        stats->delete_misses += thread_stats[ii].delete_misses;
-        stats->decr_misses += thread_stats[ii].decr_misses;
-        stats->incr_misses += thread_stats[ii].incr_misses;
-        stats->decr_hits += thread_stats[ii].decr_hits;
-        stats->incr_hits += thread_stats[ii].incr_hits;
-        stats->cas_misses += thread_stats[ii].cas_misses;
-        stats->bytes_read += thread_stats[ii].bytes_read;
-        stats->bytes_written += thread_stats[ii].bytes_written;
-        stats->cmd_flush += thread_stats[ii].cmd_flush;
-        stats->conn_yields += thread_stats[ii].conn_yields;
-        stats->auth_cmds += thread_stats[ii].auth_cmds;
-        stats->auth_errors += thread_stats[ii].auth_errors;
-        stats->rbufs_allocated += thread_stats[ii].rbufs_allocated;
-        stats->rbufs_loaned += thread_stats[ii].rbufs_loaned;
-        stats->rbufs_existing += thread_stats[ii].rbufs_existing;
-        stats->wbufs_allocated += thread_stats[ii].wbufs_allocated;
-        stats->wbufs_loaned += thread_stats[ii].wbufs_loaned;
-
-        if (thread_stats[ii].iovused_high_watermark > stats->iovused_high_watermark) {
-            stats->iovused_high_watermark = thread_stats[ii].iovused_high_watermark;
+        struct thread_stats *ts = &thread_stats[ii];
+        uint64_t high;
+
+        stats->cmd_get += STATS_LOAD(ts->cmd_get);
+        stats->get_misses += STATS_LOAD(ts->get_misses);
+        stats->delete_misses += STATS_LOAD(ts->delete_misses);
+        stats->decr_misses += STATS_LOAD(ts->decr_misses);
+        stats->incr_misses += STATS_LOAD(ts->incr_misses);
+        stats->decr_hits += STATS_LOAD(ts->decr_hits);
+        stats->incr_hits += STATS_LOAD(ts->incr_hits);
+        stats->cas_misses += STATS_LOAD(ts->cas_misses);
+        stats->bytes_read += STATS_LOAD(ts->bytes_read);
+        stats->bytes_written += STATS_LOAD(ts->bytes_written);
+        stats->cmd_flush += STATS_LOAD(ts->cmd_flush);
+        stats->conn_yields += STATS_LOAD(ts->conn_yields);
+        stats->auth_cmds += STATS_LOAD(ts->auth_cmds);
+        stats->auth_errors += STATS_LOAD(ts->auth_errors);
+        stats->rbufs_allocated += STATS_LOAD(ts->rbufs_allocated);
+        stats->rbufs_loaned += STATS_LOAD(ts->rbufs_loaned);
+        stats->rbufs_existing += STATS_LOAD(ts->rbufs_existing);
+        stats->wbufs_allocated += STATS_LOAD(ts->wbufs_allocated);
+        stats->wbufs_loaned += STATS_LOAD(ts->wbufs_loaned);
+
+        high = STATS_LOAD(ts->iovused_high_watermark);
+        if (high > stats->iovused_high_watermark) {
+            stats->iovused_high_watermark = high;
         }
-        if (thread_stats[ii].msgused_high_watermark > stats->msgused_high_watermark) {
-            stats->msgused_high_watermark = thread_stats[ii].msgused_high_watermark;
+        high = STATS_LOAD(ts->msgused_high_watermark);
+        if (high > stats->msgused_high_watermark) {
+            stats->msgused_high_watermark = high;
         }
 
         for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             stats->slab_stats[sid].cmd_set +=
-                thread_stats[ii].slab_stats[sid].cmd_set;
+                STATS_LOAD(ts->slab_stats[sid].cmd_set);
             stats->slab_stats[sid].get_hits +=
-                thread_stats[ii].slab_stats[sid].get_hits;
+                STATS_LOAD(ts->slab_stats[sid].get_hits);
             stats->slab_stats[sid].delete_hits +=
-                thread_stats[ii].slab_stats[sid].delete_hits;
+                STATS_LOAD(ts->slab_stats[sid].delete_hits);
             stats->slab_stats[sid].cas_hits +=
-                thread_stats[ii].slab_stats[sid].cas_hits;
+                STATS_LOAD(ts->slab_stats[sid].cas_hits);
             stats->slab_stats[sid].cas_badval +=
-                thread_stats[ii].slab_stats[sid].cas_badval;
+                STATS_LOAD(ts->slab_stats[sid].cas_badval);
         }
-
-        cb_mutex_exit(&thread_stats[ii].mutex);
     }
 }
 
@@ -635,8 +1136,9 @@ void thread_init(int nthr, struct event_base *main_base,
     cb_mutex_initialize(&init_lock);
     cb_cond_initialize(&init_cond);
 
+    load_samples = calloc(nthr, sizeof(*load_samples));
     threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
-    if (! threads) {
+    if (! threads || ! load_samples) {
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
                                         "Can't allocate thread descriptors: %s",
                                         strerror(errno));
@@ -653,9 +1155,15 @@ void thread_init(int nthr, struct event_base *main_base,
     setup_dispatcher(main_base, dispatcher_callback);
 
     for (i = 0; i < nthreads; i++) {
+#ifdef HAVE_SYS_EVENTFD_H
+        if (!create_notification_eventfd(&threads[i])) {
+            exit(1);
+        }
+#else
         if (!create_notification_pipe(&threads[i])) {
             exit(1);
         }
+#endif
         threads[i].index = i;
 
         setup_thread(&threads[i]);
@@ -690,23 +1198,50 @@ void threads_cleanup(void)
     for (ii = 0; ii < nthreads; ++ii) {
         CQ_ITEM *it;
 
+        if (threads[ii].notify[1] != threads[ii].notify[0]) {
+            safe_close(threads[ii].notify[1]);
+        }
         safe_close(threads[ii].notify[0]);
-        safe_close(threads[ii].notify[1]);
         event_base_free(threads[ii].base);
+        io_notify_queue_destroy(threads[ii].io_notify);
+        uring_destroy(threads[ii].uring);
 
         while ((it = cq_pop(threads[ii].new_conn_queue)) != NULL) {
             cqi_free(it);
         }
         free(threads[ii].new_conn_queue);
-        free(threads[ii].read.buf);
+        free(threads[ii].acceptors);
+        rbuf_pool_destroy(&threads[ii].rbufs);
         free(threads[ii].write.buf);
     }
 
     free(thread_ids);
     free(threads);
+    free(load_samples);
 }
 
 void notify_thread(LIBEVENT_THREAD *thread) {
+    if (thread->type == GENERAL) {
+        /*
+         * The worker looks at all of its queues when it wakes up, so
+         * there's no need to notify it again until it did.
+         */
+        if (!io_notify_arm(thread->io_notify)) {
+            return;
+        }
+#ifdef HAVE_SYS_EVENTFD_H
+        {
+            uint64_t value = 1;
+            if (write(thread->notify[1], &value, sizeof(value)) == -1) {
+                settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                                "Failed to notify thread: %s",
+                                                strerror(errno));
+            }
+            return;
+        }
+#endif
+    }
+
     if (send(thread->notify[1], "", 1, 0) != 1) {
         log_socket_error(EXTENSION_LOG_WARNING, NULL,
                          "Failed to notify thread: %s");
@@ -0,0 +1,358 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+#include "config.h"
+#include "memcached.h"
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+/* The syscall numbers are the same on all architectures */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+struct uring {
+    int fd;
+    SOCKET eventfd;
+
+    /* The submission queue, shared with the kernel */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    /* The completion queue, shared with the kernel */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    unsigned int cq_entries;
+    struct io_uring_cqe *cqes;
+
+    unsigned int unsubmitted; /* queued, but not passed to the kernel */
+    unsigned int inflight;    /* queued, but not yet reaped */
+};
+
+static int sys_io_uring_setup(unsigned int entries,
+                              struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+                                 unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_log_error(const char *what) {
+    settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                    "io_uring: %s: %s", what,
+                                    strerror(errno));
+}
+
+/* Check that the kernel knows about all of the requests we use */
+static bool uring_probe(URING *ring) {
+    const size_t len = sizeof(struct io_uring_probe) +
+        256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    bool ret = false;
+
+    if (probe == NULL) {
+        return false;
+    }
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe,
+                              256) == -1) {
+        uring_log_error("Failed to probe for supported requests");
+    } else if (probe->last_op < IORING_OP_SENDMSG ||
+               (probe->ops[IORING_OP_SENDMSG].flags &
+                IO_URING_OP_SUPPORTED) == 0) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "io_uring: sendmsg not supported");
+    } else {
+        ret = true;
+    }
+
+    free(probe);
+    return ret;
+}
+
+URING *uring_create(unsigned int entries) {
+    struct io_uring_params params;
+    URING *ring = calloc(1, sizeof(*ring));
+    void *ptr;
+
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->eventfd = INVALID_SOCKET;
+
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = sys_io_uring_setup(entries, &params)) == -1) {
+        uring_log_error("Failed to create ring");
+        free(ring);
+        return NULL;
+    }
+
+    if ((params.features & IORING_FEAT_NODROP) == 0 || !uring_probe(ring)) {
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                        "io_uring: The kernel is too old");
+        uring_destroy(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_size = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned int);
+    ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        uring_log_error("Failed to map the submission queue");
+        uring_destroy(ring);
+        return NULL;
+    }
+    ring->sq_ring = ptr;
+    ring->sq_head = (unsigned int*)((char*)ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)ptr + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int*)((char*)ptr + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned int*)((char*)ptr + params.sq_off.array);
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        uring_log_error("Failed to map the submission entries");
+        uring_destroy(ring);
+        return NULL;
+    }
+    ring->sqes = ptr;
+
+    ring->cq_ring_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED) {
+        uring_log_error("Failed to map the completion queue");
+        uring_destroy(ring);
+        return NULL;
+    }
+    ring->cq_ring = ptr;
+    ring->cq_head = (unsigned int*)((char*)ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)ptr + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int*)((char*)ptr + params.cq_off.ring_mask);
+    ring->cq_entries = params.cq_entries;
+    ring->cqes = (struct io_uring_cqe*)((char*)ptr + params.cq_off.cqes);
+
+    ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->eventfd == INVALID_SOCKET) {
+        uring_log_error("Failed to create eventfd");
+        uring_destroy(ring);
+        return NULL;
+    }
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_EVENTFD,
+                              &ring->eventfd, 1) == -1) {
+        uring_log_error("Failed to register eventfd");
+        uring_destroy(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void uring_destroy(URING *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    if (ring->cq_ring != NULL) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->eventfd != INVALID_SOCKET) {
+        close(ring->eventfd);
+    }
+    close(ring->fd);
+    free(ring);
+}
+
+SOCKET uring_eventfd(URING *ring) {
+    return ring->eventfd;
+}
+
+bool uring_prep_sendmsg(URING *ring, SOCKET sfd, struct msghdr *msg,
+                        int flags, void *data) {
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index;
+    struct io_uring_sqe *sqe;
+
+    /*
+     * Don't queue more requests than we have room for completions, so
+     * that the kernel never has to hold on to them for us
+     */
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+        ring->sq_entries || ring->inflight >= ring->cq_entries) {
+        return false;
+    }
+
+    index = tail & ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sfd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = (uint64_t)(uintptr_t)data;
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->unsubmitted;
+    ++ring->inflight;
+    return true;
+}
+
+unsigned int uring_unsubmitted(URING *ring) {
+    return ring->unsubmitted;
+}
+
+bool uring_submit(URING *ring) {
+    while (ring->unsubmitted > 0) {
+        int ret = sys_io_uring_enter(ring->fd, ring->unsubmitted, 0, 0);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                /* The kernel is short on resources, try again later */
+                return true;
+            }
+            ret = errno;
+            uring_log_error("Failed to submit requests");
+            errno = ret;
+            return false;
+        }
+        ring->unsubmitted -= ret;
+    }
+
+    return true;
+}
+
+bool uring_unqueue(URING *ring, void **data) {
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index;
+
+    if (ring->unsubmitted == 0) {
+        return false;
+    }
+
+    /*
+     * The kernel only looks at the submission queue from within
+     * io_uring_enter(), so it's safe to move the tail back over the
+     * entries it hasn't consumed yet.
+     */
+    --tail;
+    index = ring->sq_array[tail & ring->sq_mask];
+    *data = (void*)(uintptr_t)ring->sqes[index].user_data;
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    --ring->unsubmitted;
+    --ring->inflight;
+    return true;
+}
+
+bool uring_reap(URING *ring, void **data, int *res) {
+    unsigned int head = *ring->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    cqe = &ring->cqes[head & ring->cq_mask];
+    *data = (void*)(uintptr_t)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    --ring->inflight;
+    return true;
+}
+
+#else
+
+URING *uring_create(unsigned int entries) {
+    settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
+                                    "io_uring: Not supported on this platform");
+    return NULL;
+}
+
+void uring_destroy(URING *ring) {
+    cb_assert(ring == NULL);
+}
+
+SOCKET uring_eventfd(URING *ring) {
+    abort();
+}
+
+bool uring_prep_sendmsg(URING *ring, SOCKET sfd, struct msghdr *msg,
+                        int flags, void *data) {
+    abort();
+}
+
+unsigned int uring_unsubmitted(URING *ring) {
+    abort();
+}
+
+bool uring_submit(URING *ring) {
+    abort();
+}
+
+bool uring_unqueue(URING *ring, void **data) {
+    abort();
+}
+
+bool uring_reap(URING *ring, void **data, int *res) {
+    abort();
+}
+
+#endif
@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * A minimal io_uring submission/completion ring used by the worker threads
+ * to batch their sends (see settings.io_uring). It talks to the kernel
+ * directly so that we don't depend on liburing. A ring is only used by the
+ * thread which created it.
+ *
+ * On platforms without io_uring uring_create() always fails.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <memcached/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct uring URING;
+
+    /*
+     * Create a ring with room for the given number of submissions. Returns
+     * NULL (and logs why) if the kernel doesn't support what we need.
+     */
+    URING *uring_create(unsigned int entries);
+    void uring_destroy(URING *ring);
+
+    /* The eventfd the kernel signals when a request completes */
+    SOCKET uring_eventfd(URING *ring);
+
+    /*
+     * Queue a sendmsg (with the given flags) of the message (which must
+     * stay valid until it completes) on the socket. Returns false if there
+     * is no room for another request in the ring.
+     */
+    bool uring_prep_sendmsg(URING *ring, SOCKET sfd, struct msghdr *msg,
+                            int flags, void *data);
+
+    /* Number of requests queued but not yet submitted to the kernel */
+    unsigned int uring_unsubmitted(URING *ring);
+
+    /*
+     * Submit the queued requests. Returns false (with errno set) on
+     * failure. If the kernel is short on resources it returns true with
+     * some requests still unsubmitted, and the caller should try again
+     * later.
+     */
+    bool uring_submit(URING *ring);
+
+    /*
+     * Take back the most recently queued request which hasn't been
+     * submitted yet. Returns false if there are none, otherwise the data
+     * passed to uring_prep_sendmsg().
+     */
+    bool uring_unqueue(URING *ring, void **data);
+
+    /*
+     * Fetch the next completed request. Returns false if there are no
+     * completions, otherwise the data passed to uring_prep_sendmsg() and
+     * the result of the request (a negative errno on failure).
+     */
+    bool uring_reap(URING *ring, void **data, int *res);
+
+#ifdef __cplusplus
+}
+#endif
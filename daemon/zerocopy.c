@@ -0,0 +1,221 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+#include "config.h"
+#include "zerocopy.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
+/* How often we check if the kernel is done when closing a connection */
+#define ZEROCOPY_LINGER_USEC 10000
+
+/* Has the kernel completed the send with the given id? */
+static bool zerocopy_completed(conn *c, uint32_t id) {
+    return (int32_t)(c->zerocopy.completed - id) > 0;
+}
+
+bool zerocopy_wanted(conn *c, size_t nbytes) {
+#ifdef HAVE_ZEROCOPY
+    if (settings.zerocopy_threshold == 0 ||
+        nbytes < settings.zerocopy_threshold || c->ssl.enabled) {
+        return false;
+    }
+
+    if (!c->zerocopy.enabled) {
+        int flags = 1;
+        if (c->zerocopy.unsupported) {
+            return false;
+        }
+        if (setsockopt(c->sfd, SOL_SOCKET, SO_ZEROCOPY, (void *)&flags,
+                       sizeof(flags)) == -1) {
+            settings.extensions.logger->log(EXTENSION_LOG_DEBUG, c,
+                                            "%d: Zero copy sends not "
+                                            "supported: %s", c->sfd,
+                                            strerror(errno));
+            c->zerocopy.unsupported = true;
+            return false;
+        }
+        c->zerocopy.enabled = true;
+    }
+
+    /* Make sure we can hold on to the item once the response is sent */
+    if (c->zerocopy.nheld == c->zerocopy.size) {
+        int size = c->zerocopy.size ? c->zerocopy.size * 2 : 4;
+        struct zerocopy_item *held = realloc(c->zerocopy.held,
+                                             size * sizeof(*held));
+        if (held == NULL) {
+            return false;
+        }
+        c->zerocopy.held = held;
+        c->zerocopy.size = size;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+ssize_t zerocopy_sendmsg(conn *c, struct msghdr *m) {
+#ifdef HAVE_ZEROCOPY
+    ssize_t res = sendmsg(c->sfd, m, MSG_ZEROCOPY);
+    if (res > 0) {
+        /* The kernel numbers the sends which sent any data */
+        ++c->zerocopy.next;
+        c->zerocopy.sent = true;
+    } else if (res == -1 && errno == ENOBUFS) {
+        /* We hit the limit of pinned memory for the socket */
+        res = sendmsg(c->sfd, m, 0);
+    }
+    return res;
+#else
+    return sendmsg(c->sfd, m, 0);
+#endif
+}
+
+void zerocopy_release_item(conn *c, item *it) {
+    if (c->zerocopy.sent) {
+        struct zerocopy_item *held;
+
+        c->zerocopy.sent = false;
+        if (!zerocopy_completed(c, c->zerocopy.next - 1)) {
+            /* zerocopy_wanted() made room for it */
+            cb_assert(c->zerocopy.nheld < c->zerocopy.size);
+            held = c->zerocopy.held + c->zerocopy.nheld++;
+            held->it = it;
+            held->id = c->zerocopy.next - 1;
+            return;
+        }
+    }
+
+    settings.engine.v1->release(settings.engine.v0, c, it);
+}
+
+bool zerocopy_pending(conn *c) {
+    return c->zerocopy.completed != c->zerocopy.next;
+}
+
+void zerocopy_reap(conn *c) {
+#ifdef HAVE_ZEROCOPY
+    int ii, jj;
+
+    while (true) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->sfd, &msg, MSG_ERRQUEUE) == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_socket_error(EXTENSION_LOG_WARNING, c,
+                                 "Failed to read zero copy completions: %s");
+            }
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *err;
+
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                   cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 &&
+                   cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+                err->ee_errno != 0) {
+                continue;
+            }
+
+            /*
+             * The sends [ee_info, ee_data] completed. TCP completes the
+             * sends in order, so this continues where the last range
+             * ended (unless the kernel merged it with that).
+             */
+            if (!zerocopy_completed(c, err->ee_data)) {
+                c->zerocopy.completed = err->ee_data + 1;
+            }
+        }
+    }
+
+    /* Release the items the kernel is done with */
+    for (ii = jj = 0; ii < c->zerocopy.nheld; ++ii) {
+        struct zerocopy_item *held = c->zerocopy.held + ii;
+        if (zerocopy_completed(c, held->id)) {
+            settings.engine.v1->release(settings.engine.v0, c, held->it);
+        } else {
+            c->zerocopy.held[jj++] = *held;
+        }
+    }
+    c->zerocopy.nheld = jj;
+#endif
+}
+
+bool zerocopy_linger(conn *c) {
+    struct timeval tv = { 0, ZEROCOPY_LINGER_USEC };
+    struct event_base *base = c->event.ev_base;
+
+    if (c->item != NULL) {
+        zerocopy_release_item(c, c->item);
+        c->item = NULL;
+    }
+
+    if (c->zerocopy.nheld == 0) {
+        return false;
+    }
+
+    zerocopy_reap(c);
+    if (c->zerocopy.nheld == 0) {
+        return false;
+    }
+
+    /* Check again in a little while */
+    if (c->registered_in_libevent && !unregister_event(c)) {
+        return false;
+    }
+    event_set(&c->event, c->sfd, EV_PERSIST, event_handler, (void *)c);
+    event_base_set(base, &c->event);
+    c->ev_flags = EV_PERSIST;
+    if (!register_event(c, &tv)) {
+        /*
+         * We can't tell when the kernel is done with the items, so we
+         * must never release them
+         */
+        settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                        "%d: Leaking %d items sent without "
+                                        "copying", c->sfd, c->zerocopy.nheld);
+        c->zerocopy.nheld = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void zerocopy_destroy(conn *c) {
+    free(c->zerocopy.held);
+    c->zerocopy.held = NULL;
+    c->zerocopy.size = 0;
+}
@@ -0,0 +1,84 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+*     Copyright 2015 Couchbase, Inc
+*
+*   Licensed under the Apache License, Version 2.0 (the "License");
+*   you may not use this file except in compliance with the License.
+*   You may obtain a copy of the License at
+*
+*       http://www.apache.org/licenses/LICENSE-2.0
+*
+*   Unless required by applicable law or agreed to in writing, software
+*   distributed under the License is distributed on an "AS IS" BASIS,
+*   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*   See the License for the specific language governing permissions and
+*   limitations under the License.
+*/
+
+/*
+ * Sending large values straight from the item memory with MSG_ZEROCOPY
+ * (see settings.zerocopy_threshold).
+ *
+ * The kernel keeps using the item memory after sendmsg() returns, and
+ * tells us when it is done through the error queue of the socket. Until
+ * then we keep our reference to the item, so the engine can't free or
+ * reuse it.
+ */
+#pragma once
+
+#include "memcached.h"
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define HAVE_ZEROCOPY 1
+#else
+/* zerocopy_wanted() never lets anyone use it */
+#define MSG_ZEROCOPY 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* An item the kernel may still be sending from */
+    struct zerocopy_item {
+        item *it;
+        uint32_t id; /* the id of the last send using it */
+    };
+
+    /*
+     * Should a value of the given size be sent without copying it? Enables
+     * zero copy sends on the socket the first time.
+     */
+    bool zerocopy_wanted(conn *c, size_t nbytes);
+
+    /* Send the message with MSG_ZEROCOPY */
+    ssize_t zerocopy_sendmsg(conn *c, struct msghdr *m);
+
+    /*
+     * Release the item, or hold on to it until the kernel is done with it
+     * if it was sent without copying.
+     */
+    void zerocopy_release_item(conn *c, item *it);
+
+    /* Are there zero copy sends the kernel hasn't told us about yet? */
+    bool zerocopy_pending(conn *c);
+
+    /*
+     * Read the completions from the error queue of the socket, and release
+     * the items the kernel is done with.
+     */
+    void zerocopy_reap(conn *c);
+
+    /*
+     * Called when closing the connection. Returns true if the kernel still
+     * uses some of the items, and the connection must stay open for a
+     * while (it is run again by a timer).
+     */
+    bool zerocopy_linger(conn *c);
+
+    /* Free the zero copy state of the connection */
+    void zerocopy_destroy(conn *c);
+
+#ifdef __cplusplus
+}
+#endif
@@ -111,6 +111,12 @@ static ENGINE_ERROR_CODE bucket_get(ENGINE_HANDLE* handle,
                                     const void* key,
                                     const int nkey,
                                     uint16_t vbucket);
+static ENGINE_ERROR_CODE bucket_get_multi(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          const item_key *keys,
+                                          int nkeys,
+                                          item** items,
+                                          ENGINE_ERROR_CODE *status);
 static ENGINE_ERROR_CODE bucket_get_stats(ENGINE_HANDLE* handle,
                                           const void *cookie,
                                           const char *stat_key,
@@ -579,6 +585,7 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface,
     bucket_engine.engine.remove = bucket_item_delete;
     bucket_engine.engine.release = bucket_item_release;
     bucket_engine.engine.get = bucket_get;
+    bucket_engine.engine.get_multi = bucket_get_multi;
     bucket_engine.engine.store = bucket_store;
     bucket_engine.engine.arithmetic = bucket_arithmetic;
     bucket_engine.engine.flush = bucket_flush;
@@ -1761,6 +1768,41 @@ static ENGINE_ERROR_CODE bucket_get(ENGINE_HANDLE* handle,
     }
 }
 
+static ENGINE_ERROR_CODE bucket_get_multi(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          const item_key *keys,
+                                          int nkeys,
+                                          item** items,
+                                          ENGINE_ERROR_CODE *status) {
+    proxied_engine_handle_t *peh = get_engine_handle(handle, cookie);
+    if (peh) {
+        ENGINE_ERROR_CODE ret = ENGINE_ENOTSUP;
+        int ii;
+
+        /* Only look up the bucket once for the whole batch */
+        if (peh->pe.v1->get_multi) {
+            ret = peh->pe.v1->get_multi(peh->pe.v0, cookie, keys, nkeys,
+                                        items, status);
+        }
+
+        if (ret == ENGINE_SUCCESS) {
+            rel_time_t now = get_current_time();
+            for (ii = 0; ii < nkeys; ++ii) {
+                if (status[ii] == ENGINE_SUCCESS ||
+                    status[ii] == ENGINE_KEY_ENOENT) {
+                    topkeys_update(peh->topkeys, keys[ii].key, keys[ii].nkey,
+                                   now);
+                }
+            }
+        }
+
+        release_engine_handle(peh);
+        return ret;
+    } else {
+        return ENGINE_NO_BUCKET;
+    }
+}
+
 static void add_engine(const void *key, size_t nkey,
                        const void *val, size_t nval,
                        void *arg) {
@@ -9,201 +9,636 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <platform/platform.h>
 
 #include "default_engine_internal.h"
+#include "atomics.h"
 
 #define hashsize(n) ((size_t)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+#if defined(__GNUC__) || defined(__clang__)
+#define assoc_prefetch_address(p) __builtin_prefetch(p)
+#else
+#define assoc_prefetch_address(p) (void)(p)
+#endif
+
+/*
+ * Allocate a number of (zeroed) buckets aligned to a cache line. The
+ * pointer returned by calloc() is stored right in front of the buckets.
+ */
+static struct assoc_bucket *assoc_buckets_alloc(size_t count) {
+    char *mem = calloc(1, count * sizeof(struct assoc_bucket) +
+                       ASSOC_BUCKET_ALIGN + sizeof(void*));
+    uintptr_t aligned;
+
+    if (mem == NULL) {
+        return NULL;
+    }
+    aligned = ((uintptr_t)mem + sizeof(void*) + ASSOC_BUCKET_ALIGN - 1) &
+        ~(uintptr_t)(ASSOC_BUCKET_ALIGN - 1);
+    ((void**)aligned)[-1] = mem;
+    return (struct assoc_bucket *)aligned;
+}
+
+static void assoc_buckets_free(struct assoc_bucket *buckets) {
+    if (buckets != NULL) {
+        free(((void**)buckets)[-1]);
+    }
+}
+
+static struct assoc_bucket *assoc_overflow_alloc(struct default_engine *engine) {
+    struct assoc_bucket *bucket = assoc_buckets_alloc(1);
+    if (bucket != NULL) {
+        atomic_fetch_add_uint32(&engine->assoc.overflow_buckets, 1);
+    }
+    return bucket;
+}
+
+static void assoc_overflow_free(struct default_engine *engine,
+                                struct assoc_bucket *bucket) {
+    atomic_fetch_sub_uint32(&engine->assoc.overflow_buckets, 1);
+    assoc_buckets_free(bucket);
+}
+
+/* Free a table along with all of its overflow buckets */
+static void assoc_table_free(struct default_engine *engine,
+                             struct assoc_bucket *table, uint32_t power) {
+    size_t ii;
+
+    if (table == NULL) {
+        return;
+    }
+    for (ii = 0; ii < hashsize(power); ++ii) {
+        struct assoc_bucket *next = table[ii].next;
+        while (next != NULL) {
+            struct assoc_bucket *bucket = next;
+            next = bucket->next;
+            assoc_overflow_free(engine, bucket);
+        }
+    }
+    assoc_buckets_free(table);
+}
+
 ENGINE_ERROR_CODE assoc_init(struct default_engine *engine) {
-    engine->assoc.primary_hashtable = calloc(hashsize(engine->assoc.hashpower),
-                                             sizeof(hash_item*));
+    /* The buckets must never be shared between item locks */
+    cb_assert(ITEM_LOCK_POWER < engine->assoc.hashpower);
+    engine->assoc.minpower = engine->assoc.hashpower;
+    engine->assoc.primary_hashtable = assoc_buckets_alloc(hashsize(engine->assoc.hashpower));
     return (engine->assoc.primary_hashtable != NULL) ? ENGINE_SUCCESS : ENGINE_ENOMEM;
 }
 
 void assoc_destroy(struct default_engine *engine) {
-    while (engine->assoc.expanding) {
-#ifdef WIN32
-        Sleep(1);
-#else
-        usleep(250);
-#endif
-    }
-    free(engine->assoc.primary_hashtable);
+    /* The maintenance thread may have been stopped in the middle of a resize */
+    assoc_table_free(engine, engine->assoc.old_hashtable,
+                     engine->assoc.oldpower);
+    assoc_table_free(engine, engine->assoc.primary_hashtable,
+                     engine->assoc.hashpower);
 }
 
-hash_item *assoc_find(struct default_engine *engine, uint32_t hash, const char *key, const size_t nkey) {
-    hash_item *it;
+/*
+ * Get the bucket for a key. Must be called with the item lock for the
+ * key held, which keeps the key's old bucket from being migrated under
+ * us.
+ */
+static struct assoc_bucket *assoc_get_bucket(struct default_engine *engine,
+                                             uint32_t hash) {
     unsigned int oldbucket;
-    hash_item *ret = NULL;
-    int depth = 0;
 
-    if (engine->assoc.expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc.hashpower - 1))) >= engine->assoc.expand_bucket)
+    if (engine->assoc.resizing &&
+        (oldbucket = (hash & hashmask(engine->assoc.oldpower))) >= engine->assoc.migrate_bucket)
     {
-        it = engine->assoc.old_hashtable[oldbucket];
-    } else {
-        it = engine->assoc.primary_hashtable[hash & hashmask(engine->assoc.hashpower)];
+        return &engine->assoc.old_hashtable[oldbucket];
     }
+    return &engine->assoc.primary_hashtable[hash & hashmask(engine->assoc.hashpower)];
+}
+
+/*
+ * Find the slot holding a key. Must be called with the item lock for
+ * the key held.
+ *
+ * @return the slot number, or -1 if the key wasn't found
+ */
+static int assoc_find_slot(struct default_engine *engine, uint32_t hash,
+                           const char *key, const size_t nkey,
+                           struct assoc_bucket **bucket) {
+    const uint8_t tag = assoc_bucket_tag(hash);
+    struct assoc_bucket *b = assoc_get_bucket(engine, hash);
+    int depth = 0;
 
-    while (it) {
-        if ((nkey == it->nkey) && (memcmp(key, item_get_key(it), nkey) == 0)) {
-            ret = it;
-            break;
+    for (; b != NULL; b = b->next) {
+        uint64_t match = assoc_bucket_match(b->tags, tag);
+        while (match != 0) {
+            int slot = assoc_bucket_slot(match);
+            hash_item *it = b->slots[slot];
+            match &= match - 1;
+            if (it != NULL && nkey == it->nkey &&
+                memcmp(key, item_get_key(it), nkey) == 0) {
+                MEMCACHED_ASSOC_FIND(key, nkey, depth);
+                *bucket = b;
+                return slot;
+            }
+            ++depth;
         }
-        it = it->h_next;
-        ++depth;
     }
     MEMCACHED_ASSOC_FIND(key, nkey, depth);
-    return ret;
+    return -1;
 }
 
-/* returns the address of the item pointer before the key.  if *item == 0,
-   the item wasn't found */
+hash_item *assoc_find(struct default_engine *engine, uint32_t hash, const char *key, const size_t nkey) {
+    struct assoc_bucket *bucket;
+    int slot = assoc_find_slot(engine, hash, key, nkey, &bucket);
+    return (slot == -1) ? NULL : bucket->slots[slot];
+}
 
-static hash_item** _hashitem_before(struct default_engine *engine,
-                                    uint32_t hash,
-                                    const char *key,
-                                    const size_t nkey) {
-    hash_item **pos;
-    unsigned int oldbucket;
+/*
+ * Look up a key without holding the item lock. The caller must be in an
+ * epoch so that neither the items nor the table can be freed underneath
+ * it. The buckets are only modified with atomic stores: an item is
+ * stored in its slot before the tag is set, and the tag is cleared
+ * before the slot, so the lookup sees every insert, delete or replace
+ * either before or after it happened. Items are moved between the
+ * buckets while the table is resized, so lookups during the resize have
+ * to hold the item lock.
+ *
+ * The maintenance thread sets the resizing flag before it touches the
+ * table or the hashpower, so if the flag is clear both before and after
+ * we read them they belong together.
+ *
+ * @return false if the lookup must be done with the item lock held
+ */
+bool assoc_find_lockfree(struct default_engine *engine, uint32_t hash,
+                         const char *key, const size_t nkey,
+                         hash_item **item) {
+    const uint8_t tag = assoc_bucket_tag(hash);
+    struct assoc_bucket *table;
+    struct assoc_bucket *b;
+    uint32_t hashpower;
 
-    if (engine->assoc.expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc.hashpower - 1))) >= engine->assoc.expand_bucket)
-    {
-        pos = &engine->assoc.old_hashtable[oldbucket];
-    } else {
-        pos = &engine->assoc.primary_hashtable[hash & hashmask(engine->assoc.hashpower)];
+    if (atomic_load_bool(&engine->assoc.resizing)) {
+        return false;
+    }
+    table = atomic_load_ptr((void**)&engine->assoc.primary_hashtable);
+    hashpower = atomic_load_uint32(&engine->assoc.hashpower);
+    if (atomic_load_bool(&engine->assoc.resizing)) {
+        return false;
     }
 
-    while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, item_get_key(*pos), nkey))) {
-        pos = &(*pos)->h_next;
+    for (b = &table[hash & hashmask(hashpower)]; b != NULL;
+         b = atomic_load_ptr((void**)&b->next)) {
+        uint64_t match = assoc_bucket_match(atomic_load_uint64(&b->tags), tag);
+        while (match != 0) {
+            hash_item *it = atomic_load_ptr((void**)&b->slots[assoc_bucket_slot(match)]);
+            match &= match - 1;
+            if (it != NULL && nkey == it->nkey &&
+                memcmp(key, item_get_key(it), nkey) == 0) {
+                *item = it;
+                return true;
+            }
+        }
     }
-    return pos;
+    *item = NULL;
+    return true;
 }
 
-static void assoc_maintenance_thread(void *arg);
+void assoc_prefetch(struct default_engine *engine, uint32_t hash) {
+    struct assoc_bucket *table;
+    uint32_t hashpower;
 
-/* grows the hashtable to the next power of 2. */
-static void assoc_expand(struct default_engine *engine) {
-    engine->assoc.old_hashtable = engine->assoc.primary_hashtable;
+    /* This is only a hint, so a stale table doesn't matter */
+    table = atomic_load_ptr((void**)&engine->assoc.primary_hashtable);
+    hashpower = atomic_load_uint32(&engine->assoc.hashpower);
+    if (table != NULL) {
+        assoc_prefetch_address(&table[hash & hashmask(hashpower)]);
+    }
+}
 
-    engine->assoc.primary_hashtable = calloc(hashsize(engine->assoc.hashpower + 1),
-                                             sizeof(hash_item *));
-    if (engine->assoc.primary_hashtable) {
-        int ret = 0;
-        cb_thread_t tid;
-
-        engine->assoc.hashpower++;
-        engine->assoc.expanding = true;
-        engine->assoc.expand_bucket = 0;
-
-        /* start a thread to do the expansion */
-        if ((ret = cb_create_thread(&tid, assoc_maintenance_thread, engine, 1)) != 0)
-        {
-            EXTENSION_LOGGER_DESCRIPTOR *logger;
-            logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
-            logger->log(EXTENSION_LOG_WARNING, NULL,
-                        "Can't create thread: %s\n", strerror(ret));
-            engine->assoc.hashpower--;
-            engine->assoc.expanding = false;
-            free(engine->assoc.primary_hashtable);
-            engine->assoc.primary_hashtable =engine->assoc.old_hashtable;
+/*
+ * Put an item in the first free slot of a bucket (or its overflow
+ * buckets). The overflow bucket is taken from the spare list if there
+ * is one, and allocated otherwise.
+ *
+ * @return false if we failed to allocate an overflow bucket
+ */
+static bool assoc_bucket_insert(struct default_engine *engine,
+                                struct assoc_bucket *bucket,
+                                uint8_t tag, hash_item *it,
+                                struct assoc_bucket **spare) {
+    for (;;) {
+        uint64_t tags = bucket->tags;
+        uint64_t empty = assoc_bucket_match(tags, 0);
+        if (empty != 0) {
+            int slot = assoc_bucket_slot(empty);
+            atomic_store_ptr((void**)&bucket->slots[slot], it);
+            atomic_store_uint64(&bucket->tags,
+                                tags | ((uint64_t)tag << (slot * 8)));
+            return true;
         }
-    } else {
-        engine->assoc.primary_hashtable = engine->assoc.old_hashtable;
-        /* Bad news, but we can keep running. */
+
+        if (bucket->next == NULL) {
+            struct assoc_bucket *next;
+            if (spare != NULL && *spare != NULL) {
+                next = *spare;
+                *spare = next->next;
+                next->next = NULL;
+            } else if ((next = assoc_overflow_alloc(engine)) == NULL) {
+                return false;
+            }
+            atomic_store_ptr((void**)&bucket->next, next);
+        }
+        bucket = bucket->next;
+    }
+}
+
+/*
+ * Should the table be resized? The table grows when there are more than
+ * 3 items per bucket (half of the slots), and shrinks (down to the size
+ * it was created with) when there are less than 1 per 4 buckets. Must be
+ * called with assoc.lock held.
+ *
+ * @return 1 to grow, -1 to shrink or 0 to leave the table alone
+ */
+static int assoc_wanted_resize(struct default_engine *engine) {
+    uint32_t hashpower = atomic_load_uint32(&engine->assoc.hashpower);
+    size_t size = hashsize(hashpower);
+
+    if (engine->assoc.hash_items > size * 3) {
+        return 1;
+    }
+    if (hashpower > engine->assoc.minpower &&
+        engine->assoc.hash_items < size / 4) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Update the number of items in the table, and wake up the maintenance
+ * thread if the table should be resized.
+ */
+static unsigned int assoc_adjust_items(struct default_engine *engine,
+                                       int delta) {
+    unsigned int hash_items;
+
+    cb_mutex_enter(&engine->assoc.lock);
+    hash_items = engine->assoc.hash_items += delta;
+    if (!engine->assoc.maintenance.requested &&
+        assoc_wanted_resize(engine) != 0) {
+        engine->assoc.maintenance.requested = true;
+        cb_cond_signal(&engine->assoc.maintenance.cond);
     }
+    cb_mutex_exit(&engine->assoc.lock);
+
+    return hash_items;
 }
 
 /* Note: this isn't an assoc_update.  The key must not already exist to call this */
 int assoc_insert(struct default_engine *engine, uint32_t hash, hash_item *it) {
-    unsigned int oldbucket;
+    unsigned int hash_items;
 
     cb_assert(assoc_find(engine, hash, item_get_key(it), it->nkey) == 0);  /* shouldn't have duplicately named things defined */
 
-    if (engine->assoc.expanding &&
-        (oldbucket = (hash & hashmask(engine->assoc.hashpower - 1))) >= engine->assoc.expand_bucket)
-    {
-        it->h_next = engine->assoc.old_hashtable[oldbucket];
-        engine->assoc.old_hashtable[oldbucket] = it;
-    } else {
-        it->h_next = engine->assoc.primary_hashtable[hash & hashmask(engine->assoc.hashpower)];
-        engine->assoc.primary_hashtable[hash & hashmask(engine->assoc.hashpower)] = it;
-    }
-
-    engine->assoc.hash_items++;
-    if (! engine->assoc.expanding && engine->assoc.hash_items > (hashsize(engine->assoc.hashpower) * 3) / 2) {
-        assoc_expand(engine);
+    if (!assoc_bucket_insert(engine, assoc_get_bucket(engine, hash),
+                             assoc_bucket_tag(hash), it, NULL)) {
+        return 0;
     }
 
-    MEMCACHED_ASSOC_INSERT(item_get_key(it), it->nkey, engine->assoc.hash_items);
+    hash_items = assoc_adjust_items(engine, 1);
+    MEMCACHED_ASSOC_INSERT(item_get_key(it), it->nkey, hash_items);
     return 1;
 }
 
 void assoc_delete(struct default_engine *engine, uint32_t hash, const char *key, const size_t nkey) {
-    hash_item **before = _hashitem_before(engine, hash, key, nkey);
+    struct assoc_bucket *bucket;
+    int slot = assoc_find_slot(engine, hash, key, nkey, &bucket);
 
-    if (*before) {
-        hash_item *nxt;
-        engine->assoc.hash_items--;
+    if (slot != -1) {
+        unsigned int hash_items = assoc_adjust_items(engine, -1);
         /* The DTrace probe cannot be triggered as the last instruction
          * due to possible tail-optimization by the compiler
          */
-        MEMCACHED_ASSOC_DELETE(key, nkey, engine->assoc.hash_items);
-        nxt = (*before)->h_next;
-        (*before)->h_next = 0;   /* probably pointless, but whatever. */
-        *before = nxt;
+        MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
+        /*
+         * Clear the tag before the slot, so that item_get() never sees
+         * the tag of a slot which has been reused for another key. The
+         * empty overflow buckets are kept until the next resize.
+         */
+        atomic_store_uint64(&bucket->tags,
+                            bucket->tags & ~((uint64_t)0xff << (slot * 8)));
+        atomic_store_ptr((void**)&bucket->slots[slot], NULL);
         return;
     }
     /* Note:  we never actually get here.  the callers don't delete things
        they can't find. */
-    cb_assert(*before != 0);
+    cb_assert(slot != -1);
 }
 
+/*
+ * Replace an item in the hash table with a new item with the same key.
+ * This is done in a single store so that item_get() can't miss the key
+ * between the delete and insert.
+ */
+void assoc_replace(struct default_engine *engine, uint32_t hash,
+                   hash_item *old_it, hash_item *new_it) {
+    struct assoc_bucket *bucket;
+    int slot = assoc_find_slot(engine, hash, item_get_key(old_it),
+                               old_it->nkey, &bucket);
+    cb_assert(slot != -1 && bucket->slots[slot] == old_it);
+    atomic_store_ptr((void**)&bucket->slots[slot], new_it);
+}
 
+/*
+ * Move the items in a bucket of the old table (and its overflow buckets)
+ * over to the new table. Must be called with the item lock for the
+ * bucket held.
+ *
+ * The emptied overflow buckets are put on the spare list, and used for
+ * the overflow buckets needed in the new table. The items in an old
+ * bucket never need more overflow buckets in the new table than they
+ * had in the old one, plus one when two old buckets are merged by a
+ * shrink, so the caller makes sure that there's a spare bucket before
+ * calling this. That way we never allocate memory (and never fail)
+ * while holding the item lock.
+ */
+static void assoc_migrate_bucket(struct default_engine *engine,
+                                 struct assoc_bucket *bucket,
+                                 struct assoc_bucket **spare) {
+    const uint32_t newpower = engine->assoc.hashpower;
+    struct assoc_bucket *next = bucket->next;
+    struct assoc_bucket *b;
 
-#define DEFAULT_HASH_BULK_MOVE 1
-int hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
-
-static void assoc_maintenance_thread(void *arg) {
-    struct default_engine *engine = arg;
-    bool done = false;
-    do {
+    for (b = bucket; b != NULL; b = next) {
+        hash_item *items[ASSOC_BUCKET_SLOTS];
         int ii;
-        cb_mutex_enter(&engine->cache_lock);
 
-        for (ii = 0; ii < hash_bulk_move && engine->assoc.expanding; ++ii) {
-            hash_item *it, *next;
-            int bucket;
+        next = b->next;
+        memcpy(items, b->slots, sizeof(items));
+        memset(b, 0, sizeof(*b));
+        if (b != bucket) {
+            b->next = *spare;
+            *spare = b;
+        }
 
-            for (it = engine->assoc.old_hashtable[engine->assoc.expand_bucket];
-                 NULL != it; it = next) {
-                next = it->h_next;
+        for (ii = 0; ii < ASSOC_BUCKET_SLOTS; ++ii) {
+            uint32_t hash;
+            bool inserted;
 
-                bucket = engine->server.core->hash(item_get_key(it), it->nkey, 0)
-                    & hashmask(engine->assoc.hashpower);
-                it->h_next = engine->assoc.primary_hashtable[bucket];
-                engine->assoc.primary_hashtable[bucket] = it;
+            if (items[ii] == NULL) {
+                continue;
             }
+            hash = engine->server.core->hash(item_get_key(items[ii]),
+                                             items[ii]->nkey, 0);
+            inserted = assoc_bucket_insert(engine,
+                                           &engine->assoc.primary_hashtable[hash & hashmask(newpower)],
+                                           assoc_bucket_tag(hash), items[ii],
+                                           spare);
+            cb_assert(inserted);
+        }
+    }
+}
+
+/*
+ * Move all of the items in the old table over to the new one.
+ *
+ * The item lock for a key is selected by the low bits of its hash, and
+ * there are fewer item locks than buckets in either table. All of the
+ * keys in an old bucket (and the new bucket(s) they end up in) are
+ * therefore protected by the same item lock, so the buckets may be
+ * migrated one at a time while the rest of the table is in use. The
+ * buckets are migrated in slices of hash_bulk_move buckets, and the
+ * thread sleeps for hash_bulk_sleep microseconds between the slices.
+ *
+ * @return false if the migration was cut short by a shutdown
+ */
+static bool assoc_migrate(struct default_engine *engine) {
+    const unsigned int oldsize = (unsigned int)hashsize(engine->assoc.oldpower);
+    size_t bulk_move = engine->config.hash_bulk_move;
+    struct assoc_bucket *spare = NULL;
+    unsigned int bucket = 0;
+    bool shutdown = false;
 
-            engine->assoc.old_hashtable[engine->assoc.expand_bucket] = NULL;
-            engine->assoc.expand_bucket++;
-            if (engine->assoc.expand_bucket == hashsize(engine->assoc.hashpower - 1)) {
-                engine->assoc.expanding = false;
-                free(engine->assoc.old_hashtable);
-                if (engine->config.verbose > 1) {
-                    EXTENSION_LOGGER_DESCRIPTOR *logger;
-                    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
-                    logger->log(EXTENSION_LOG_INFO, NULL,
-                                "Hash table expansion done\n");
-                }
+    if (bulk_move == 0) {
+        bulk_move = 1;
+    }
+
+    while (bucket < oldsize && !shutdown) {
+        unsigned int end = bucket + (unsigned int)bulk_move;
+        if (end > oldsize || end < bucket) {
+            end = oldsize;
+        }
+
+        for (; bucket < end; ++bucket) {
+            if (spare == NULL && (spare = assoc_overflow_alloc(engine)) == NULL) {
+                /* Wait for some memory to become available */
+                break;
+            }
+
+            item_lock(engine, bucket);
+            assoc_migrate_bucket(engine, &engine->assoc.old_hashtable[bucket],
+                                 &spare);
+            engine->assoc.migrate_bucket = bucket + 1;
+            item_unlock(engine, bucket);
+        }
+
+        cb_mutex_enter(&engine->assoc.lock);
+        engine->assoc.maintenance.migrated = bucket;
+        shutdown = engine->assoc.maintenance.shutdown;
+        cb_mutex_exit(&engine->assoc.lock);
+
+        if (bucket < oldsize && !shutdown) {
+            /* Back off for a while if we ran out of memory */
+            size_t sleeptime = (bucket < end) ? 1000 : engine->config.hash_bulk_sleep;
+            if (sleeptime != 0) {
+#ifdef WIN32
+                Sleep((DWORD)(sleeptime / 1000));
+#else
+                usleep((useconds_t)sleeptime);
+#endif
             }
         }
-        if (!engine->assoc.expanding) {
-            done = true;
+    }
+
+    while (spare != NULL) {
+        struct assoc_bucket *next = spare->next;
+        assoc_overflow_free(engine, spare);
+        spare = next;
+    }
+
+    return !shutdown;
+}
+
+/*
+ * Resize the table to 2^newpower buckets. The foreground keeps using the
+ * table while the buckets are migrated.
+ *
+ * @return false if the new table couldn't be allocated
+ */
+static bool assoc_resize(struct default_engine *engine, uint32_t newpower) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    struct assoc_bucket *new_table;
+    bool grow = newpower > engine->assoc.hashpower;
+
+    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+    new_table = assoc_buckets_alloc(hashsize(newpower));
+    if (new_table == NULL) {
+        /* Bad news, but we can keep running. */
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Failed to allocate a hash table with 2^%u buckets\n",
+                    newpower);
+        return false;
+    }
+
+    item_lock_all(engine);
+    /* See assoc_find_lockfree() for the order of these */
+    atomic_store_bool(&engine->assoc.resizing, true);
+    engine->assoc.old_hashtable = engine->assoc.primary_hashtable;
+    engine->assoc.oldpower = engine->assoc.hashpower;
+    engine->assoc.migrate_bucket = 0;
+    atomic_store_ptr((void**)&engine->assoc.primary_hashtable, new_table);
+    atomic_store_uint32(&engine->assoc.hashpower, newpower);
+    cb_mutex_enter(&engine->assoc.lock);
+    engine->assoc.maintenance.migrated = 0;
+    engine->assoc.maintenance.total = (unsigned int)hashsize(engine->assoc.oldpower);
+    cb_mutex_exit(&engine->assoc.lock);
+    item_unlock_all(engine);
+
+    /* Wait for the lock-free readers still walking the old table */
+    epoch_synchronize(&engine->epoch);
+
+    if (!assoc_migrate(engine)) {
+        /* assoc_destroy() takes care of both tables */
+        return true;
+    }
+
+    /*
+     * No lock-free reader has looked at the old table since the
+     * epoch_synchronize(), so it may be freed right away.
+     */
+    item_lock_all(engine);
+    atomic_store_bool(&engine->assoc.resizing, false);
+    assoc_table_free(engine, engine->assoc.old_hashtable,
+                     engine->assoc.oldpower);
+    engine->assoc.old_hashtable = NULL;
+    item_unlock_all(engine);
+
+    cb_mutex_enter(&engine->assoc.lock);
+    if (grow) {
+        engine->assoc.maintenance.expansions++;
+    } else {
+        engine->assoc.maintenance.shrinks++;
+    }
+    cb_mutex_exit(&engine->assoc.lock);
+
+    if (engine->config.verbose > 1) {
+        logger->log(EXTENSION_LOG_INFO, NULL, "Hash table %s done\n",
+                    grow ? "expansion" : "shrink");
+    }
+    return true;
+}
+
+/*
+ * The maintenance thread lives as long as the engine, and resizes the
+ * table whenever assoc_adjust_items() finds that it is too small or too
+ * big.
+ */
+static void assoc_maintenance_thread(void *arg) {
+    struct default_engine *engine = arg;
+    bool resized;
+
+    cb_mutex_enter(&engine->assoc.lock);
+    while (!engine->assoc.maintenance.shutdown) {
+        int delta = assoc_wanted_resize(engine);
+        if (delta == 0) {
+            engine->assoc.maintenance.requested = false;
+            cb_cond_wait(&engine->assoc.maintenance.cond, &engine->assoc.lock);
+            continue;
+        }
+
+        engine->assoc.maintenance.requested = true;
+        cb_mutex_exit(&engine->assoc.lock);
+        resized = assoc_resize(engine, engine->assoc.hashpower + delta);
+        cb_mutex_enter(&engine->assoc.lock);
+
+        if (!resized && !engine->assoc.maintenance.shutdown) {
+            /* Try again when the table has changed some more */
+            engine->assoc.maintenance.requested = false;
+            cb_cond_wait(&engine->assoc.maintenance.cond, &engine->assoc.lock);
         }
-        cb_mutex_exit(&engine->cache_lock);
-    } while (!done);
+    }
+    cb_mutex_exit(&engine->assoc.lock);
+}
+
+int start_assoc_maintenance_thread(struct default_engine *engine) {
+    int ret;
+
+    cb_mutex_enter(&engine->assoc.lock);
+    engine->assoc.maintenance.shutdown = false;
+    ret = cb_create_thread(&engine->assoc.maintenance.tid,
+                           assoc_maintenance_thread, engine, 0);
+    engine->assoc.maintenance.started = (ret == 0);
+    cb_mutex_exit(&engine->assoc.lock);
+
+    if (ret != 0) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Can't create thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void stop_assoc_maintenance_thread(struct default_engine *engine) {
+    bool started;
+
+    cb_mutex_enter(&engine->assoc.lock);
+    started = engine->assoc.maintenance.started;
+    engine->assoc.maintenance.shutdown = true;
+    engine->assoc.maintenance.started = false;
+    cb_cond_signal(&engine->assoc.maintenance.cond);
+    cb_mutex_exit(&engine->assoc.lock);
+
+    if (started) {
+        cb_join_thread(engine->assoc.maintenance.tid);
+    }
+}
+
+void assoc_stats(struct default_engine *engine,
+                 ADD_STAT add_stats, const void *cookie) {
+    const char *prefix = "hash";
+    const char *status = "idle";
+    uint32_t hashpower;
+    size_t bytes;
+
+    cb_mutex_enter(&engine->assoc.lock);
+    hashpower = atomic_load_uint32(&engine->assoc.hashpower);
+    bytes = (hashsize(hashpower) +
+             atomic_load_uint32(&engine->assoc.overflow_buckets)) *
+        sizeof(struct assoc_bucket);
+    if (atomic_load_bool(&engine->assoc.resizing)) {
+        status = (hashpower > engine->assoc.oldpower) ? "expanding" : "shrinking";
+        bytes += hashsize(engine->assoc.oldpower) * sizeof(struct assoc_bucket);
+    }
+
+    add_statistics(cookie, add_stats, prefix, -1, "status", "%s", status);
+    add_statistics(cookie, add_stats, prefix, -1, "power_level", "%u",
+                   hashpower);
+    add_statistics(cookie, add_stats, prefix, -1, "bytes", "%"PRIu64,
+                   (uint64_t)bytes);
+    add_statistics(cookie, add_stats, prefix, -1, "items", "%u",
+                   engine->assoc.hash_items);
+    add_statistics(cookie, add_stats, prefix, -1, "overflow_buckets", "%u",
+                   atomic_load_uint32(&engine->assoc.overflow_buckets));
+    if (atomic_load_bool(&engine->assoc.resizing)) {
+        add_statistics(cookie, add_stats, prefix, -1, "migrated_buckets",
+                       "%u", engine->assoc.maintenance.migrated);
+        add_statistics(cookie, add_stats, prefix, -1, "total_buckets",
+                       "%u", engine->assoc.maintenance.total);
+    }
+    add_statistics(cookie, add_stats, prefix, -1, "expansions", "%"PRIu64,
+                   engine->assoc.maintenance.expansions);
+    add_statistics(cookie, add_stats, prefix, -1, "shrinks", "%"PRIu64,
+                   engine->assoc.maintenance.shrinks);
+    cb_mutex_exit(&engine->assoc.lock);
 }
@@ -1,31 +1,62 @@
 #ifndef ASSOC_H
 #define ASSOC_H
 
+#include "assoc_bucket.h"
+
 struct assoc {
    /* how many powers of 2's worth of buckets we use */
-   unsigned int hashpower;
+   uint32_t hashpower;
 
+   /* The table is never shrunk below the size it was created with */
+   uint32_t minpower;
 
-   /* Main hash table. This is where we look except during expansion. */
-   hash_item** primary_hashtable;
+   /* Main hash table. This is where we look except during a resize. */
+   struct assoc_bucket *primary_hashtable;
 
    /*
-    * Previous hash table. During expansion, we look here for keys that haven't
-    * been moved over to the primary yet.
+    * Previous hash table. During a resize, we look here for keys that
+    * haven't been moved over to the primary yet.
     */
-   hash_item** old_hashtable;
+   struct assoc_bucket *old_hashtable;
+
+   /* how many powers of 2's worth of buckets the old table has */
+   uint32_t oldpower;
 
    /* Number of items in the hash table. */
    unsigned int hash_items;
 
-   /* Flag: Are we in the middle of expanding now? */
-   bool expanding;
+   /* Number of overflow buckets in use (must be modified atomically) */
+   uint32_t overflow_buckets;
+
+   /* Flag: Are we in the middle of a resize now? */
+   bool resizing;
 
    /*
-    * During expansion we migrate values with bucket granularity; this is how
-    * far we've gotten so far. Ranges from 0 .. hashsize(hashpower - 1) - 1.
+    * During a resize we migrate values with bucket granularity; this is
+    * how far we've gotten so far. Ranges from 0 .. hashsize(oldpower) - 1.
     */
-   unsigned int expand_bucket;
+   unsigned int migrate_bucket;
+
+   /*
+    * The hash chains are protected by the item locks. The rest of the
+    * members below are shared with the maintenance thread and protected
+    * by this lock.
+    */
+   cb_mutex_t lock;
+
+   struct {
+      cb_thread_t tid;
+      cb_cond_t cond;
+      bool started;
+      bool shutdown;
+      /* Flag: Has the maintenance thread been asked to resize the table? */
+      bool requested;
+      /* Progress of the current resize, for the stats */
+      unsigned int migrated;
+      unsigned int total;
+      uint64_t expansions;
+      uint64_t shrinks;
+   } maintenance;
 };
 
 /* associative array */
@@ -33,11 +64,20 @@ ENGINE_ERROR_CODE assoc_init(struct default_engine *engine);
 void assoc_destroy(struct default_engine *engine);
 hash_item *assoc_find(struct default_engine *engine, uint32_t hash,
                       const char *key, const size_t nkey);
+bool assoc_find_lockfree(struct default_engine *engine, uint32_t hash,
+                         const char *key, const size_t nkey,
+                         hash_item **item);
+/* Start loading the bucket of the hash into the CPU cache */
+void assoc_prefetch(struct default_engine *engine, uint32_t hash);
 int assoc_insert(struct default_engine *engine, uint32_t hash,
                  hash_item *item);
 void assoc_delete(struct default_engine *engine, uint32_t hash,
                   const char *key, const size_t nkey);
+void assoc_replace(struct default_engine *engine, uint32_t hash,
+                   hash_item *old_it, hash_item *new_it);
 int start_assoc_maintenance_thread(struct default_engine *engine);
 void stop_assoc_maintenance_thread(struct default_engine *engine);
+void assoc_stats(struct default_engine *engine,
+                 ADD_STAT add_stats, const void *cookie);
 
 #endif
@@ -0,0 +1,109 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * The layout of the buckets in the hash table.
+ *
+ * Each bucket fills a cache line (on 64 bit platforms) and holds up to
+ * ASSOC_BUCKET_SLOTS items. Next to the item pointers the bucket keeps
+ * a one byte fingerprint (tag) of the hash of each key, all packed into
+ * a single 64 bit word. A lookup compares the tag with all of the slots
+ * at once, and only looks at the items (and their keys) in the slots
+ * with a matching tag. Most lookups for a key which isn't there never
+ * leave the bucket's cache line.
+ *
+ * A bucket with all of its slots in use is continued in an overflow
+ * bucket.
+ */
+#ifndef ASSOC_BUCKET_H
+#define ASSOC_BUCKET_H
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSOC_BUCKET_SLOTS 6
+#define ASSOC_BUCKET_ALIGN 64
+
+struct _hash_item;
+
+struct assoc_bucket {
+    /* Byte n holds the tag of slots[n], or 0 if the slot is empty */
+    uint64_t tags;
+    struct _hash_item *slots[ASSOC_BUCKET_SLOTS];
+    struct assoc_bucket *next;
+};
+
+/* The top bit of the bytes which are in use in the tags word */
+#define ASSOC_BUCKET_SLOT_BITS 0x0000808080808080ULL
+#define ASSOC_BUCKET_LOW_BITS 0x0101010101010101ULL
+
+/**
+ * Get the tag for a key. The low bits of the hash select the bucket, so
+ * the tag is taken from the high bits. A tag is never 0, which marks an
+ * empty slot.
+ */
+static inline uint8_t assoc_bucket_tag(uint32_t hash) {
+    uint8_t tag = (uint8_t)(hash >> 24);
+    return tag ? tag : 1;
+}
+
+/**
+ * Find the slots with a given tag.
+ *
+ * @return a mask with the top bit set in the byte of each slot which
+ *         may hold the tag. The lowest slot in the mask is always a
+ *         match, but the ones above it may be false positives.
+ *         Passing a tag of 0 finds the empty slots.
+ */
+static inline uint64_t assoc_bucket_match(uint64_t tags, uint8_t tag) {
+    uint64_t x = tags ^ (ASSOC_BUCKET_LOW_BITS * tag);
+    return (x - ASSOC_BUCKET_LOW_BITS) & ~x & ASSOC_BUCKET_SLOT_BITS;
+}
+
+/**
+ * Get the slot number of the lowest slot in a mask returned by
+ * assoc_bucket_match(). The mask must not be 0.
+ */
+static inline int assoc_bucket_slot(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long bit;
+#ifdef _WIN64
+    _BitScanForward64(&bit, mask);
+#else
+    if (!_BitScanForward(&bit, (unsigned long)mask)) {
+        _BitScanForward(&bit, (unsigned long)(mask >> 32));
+        bit += 32;
+    }
+#endif
+    return (int)(bit >> 3);
+#else
+    return __builtin_ctzll(mask) >> 3;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+#include "atomics.h"
+
+#ifdef HAVE_ATOMIC
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
+/*
+ * The values live in structures shared with the C code, so we can't
+ * declare them as std::atomic. std::atomic<T> of the integral and
+ * pointer types used here has the same size and representation as T
+ * on all of the platforms we support.
+ */
+template <typename T>
+static inline std::atomic<T> *as_atomic(T *ptr) {
+    return reinterpret_cast<std::atomic<T> *>(ptr);
+}
+
+uint16_t atomic_load_uint16(uint16_t *ptr) {
+    return as_atomic(ptr)->load();
+}
+
+void atomic_store_uint16(uint16_t *ptr, uint16_t val) {
+    as_atomic(ptr)->store(val);
+}
+
+uint16_t atomic_fetch_add_uint16(uint16_t *ptr, uint16_t val) {
+    return as_atomic(ptr)->fetch_add(val);
+}
+
+uint16_t atomic_fetch_sub_uint16(uint16_t *ptr, uint16_t val) {
+    return as_atomic(ptr)->fetch_sub(val);
+}
+
+bool atomic_cas_uint16(uint16_t *ptr, uint16_t *expected, uint16_t desired) {
+    return as_atomic(ptr)->compare_exchange_strong(*expected, desired);
+}
+
+uint32_t atomic_load_uint32(uint32_t *ptr) {
+    return as_atomic(ptr)->load();
+}
+
+void atomic_store_uint32(uint32_t *ptr, uint32_t val) {
+    as_atomic(ptr)->store(val);
+}
+
+uint32_t atomic_fetch_add_uint32(uint32_t *ptr, uint32_t val) {
+    return as_atomic(ptr)->fetch_add(val);
+}
+
+uint32_t atomic_fetch_sub_uint32(uint32_t *ptr, uint32_t val) {
+    return as_atomic(ptr)->fetch_sub(val);
+}
+
+uint64_t atomic_load_uint64(uint64_t *ptr) {
+    return as_atomic(ptr)->load();
+}
+
+void atomic_store_uint64(uint64_t *ptr, uint64_t val) {
+    as_atomic(ptr)->store(val);
+}
+
+uint64_t atomic_fetch_add_uint64(uint64_t *ptr, uint64_t val) {
+    return as_atomic(ptr)->fetch_add(val);
+}
+
+uint64_t atomic_fetch_sub_uint64(uint64_t *ptr, uint64_t val) {
+    return as_atomic(ptr)->fetch_sub(val);
+}
+
+bool atomic_load_bool(bool *ptr) {
+    return as_atomic(ptr)->load();
+}
+
+void atomic_store_bool(bool *ptr, bool val) {
+    as_atomic(ptr)->store(val);
+}
+
+void *atomic_load_ptr(void **ptr) {
+    return as_atomic(ptr)->load();
+}
+
+void atomic_store_ptr(void **ptr, void *val) {
+    as_atomic(ptr)->store(val);
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * The default engine is written in C, so just like the daemon (see
+ * daemon/runtime.h) we use this little wrapper around std::atomic for
+ * the few places where we need atomic operations on plain memory. All
+ * of the operations are sequentially consistent.
+ */
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    uint16_t atomic_load_uint16(uint16_t *ptr);
+    void atomic_store_uint16(uint16_t *ptr, uint16_t val);
+    uint16_t atomic_fetch_add_uint16(uint16_t *ptr, uint16_t val);
+    uint16_t atomic_fetch_sub_uint16(uint16_t *ptr, uint16_t val);
+
+    /**
+     * Compare *ptr with *expected and replace it with desired if they
+     * are equal. Otherwise *expected is updated with the current value.
+     * @return true if the value was replaced
+     */
+    bool atomic_cas_uint16(uint16_t *ptr, uint16_t *expected,
+                           uint16_t desired);
+
+    uint32_t atomic_load_uint32(uint32_t *ptr);
+    void atomic_store_uint32(uint32_t *ptr, uint32_t val);
+    uint32_t atomic_fetch_add_uint32(uint32_t *ptr, uint32_t val);
+    uint32_t atomic_fetch_sub_uint32(uint32_t *ptr, uint32_t val);
+
+    uint64_t atomic_load_uint64(uint64_t *ptr);
+    void atomic_store_uint64(uint64_t *ptr, uint64_t val);
+    uint64_t atomic_fetch_add_uint64(uint64_t *ptr, uint64_t val);
+    uint64_t atomic_fetch_sub_uint64(uint64_t *ptr, uint64_t val);
+
+    bool atomic_load_bool(bool *ptr);
+    void atomic_store_bool(bool *ptr, bool val);
+
+    void *atomic_load_ptr(void **ptr);
+    void atomic_store_ptr(void **ptr, void *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,601 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * The DCP producer streaming the seqno logs (see dcp_producer.h)
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <platform/platform.h>
+#include <memcached/protocol_binary.h>
+
+#include "default_engine_internal.h"
+#include "atomics.h"
+
+static struct dcp_connection *dcp_get_connection(struct default_engine *engine,
+                                                 const void *cookie) {
+    return engine->server.cookie->get_engine_specific(cookie);
+}
+
+void dcp_producers_init(struct default_engine *engine) {
+    cb_mutex_initialize(&engine->dcp.lock);
+}
+
+static void dcp_free_streams(struct dcp_connection *connection) {
+    while (connection->streams != NULL) {
+        struct dcp_stream *stream = connection->streams;
+        connection->streams = stream->next;
+        free(stream);
+    }
+}
+
+void dcp_producers_destroy(struct default_engine *engine) {
+    /* The items they hold go away with the slabs */
+    while (engine->dcp.connections != NULL) {
+        struct dcp_connection *connection = engine->dcp.connections;
+        engine->dcp.connections = connection->next;
+        dcp_free_streams(connection);
+        free(connection);
+    }
+    cb_mutex_destroy(&engine->dcp.lock);
+}
+
+/* Drop the messages picked up for the current stream, but not yet sent */
+static void dcp_batch_release(struct default_engine *engine,
+                              struct dcp_connection *connection) {
+    while (connection->next_message < connection->nbatch) {
+        struct dcp_message *msg = &connection->batch[connection->next_message++];
+        if (msg->item != NULL) {
+            item_release(engine, msg->item);
+        }
+    }
+    connection->nbatch = connection->next_message = 0;
+    connection->marker = false;
+    connection->current = NULL;
+}
+
+static struct dcp_stream *dcp_find_stream(struct dcp_connection *connection,
+                                          uint16_t vbucket) {
+    struct dcp_stream *stream = connection->streams;
+    while (stream != NULL && stream->vbucket != vbucket) {
+        stream = stream->next;
+    }
+    return stream;
+}
+
+static void dcp_remove_stream(struct default_engine *engine,
+                              struct dcp_connection *connection,
+                              struct dcp_stream *stream) {
+    struct dcp_stream **prev = &connection->streams;
+
+    cb_mutex_enter(&engine->dcp.lock);
+    while (*prev != stream) {
+        prev = &(*prev)->next;
+    }
+    *prev = stream->next;
+    cb_mutex_exit(&engine->dcp.lock);
+
+    if (connection->current == stream) {
+        dcp_batch_release(engine, connection);
+    }
+    free(stream);
+}
+
+ENGINE_ERROR_CODE dcp_open(struct default_engine *engine, const void *cookie,
+                           uint32_t flags) {
+    struct dcp_connection *connection;
+
+    /* We've got nothing to consume the streams of other nodes with */
+    if (!engine->config.seqnos || (flags & DCP_OPEN_PRODUCER) == 0 ||
+        (flags & DCP_OPEN_NOTIFIER) != 0) {
+        return ENGINE_ENOTSUP;
+    }
+
+    if (dcp_get_connection(engine, cookie) != NULL) {
+        return ENGINE_EINVAL;
+    }
+
+    if ((connection = calloc(1, sizeof(*connection))) == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    connection->cookie = cookie;
+
+    cb_mutex_enter(&engine->dcp.lock);
+    connection->next = engine->dcp.connections;
+    engine->dcp.connections = connection;
+    cb_mutex_exit(&engine->dcp.lock);
+
+    engine->server.cookie->store_engine_specific(cookie, connection);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE dcp_stream_req(struct default_engine *engine,
+                                 const void *cookie,
+                                 uint32_t flags,
+                                 uint32_t opaque,
+                                 uint16_t vbucket,
+                                 uint64_t start_seqno,
+                                 uint64_t end_seqno,
+                                 uint64_t vbucket_uuid,
+                                 uint64_t snap_start_seqno,
+                                 uint64_t snap_end_seqno,
+                                 uint64_t *rollback_seqno,
+                                 dcp_add_failover_log callback) {
+    struct dcp_connection *connection = dcp_get_connection(engine, cookie);
+    struct vbucket_seqnos *vb;
+    struct dcp_stream *stream;
+    vbucket_failover_t entry;
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+
+    if (connection == NULL) {
+        return ENGINE_DISCONNECT;
+    }
+
+    if ((flags & DCP_ADD_STREAM_FLAG_TAKEOVER) != 0) {
+        return ENGINE_ENOTSUP;
+    }
+
+    if (start_seqno > end_seqno || snap_start_seqno > start_seqno ||
+        start_seqno > snap_end_seqno) {
+        return ENGINE_ERANGE;
+    }
+
+    if (dcp_find_stream(connection, vbucket) != NULL) {
+        return ENGINE_KEY_EEXISTS;
+    }
+
+    if ((vb = seqnos_vbucket(engine, vbucket, true)) == NULL) {
+        return ENGINE_ENOMEM;
+    }
+
+    /*
+     * The consumer may go on from where it is as long as the history it
+     * has is ours, and we still remember the deletions since. We have
+     * everything in memory, so a partial snapshot is fine.
+     */
+    cb_mutex_enter(&vb->lock);
+    if (start_seqno > 0 &&
+        (vbucket_uuid != vb->uuid || start_seqno < vb->purge_seqno)) {
+        *rollback_seqno = 0;
+        ret = ENGINE_ROLLBACK;
+    } else if (start_seqno > vb->high_seqno) {
+        *rollback_seqno = vb->high_seqno;
+        ret = ENGINE_ROLLBACK;
+    } else if ((flags & (DCP_ADD_STREAM_FLAG_LATEST |
+                         DCP_ADD_STREAM_FLAG_DISKONLY)) != 0) {
+        /* All we have "on disk" is what we have now */
+        end_seqno = vb->high_seqno;
+    }
+    entry.uuid = vb->uuid;
+    entry.seqno = vb->uuid_seqno;
+    cb_mutex_exit(&vb->lock);
+
+    if (ret != ENGINE_SUCCESS) {
+        return ret;
+    }
+
+    if ((stream = calloc(1, sizeof(*stream))) == NULL) {
+        return ENGINE_ENOMEM;
+    }
+    stream->opaque = opaque;
+    stream->vbucket = vbucket;
+    stream->uuid = entry.uuid;
+    stream->last_seqno = start_seqno;
+    stream->end_seqno = end_seqno;
+    stream->snap_end_seqno = start_seqno;
+
+    if ((ret = callback(&entry, 1, cookie)) != ENGINE_SUCCESS) {
+        free(stream);
+        return ret;
+    }
+
+    cb_mutex_enter(&engine->dcp.lock);
+    stream->next = connection->streams;
+    connection->streams = stream;
+    cb_mutex_exit(&engine->dcp.lock);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE dcp_close_stream(struct default_engine *engine,
+                                   const void *cookie,
+                                   uint16_t vbucket) {
+    struct dcp_connection *connection = dcp_get_connection(engine, cookie);
+    struct dcp_stream *stream;
+
+    if (connection == NULL) {
+        return ENGINE_DISCONNECT;
+    }
+
+    if ((stream = dcp_find_stream(connection, vbucket)) == NULL) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    dcp_remove_stream(engine, connection, stream);
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE dcp_get_failover_log(struct default_engine *engine,
+                                       const void *cookie,
+                                       uint16_t vbucket,
+                                       dcp_add_failover_log callback) {
+    struct vbucket_seqnos *vb;
+    vbucket_failover_t entry;
+
+    if (!engine->config.seqnos) {
+        return ENGINE_ENOTSUP;
+    }
+
+    if ((vb = seqnos_vbucket(engine, vbucket, true)) == NULL) {
+        return ENGINE_ENOMEM;
+    }
+
+    /* We only remember the history since the last flush */
+    cb_mutex_enter(&vb->lock);
+    entry.uuid = vb->uuid;
+    entry.seqno = vb->uuid_seqno;
+    cb_mutex_exit(&vb->lock);
+
+    return callback(&entry, 1, cookie);
+}
+
+/*
+ * Pick up the messages for the entries after the last seqno of the
+ * stream, up to the end of its snapshot (or until the batch is full).
+ * Called with the lock of the vBucket held, so we may only try to take
+ * the item locks. Returns true if we have to stop early as an item lock
+ * is busy, and sets batch_seqno to where the stream is at once the batch
+ * is sent.
+ */
+static bool dcp_stream_collect(struct default_engine *engine,
+                               struct dcp_connection *connection,
+                               struct dcp_stream *stream,
+                               const struct vbucket_seqnos *vb) {
+    size_t ii;
+
+    connection->nbatch = connection->next_message = 0;
+    connection->batch_seqno = stream->snap_end_seqno;
+
+    for (ii = seqnos_log_find(vb, stream->last_seqno); ii < vb->nlog; ++ii) {
+        const struct seqno_entry *entry = &vb->log[ii];
+        const uint64_t seqno = entry->seqno & ~SEQNO_ENTRY_DELETION;
+        struct dcp_message *msg = &connection->batch[connection->nbatch];
+
+        if (seqno > stream->snap_end_seqno) {
+            break;
+        }
+
+        if (connection->nbatch == DCP_STEP_BATCH) {
+            connection->batch_seqno = seqno - 1;
+            break;
+        }
+
+        if (entry->seqno & SEQNO_ENTRY_DELETION) {
+            const struct seqno_tombstone *tombstone = entry->u.tombstone;
+            msg->item = NULL;
+            msg->cas = tombstone->cas;
+            msg->nkey = tombstone->nkey;
+            memcpy(msg->key, tombstone->key, tombstone->nkey);
+        } else if (entry->u.item == NULL) {
+            /* Replaced, deleted, evicted or expired since */
+            continue;
+        } else {
+            switch (item_pin_seqno(engine, entry->u.item,
+                                   SEQNO_TAG(vb->id, seqno))) {
+            case ENGINE_SUCCESS:
+                msg->item = entry->u.item;
+                break;
+            case ENGINE_TMPFAIL:
+                connection->batch_seqno = seqno - 1;
+                return true;
+            default:
+                /* Replaced, deleted or expired since */
+                continue;
+            }
+        }
+        msg->seqno = seqno;
+        ++connection->nbatch;
+    }
+
+    return false;
+}
+
+/*
+ * Pick up the next batch of messages of the stream, starting a new
+ * snapshot if we're done with the current one. Returns false if the
+ * stream has nothing more for now.
+ */
+static bool dcp_stream_fill(struct default_engine *engine,
+                            struct dcp_connection *connection,
+                            struct dcp_stream *stream,
+                            struct vbucket_seqnos *vb) {
+    for (;;) {
+        bool busy;
+
+        cb_mutex_enter(&vb->lock);
+        if (stream->last_seqno == stream->snap_end_seqno) {
+            uint64_t end = vb->high_seqno;
+            if (end > stream->end_seqno) {
+                end = stream->end_seqno;
+            }
+            if (end <= stream->last_seqno) {
+                cb_mutex_exit(&vb->lock);
+                return false;
+            }
+            stream->snap_end_seqno = end;
+            connection->snap_start_seqno = stream->last_seqno + 1;
+            connection->marker = true;
+        }
+        busy = dcp_stream_collect(engine, connection, stream, vb);
+        cb_mutex_exit(&vb->lock);
+
+        if (connection->nbatch > 0) {
+            connection->current = stream;
+            return true;
+        }
+
+        if (!busy) {
+            /* Everything in the snapshot was replaced since */
+            stream->last_seqno = connection->batch_seqno;
+            connection->marker = false;
+        }
+    }
+}
+
+/*
+ * Must the stream end? A vBucket which is no longer active or has lost
+ * its history (or the deletions the consumer hasn't got yet) ends with
+ * DCP_STREAM_END_STATE_CHANGED, and the consumer has to ask again.
+ */
+static bool dcp_stream_done(struct default_engine *engine,
+                            const struct dcp_stream *stream,
+                            struct vbucket_seqnos *vb, uint32_t *flags) {
+    bool ret = true;
+
+    cb_mutex_enter(&vb->lock);
+    if (!handled_vbucket(engine, stream->vbucket) ||
+        stream->uuid != vb->uuid ||
+        (stream->last_seqno != 0 && stream->last_seqno < vb->purge_seqno)) {
+        *flags = DCP_STREAM_END_STATE_CHANGED;
+    } else if (stream->last_seqno >= stream->end_seqno) {
+        *flags = DCP_STREAM_END_OK;
+    } else {
+        ret = false;
+    }
+    cb_mutex_exit(&vb->lock);
+    return ret;
+}
+
+/* Has the stream got something to send (or must it end)? */
+static bool dcp_stream_ready(struct default_engine *engine,
+                             const struct dcp_stream *stream) {
+    struct vbucket_seqnos *vb = seqnos_vbucket(engine, stream->vbucket,
+                                               false);
+    uint32_t flags;
+    bool ret;
+
+    if (dcp_stream_done(engine, stream, vb, &flags)) {
+        return true;
+    }
+
+    cb_mutex_enter(&vb->lock);
+    ret = vb->high_seqno > stream->last_seqno;
+    cb_mutex_exit(&vb->lock);
+    return ret;
+}
+
+static void dcp_resume(struct default_engine *engine,
+                       struct dcp_connection *connection) {
+    cb_mutex_enter(&engine->dcp.lock);
+    if (connection->paused) {
+        connection->paused = false;
+        atomic_fetch_sub_uint32(&engine->dcp.npaused, 1);
+    }
+    cb_mutex_exit(&engine->dcp.lock);
+}
+
+/*
+ * Wait for dcp_notify() to wake us up. The streams are looked at again
+ * once we're paused, so that we don't miss a mutation logged after we
+ * looked at them the first time.
+ */
+static ENGINE_ERROR_CODE dcp_pause(struct default_engine *engine,
+                                   struct dcp_connection *connection) {
+    struct dcp_stream *stream;
+
+    cb_mutex_enter(&engine->dcp.lock);
+    connection->paused = true;
+    atomic_fetch_add_uint32(&engine->dcp.npaused, 1);
+    cb_mutex_exit(&engine->dcp.lock);
+
+    for (stream = connection->streams; stream != NULL; stream = stream->next) {
+        if (dcp_stream_ready(engine, stream)) {
+            dcp_resume(engine, connection);
+            return ENGINE_WANT_MORE;
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+/* Move the stream to the end of the list, so the others get their turn */
+static void dcp_rotate_streams(struct default_engine *engine,
+                               struct dcp_connection *connection,
+                               struct dcp_stream *stream) {
+    struct dcp_stream **prev;
+
+    if (stream->next == NULL) {
+        return;
+    }
+
+    cb_mutex_enter(&engine->dcp.lock);
+    prev = &connection->streams;
+    while (*prev != stream) {
+        prev = &(*prev)->next;
+    }
+    *prev = stream->next;
+    while (*prev != NULL) {
+        prev = &(*prev)->next;
+    }
+    *prev = stream;
+    stream->next = NULL;
+    cb_mutex_exit(&engine->dcp.lock);
+}
+
+/*
+ * Find a stream with something to send and pick up a batch of its
+ * messages, or end a stream which is done.
+ */
+static ENGINE_ERROR_CODE dcp_fill(struct default_engine *engine,
+                                  struct dcp_connection *connection,
+                                  struct dcp_message_producers *producers) {
+    struct dcp_stream *stream;
+
+    for (stream = connection->streams; stream != NULL; stream = stream->next) {
+        struct vbucket_seqnos *vb = seqnos_vbucket(engine, stream->vbucket,
+                                                   false);
+        uint32_t flags;
+
+        if (dcp_stream_done(engine, stream, vb, &flags)) {
+            ENGINE_ERROR_CODE ret;
+            ret = producers->stream_end(connection->cookie, stream->opaque,
+                                        stream->vbucket, flags);
+            if (ret == ENGINE_SUCCESS) {
+                dcp_remove_stream(engine, connection, stream);
+                ret = ENGINE_WANT_MORE;
+            }
+            return ret;
+        }
+
+        if (dcp_stream_fill(engine, connection, stream, vb)) {
+            dcp_rotate_streams(engine, connection, stream);
+            return ENGINE_WANT_MORE;
+        }
+    }
+
+    return dcp_pause(engine, connection);
+}
+
+/*
+ * Send the marker and messages of the batch, for as long as the producers
+ * take them. A message refused with ENGINE_E2BIG (the connection is full)
+ * is kept for the next step; the producers own the item of a mutation
+ * once they've been given it.
+ */
+static ENGINE_ERROR_CODE dcp_send(struct dcp_connection *connection,
+                                  struct dcp_message_producers *producers) {
+    struct dcp_stream *stream = connection->current;
+    ENGINE_ERROR_CODE ret;
+
+    if (connection->marker) {
+        ret = producers->marker(connection->cookie, stream->opaque,
+                                stream->vbucket,
+                                connection->snap_start_seqno,
+                                stream->snap_end_seqno,
+                                DCP_MARKER_FLAG_MEMORY);
+        if (ret != ENGINE_SUCCESS) {
+            return ret;
+        }
+        connection->marker = false;
+    }
+
+    while (connection->next_message < connection->nbatch) {
+        struct dcp_message *msg = &connection->batch[connection->next_message];
+
+        if (msg->item != NULL) {
+            ret = producers->mutation(connection->cookie, stream->opaque,
+                                      msg->item, stream->vbucket,
+                                      msg->seqno, 0, 0, NULL, 0, 0);
+        } else {
+            ret = producers->deletion(connection->cookie, stream->opaque,
+                                      msg->key, msg->nkey, msg->cas,
+                                      stream->vbucket, msg->seqno, 0,
+                                      NULL, 0);
+        }
+
+        if (ret == ENGINE_E2BIG) {
+            return ret;
+        }
+        ++connection->next_message;
+        if (ret != ENGINE_SUCCESS) {
+            return ret;
+        }
+        stream->last_seqno = msg->seqno;
+    }
+
+    stream->last_seqno = connection->batch_seqno;
+    connection->nbatch = connection->next_message = 0;
+    connection->current = NULL;
+    return ENGINE_WANT_MORE;
+}
+
+ENGINE_ERROR_CODE dcp_step(struct default_engine *engine,
+                           const void *cookie,
+                           struct dcp_message_producers *producers) {
+    struct dcp_connection *connection = dcp_get_connection(engine, cookie);
+
+    if (connection == NULL) {
+        return ENGINE_DISCONNECT;
+    }
+
+    if (connection->paused) {
+        dcp_resume(engine, connection);
+    }
+
+    if (connection->current == NULL) {
+        ENGINE_ERROR_CODE ret = dcp_fill(engine, connection, producers);
+        if (connection->current == NULL) {
+            return ret;
+        }
+    }
+
+    return dcp_send(connection, producers);
+}
+
+void dcp_disconnect(struct default_engine *engine, const void *cookie) {
+    struct dcp_connection *connection = dcp_get_connection(engine, cookie);
+    struct dcp_connection **prev = &engine->dcp.connections;
+
+    if (connection == NULL) {
+        return;
+    }
+
+    cb_mutex_enter(&engine->dcp.lock);
+    while (*prev != NULL && *prev != connection) {
+        prev = &(*prev)->next;
+    }
+    if (*prev == NULL) {
+        /* Not one of ours (a TAP connection) */
+        cb_mutex_exit(&engine->dcp.lock);
+        return;
+    }
+    *prev = connection->next;
+    if (connection->paused) {
+        atomic_fetch_sub_uint32(&engine->dcp.npaused, 1);
+    }
+    cb_mutex_exit(&engine->dcp.lock);
+
+    engine->server.cookie->store_engine_specific(cookie, NULL);
+    dcp_batch_release(engine, connection);
+    dcp_free_streams(connection);
+    free(connection);
+}
+
+void dcp_notify(struct default_engine *engine, uint16_t vbucket) {
+    struct dcp_connection *connection;
+
+    if (atomic_load_uint32(&engine->dcp.npaused) == 0) {
+        return;
+    }
+
+    cb_mutex_enter(&engine->dcp.lock);
+    for (connection = engine->dcp.connections; connection != NULL;
+         connection = connection->next) {
+        if (connection->paused &&
+            dcp_find_stream(connection, vbucket) != NULL) {
+            connection->paused = false;
+            atomic_fetch_sub_uint32(&engine->dcp.npaused, 1);
+            engine->server.cookie->notify_io_complete(connection->cookie,
+                                                      ENGINE_SUCCESS);
+        }
+    }
+    cb_mutex_exit(&engine->dcp.lock);
+}
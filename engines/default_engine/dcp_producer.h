@@ -0,0 +1,114 @@
+#ifndef DCP_PRODUCER_H
+#define DCP_PRODUCER_H
+
+/*
+ * The DCP producer streaming the seqno logs of the vBuckets (see
+ * seqnos.h). A stream sends the entries of its vBucket in snapshots: a
+ * snapshot marker for the seqnos from the one after the last the consumer
+ * has to the high seqno of the vBucket, followed by the mutations and
+ * deletions still in the log in that range (an entry replaced by a later
+ * one is skipped). A stream with an end seqno ends once it got there,
+ * the others wait for more mutations.
+ */
+
+/* The most messages we pick up from a log per hold of its lock */
+#define DCP_STEP_BATCH 32
+
+#define DCP_MARKER_FLAG_MEMORY 0x01
+
+#define DCP_STREAM_END_OK 0
+#define DCP_STREAM_END_STATE_CHANGED 2
+
+#ifndef KEY_MAX_LENGTH
+#define KEY_MAX_LENGTH 250
+#endif
+
+struct dcp_stream {
+    struct dcp_stream *next;
+    uint32_t opaque;
+    uint16_t vbucket;
+    /* The uuid of the vBucket when the stream was opened */
+    uint64_t uuid;
+    /* The last seqno the consumer has */
+    uint64_t last_seqno;
+    uint64_t end_seqno;
+    /* The end of the snapshot we're sending */
+    uint64_t snap_end_seqno;
+};
+
+/* A message picked up from a log, but not yet sent */
+struct dcp_message {
+    uint64_t seqno;
+    /* The item of a mutation (we hold a reference), NULL for a deletion */
+    hash_item *item;
+    uint64_t cas;
+    uint16_t nkey;
+    char key[KEY_MAX_LENGTH];
+};
+
+struct dcp_connection {
+    struct dcp_connection *next;
+    const void *cookie;
+    /* Changed with the lock held, so that dcp_notify() may look at them */
+    struct dcp_stream *streams;
+    bool paused;
+
+    /* The stream the batch is from */
+    struct dcp_stream *current;
+    /* Send a marker for the snapshot before the batch */
+    bool marker;
+    uint64_t snap_start_seqno;
+    uint64_t snap_end_seqno;
+    /* The stream has the seqnos up to here once the batch is sent */
+    uint64_t batch_seqno;
+    struct dcp_message batch[DCP_STEP_BATCH];
+    int nbatch;
+    int next_message;
+};
+
+struct dcp_producers {
+    /* Ranks below the item locks */
+    cb_mutex_t lock;
+    struct dcp_connection *connections;
+    /* The number of connections waiting for a mutation */
+    uint32_t npaused;
+};
+
+void dcp_producers_init(struct default_engine *engine);
+void dcp_producers_destroy(struct default_engine *engine);
+
+ENGINE_ERROR_CODE dcp_open(struct default_engine *engine, const void *cookie,
+                           uint32_t flags);
+ENGINE_ERROR_CODE dcp_stream_req(struct default_engine *engine,
+                                 const void *cookie,
+                                 uint32_t flags,
+                                 uint32_t opaque,
+                                 uint16_t vbucket,
+                                 uint64_t start_seqno,
+                                 uint64_t end_seqno,
+                                 uint64_t vbucket_uuid,
+                                 uint64_t snap_start_seqno,
+                                 uint64_t snap_end_seqno,
+                                 uint64_t *rollback_seqno,
+                                 dcp_add_failover_log callback);
+ENGINE_ERROR_CODE dcp_close_stream(struct default_engine *engine,
+                                   const void *cookie,
+                                   uint16_t vbucket);
+ENGINE_ERROR_CODE dcp_get_failover_log(struct default_engine *engine,
+                                       const void *cookie,
+                                       uint16_t vbucket,
+                                       dcp_add_failover_log callback);
+ENGINE_ERROR_CODE dcp_step(struct default_engine *engine,
+                           const void *cookie,
+                           struct dcp_message_producers *producers);
+
+/* Free the state of a producer connection when it is closed */
+void dcp_disconnect(struct default_engine *engine, const void *cookie);
+
+/*
+ * Wake up the producer connections waiting for a mutation in (or a state
+ * change of) the vBucket.
+ */
+void dcp_notify(struct default_engine *engine, uint16_t vbucket);
+
+#endif
@@ -45,6 +45,12 @@ static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
                                      const void* key,
                                      const int nkey,
                                      uint16_t vbucket);
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           const item_key *keys,
+                                           int nkeys,
+                                           item** items,
+                                           ENGINE_ERROR_CODE *status);
 static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
                   const void *cookie,
                   const char *stat_key,
@@ -100,7 +106,7 @@ static vbucket_state_t get_vbucket_state(struct default_engine *e,
     return vi.v.state;
 }
 
-static bool handled_vbucket(struct default_engine *e, uint16_t vbid) {
+bool handled_vbucket(struct default_engine *e, uint16_t vbid) {
     return e->config.ignore_vbucket
         || (get_vbucket_state(e, vbid) == vbucket_state_active);
 }
@@ -114,11 +120,44 @@ static bool get_item_info(ENGINE_HANDLE *handle, const void *cookie,
 static bool set_item_info(ENGINE_HANDLE *handle, const void *cookie,
                           item* item, const item_info *itm_info);
 
+static ENGINE_ERROR_CODE default_dcp_step(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          struct dcp_message_producers *producers);
+static ENGINE_ERROR_CODE default_dcp_open(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          uint32_t opaque,
+                                          uint32_t seqno,
+                                          uint32_t flags,
+                                          void *name,
+                                          uint16_t nname);
+static ENGINE_ERROR_CODE default_dcp_close_stream(ENGINE_HANDLE* handle,
+                                                  const void* cookie,
+                                                  uint32_t opaque,
+                                                  uint16_t vbucket);
+static ENGINE_ERROR_CODE default_dcp_stream_req(ENGINE_HANDLE* handle,
+                                                const void* cookie,
+                                                uint32_t flags,
+                                                uint32_t opaque,
+                                                uint16_t vbucket,
+                                                uint64_t start_seqno,
+                                                uint64_t end_seqno,
+                                                uint64_t vbucket_uuid,
+                                                uint64_t snap_start_seqno,
+                                                uint64_t snap_end_seqno,
+                                                uint64_t *rollback_seqno,
+                                                dcp_add_failover_log callback);
+static ENGINE_ERROR_CODE default_dcp_get_failover_log(ENGINE_HANDLE* handle,
+                                                      const void* cookie,
+                                                      uint32_t opaque,
+                                                      uint16_t vbucket,
+                                                      dcp_add_failover_log callback);
+
 ENGINE_ERROR_CODE create_default_engine_instance(uint64_t interface,
                                                  GET_SERVER_API get_server_api,
                                                  ENGINE_HANDLE **handle) {
    SERVER_HANDLE_V1 *api = get_server_api();
    struct default_engine *engine;
+   int ii;
 
    if (interface != 1 || api == NULL) {
       return ENGINE_ENOTSUP;
@@ -129,9 +168,19 @@ ENGINE_ERROR_CODE create_default_engine_instance(uint64_t interface,
    }
 
    cb_mutex_initialize(&engine->slabs.lock);
-   cb_mutex_initialize(&engine->cache_lock);
-   cb_mutex_initialize(&engine->stats.lock);
+   for (ii = 0; ii < SLAB_CACHE_COUNT; ++ii) {
+      cb_mutex_initialize(&engine->slabs.caches[ii].lock);
+   }
+   cb_mutex_initialize(&engine->slabs.rebalance.lock);
+   cb_cond_initialize(&engine->slabs.rebalance.cond);
+   cb_mutex_initialize(&engine->assoc.lock);
+   cb_cond_initialize(&engine->assoc.maintenance.cond);
+   cb_mutex_initialize(&engine->cas.lock);
+   item_locks_init(engine);
+   epoch_init(&engine->epoch);
    cb_mutex_initialize(&engine->scrubber.lock);
+   cb_mutex_initialize(&engine->seqnos.lock);
+   dcp_producers_init(engine);
 
    engine->engine.interface.interface = 1;
    engine->engine.get_info = default_get_info;
@@ -141,6 +190,7 @@ ENGINE_ERROR_CODE create_default_engine_instance(uint64_t interface,
    engine->engine.remove = default_item_delete;
    engine->engine.release = default_item_release;
    engine->engine.get = default_get;
+   engine->engine.get_multi = default_get_multi;
    engine->engine.get_stats = default_get_stats;
    engine->engine.reset_stats = default_reset_stats;
    engine->engine.store = default_store;
@@ -150,10 +200,14 @@ ENGINE_ERROR_CODE create_default_engine_instance(uint64_t interface,
    engine->engine.item_set_cas = item_set_cas;
    engine->engine.get_item_info = get_item_info;
    engine->engine.set_item_info = set_item_info;
+   engine->engine.dcp.step = default_dcp_step;
+   engine->engine.dcp.open = default_dcp_open;
+   engine->engine.dcp.close_stream = default_dcp_close_stream;
+   engine->engine.dcp.stream_req = default_dcp_stream_req;
+   engine->engine.dcp.get_failover_log = default_dcp_get_failover_log;
    engine->server = *api;
    engine->get_server_api = get_server_api;
    engine->initialized = true;
-   engine->assoc.hashpower = 16;
    engine->config.use_cas = true;
    engine->config.verbose = 0;
    engine->config.oldest_live = 0;
@@ -163,6 +217,18 @@ ENGINE_ERROR_CODE create_default_engine_instance(uint64_t interface,
    engine->config.factor = 1.25;
    engine->config.chunk_size = 48;
    engine->config.item_size_max= 1024 * 1024;
+   engine->config.hashpower = 13;
+   engine->config.hash_bulk_move = 1024;
+   engine->config.hash_bulk_sleep = 0;
+   engine->config.hot_lru_pct = 20;
+   engine->config.warm_lru_pct = 40;
+   engine->config.item_update_interval = 60;
+   engine->config.lru_crawler = true;
+   engine->config.lru_crawler_sleep = 100;
+   engine->config.lru_crawler_tocrawl = 0;
+   engine->config.lru_crawler_interval = 60;
+   engine->config.slab_automove = true;
+   engine->config.slab_automove_interval = 10;
    engine->info.engine_info.description = "Default engine v0.1";
    engine->info.engine_info.num_features = 1;
    engine->info.engine_info.features[0].feature = ENGINE_FEATURE_LRU;
@@ -184,6 +250,14 @@ static const engine_info* default_get_info(ENGINE_HANDLE* handle) {
     return &get_handle(handle)->info.engine_info;
 }
 
+static void default_handle_disconnect(const void *cookie,
+                                      ENGINE_EVENT_TYPE type,
+                                      const void *event_data,
+                                      const void *cb_data) {
+    struct default_engine *engine = (struct default_engine*)cb_data;
+    dcp_disconnect(engine, cookie);
+}
+
 static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
                                             const char* config_str) {
    struct default_engine* se = get_handle(handle);
@@ -197,6 +271,7 @@ static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
        se->info.engine_info.features[se->info.engine_info.num_features++].feature = ENGINE_FEATURE_CAS;
    }
 
+   se->assoc.hashpower = (uint32_t)se->config.hashpower;
    ret = assoc_init(se);
    if (ret != ENGINE_SUCCESS) {
       return ret;
@@ -208,27 +283,74 @@ static ENGINE_ERROR_CODE default_initialize(ENGINE_HANDLE* handle,
       return ret;
    }
 
+   ret = seqnos_init(se);
+   if (ret != ENGINE_SUCCESS) {
+      return ret;
+   }
+
+   if (se->config.seqnos) {
+      se->server.callback->register_callback(handle, ON_DISCONNECT,
+                                             default_handle_disconnect, se);
+   }
+
+   if (start_assoc_maintenance_thread(se) != 0) {
+      return ENGINE_FAILED;
+   }
+
+   if (item_start_lru_maintainer(se) != 0) {
+      return ENGINE_FAILED;
+   }
+
+   if (item_start_lru_crawler(se) != 0) {
+      return ENGINE_FAILED;
+   }
+
+   if (slabs_start_rebalancer(se) != 0) {
+      return ENGINE_FAILED;
+   }
+
    return ENGINE_SUCCESS;
 }
 
 static void default_destroy(ENGINE_HANDLE* handle, const bool force) {
     struct default_engine* se = get_handle(handle);
+    int ii;
     (void)force;
 
     if (se->initialized) {
+        slabs_stop_rebalancer(se);
+        item_stop_lru_crawler(se);
+        item_stop_lru_maintainer(se);
+
         /* Destroy the association table */
+        stop_assoc_maintenance_thread(se);
         assoc_destroy(se);
 
+        /* The DCP producers may still hold references to items */
+        dcp_producers_destroy(se);
+        seqnos_destroy(se);
+
         /* Destory the slabs cache */
         slabs_destroy(se);
 
         free(se->config.uuid);
+        free(se->config.numa_policy);
+        free(se->config.numa_nodes);
 
         /* Clean up the mutexes */
-        cb_mutex_destroy(&se->cache_lock);
-        cb_mutex_destroy(&se->stats.lock);
+        item_locks_destroy(se);
+        epoch_destroy(&se->epoch);
+        cb_cond_destroy(&se->assoc.maintenance.cond);
+        cb_mutex_destroy(&se->assoc.lock);
+        cb_mutex_destroy(&se->cas.lock);
+        cb_cond_destroy(&se->slabs.rebalance.cond);
+        cb_mutex_destroy(&se->slabs.rebalance.lock);
         cb_mutex_destroy(&se->slabs.lock);
+        for (ii = 0; ii < SLAB_CACHE_COUNT; ++ii) {
+            cb_mutex_destroy(&se->slabs.caches[ii].lock);
+        }
         cb_mutex_destroy(&se->scrubber.lock);
+        cb_mutex_destroy(&se->seqnos.lock);
         se->initialized = false;
         free(se);
     }
@@ -246,10 +368,13 @@ static ENGINE_ERROR_CODE default_item_allocate(ENGINE_HANDLE* handle,
    hash_item *it;
    unsigned int id;
    struct default_engine* engine = get_handle(handle);
-   size_t ntotal = sizeof(hash_item) + nkey + nbytes;
+   size_t ntotal = item_header_size(engine) + nkey + nbytes;
    if (engine->config.use_cas) {
       ntotal += sizeof(uint64_t);
    }
+   if (engine->config.seqnos) {
+      ntotal += sizeof(uint64_t);
+   }
    id = slabs_clsid(engine, ntotal);
    if (id == 0) {
       return ENGINE_E2BIG;
@@ -275,7 +400,9 @@ static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
                                              mutation_descr_t* mut_info)
 {
    struct default_engine* engine = get_handle(handle);
+   struct vbucket_seqnos *vb;
    hash_item *it;
+   uint64_t seqno;
 
    VBUCKET_GUARD(engine, vbucket);
 
@@ -285,17 +412,21 @@ static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
    }
 
    if (*cas == 0 || *cas == item_get_cas(it)) {
-      item_unlink(engine, it);
+      seqno = item_delete(engine, it);
       item_release(engine, it);
    } else {
       item_release(engine, it);
       return ENGINE_KEY_EEXISTS;
    }
 
-   /* vbucket UUID / seqno arn't supported by default engine, so just return
-      zeros. */
+   /* The vbucket UUID / seqno are zeros unless we keep seqnos */
    mut_info->vbucket_uuid = 0;
-   mut_info->seqno = 0;
+   mut_info->seqno = seqno;
+   if (seqno != 0 && (vb = seqnos_vbucket(engine, vbucket, false)) != NULL) {
+      cb_mutex_enter(&vb->lock);
+      mut_info->vbucket_uuid = vb->uuid;
+      cb_mutex_exit(&vb->lock);
+   }
 
    return ENGINE_SUCCESS;
 }
@@ -323,6 +454,45 @@ static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
    }
 }
 
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           const item_key *keys,
+                                           int nkeys,
+                                           item** items,
+                                           ENGINE_ERROR_CODE *status) {
+   struct default_engine *engine = get_handle(handle);
+   bool found[ITEM_GET_MULTI_MAX];
+   int ii, base, n;
+
+   for (ii = 0; ii < nkeys; ++ii) {
+      if (!handled_vbucket(engine, keys[ii].vbucket)) {
+         break;
+      }
+   }
+
+   if (ii < nkeys) {
+      /* Not all ours, look them up one by one */
+      for (ii = 0; ii < nkeys; ++ii) {
+         status[ii] = default_get(handle, cookie, &items[ii], keys[ii].key,
+                                  keys[ii].nkey, keys[ii].vbucket);
+      }
+      return ENGINE_SUCCESS;
+   }
+
+   for (base = 0; base < nkeys; base += n) {
+      n = nkeys - base;
+      if (n > ITEM_GET_MULTI_MAX) {
+         n = ITEM_GET_MULTI_MAX;
+      }
+      item_get_multi(engine, keys + base, n, (hash_item**)items + base, found);
+      for (ii = 0; ii < n; ++ii) {
+         status[base + ii] = found[ii] ? ENGINE_SUCCESS : ENGINE_KEY_ENOENT;
+      }
+   }
+
+   return ENGINE_SUCCESS;
+}
+
 static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
                                            const void* cookie,
                                            const char* stat_key,
@@ -336,26 +506,35 @@ static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
       char val[128];
       int len;
 
-      cb_mutex_enter(&engine->stats.lock);
-      len = sprintf(val, "%"PRIu64, (uint64_t)engine->stats.evictions);
+      len = sprintf(val, "%"PRIu64,
+                    ENGINE_STATS_LOAD(engine, evictions));
       add_stat("evictions", 9, val, len, cookie);
-      len = sprintf(val, "%"PRIu64, (uint64_t)engine->stats.curr_items);
+      len = sprintf(val, "%"PRIu64,
+                    ENGINE_STATS_LOAD(engine, curr_items));
       add_stat("curr_items", 10, val, len, cookie);
-      len = sprintf(val, "%"PRIu64, (uint64_t)engine->stats.total_items);
+      len = sprintf(val, "%"PRIu64,
+                    ENGINE_STATS_LOAD(engine, total_items));
       add_stat("total_items", 11, val, len, cookie);
-      len = sprintf(val, "%"PRIu64, (uint64_t)engine->stats.curr_bytes);
+      len = sprintf(val, "%"PRIu64,
+                    ENGINE_STATS_LOAD(engine, curr_bytes));
       add_stat("bytes", 5, val, len, cookie);
-      len = sprintf(val, "%"PRIu64, engine->stats.reclaimed);
+      len = sprintf(val, "%"PRIu64,
+                    ENGINE_STATS_LOAD(engine, reclaimed));
       add_stat("reclaimed", 9, val, len, cookie);
       len = sprintf(val, "%"PRIu64, (uint64_t)engine->config.maxbytes);
       add_stat("engine_maxbytes", 15, val, len, cookie);
-      cb_mutex_exit(&engine->stats.lock);
    } else if (strncmp(stat_key, "slabs", 5) == 0) {
       slabs_stats(engine, add_stat, cookie);
    } else if (strncmp(stat_key, "items", 5) == 0) {
       item_stats(engine, add_stat, cookie);
    } else if (strncmp(stat_key, "sizes", 5) == 0) {
       item_stats_sizes(engine, add_stat, cookie);
+   } else if (strncmp(stat_key, "hash", 4) == 0) {
+      assoc_stats(engine, add_stat, cookie);
+   } else if (strncmp(stat_key, "lru_crawler", 11) == 0) {
+      item_lru_crawler_stats(engine, add_stat, cookie);
+   } else if (strncmp(stat_key, "seqnos", 6) == 0) {
+      seqnos_stats(engine, add_stat, cookie);
    } else if (strncmp(stat_key, "uuid", 4) == 0) {
        if (engine->config.uuid) {
            add_stat("uuid", 4, engine->config.uuid,
@@ -401,9 +580,12 @@ static ENGINE_ERROR_CODE default_store(ENGINE_HANDLE* handle,
                                        ENGINE_STORE_OPERATION operation,
                                        uint16_t vbucket) {
     struct default_engine *engine = get_handle(handle);
+    hash_item *it = get_real_item(item);
     VBUCKET_GUARD(engine, vbucket);
-    return store_item(engine, get_real_item(item), cas, operation,
-                      cookie);
+    if (it->iflag & ITEM_WITH_SEQNO) {
+        item_set_seqno_tag(it, SEQNO_TAG(vbucket, 0));
+    }
+    return store_item(engine, it, cas, operation, cookie);
 }
 
 static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
@@ -424,12 +606,13 @@ static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
 
    return arithmetic(engine, cookie, key, nkey, increment,
                      create, delta, initial, engine->server.core->realtime(exptime),
-                     item, datatype, result);
+                     item, datatype, result, vbucket);
 }
 
 static ENGINE_ERROR_CODE default_flush(ENGINE_HANDLE* handle,
                                        const void* cookie, time_t when) {
    item_flush_expired(get_handle(handle), when);
+   seqnos_flush(get_handle(handle));
 
    return ENGINE_SUCCESS;
 }
@@ -438,11 +621,9 @@ static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie) {
    struct default_engine *engine = get_handle(handle);
    item_stats_reset(engine);
 
-   cb_mutex_enter(&engine->stats.lock);
-   engine->stats.evictions = 0;
-   engine->stats.reclaimed = 0;
-   engine->stats.total_items = 0;
-   cb_mutex_exit(&engine->stats.lock);
+   ENGINE_STATS_STORE(engine, evictions, 0);
+   ENGINE_STATS_STORE(engine, reclaimed, 0);
+   ENGINE_STATS_STORE(engine, total_items, 0);
 }
 
 static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
@@ -452,7 +633,7 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
    se->config.vb0 = true;
 
    if (cfg_str != NULL) {
-       struct config_item items[13];
+       struct config_item items[30];
        int ii = 0;
 
        memset(&items, 0, sizeof(items));
@@ -515,12 +696,155 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
        items[ii].value.dt_string = &se->config.uuid;
        ++ii;
 
+       items[ii].key = "hashpower";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.hashpower;
+       ++ii;
+
+       items[ii].key = "hash_bulk_move";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.hash_bulk_move;
+       ++ii;
+
+       items[ii].key = "hash_bulk_sleep";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.hash_bulk_sleep;
+       ++ii;
+
+       items[ii].key = "hot_lru_pct";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.hot_lru_pct;
+       ++ii;
+
+       items[ii].key = "warm_lru_pct";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.warm_lru_pct;
+       ++ii;
+
+       items[ii].key = "item_update_interval";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.item_update_interval;
+       ++ii;
+
+       items[ii].key = "lru_crawler";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.lru_crawler;
+       ++ii;
+
+       items[ii].key = "lru_crawler_sleep";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.lru_crawler_sleep;
+       ++ii;
+
+       items[ii].key = "lru_crawler_tocrawl";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.lru_crawler_tocrawl;
+       ++ii;
+
+       items[ii].key = "lru_crawler_interval";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.lru_crawler_interval;
+       ++ii;
+
+       items[ii].key = "slab_automove";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.slab_automove;
+       ++ii;
+
+       items[ii].key = "slab_automove_interval";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.slab_automove_interval;
+       ++ii;
+
+       items[ii].key = "hugepages";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.hugepages;
+       ++ii;
+
+       items[ii].key = "numa_policy";
+       items[ii].datatype = DT_STRING;
+       items[ii].value.dt_string = &se->config.numa_policy;
+       ++ii;
+
+       items[ii].key = "numa_nodes";
+       items[ii].datatype = DT_STRING;
+       items[ii].value.dt_string = &se->config.numa_nodes;
+       ++ii;
+
+       items[ii].key = "compact_items";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.compact_items;
+       ++ii;
+
+       items[ii].key = "seqnos";
+       items[ii].datatype = DT_BOOL;
+       items[ii].value.dt_bool = &se->config.seqnos;
+       ++ii;
+
        items[ii].key = NULL;
        ++ii;
-       cb_assert(ii == 13);
+       cb_assert(ii == 30);
        ret = se->server.core->parse_config(cfg_str, items, stderr);
    }
 
+   /* Each bucket must be covered by a single item lock */
+   if (ret == ENGINE_SUCCESS &&
+       (se->config.hashpower <= ITEM_LOCK_POWER || se->config.hashpower > 32)) {
+       EXTENSION_LOGGER_DESCRIPTOR *logger;
+       logger = (void*)se->server.extension->get_extension(EXTENSION_LOGGER);
+       logger->log(EXTENSION_LOG_WARNING, NULL,
+                   "hashpower must be between %d and 32\n",
+                   ITEM_LOCK_POWER + 1);
+       ret = ENGINE_EINVAL;
+   }
+
+   /* The cold LRU must be left with some of the items */
+   if (ret == ENGINE_SUCCESS &&
+       se->config.hot_lru_pct + se->config.warm_lru_pct >= 100) {
+       EXTENSION_LOGGER_DESCRIPTOR *logger;
+       logger = (void*)se->server.extension->get_extension(EXTENSION_LOGGER);
+       logger->log(EXTENSION_LOG_WARNING, NULL,
+                   "hot_lru_pct + warm_lru_pct must be less than 100\n");
+       ret = ENGINE_EINVAL;
+   }
+
+   if (ret == ENGINE_SUCCESS && se->config.lru_crawler_interval == 0) {
+       EXTENSION_LOGGER_DESCRIPTOR *logger;
+       logger = (void*)se->server.extension->get_extension(EXTENSION_LOGGER);
+       logger->log(EXTENSION_LOG_WARNING, NULL,
+                   "lru_crawler_interval must be at least 1 second\n");
+       ret = ENGINE_EINVAL;
+   }
+
+   if (ret == ENGINE_SUCCESS && se->config.slab_automove_interval == 0) {
+       EXTENSION_LOGGER_DESCRIPTOR *logger;
+       logger = (void*)se->server.extension->get_extension(EXTENSION_LOGGER);
+       logger->log(EXTENSION_LOG_WARNING, NULL,
+                   "slab_automove_interval must be at least 1 second\n");
+       ret = ENGINE_EINVAL;
+   }
+
+   if (ret == ENGINE_SUCCESS && se->config.numa_policy != NULL &&
+       strcmp(se->config.numa_policy, "none") != 0 &&
+       strcmp(se->config.numa_policy, "interleave") != 0 &&
+       strcmp(se->config.numa_policy, "bind") != 0) {
+       EXTENSION_LOGGER_DESCRIPTOR *logger;
+       logger = (void*)se->server.extension->get_extension(EXTENSION_LOGGER);
+       logger->log(EXTENSION_LOG_WARNING, NULL,
+                   "numa_policy must be none, interleave or bind\n");
+       ret = ENGINE_EINVAL;
+   }
+
+   /*
+    * Huge pages, NUMA placement and the compact items (which link to each
+    * other by their offset in it) need the preallocated arena
+    */
+   if (se->config.hugepages || se->config.compact_items ||
+       (se->config.numa_policy != NULL &&
+        strcmp(se->config.numa_policy, "none") != 0)) {
+       se->config.preallocate = true;
+   }
+
    if (se->config.vb0) {
        set_vbucket_state(se, 0, vbucket_state_active);
    }
@@ -552,6 +876,7 @@ static bool set_vbucket(struct default_engine *e,
     }
 
     set_vbucket_state(e, ntohs(req->message.header.request.vbucket), state);
+    dcp_notify(e, ntohs(req->message.header.request.vbucket));
     return response(NULL, 0, NULL, 0, &state, sizeof(state),
                     PROTOCOL_BINARY_RAW_BYTES,
                     PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
@@ -575,6 +900,7 @@ static bool rm_vbucket(struct default_engine *e,
                        protocol_binary_request_header *req,
                        ADD_RESPONSE response) {
     set_vbucket_state(e, ntohs(req->request.vbucket), vbucket_state_dead);
+    dcp_notify(e, ntohs(req->request.vbucket));
     return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
                     PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
 }
@@ -593,6 +919,72 @@ static bool scrub_cmd(struct default_engine *e,
                     res, 0, cookie);
 }
 
+/*
+ * Set one of the LRU crawler parameters at runtime. The key holds the name
+ * of the parameter and the value its new value (as a string).
+ */
+static bool set_param(struct default_engine *e, const void *cookie,
+                      protocol_binary_request_set_param *req,
+                      ADD_RESPONSE response) {
+    protocol_binary_request_header *header = &req->message.header;
+    uint16_t nkey = ntohs(header->request.keylen);
+    uint32_t bodylen = ntohl(header->request.bodylen);
+    const char *key = (const char*)(header + 1) + header->request.extlen;
+    protocol_binary_response_status res = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    char name[32], value[32];
+    size_t *param = NULL;
+    size_t nval;
+    uint32_t val;
+
+    if (bodylen < (uint32_t)nkey + header->request.extlen) {
+        return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+    nval = bodylen - nkey - header->request.extlen;
+    if (nkey == 0 || nkey >= sizeof(name) || nval >= sizeof(value)) {
+        return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+    memcpy(name, key, nkey);
+    name[nkey] = '\0';
+    memcpy(value, key + nkey, nval);
+    value[nval] = '\0';
+
+    if (strcmp(name, "lru_crawler") == 0) {
+        if (strcmp(value, "true") == 0) {
+            e->config.lru_crawler = true;
+        } else if (strcmp(value, "false") == 0) {
+            e->config.lru_crawler = false;
+        } else {
+            res = PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+    } else {
+        if (strcmp(name, "lru_crawler_sleep") == 0) {
+            param = &e->config.lru_crawler_sleep;
+        } else if (strcmp(name, "lru_crawler_tocrawl") == 0) {
+            param = &e->config.lru_crawler_tocrawl;
+        } else if (strcmp(name, "lru_crawler_interval") == 0) {
+            param = &e->config.lru_crawler_interval;
+        }
+
+        if (param == NULL) {
+            res = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+        } else if (!safe_strtoul(value, &val) ||
+                   (param == &e->config.lru_crawler_interval && val == 0)) {
+            res = PROTOCOL_BINARY_RESPONSE_EINVAL;
+        } else {
+            *param = val;
+        }
+    }
+
+    if (res == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        item_lru_crawler_reschedule(e);
+    }
+
+    return response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
+                    res, 0, cookie);
+}
+
 static bool touch(struct default_engine *e, const void *cookie,
                   protocol_binary_request_header *request,
                   ADD_RESPONSE response) {
@@ -660,6 +1052,9 @@ static ENGINE_ERROR_CODE default_unknown_command(ENGINE_HANDLE* handle,
     case PROTOCOL_BINARY_CMD_GET_VBUCKET:
         sent = get_vbucket(e, cookie, (void*)request, response);
         break;
+    case PROTOCOL_BINARY_CMD_SET_PARAM:
+        sent = set_param(e, cookie, (void*)request, response);
+        break;
     case PROTOCOL_BINARY_CMD_TOUCH:
     case PROTOCOL_BINARY_CMD_GAT:
     case PROTOCOL_BINARY_CMD_GATQ:
@@ -679,10 +1074,19 @@ static ENGINE_ERROR_CODE default_unknown_command(ENGINE_HANDLE* handle,
 }
 
 
+/* The CAS (if any) and the key follow the header */
+static char *item_get_header_end(const hash_item* item)
+{
+    if (item->iflag & ITEM_COMPACT) {
+        return (char*)item + ITEM_COMPACT_HEADER_SIZE;
+    }
+    return (char*)(item + 1);
+}
+
 uint64_t item_get_cas(const hash_item* item)
 {
     if (item->iflag & ITEM_WITH_CAS) {
-        return *(uint64_t*)(item + 1);
+        return *(uint64_t*)item_get_header_end(item);
     }
     return 0;
 }
@@ -692,16 +1096,44 @@ void item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
 {
     hash_item* it = get_real_item(item);
     if (it->iflag & ITEM_WITH_CAS) {
-        *(uint64_t*)(it + 1) = val;
+        *(uint64_t*)item_get_header_end(it) = val;
+    }
+}
+
+/* The seqno tag (see seqnos.h) follows the CAS */
+static uint64_t *item_get_seqno_tag_ptr(const hash_item* item)
+{
+    char *ret = item_get_header_end(item);
+    if (item->iflag & ITEM_WITH_CAS) {
+        ret += sizeof(uint64_t);
+    }
+    return (uint64_t*)ret;
+}
+
+uint64_t item_get_seqno_tag(const hash_item* item)
+{
+    if (item->iflag & ITEM_WITH_SEQNO) {
+        return *item_get_seqno_tag_ptr(item);
+    }
+    return 0;
+}
+
+void item_set_seqno_tag(hash_item* item, uint64_t tag)
+{
+    if (item->iflag & ITEM_WITH_SEQNO) {
+        *item_get_seqno_tag_ptr(item) = tag;
     }
 }
 
 const void* item_get_key(const hash_item* item)
 {
-    char *ret = (void*)(item + 1);
+    char *ret = item_get_header_end(item);
     if (item->iflag & ITEM_WITH_CAS) {
         ret += sizeof(uint64_t);
     }
+    if (item->iflag & ITEM_WITH_SEQNO) {
+        ret += sizeof(uint64_t);
+    }
 
     return ret;
 }
@@ -747,3 +1179,61 @@ static bool set_item_info(ENGINE_HANDLE *handle, const void *cookie,
     it->datatype = itm_info->datatype;
     return true;
 }
+
+static ENGINE_ERROR_CODE default_dcp_step(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          struct dcp_message_producers *producers)
+{
+    return dcp_step(get_handle(handle), cookie, producers);
+}
+
+static ENGINE_ERROR_CODE default_dcp_open(ENGINE_HANDLE* handle,
+                                          const void* cookie,
+                                          uint32_t opaque,
+                                          uint32_t seqno,
+                                          uint32_t flags,
+                                          void *name,
+                                          uint16_t nname)
+{
+    return dcp_open(get_handle(handle), cookie, flags);
+}
+
+static ENGINE_ERROR_CODE default_dcp_close_stream(ENGINE_HANDLE* handle,
+                                                  const void* cookie,
+                                                  uint32_t opaque,
+                                                  uint16_t vbucket)
+{
+    return dcp_close_stream(get_handle(handle), cookie, vbucket);
+}
+
+static ENGINE_ERROR_CODE default_dcp_stream_req(ENGINE_HANDLE* handle,
+                                                const void* cookie,
+                                                uint32_t flags,
+                                                uint32_t opaque,
+                                                uint16_t vbucket,
+                                                uint64_t start_seqno,
+                                                uint64_t end_seqno,
+                                                uint64_t vbucket_uuid,
+                                                uint64_t snap_start_seqno,
+                                                uint64_t snap_end_seqno,
+                                                uint64_t *rollback_seqno,
+                                                dcp_add_failover_log callback)
+{
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+    return dcp_stream_req(engine, cookie, flags, opaque, vbucket,
+                          start_seqno, end_seqno, vbucket_uuid,
+                          snap_start_seqno, snap_end_seqno,
+                          rollback_seqno, callback);
+}
+
+static ENGINE_ERROR_CODE default_dcp_get_failover_log(ENGINE_HANDLE* handle,
+                                                      const void* cookie,
+                                                      uint32_t opaque,
+                                                      uint16_t vbucket,
+                                                      dcp_add_failover_log callback)
+{
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+    return dcp_get_failover_log(engine, cookie, vbucket, callback);
+}
@@ -11,6 +11,7 @@
 #include "config.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <memcached/engine.h>
 #include <memcached/util.h>
@@ -28,6 +29,12 @@
     harvesting it on a low memory condition. */
 #define TAIL_REPAIR_TIME (3 * 3600)
 
+/** The number of item locks is 2^ITEM_LOCK_POWER. The lock for a key is
+    selected by the low bits of its hash, so this must be less than the
+    hashpower of the hash table. */
+#define ITEM_LOCK_POWER 12
+#define ITEM_LOCK_COUNT (1 << ITEM_LOCK_POWER)
+
 
 /* Forward decl */
 struct default_engine;
@@ -36,6 +43,7 @@ struct default_engine;
 #include "items.h"
 #include "assoc.h"
 #include "slabs.h"
+#include "epoch.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +57,22 @@ extern "C" {
 /* temp */
 #define ITEM_SLABBED (2<<8)
 
+/* The item has been accessed since it was last moved in the LRU */
+#define ITEM_ACTIVE (4<<8)
+
+/* The LRU segment the item is in (LRU_COLD, LRU_WARM or LRU_HOT) */
+#define ITEM_LRU_SHIFT 11
+#define ITEM_LRU_MASK (3<<ITEM_LRU_SHIFT)
+
+/* The cursor must see every item in the LRU (see item_lru_frozen()) */
+#define ITEM_WALKER (1<<13)
+
+/* The item has the compact header (see ITEM_COMPACT_HEADER_SIZE) */
+#define ITEM_COMPACT (1<<14)
+
+/* The item has room for its seqno tag after the CAS (see seqnos.h) */
+#define ITEM_WITH_SEQNO (1<<15)
+
 struct config {
    bool use_cas;
    size_t verbose;
@@ -62,6 +86,40 @@ struct config {
    bool ignore_vbucket;
    bool vb0;
    char *uuid;
+   /* The hash table starts out with 2^hashpower buckets */
+   size_t hashpower;
+   /* Number of buckets moved per slice of a hash table resize */
+   size_t hash_bulk_move;
+   /* Microseconds to sleep between the slices of a resize */
+   size_t hash_bulk_sleep;
+   /* Percentage of the items in a slab class kept in the hot LRU */
+   size_t hot_lru_pct;
+   /* Percentage of the items in a slab class kept in the warm LRU */
+   size_t warm_lru_pct;
+   /* Seconds before a hit marks an item as active again */
+   size_t item_update_interval;
+   /* Run the LRU crawler to reclaim expired items */
+   bool lru_crawler;
+   /* Microseconds the LRU crawler sleeps between its steps */
+   size_t lru_crawler_sleep;
+   /* Items the LRU crawler looks at in each LRU segment per run (0 = all) */
+   size_t lru_crawler_tocrawl;
+   /* Seconds between the runs of the LRU crawler */
+   size_t lru_crawler_interval;
+   /* Move slab pages to the slab classes evicting the most items */
+   bool slab_automove;
+   /* Seconds in each of the windows the slab automover looks at */
+   size_t slab_automove_interval;
+   /* Back the preallocated slab memory with huge pages */
+   bool hugepages;
+   /* NUMA policy of the preallocated slab memory: none, interleave or bind */
+   char *numa_policy;
+   /* The NUMA nodes used by numa_policy, e.g. "0-3" (NULL = all online) */
+   char *numa_nodes;
+   /* Use the compact item header with 32 bit LRU links */
+   bool compact_items;
+   /* Give the items per vBucket seqnos, and let DCP stream them */
+   bool seqnos;
 };
 
 MEMCACHED_PUBLIC_API
@@ -72,8 +130,8 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface,
 /**
  * Statistic information collected by the default engine
  */
+/* Updated by all of the threads with the ENGINE_STATS_* macros below */
 struct engine_stats {
-   cb_mutex_t lock;
    uint64_t evictions;
    uint64_t reclaimed;
    uint64_t curr_bytes;
@@ -81,6 +139,32 @@ struct engine_stats {
    uint64_t total_items;
 };
 
+/*
+ * The counters don't order any other memory accesses, so relaxed atomics
+ * are enough (like the STATS_* macros of the daemon). Compilers without
+ * the __atomic builtins use the wrappers in atomics.h.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define ENGINE_STATS_LOAD(engine, stat) \
+    __atomic_load_n(&(engine)->stats.stat, __ATOMIC_RELAXED)
+#define ENGINE_STATS_STORE(engine, stat, val) \
+    __atomic_store_n(&(engine)->stats.stat, (val), __ATOMIC_RELAXED)
+#define ENGINE_STATS_ADD(engine, stat, amt) \
+    __atomic_fetch_add(&(engine)->stats.stat, (amt), __ATOMIC_RELAXED)
+#define ENGINE_STATS_SUB(engine, stat, amt) \
+    __atomic_fetch_sub(&(engine)->stats.stat, (amt), __ATOMIC_RELAXED)
+#else
+#include "atomics.h"
+#define ENGINE_STATS_LOAD(engine, stat) \
+    atomic_load_uint64(&(engine)->stats.stat)
+#define ENGINE_STATS_STORE(engine, stat, val) \
+    atomic_store_uint64(&(engine)->stats.stat, (val))
+#define ENGINE_STATS_ADD(engine, stat, amt) \
+    atomic_fetch_add_uint64(&(engine)->stats.stat, (amt))
+#define ENGINE_STATS_SUB(engine, stat, amt) \
+    atomic_fetch_sub_uint64(&(engine)->stats.stat, (amt))
+#endif
+
 struct engine_scrubber {
    cb_mutex_t lock;
    bool running;
@@ -96,6 +180,9 @@ struct vbucket_info {
 
 #define NUM_VBUCKETS 65536
 
+#include "seqnos.h"
+#include "dcp_producer.h"
+
 /**
  * Definition of the private instance data used by the default engine.
  *
@@ -116,15 +203,35 @@ struct default_engine {
    struct items items;
 
    /**
-    * The cache layer (item_* and assoc_*) is currently protected by
-    * this single mutex
+    * The cache layer is partitioned by key hash. The hash chains and the
+    * refcount / expiry of the items in them are protected by the item lock
+    * selected by item_lock(), and each slab class' LRU is protected by its
+    * own lock in struct items. When more than one lock is needed they must
+    * be taken in the order: item lock, LRU lock, cursor handle lock,
+    * slab cache lock, slabs / stats lock.
+    * item_get() may find and reference an item without any of them
+    * (see epoch.h).
     */
-   cb_mutex_t cache_lock;
+   cb_mutex_t item_locks[ITEM_LOCK_COUNT];
+
+   struct epoch epoch;
+
+   struct {
+      cb_mutex_t lock;
+      uint64_t id;
+   } cas;
 
    struct config config;
    struct engine_stats stats;
    struct engine_scrubber scrubber;
 
+   /**
+    * The vBucket seqnos lock of a vBucket ranks below the item locks, and
+    * the DCP producers lock below those (see dcp_notify()).
+    */
+   struct seqnos seqnos;
+   struct dcp_producers dcp;
+
    union {
        engine_info engine_info;
        char buffer[sizeof(engine_info) +
@@ -139,5 +246,8 @@ const void* item_get_key(const hash_item* item);
 void item_set_cas(ENGINE_HANDLE *handle, const void *cookie,
                   item* item, uint64_t val);
 uint64_t item_get_cas(const hash_item* item);
+uint64_t item_get_seqno_tag(const hash_item* item);
+void item_set_seqno_tag(hash_item* item, uint64_t tag);
 uint8_t item_get_clsid(const hash_item* item);
+bool handled_vbucket(struct default_engine *e, uint16_t vbid);
 #endif
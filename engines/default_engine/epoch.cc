@@ -0,0 +1,100 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Epoch based reclamation for the lock-free readers (see epoch.h). This
+ * is C++ so that the hot paths get inlined atomics rather than calls
+ * into atomics.cc.
+ */
+#include "config.h"
+#include "epoch.h"
+
+#ifdef HAVE_ATOMIC
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+template <typename T>
+static inline std::atomic<T> *as_atomic(T *ptr) {
+    return reinterpret_cast<std::atomic<T> *>(ptr);
+}
+
+void epoch_init(struct epoch *epoch) {
+    cb_mutex_initialize(&epoch->lock);
+}
+
+void epoch_destroy(struct epoch *epoch) {
+    cb_mutex_destroy(&epoch->lock);
+}
+
+unsigned int epoch_enter(struct epoch *epoch, uint32_t hash) {
+    unsigned int stripe = (hash >> 16) % EPOCH_STRIPES;
+    struct epoch_stripe *s = &epoch->stripes[stripe];
+
+    for (;;) {
+        uint64_t current = as_atomic(&epoch->current)->load();
+        unsigned int parity = (unsigned int)(current & 1);
+
+        as_atomic(&s->active[parity])->fetch_add(1);
+        /*
+         * If the epoch moved on before we were counted the writer may
+         * already have checked our stripe, so we have to try again
+         * in the new epoch.
+         */
+        if (as_atomic(&epoch->current)->load() == current) {
+            return (stripe << 1) | parity;
+        }
+        as_atomic(&s->active[parity])->fetch_sub(1);
+    }
+}
+
+void epoch_exit(struct epoch *epoch, unsigned int token) {
+    struct epoch_stripe *s = &epoch->stripes[token >> 1];
+    as_atomic(&s->active[token & 1])->fetch_sub(1);
+}
+
+void epoch_synchronize(struct epoch *epoch) {
+    cb_mutex_enter(&epoch->lock);
+    uint64_t current = as_atomic(&epoch->current)->load();
+    unsigned int parity = (unsigned int)(current & 1);
+    as_atomic(&epoch->current)->store(current + 1);
+
+    /*
+     * The readers only spend a few hundred nanoseconds in an epoch, but
+     * they might get scheduled out while they're in one.
+     */
+    for (int ii = 0; ii < EPOCH_STRIPES; ++ii) {
+        std::atomic<uint32_t> *active;
+        active = as_atomic(&epoch->stripes[ii].active[parity]);
+        int spins = 0;
+        while (active->load() != 0) {
+            if (++spins > 1000) {
+#ifdef WIN32
+                Sleep(0);
+#else
+                usleep(1);
+#endif
+            }
+        }
+    }
+    cb_mutex_exit(&epoch->lock);
+}
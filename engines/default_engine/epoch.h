@@ -0,0 +1,62 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <platform/platform.h>
+
+/*
+ * Epoch based reclamation allows item_get() to walk the hash chains and
+ * take a reference on an item without holding the item lock. A reader
+ * announces that it is looking at the cache by entering the current
+ * epoch, and an item that has been removed from the hash table can't be
+ * handed back to the slab allocator until epoch_synchronize() has seen
+ * all of the readers that might have found it leave.
+ *
+ * The readers are counted in a number of stripes (selected by the key
+ * hash) so that they don't all fight over the same cache line.
+ */
+#define EPOCH_STRIPES 64
+
+struct epoch_stripe {
+    /* The number of readers in the even and odd epochs */
+    uint32_t active[2];
+    char pad[64 - 2 * sizeof(uint32_t)];
+};
+
+struct epoch {
+    uint64_t current;
+    struct epoch_stripe stripes[EPOCH_STRIPES];
+
+    /* Serializes epoch_synchronize() */
+    cb_mutex_t lock;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void epoch_init(struct epoch *epoch);
+void epoch_destroy(struct epoch *epoch);
+
+/**
+ * Enter the current epoch. The reader must not block on any of the
+ * engine's locks until it has left the epoch again.
+ * @param epoch the engine's epoch
+ * @param hash the hash of the key being looked up
+ * @return the token to pass to epoch_exit()
+ */
+unsigned int epoch_enter(struct epoch *epoch, uint32_t hash);
+void epoch_exit(struct epoch *epoch, unsigned int token);
+
+/**
+ * Advance the epoch and wait for all of the readers in the previous one
+ * to leave. Anything that was unreachable for new readers before the
+ * call may be freed when it returns.
+ */
+void epoch_synchronize(struct epoch *epoch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
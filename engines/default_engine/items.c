@@ -9,6 +9,7 @@
 #include <inttypes.h>
 
 #include "default_engine_internal.h"
+#include "atomics.h"
 
 /* Forward Declarations */
 static void item_link_q(struct default_engine *engine, hash_item *it);
@@ -20,49 +21,275 @@ static hash_item *do_item_alloc(struct default_engine *engine,
                                 const void *cookie,
                                 uint8_t datatype);
 static hash_item *do_item_get(struct default_engine *engine,
-                              const char *key, const size_t nkey);
+                              const char *key, const size_t nkey,
+                              uint32_t hash);
 static int do_item_link(struct default_engine *engine, hash_item *it);
 static void do_item_unlink(struct default_engine *engine, hash_item *it);
+static void do_item_unlink_nolock(struct default_engine *engine, hash_item *it);
 static void do_item_release(struct default_engine *engine, hash_item *it);
 static void do_item_update(struct default_engine *engine, hash_item *it);
 static int do_item_replace(struct default_engine *engine,
                             hash_item *it, hash_item *new_it);
 static void item_free(struct default_engine *engine, hash_item *it);
+static bool item_reclaim(struct default_engine *engine);
+static void *item_slabs_alloc(struct default_engine *engine,
+                              size_t ntotal, unsigned int id);
 
-/*
- * We only reposition items in the LRU queue if they haven't been repositioned
- * in this many seconds. That saves us from churning on frequently-accessed
- * items.
- */
-#define ITEM_UPDATE_INTERVAL 60
 /*
  * To avoid scanning through the complete cache in some circumstances we'll
  * just give up and return an error after inspecting a fixed number of objects.
  */
 static const int search_items = 50;
 
+/*
+ * Freed items are handed back to the slab allocator in batches by the LRU
+ * maintainer (see item_free()), or when we run out of memory.
+ */
+#define ITEM_RETIRE_BATCH 64
+#define ITEM_RETIRE_BYTES (1024 * 1024)
+
+/*
+ * item_get() takes its reference without holding the item lock, so the
+ * refcount may only be modified with atomic operations. The busy bit is
+ * set while an item is being freed or modified in place, and stops
+ * item_get() from taking new references to it.
+ */
+#define ITEM_REFCOUNT_BUSY 0x8000
+
+/*
+ * The LRU maintainer moves at most this many items per segment of a slab
+ * class in each pass, and sleeps between 1ms and 1s between the passes
+ * depending on how much work it found.
+ */
+#define LRU_MAINTAINER_BATCH 500
+#define LRU_MAINTAINER_MIN_SLEEP 1
+#define LRU_MAINTAINER_MAX_SLEEP 1000
+
+/*
+ * The LRU crawler holds the LRU lock while it looks at this many items, and
+ * sleeps lru_crawler_sleep microseconds between the steps.
+ */
+#define LRU_CRAWLER_STEP 100
+
+void item_locks_init(struct default_engine *engine) {
+    int ii;
+    for (ii = 0; ii < ITEM_LOCK_COUNT; ++ii) {
+        cb_mutex_initialize(&engine->item_locks[ii]);
+    }
+    for (ii = 0; ii < POWER_LARGEST; ++ii) {
+        cb_mutex_initialize(&engine->items.lock[ii]);
+    }
+    cb_mutex_initialize(&engine->items.retired.lock);
+    cb_mutex_initialize(&engine->items.cursor_handles.lock);
+    cb_mutex_initialize(&engine->items.maintainer.lock);
+    cb_cond_initialize(&engine->items.maintainer.cond);
+    cb_mutex_initialize(&engine->items.crawler.lock);
+    cb_cond_initialize(&engine->items.crawler.cond);
+}
+
+void item_locks_destroy(struct default_engine *engine) {
+    int ii;
+    for (ii = 0; ii < ITEM_LOCK_COUNT; ++ii) {
+        cb_mutex_destroy(&engine->item_locks[ii]);
+    }
+    for (ii = 0; ii < POWER_LARGEST; ++ii) {
+        cb_mutex_destroy(&engine->items.lock[ii]);
+    }
+    cb_mutex_destroy(&engine->items.retired.lock);
+    cb_mutex_destroy(&engine->items.cursor_handles.lock);
+    free(engine->items.cursor_handles.slots);
+    cb_mutex_destroy(&engine->items.maintainer.lock);
+    cb_cond_destroy(&engine->items.maintainer.cond);
+    cb_mutex_destroy(&engine->items.crawler.lock);
+    cb_cond_destroy(&engine->items.crawler.cond);
+}
+
+size_t item_header_size(struct default_engine *engine) {
+    return engine->config.compact_items ?
+        ITEM_COMPACT_HEADER_SIZE : sizeof(hash_item);
+}
+
+void item_lock(struct default_engine *engine, uint32_t hash) {
+    cb_mutex_enter(&engine->item_locks[hash & (ITEM_LOCK_COUNT - 1)]);
+}
+
+bool item_trylock(struct default_engine *engine, uint32_t hash) {
+    return cb_mutex_try_enter(&engine->item_locks[hash & (ITEM_LOCK_COUNT - 1)]) == 0;
+}
+
+void item_unlock(struct default_engine *engine, uint32_t hash) {
+    cb_mutex_exit(&engine->item_locks[hash & (ITEM_LOCK_COUNT - 1)]);
+}
+
+void item_lock_all(struct default_engine *engine) {
+    int ii;
+    for (ii = 0; ii < ITEM_LOCK_COUNT; ++ii) {
+        cb_mutex_enter(&engine->item_locks[ii]);
+    }
+}
+
+void item_unlock_all(struct default_engine *engine) {
+    int ii;
+    for (ii = ITEM_LOCK_COUNT - 1; ii >= 0; --ii) {
+        cb_mutex_exit(&engine->item_locks[ii]);
+    }
+}
+
+static uint32_t item_hash(struct default_engine *engine,
+                          const hash_item *it) {
+    return engine->server.core->hash(item_get_key(it), it->nkey, 0);
+}
+
+/* Cursors are linked into the LRU as fake items with no key and no data */
+static bool item_is_cursor(const hash_item *it) {
+    return it->nkey == 0 && it->nbytes == 0;
+}
+
+/* The LRU segment the item is linked into */
+static int item_lru(const hash_item *it) {
+    return (it->iflag & ITEM_LRU_MASK) >> ITEM_LRU_SHIFT;
+}
+
+static void item_set_lru(hash_item *it, int lru) {
+    it->iflag = (uint16_t)((it->iflag & ~ITEM_LRU_MASK) |
+                           (lru << ITEM_LRU_SHIFT));
+}
+
+/*
+ * The LRU links of the items in the compact layout (and of the cursors
+ * linked next to them) are handles rather than pointers, see
+ * ITEM_CURSOR_HANDLE_BASE.
+ */
+static hash_item *item_from_handle(struct default_engine *engine,
+                                   uint32_t handle) {
+    if (handle == 0) {
+        return NULL;
+    }
+    if (handle >= ITEM_CURSOR_HANDLE_BASE) {
+        return engine->items.cursor_handles.slots[handle - ITEM_CURSOR_HANDLE_BASE];
+    }
+    return (hash_item*)((char*)engine->slabs.mem_base +
+                        ((size_t)(handle - 1) << engine->slabs.item_shift));
+}
+
+static uint32_t item_to_handle(struct default_engine *engine,
+                               const hash_item *it) {
+    if (it == NULL) {
+        return 0;
+    }
+    if (item_is_cursor(it)) {
+        return it->flags;
+    }
+    return (uint32_t)((((const char*)it - (const char*)engine->slabs.mem_base)
+                       >> engine->slabs.item_shift) + 1);
+}
+
+static hash_item *item_next(struct default_engine *engine,
+                            const hash_item *it) {
+    if (engine->config.compact_items) {
+        return item_from_handle(engine, it->lru.compact.next);
+    }
+    return it->lru.full.next;
+}
+
+static hash_item *item_prev(struct default_engine *engine,
+                            const hash_item *it) {
+    if (engine->config.compact_items) {
+        return item_from_handle(engine, it->lru.compact.prev);
+    }
+    return it->lru.full.prev;
+}
+
+static void item_set_next(struct default_engine *engine, hash_item *it,
+                          hash_item *next) {
+    if (engine->config.compact_items) {
+        it->lru.compact.next = item_to_handle(engine, next);
+    } else {
+        it->lru.full.next = next;
+    }
+}
+
+static void item_set_prev(struct default_engine *engine, hash_item *it,
+                          hash_item *prev) {
+    if (engine->config.compact_items) {
+        it->lru.compact.prev = item_to_handle(engine, prev);
+    } else {
+        it->lru.full.prev = prev;
+    }
+}
+
+/* The cursors number the LRU segments of all slab classes in walk order */
+static int item_lru_id(const hash_item *it) {
+    return it->slabs_clsid * LRU_SEGMENTS + item_lru(it);
+}
+
+/*
+ * Items may not be moved between the segments of an LRU while a tap
+ * cursor (ITEM_WALKER) is walking it, as an item moved from a segment
+ * the cursor hasn't visited yet to one it has already visited would be
+ * missed. The scrubber and the LRU crawler don't mind.
+ */
+static bool item_lru_frozen(struct default_engine *engine, unsigned int id) {
+    return engine->items.cursors[id] != 0;
+}
+
+static uint16_t item_refcount(hash_item *it) {
+    return atomic_load_uint16(&it->refcount);
+}
+
+/*
+ * Set the busy bit if the item has the given refcount. An unreferenced
+ * item must be claimed before it is freed, as item_get() may race us
+ * and take a reference to it.
+ */
+static bool item_claim(hash_item *it, uint16_t refcount) {
+    return atomic_cas_uint16(&it->refcount, &refcount,
+                             refcount | ITEM_REFCOUNT_BUSY);
+}
+
+/* Take a reference to an item unless it is busy */
+static bool item_try_pin(hash_item *it) {
+    uint16_t refcount = item_refcount(it);
+    do {
+        if ((refcount & ITEM_REFCOUNT_BUSY) != 0) {
+            return false;
+        }
+    } while (!atomic_cas_uint16(&it->refcount, &refcount, refcount + 1));
+    return true;
+}
+
 void item_stats_reset(struct default_engine *engine) {
-    cb_mutex_enter(&engine->cache_lock);
-    memset(engine->items.itemstats, 0, sizeof(engine->items.itemstats));
-    cb_mutex_exit(&engine->cache_lock);
+    int ii;
+    for (ii = 0; ii < POWER_LARGEST; ++ii) {
+        cb_mutex_enter(&engine->items.lock[ii]);
+        memset(&engine->items.itemstats[ii], 0,
+               sizeof(engine->items.itemstats[ii]));
+        cb_mutex_exit(&engine->items.lock[ii]);
+    }
 }
 
 
 /* warning: don't use these macros with a function, as it evals its arg twice */
 static size_t ITEM_ntotal(struct default_engine *engine,
                           const hash_item *item) {
-    size_t ret = sizeof(*item) + item->nkey + item->nbytes;
+    size_t ret = item_header_size(engine) + item->nkey + item->nbytes;
     if (engine->config.use_cas) {
         ret += sizeof(uint64_t);
     }
+    if (engine->config.seqnos) {
+        ret += sizeof(uint64_t);
+    }
 
     return ret;
 }
 
 /* Get the next CAS id for a new item. */
-static uint64_t get_cas_id(void) {
-    static uint64_t cas_id = 0;
-    return ++cas_id;
+static uint64_t get_cas_id(struct default_engine *engine) {
+    uint64_t ret;
+    cb_mutex_enter(&engine->cas.lock);
+    ret = ++engine->cas.id;
+    cb_mutex_exit(&engine->cas.lock);
+    return ret;
 }
 
 /* Enable this for reference-count debugging. */
@@ -77,6 +304,179 @@ static uint64_t get_cas_id(void) {
 #endif
 
 
+/*
+ * Move an item to the head of another segment of its LRU. Must be called
+ * with both the LRU lock and the item lock held.
+ */
+static void do_item_lru_move(struct default_engine *engine, hash_item *it,
+                             int lru) {
+    item_unlink_q(engine, it);
+    it->iflag &= ~ITEM_ACTIVE;
+    item_set_lru(it, lru);
+    item_link_q(engine, it);
+}
+
+/*
+ * The items in the tail of the segments are looked at (and moved around)
+ * while holding the LRU lock, so we can only try to grab their item locks
+ * (the caller may hold another item lock). Items we can't lock are simply
+ * skipped. The items can't go away while we hold the LRU lock, so we may
+ * peek at them to avoid locking the ones that don't look like candidates,
+ * but the check must be repeated once the item lock is held.
+ */
+
+/*
+ * Do a quick check if we have any expired items in the tail of the
+ * segments, and unlink the first one we find.
+ */
+static void do_item_reclaim_tail(struct default_engine *engine,
+                                 unsigned int id, rel_time_t current_time) {
+    rel_time_t oldest_live = engine->config.oldest_live;
+    int lru;
+
+    for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+        int tries = search_items;
+        hash_item *search;
+        for (search = engine->items.tails[id][lru];
+             tries > 0 && search != NULL;
+             tries--, search = item_prev(engine, search)) {
+            bool reclaimed = false;
+            uint32_t hv;
+            if (item_is_cursor(search) || item_refcount(search) != 0 ||
+                !((search->time < oldest_live) ||
+                  (search->exptime != 0 && search->exptime < current_time))) {
+                continue;
+            }
+            hv = item_hash(engine, search);
+            if (!item_trylock(engine, hv)) {
+                continue;
+            }
+            if (item_refcount(search) == 0 &&
+                ((search->time < oldest_live) || /* dead by flush */
+                 (search->exptime != 0 && search->exptime < current_time))) {
+                /*
+                 * We can't steal the item, as a reader in item_get() may
+                 * still be looking at it. Free it and let the slab
+                 * allocator hand its memory back to us once it has been
+                 * reclaimed.
+                 */
+                ENGINE_STATS_ADD(engine, reclaimed, 1);
+                engine->items.itemstats[id].reclaimed++;
+                do_item_unlink_nolock(engine, search);
+                reclaimed = true;
+            }
+            item_unlock(engine, hv);
+            if (reclaimed) {
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Evict an item to make room for a new one. The victim is taken from the
+ * tail of the cold segment, or from the warm and hot segments if the LRU
+ * maintainer hasn't moved anything to the cold segment yet. Active items
+ * get a second chance in the warm segment instead (unless a cursor is
+ * walking the LRU, see item_lru_frozen()).
+ */
+static void do_item_evict(struct default_engine *engine, unsigned int id,
+                          rel_time_t current_time, const void *cookie) {
+    const bool frozen = item_lru_frozen(engine, id);
+    int lru;
+
+    for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+        int tries = search_items;
+        hash_item *search, *prev;
+        for (search = engine->items.tails[id][lru];
+             tries > 0 && search != NULL;
+             tries--, search = prev) {
+            bool evicted = false;
+            uint32_t hv;
+            prev = item_prev(engine, search);
+            if (item_is_cursor(search) || item_refcount(search) != 0) {
+                continue;
+            }
+            hv = item_hash(engine, search);
+            if (!item_trylock(engine, hv)) {
+                continue;
+            }
+            if (item_refcount(search) == 0) {
+                if (search->exptime == 0 || search->exptime > current_time) {
+                    if (!frozen && (search->iflag & ITEM_ACTIVE) != 0) {
+                        if (lru == LRU_WARM) {
+                            engine->items.itemstats[id].moves_within_lru++;
+                        } else {
+                            engine->items.itemstats[id].moves_to_warm++;
+                        }
+                        do_item_lru_move(engine, search, LRU_WARM);
+                        item_unlock(engine, hv);
+                        continue;
+                    }
+                    engine->items.itemstats[id].evicted++;
+                    engine->items.itemstats[id].evicted_time = current_time - search->time;
+                    if (search->exptime != 0) {
+                        engine->items.itemstats[id].evicted_nonzero++;
+                    }
+                    ENGINE_STATS_ADD(engine, evictions, 1);
+                    engine->server.stat->evicting(cookie,
+                                                  item_get_key(search),
+                                                  search->nkey);
+                } else {
+                    engine->items.itemstats[id].reclaimed++;
+                    ENGINE_STATS_ADD(engine, reclaimed, 1);
+                }
+                do_item_unlink_nolock(engine, search);
+                evicted = true;
+            }
+            item_unlock(engine, hv);
+            if (evicted) {
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Last ditch effort. There is a very rare bug which causes refcount leaks.
+ * We've fixed most of them, but it still happens, and it may happen in the
+ * future.
+ * We can reasonably assume no item can stay locked for more than three
+ * hours, so if we find one in the tail which is that old, free it anyway.
+ */
+static void do_item_repair_tail(struct default_engine *engine,
+                                unsigned int id, rel_time_t current_time) {
+    int lru;
+
+    for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+        int tries = search_items;
+        hash_item *search;
+        for (search = engine->items.tails[id][lru];
+             tries > 0 && search != NULL;
+             tries--, search = item_prev(engine, search)) {
+            bool repaired = false;
+            uint32_t hv;
+            if (item_is_cursor(search) || item_refcount(search) == 0) {
+                continue;
+            }
+            hv = item_hash(engine, search);
+            if (!item_trylock(engine, hv)) {
+                continue;
+            }
+            if (item_refcount(search) != 0 && search->time + TAIL_REPAIR_TIME < current_time) {
+                engine->items.itemstats[id].tailrepairs++;
+                atomic_store_uint16(&search->refcount, 0);
+                do_item_unlink_nolock(engine, search);
+                repaired = true;
+            }
+            item_unlock(engine, hv);
+            if (repaired) {
+                return;
+            }
+        }
+    }
+}
+
 /*@null@*/
 hash_item *do_item_alloc(struct default_engine *engine,
                          const void *key,
@@ -87,56 +487,30 @@ hash_item *do_item_alloc(struct default_engine *engine,
                          const void *cookie,
                          uint8_t datatype) {
     hash_item *it = NULL;
-    int tries = search_items;
-    hash_item *search;
-    rel_time_t oldest_live;
     rel_time_t current_time;
     unsigned int id;
 
-    size_t ntotal = sizeof(hash_item) + nkey + nbytes;
+    size_t ntotal = item_header_size(engine) + nkey + nbytes;
     if (engine->config.use_cas) {
         ntotal += sizeof(uint64_t);
     }
+    if (engine->config.seqnos) {
+        ntotal += sizeof(uint64_t);
+    }
 
     if ((id = slabs_clsid(engine, ntotal)) == 0) {
         return 0;
     }
 
-    /* do a quick check if we have any expired items in the tail.. */
-    tries = search_items;
-    oldest_live = engine->config.oldest_live;
+    cb_mutex_enter(&engine->items.lock[id]);
     current_time = engine->server.core->get_current_time();
+    do_item_reclaim_tail(engine, id, current_time);
 
-    for (search = engine->items.tails[id];
-         tries > 0 && search != NULL;
-         tries--, search=search->prev) {
-        if (search->refcount == 0 &&
-            ((search->time < oldest_live) || /* dead by flush */
-             (search->exptime != 0 && search->exptime < current_time))) {
-            it = search;
-            /* I don't want to actually free the object, just steal
-             * the item to avoid to grab the slab mutex twice ;-)
-             */
-            cb_mutex_enter(&engine->stats.lock);
-            engine->stats.reclaimed++;
-            cb_mutex_exit(&engine->stats.lock);
-            engine->items.itemstats[id].reclaimed++;
-            it->refcount = 1;
-            slabs_adjust_mem_requested(engine, it->slabs_clsid, ITEM_ntotal(engine, it), ntotal);
-            do_item_unlink(engine, it);
-            /* Initialize the item block: */
-            it->slabs_clsid = 0;
-            it->refcount = 0;
-            break;
-        }
-    }
-
-    if (it == NULL && (it = slabs_alloc(engine, ntotal, id)) == NULL) {
+    if ((it = item_slabs_alloc(engine, ntotal, id)) == NULL) {
         /*
         ** Could not find an expired item at the tail, and memory allocation
         ** failed. Try to evict some items!
         */
-        tries = search_items;
 
         /* If requested to not push old items out of cache when memory runs out,
          * we're out of luck at this point...
@@ -144,66 +518,18 @@ hash_item *do_item_alloc(struct default_engine *engine,
 
         if (engine->config.evict_to_free == 0) {
             engine->items.itemstats[id].outofmemory++;
+            cb_mutex_exit(&engine->items.lock[id]);
             return NULL;
         }
 
-        /*
-         * try to get one off the right LRU
-         * don't necessariuly unlink the tail because it may be locked: refcount>0
-         * search up from tail an item with refcount==0 and unlink it; give up after search_items
-         * tries
-         */
-
-        if (engine->items.tails[id] == 0) {
-            engine->items.itemstats[id].outofmemory++;
-            return NULL;
-        }
-
-        for (search = engine->items.tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
-            if (search->refcount == 0) {
-                if (search->exptime == 0 || search->exptime > current_time) {
-                    engine->items.itemstats[id].evicted++;
-                    engine->items.itemstats[id].evicted_time = current_time - search->time;
-                    if (search->exptime != 0) {
-                        engine->items.itemstats[id].evicted_nonzero++;
-                    }
-                    cb_mutex_enter(&engine->stats.lock);
-                    engine->stats.evictions++;
-                    cb_mutex_exit(&engine->stats.lock);
-                    engine->server.stat->evicting(cookie,
-                                                  item_get_key(search),
-                                                  search->nkey);
-                } else {
-                    engine->items.itemstats[id].reclaimed++;
-                    cb_mutex_enter(&engine->stats.lock);
-                    engine->stats.reclaimed++;
-                    cb_mutex_exit(&engine->stats.lock);
-                }
-                do_item_unlink(engine, search);
-                break;
-            }
-        }
-        it = slabs_alloc(engine, ntotal, id);
+        do_item_evict(engine, id, current_time, cookie);
+        it = item_slabs_alloc(engine, ntotal, id);
         if (it == 0) {
             engine->items.itemstats[id].outofmemory++;
-            /* Last ditch effort. There is a very rare bug which causes
-             * refcount leaks. We've fixed most of them, but it still happens,
-             * and it may happen in the future.
-             * We can reasonably assume no item can stay locked for more than
-             * three hours, so if we find one in the tail which is that old,
-             * free it anyway.
-             */
-            tries = search_items;
-            for (search = engine->items.tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
-                if (search->refcount != 0 && search->time + TAIL_REPAIR_TIME < current_time) {
-                    engine->items.itemstats[id].tailrepairs++;
-                    search->refcount = 0;
-                    do_item_unlink(engine, search);
-                    break;
-                }
-            }
-            it = slabs_alloc(engine, ntotal, id);
+            do_item_repair_tail(engine, id, current_time);
+            it = item_slabs_alloc(engine, ntotal, id);
             if (it == 0) {
+                cb_mutex_exit(&engine->items.lock[id]);
                 return NULL;
             }
         }
@@ -213,12 +539,22 @@ hash_item *do_item_alloc(struct default_engine *engine,
 
     it->slabs_clsid = id;
 
-    cb_assert(it != engine->items.heads[it->slabs_clsid]);
+    cb_assert(it != engine->items.heads[it->slabs_clsid][LRU_HOT]);
+    cb_mutex_exit(&engine->items.lock[id]);
 
-    it->next = it->prev = it->h_next = 0;
+    item_set_next(engine, it, NULL);
+    item_set_prev(engine, it, NULL);
     it->refcount = 1;     /* the caller will have a reference */
     DEBUG_REFCNT(it, '*');
     it->iflag = engine->config.use_cas ? ITEM_WITH_CAS : 0;
+    if (engine->config.compact_items) {
+        it->iflag |= ITEM_COMPACT;
+    }
+    if (engine->config.seqnos) {
+        /* In vBucket 0 unless the caller says otherwise */
+        it->iflag |= ITEM_WITH_SEQNO;
+        item_set_seqno_tag(it, 0);
+    }
     it->nkey = (uint16_t)nkey;
     it->nbytes = nbytes;
     it->flags = flags;
@@ -228,20 +564,85 @@ hash_item *do_item_alloc(struct default_engine *engine,
     return it;
 }
 
+
+/*
+ * Free an item that has been claimed. Readers in item_get() may still be
+ * looking at it (or walking past it in the hash chain), so it is put on
+ * the retired list until they have left their epoch. Waiting for them
+ * may take a while, and we're usually called with an item lock held, so
+ * the LRU maintainer reclaims the items once a batch is retired.
+ */
 static void item_free(struct default_engine *engine, hash_item *it) {
-    size_t ntotal = ITEM_ntotal(engine, it);
-    unsigned int clsid;
+    const size_t ntotal = ITEM_ntotal(engine, it);
+    bool reclaim;
     cb_assert((it->iflag & ITEM_LINKED) == 0);
-    cb_assert(it != engine->items.heads[it->slabs_clsid]);
-    cb_assert(it != engine->items.tails[it->slabs_clsid]);
-    cb_assert(it->refcount == 0);
-
-    /* so slab size changer can tell later if item is already free or not */
-    clsid = it->slabs_clsid;
-    it->slabs_clsid = 0;
-    it->iflag |= ITEM_SLABBED;
+    cb_assert(it != engine->items.heads[it->slabs_clsid][item_lru(it)]);
+    cb_assert(it != engine->items.tails[it->slabs_clsid][item_lru(it)]);
+    cb_assert(item_refcount(it) == ITEM_REFCOUNT_BUSY);
     DEBUG_REFCNT(it, 'F');
-    slabs_free(engine, it, ntotal, clsid);
+
+    cb_mutex_enter(&engine->items.retired.lock);
+    item_set_next(engine, it, engine->items.retired.head);
+    engine->items.retired.head = it;
+    engine->items.retired.count++;
+    engine->items.retired.bytes += ntotal;
+    /* Only wake the maintainer up when we get to a full batch */
+    reclaim = engine->items.retired.count == ITEM_RETIRE_BATCH ||
+        (engine->items.retired.bytes >= ITEM_RETIRE_BYTES &&
+         engine->items.retired.bytes - ntotal < ITEM_RETIRE_BYTES);
+    cb_mutex_exit(&engine->items.retired.lock);
+
+    if (reclaim) {
+        cb_mutex_enter(&engine->items.maintainer.lock);
+        engine->items.maintainer.reclaim = true;
+        cb_cond_signal(&engine->items.maintainer.cond);
+        cb_mutex_exit(&engine->items.maintainer.lock);
+    }
+}
+
+/*
+ * Hand the retired items back to the slab allocator.
+ * @return true if any items were freed
+ */
+static bool item_reclaim(struct default_engine *engine) {
+    hash_item *it, *next;
+
+    cb_mutex_enter(&engine->items.retired.lock);
+    it = engine->items.retired.head;
+    engine->items.retired.head = NULL;
+    engine->items.retired.count = 0;
+    engine->items.retired.bytes = 0;
+    cb_mutex_exit(&engine->items.retired.lock);
+
+    if (it == NULL) {
+        return false;
+    }
+
+    epoch_synchronize(&engine->epoch);
+    for (; it != NULL; it = next) {
+        size_t ntotal = ITEM_ntotal(engine, it);
+        unsigned int clsid = it->slabs_clsid;
+        next = item_next(engine, it);
+
+        /* so slab size changer can tell later if item is already free or not */
+        it->slabs_clsid = 0;
+        it->iflag |= ITEM_SLABBED;
+        slabs_free(engine, it, ntotal, clsid);
+    }
+    return true;
+}
+
+/*
+ * Memory held by the retired items isn't available until they've been
+ * reclaimed, so do that before giving up on an allocation.
+ */
+static void *item_slabs_alloc(struct default_engine *engine,
+                              size_t ntotal, unsigned int id) {
+    void *ret = slabs_alloc(engine, ntotal, id);
+    if (ret == NULL && item_reclaim(engine)) {
+        ret = slabs_alloc(engine, ntotal, id);
+    }
+    return ret;
 }
 
 static void item_link_q(struct default_engine *engine, hash_item *it) { /* item is the new head */
@@ -249,117 +650,198 @@ static void item_link_q(struct default_engine *engine, hash_item *it) { /* item
     cb_assert(it->slabs_clsid < POWER_LARGEST);
     cb_assert((it->iflag & ITEM_SLABBED) == 0);
 
-    head = &engine->items.heads[it->slabs_clsid];
-    tail = &engine->items.tails[it->slabs_clsid];
+    head = &engine->items.heads[it->slabs_clsid][item_lru(it)];
+    tail = &engine->items.tails[it->slabs_clsid][item_lru(it)];
     cb_assert(it != *head);
     cb_assert((*head && *tail) || (*head == 0 && *tail == 0));
-    it->prev = 0;
-    it->next = *head;
-    if (it->next) it->next->prev = it;
+    item_set_prev(engine, it, NULL);
+    item_set_next(engine, it, *head);
+    if (*head) item_set_prev(engine, *head, it);
     *head = it;
     if (*tail == 0) *tail = it;
-    engine->items.sizes[it->slabs_clsid]++;
+    engine->items.sizes[it->slabs_clsid][item_lru(it)]++;
     return;
 }
 
 static void item_unlink_q(struct default_engine *engine, hash_item *it) {
-    hash_item **head, **tail;
+    hash_item **head, **tail, *next, *prev;
     cb_assert(it->slabs_clsid < POWER_LARGEST);
-    head = &engine->items.heads[it->slabs_clsid];
-    tail = &engine->items.tails[it->slabs_clsid];
+    head = &engine->items.heads[it->slabs_clsid][item_lru(it)];
+    tail = &engine->items.tails[it->slabs_clsid][item_lru(it)];
 
+    next = item_next(engine, it);
+    prev = item_prev(engine, it);
     if (*head == it) {
-        cb_assert(it->prev == 0);
-        *head = it->next;
+        cb_assert(prev == 0);
+        *head = next;
     }
     if (*tail == it) {
-        cb_assert(it->next == 0);
-        *tail = it->prev;
+        cb_assert(next == 0);
+        *tail = prev;
     }
-    cb_assert(it->next != it);
-    cb_assert(it->prev != it);
+    cb_assert(next != it);
+    cb_assert(prev != it);
 
-    if (it->next) it->next->prev = it->prev;
-    if (it->prev) it->prev->next = it->next;
-    engine->items.sizes[it->slabs_clsid]--;
+    if (next) item_set_prev(engine, next, prev);
+    if (prev) item_set_next(engine, prev, next);
+    engine->items.sizes[it->slabs_clsid][item_lru(it)]--;
     return;
 }
 
-int do_item_link(struct default_engine *engine, hash_item *it) {
+/*
+ * The item functions below must be called with the item lock for the key
+ * held. The do_*_nolock variants expect the caller to hold the LRU lock
+ * for the item's slab class as well.
+ */
+
+/*
+ * item_get() may find the item as soon as it is in the hash table, so
+ * everything it looks at must be set up before it is inserted.
+ */
+static void item_prepare_link(struct default_engine *engine, hash_item *it) {
     MEMCACHED_ITEM_LINK(item_get_key(it), it->nkey, it->nbytes);
     cb_assert((it->iflag & (ITEM_LINKED|ITEM_SLABBED)) == 0);
     cb_assert(it->nbytes < (1024 * 1024));  /* 1MB max size */
     it->iflag |= ITEM_LINKED;
     it->time = engine->server.core->get_current_time();
-    assoc_insert(engine, engine->server.core->hash(item_get_key(it),
-                                                        it->nkey, 0),
-                 it);
-
-    cb_mutex_enter(&engine->stats.lock);
-    engine->stats.curr_bytes += ITEM_ntotal(engine, it);
-    engine->stats.curr_items += 1;
-    engine->stats.total_items += 1;
-    cb_mutex_exit(&engine->stats.lock);
 
     /* Allocate a new CAS ID on link. */
-    item_set_cas(NULL, NULL, it, get_cas_id());
+    item_set_cas(NULL, NULL, it, get_cas_id(engine));
+
+    if (it->iflag & ITEM_WITH_SEQNO) {
+        seqnos_link(engine, it);
+    }
+}
 
+/* Account for a linked item and put it at the head of its hot LRU */
+static void item_link_lru(struct default_engine *engine, hash_item *it) {
+    it->iflag &= ~ITEM_ACTIVE;
+    item_set_lru(it, LRU_HOT);
+
+    ENGINE_STATS_ADD(engine, curr_bytes, ITEM_ntotal(engine, it));
+    ENGINE_STATS_ADD(engine, curr_items, 1);
+    ENGINE_STATS_ADD(engine, total_items, 1);
+
+    cb_mutex_enter(&engine->items.lock[it->slabs_clsid]);
     item_link_q(engine, it);
+    cb_mutex_exit(&engine->items.lock[it->slabs_clsid]);
+}
 
+/*
+ * Remove an item which is no longer in the hash table from the stats and
+ * the LRU, and free it unless someone still holds a reference to it.
+ */
+static void item_unlink_lru_nolock(struct default_engine *engine,
+                                   hash_item *it) {
+    it->iflag &= ~ITEM_LINKED;
+    if (it->iflag & ITEM_WITH_SEQNO) {
+        seqnos_unlink(engine, it);
+    }
+    ENGINE_STATS_SUB(engine, curr_bytes, ITEM_ntotal(engine, it));
+    ENGINE_STATS_SUB(engine, curr_items, 1);
+    item_unlink_q(engine, it);
+    if (item_claim(it, 0)) {
+        item_free(engine, it);
+    }
+}
+
+int do_item_link(struct default_engine *engine, hash_item *it) {
+    item_prepare_link(engine, it);
+    if (!assoc_insert(engine, item_hash(engine, it), it)) {
+        /* Failed to allocate an overflow bucket in the hash table */
+        it->iflag &= ~ITEM_LINKED;
+        if (it->iflag & ITEM_WITH_SEQNO) {
+            seqnos_unlink(engine, it);
+        }
+        return 0;
+    }
+    item_link_lru(engine, it);
     return 1;
 }
 
-void do_item_unlink(struct default_engine *engine, hash_item *it) {
+static void do_item_unlink_nolock(struct default_engine *engine,
+                                  hash_item *it) {
     MEMCACHED_ITEM_UNLINK(item_get_key(it), it->nkey, it->nbytes);
     if ((it->iflag & ITEM_LINKED) != 0) {
-        it->iflag &= ~ITEM_LINKED;
-        cb_mutex_enter(&engine->stats.lock);
-        engine->stats.curr_bytes -= ITEM_ntotal(engine, it);
-        engine->stats.curr_items -= 1;
-        cb_mutex_exit(&engine->stats.lock);
-        assoc_delete(engine, engine->server.core->hash(item_get_key(it),
-                                                            it->nkey, 0),
+        assoc_delete(engine, item_hash(engine, it),
                      item_get_key(it), it->nkey);
-        item_unlink_q(engine, it);
-        if (it->refcount == 0) {
-            item_free(engine, it);
-        }
+        item_unlink_lru_nolock(engine, it);
+    }
+}
+
+void do_item_unlink(struct default_engine *engine, hash_item *it) {
+    if ((it->iflag & ITEM_LINKED) != 0) {
+        const unsigned int clsid = it->slabs_clsid;
+        cb_mutex_enter(&engine->items.lock[clsid]);
+        do_item_unlink_nolock(engine, it);
+        cb_mutex_exit(&engine->items.lock[clsid]);
     }
 }
 
 void do_item_release(struct default_engine *engine, hash_item *it) {
+    uint16_t refcount;
     MEMCACHED_ITEM_REMOVE(item_get_key(it), it->nkey, it->nbytes);
-    if (it->refcount != 0) {
-        it->refcount--;
+    refcount = item_refcount(it);
+    if (refcount != 0) {
+        refcount = atomic_fetch_sub_uint16(&it->refcount, 1) - 1;
         DEBUG_REFCNT(it, '-');
     }
-    if (it->refcount == 0 && (it->iflag & ITEM_LINKED) == 0) {
+    if (refcount == 0 && (it->iflag & ITEM_LINKED) == 0 &&
+        item_claim(it, 0)) {
         item_free(engine, it);
     }
 }
 
+/*
+ * A hit doesn't move the item in the LRU, it only marks the item as active
+ * (and updates its access time) if it hasn't been marked within the last
+ * item_update_interval seconds. The LRU maintainer (or the eviction code)
+ * moves the active items to the warm segment once they reach the tail of
+ * their segment. That saves us from taking the LRU lock for frequently
+ * accessed items.
+ */
 void do_item_update(struct default_engine *engine, hash_item *it) {
     rel_time_t current_time = engine->server.core->get_current_time();
     MEMCACHED_ITEM_UPDATE(item_get_key(it), it->nkey, it->nbytes);
-    if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
+    if (it->time < current_time - engine->config.item_update_interval) {
         cb_assert((it->iflag & ITEM_SLABBED) == 0);
 
         if ((it->iflag & ITEM_LINKED) != 0) {
-            item_unlink_q(engine, it);
             it->time = current_time;
-            item_link_q(engine, it);
+            it->iflag |= ITEM_ACTIVE;
         }
     }
 }
 
+/*
+ * The new item takes the place of the old one in the hash chain in a
+ * single step, so that item_get() never misses the key.
+ */
 int do_item_replace(struct default_engine *engine,
                     hash_item *it, hash_item *new_it) {
+    unsigned int clsid;
     MEMCACHED_ITEM_REPLACE(item_get_key(it), it->nkey, it->nbytes,
                            item_get_key(new_it), new_it->nkey, new_it->nbytes);
     cb_assert((it->iflag & ITEM_SLABBED) == 0);
 
-    do_item_unlink(engine, it);
-    return do_item_link(engine, new_it);
+    if (it == new_it) {
+        /* Storing the same item again only gives it a new CAS */
+        do_item_unlink(engine, it);
+        return do_item_link(engine, new_it);
+    }
+
+    if ((it->iflag & ITEM_LINKED) == 0) {
+        return do_item_link(engine, new_it);
+    }
+
+    clsid = it->slabs_clsid;
+    item_prepare_link(engine, new_it);
+    assoc_replace(engine, item_hash(engine, it), it, new_it);
+    cb_mutex_enter(&engine->items.lock[clsid]);
+    item_unlink_lru_nolock(engine, it);
+    cb_mutex_exit(&engine->items.lock[clsid]);
+    item_link_lru(engine, new_it);
+    return 1;
 }
 
 /*@null@*/
@@ -376,7 +858,7 @@ static char *do_item_cachedump(const unsigned int slabs_clsid,
     char key_temp[KEY_MAX_LENGTH + 1];
     char temp[512];
 
-    it = engine->items.heads[slabs_clsid];
+    it = engine->items.heads[slabs_clsid][LRU_HOT];
 
     buffer = malloc((size_t)memlimit);
     if (buffer == 0) return NULL;
@@ -412,50 +894,93 @@ static char *do_item_cachedump(const unsigned int slabs_clsid,
     return NULL;
 }
 
+/*
+ * Unlink the expired (and flushed) items at the tail of a segment so
+ * that they don't show up in the stats. Must be called with the LRU lock
+ * held.
+ */
+static void do_item_purge_tail(struct default_engine *engine,
+                               unsigned int id, int lru,
+                               rel_time_t current_time) {
+    int search = search_items;
+    hash_item *tail;
+
+    while (search > 0 &&
+           (tail = engine->items.tails[id][lru]) != NULL &&
+           ((engine->config.oldest_live != 0 && /* Item flushd */
+             engine->config.oldest_live <= current_time &&
+             tail->time <= engine->config.oldest_live) ||
+            (tail->exptime != 0 && /* and not expired */
+             tail->exptime < current_time))) {
+        uint32_t hv = item_hash(engine, tail);
+        bool unlinked = false;
+        --search;
+        if (item_trylock(engine, hv)) {
+            if (item_refcount(tail) == 0) {
+                do_item_unlink_nolock(engine, tail);
+                unlinked = true;
+            }
+            item_unlock(engine, hv);
+        }
+        if (!unlinked) {
+            break;
+        }
+    }
+}
+
 static void do_item_stats(struct default_engine *engine,
                           ADD_STAT add_stats, const void *c) {
     int i;
     rel_time_t current_time = engine->server.core->get_current_time();
     for (i = 0; i < POWER_LARGEST; i++) {
-        if (engine->items.tails[i] != NULL) {
-            const char *prefix = "items";
-            int search = search_items;
-            while (search > 0 &&
-                   engine->items.tails[i] != NULL &&
-                   ((engine->config.oldest_live != 0 && /* Item flushd */
-                     engine->config.oldest_live <= current_time &&
-                     engine->items.tails[i]->time <= engine->config.oldest_live) ||
-                    (engine->items.tails[i]->exptime != 0 && /* and not expired */
-                     engine->items.tails[i]->exptime < current_time))) {
-                --search;
-                if (engine->items.tails[i]->refcount == 0) {
-                    do_item_unlink(engine, engine->items.tails[i]);
-                } else {
-                    break;
-                }
-            }
-            if (engine->items.tails[i] == NULL) {
-                /* We removed all of the items in this slab class */
-                continue;
+        const char *prefix = "items";
+        const unsigned int *sizes = engine->items.sizes[i];
+        hash_item *oldest = NULL;
+        int lru;
+
+        cb_mutex_enter(&engine->items.lock[i]);
+        for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+            do_item_purge_tail(engine, i, lru, current_time);
+            if (oldest == NULL) {
+                oldest = engine->items.tails[i][lru];
             }
-
-            add_statistics(c, add_stats, prefix, i, "number", "%u",
-                           engine->items.sizes[i]);
-            add_statistics(c, add_stats, prefix, i, "age", "%u",
-                           engine->items.tails[i]->time);
-            add_statistics(c, add_stats, prefix, i, "evicted",
-                           "%u", engine->items.itemstats[i].evicted);
-            add_statistics(c, add_stats, prefix, i, "evicted_nonzero",
-                           "%u", engine->items.itemstats[i].evicted_nonzero);
-            add_statistics(c, add_stats, prefix, i, "evicted_time",
-                           "%u", engine->items.itemstats[i].evicted_time);
-            add_statistics(c, add_stats, prefix, i, "outofmemory",
-                           "%u", engine->items.itemstats[i].outofmemory);
-            add_statistics(c, add_stats, prefix, i, "tailrepairs",
-                           "%u", engine->items.itemstats[i].tailrepairs);;
-            add_statistics(c, add_stats, prefix, i, "reclaimed",
-                           "%u", engine->items.itemstats[i].reclaimed);;
         }
+        if (oldest == NULL) {
+            /* There are no items in this slab class */
+            cb_mutex_exit(&engine->items.lock[i]);
+            continue;
+        }
+
+        add_statistics(c, add_stats, prefix, i, "number", "%u",
+                       sizes[LRU_HOT] + sizes[LRU_WARM] + sizes[LRU_COLD]);
+        add_statistics(c, add_stats, prefix, i, "number_hot", "%u",
+                       sizes[LRU_HOT]);
+        add_statistics(c, add_stats, prefix, i, "number_warm", "%u",
+                       sizes[LRU_WARM]);
+        add_statistics(c, add_stats, prefix, i, "number_cold", "%u",
+                       sizes[LRU_COLD]);
+        add_statistics(c, add_stats, prefix, i, "age", "%u", oldest->time);
+        add_statistics(c, add_stats, prefix, i, "evicted",
+                       "%u", engine->items.itemstats[i].evicted);
+        add_statistics(c, add_stats, prefix, i, "evicted_nonzero",
+                       "%u", engine->items.itemstats[i].evicted_nonzero);
+        add_statistics(c, add_stats, prefix, i, "evicted_time",
+                       "%u", engine->items.itemstats[i].evicted_time);
+        add_statistics(c, add_stats, prefix, i, "outofmemory",
+                       "%u", engine->items.itemstats[i].outofmemory);
+        add_statistics(c, add_stats, prefix, i, "tailrepairs",
+                       "%u", engine->items.itemstats[i].tailrepairs);;
+        add_statistics(c, add_stats, prefix, i, "reclaimed",
+                       "%u", engine->items.itemstats[i].reclaimed);;
+        add_statistics(c, add_stats, prefix, i, "moves_to_cold",
+                       "%u", engine->items.itemstats[i].moves_to_cold);
+        add_statistics(c, add_stats, prefix, i, "moves_to_warm",
+                       "%u", engine->items.itemstats[i].moves_to_warm);
+        add_statistics(c, add_stats, prefix, i, "moves_within_lru",
+                       "%u", engine->items.itemstats[i].moves_within_lru);
+        add_statistics(c, add_stats, prefix, i, "crawler_reclaimed",
+                       "%u", engine->items.itemstats[i].crawler_reclaimed);
+        cb_mutex_exit(&engine->items.lock[i]);
     }
 }
 
@@ -473,18 +998,23 @@ static void do_item_stats_sizes(struct default_engine *engine,
 
         /* build the histogram */
         for (i = 0; i < POWER_LARGEST; i++) {
-            hash_item *iter = engine->items.heads[i];
-            while (iter) {
-                size_t ntotal = ITEM_ntotal(engine, iter);
-                size_t bucket = ntotal / 32;
-                if ((ntotal % 32) != 0) {
-                    bucket++;
-                }
-                if (bucket < num_buckets) {
-                    histogram[bucket]++;
+            int lru;
+            cb_mutex_enter(&engine->items.lock[i]);
+            for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+                hash_item *iter = engine->items.heads[i][lru];
+                while (iter) {
+                    size_t ntotal = ITEM_ntotal(engine, iter);
+                    size_t bucket = ntotal / 32;
+                    if ((ntotal % 32) != 0) {
+                        bucket++;
+                    }
+                    if (bucket < num_buckets) {
+                        histogram[bucket]++;
+                    }
+                    iter = item_next(engine, iter);
                 }
-                iter = iter->next;
             }
+            cb_mutex_exit(&engine->items.lock[i]);
         }
 
         /* write the buffer */
@@ -505,11 +1035,10 @@ static void do_item_stats_sizes(struct default_engine *engine,
 
 /** wrapper around assoc_find which does the lazy expiration logic */
 hash_item *do_item_get(struct default_engine *engine,
-                       const char *key, const size_t nkey) {
+                       const char *key, const size_t nkey,
+                       uint32_t hash) {
     rel_time_t current_time = engine->server.core->get_current_time();
-    hash_item *it = assoc_find(engine, engine->server.core->hash(key,
-                                                                      nkey, 0),
-                               key, nkey);
+    hash_item *it = assoc_find(engine, hash, key, nkey);
     int was_found = 0;
 
     if (engine->config.verbose > 2) {
@@ -529,7 +1058,7 @@ hash_item *do_item_get(struct default_engine *engine,
     if (it != NULL && engine->config.oldest_live != 0 &&
         engine->config.oldest_live <= current_time &&
         it->time <= engine->config.oldest_live) {
-        do_item_unlink(engine, it);           /* MTSAFE - cache_lock held */
+        do_item_unlink(engine, it);           /* MTSAFE - item lock held */
         it = NULL;
     }
 
@@ -541,7 +1070,7 @@ hash_item *do_item_get(struct default_engine *engine,
     }
 
     if (it != NULL && it->exptime != 0 && it->exptime <= current_time) {
-        do_item_unlink(engine, it);           /* MTSAFE - cache_lock held */
+        do_item_unlink(engine, it);           /* MTSAFE - item lock held */
         it = NULL;
     }
 
@@ -553,7 +1082,7 @@ hash_item *do_item_get(struct default_engine *engine,
     }
 
     if (it != NULL) {
-        it->refcount++;
+        atomic_fetch_add_uint16(&it->refcount, 1);
         DEBUG_REFCNT(it, '+');
         do_item_update(engine, it);
     }
@@ -561,9 +1090,64 @@ hash_item *do_item_get(struct default_engine *engine,
     return it;
 }
 
+/*
+ * Look up an item without taking the item lock. The items found in the
+ * hash table can't be reclaimed while we're in the epoch, so we may pin
+ * the item with an atomic increment of its refcount. Anything that
+ * would modify the item or the LRU (lazy expiry, flush and the LRU bump)
+ * is left to do_item_get(). Must be called in the epoch.
+ *
+ * @return true if the lookup is complete (*ret is NULL for a miss)
+ */
+static bool do_item_get_lockfree(struct default_engine *engine,
+                                 const void *key, const size_t nkey,
+                                 uint32_t hash, rel_time_t current_time,
+                                 hash_item **ret) {
+    rel_time_t oldest_live = engine->config.oldest_live;
+    hash_item *it;
+
+    if (!assoc_find_lockfree(engine, hash, key, nkey, &it)) {
+        return false;
+    }
+
+    if (it == NULL) {
+        *ret = NULL;
+        return true;
+    }
+
+    if ((oldest_live == 0 || oldest_live > current_time ||
+         it->time > oldest_live) &&
+        (it->exptime == 0 || it->exptime > current_time) &&
+        it->time >= current_time - engine->config.item_update_interval &&
+        item_try_pin(it)) {
+        *ret = it;
+        return true;
+    }
+
+    return false;
+}
+
+static bool item_get_lockfree(struct default_engine *engine,
+                              const void *key, const size_t nkey,
+                              uint32_t hash, hash_item **ret) {
+    rel_time_t current_time = engine->server.core->get_current_time();
+    unsigned int token;
+    bool done;
+
+    if (engine->config.verbose > 2) {
+        return false;
+    }
+
+    token = epoch_enter(&engine->epoch, hash);
+    done = do_item_get_lockfree(engine, key, nkey, hash, current_time, ret);
+    epoch_exit(&engine->epoch, token);
+
+    return done;
+}
+
 /*
  * Stores an item in the cache according to the semantics of one of the set
- * commands. In threaded mode, this is protected by the cache lock.
+ * commands. In threaded mode, this is protected by the item lock.
  *
  * Returns the state of storage.
  */
@@ -573,13 +1157,14 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
                                        const void *cookie,
                                        hash_item** stored_item) {
     const char *key = item_get_key(it);
-    hash_item *old_it = do_item_get(engine, key, it->nkey);
+    hash_item *old_it = do_item_get(engine, key, it->nkey,
+                                    item_hash(engine, it));
     ENGINE_ERROR_CODE stored = ENGINE_NOT_STORED;
 
     hash_item *new_it = NULL;
 
     if (old_it != NULL && operation == OPERATION_ADD) {
-        /* add only adds a nonexistent item, but promote to head of LRU */
+        /* add only adds a nonexistent item, but marks it as active */
         do_item_update(engine, old_it);
     } else if (!old_it && (operation == OPERATION_REPLACE
         || operation == OPERATION_APPEND || operation == OPERATION_PREPEND))
@@ -595,8 +1180,11 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
             /* cas validates */
             /* it and old_it may belong to different classes. */
             /* I'm updating the stats for the one that's getting pushed out */
-            do_item_replace(engine, old_it, it);
-            stored = ENGINE_SUCCESS;
+            if (do_item_replace(engine, old_it, it)) {
+                stored = ENGINE_SUCCESS;
+            } else {
+                stored = ENGINE_ENOMEM;
+            }
         } else {
             if (engine->config.verbose > 1) {
                 EXTENSION_LOGGER_DESCRIPTOR *logger;
@@ -656,19 +1244,28 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
                     memcpy(item_get_data(new_it) + it->nbytes, item_get_data(old_it), old_it->nbytes);
                 }
 
+                if (new_it->iflag & ITEM_WITH_SEQNO) {
+                    item_set_seqno_tag(new_it, item_get_seqno_tag(it));
+                }
+
                 it = new_it;
             }
         }
 
         if (stored == ENGINE_NOT_STORED) {
+            int linked;
             if (old_it != NULL) {
-                do_item_replace(engine, old_it, it);
+                linked = do_item_replace(engine, old_it, it);
             } else {
-                do_item_link(engine, it);
+                linked = do_item_link(engine, it);
             }
 
-            *stored_item = it;
-            stored = ENGINE_SUCCESS;
+            if (linked) {
+                *stored_item = it;
+                stored = ENGINE_SUCCESS;
+            } else {
+                stored = ENGINE_ENOMEM;
+            }
         }
     }
 
@@ -737,11 +1334,18 @@ static ENGINE_ERROR_CODE do_add_delta(struct default_engine *engine,
         return ENGINE_EINVAL;
     }
 
-    if (it->refcount == 1 && res <= (int)it->nbytes) {
-        /* we can do inline replacement */
+    if (res <= (int)it->nbytes && item_claim(it, 1)) {
+        /*
+         * we can do inline replacement. The busy bit stops item_get()
+         * from taking a reference while we modify the item.
+         */
         memcpy(item_get_data(it), buf, res);
         memset(item_get_data(it) + res, ' ', it->nbytes - res);
-        item_set_cas(NULL, NULL, it, get_cas_id());
+        item_set_cas(NULL, NULL, it, get_cas_id(engine));
+        if (it->iflag & ITEM_WITH_SEQNO) {
+            seqnos_link(engine, it);
+        }
+        atomic_store_uint16(&it->refcount, 1);
         *ritem = it;
     } else {
         hash_item *new_it = do_item_alloc(engine, item_get_key(it),
@@ -753,6 +1357,9 @@ static ENGINE_ERROR_CODE do_add_delta(struct default_engine *engine,
             return ENGINE_ENOMEM;
         }
         memcpy(item_get_data(new_it), buf, res);
+        if (new_it->iflag & ITEM_WITH_SEQNO) {
+            item_set_seqno_tag(new_it, item_get_seqno_tag(it));
+        }
         do_item_replace(engine, it, new_it);
         *ritem = new_it;
     }
@@ -769,12 +1376,8 @@ hash_item *item_alloc(struct default_engine *engine,
                       const void *key, size_t nkey, int flags,
                       rel_time_t exptime, int nbytes, const void *cookie,
                       uint8_t datatype) {
-    hash_item *it;
-    cb_mutex_enter(&engine->cache_lock);
-    it = do_item_alloc(engine, key, nkey, flags, exptime, nbytes, cookie,
-                       datatype);
-    cb_mutex_exit(&engine->cache_lock);
-    return it;
+    return do_item_alloc(engine, key, nkey, flags, exptime, nbytes, cookie,
+                         datatype);
 }
 
 /*
@@ -784,29 +1387,132 @@ hash_item *item_alloc(struct default_engine *engine,
 hash_item *item_get(struct default_engine *engine,
                     const void *key, const size_t nkey) {
     hash_item *it;
-    cb_mutex_enter(&engine->cache_lock);
-    it = do_item_get(engine, key, nkey);
-    cb_mutex_exit(&engine->cache_lock);
+    uint32_t hv = engine->server.core->hash(key, nkey, 0);
+    if (item_get_lockfree(engine, key, nkey, hv, &it)) {
+        return it;
+    }
+    item_lock(engine, hv);
+    it = do_item_get(engine, key, nkey, hv);
+    item_unlock(engine, hv);
     return it;
 }
 
+/*
+ * Look up a batch of keys. We hash them all first and prefetch their
+ * buckets, so that the cache misses on the hash table overlap, and then
+ * find them all in a single epoch. Keys which need the item lock are
+ * looked up once we've left the epoch.
+ */
+void item_get_multi(struct default_engine *engine, const item_key *keys,
+                    int nkeys, hash_item **items, bool *found) {
+    rel_time_t current_time = engine->server.core->get_current_time();
+    uint32_t hv[ITEM_GET_MULTI_MAX];
+    bool done[ITEM_GET_MULTI_MAX];
+    unsigned int token;
+    int ii;
+
+    cb_assert(nkeys > 0 && nkeys <= ITEM_GET_MULTI_MAX);
+    for (ii = 0; ii < nkeys; ++ii) {
+        hv[ii] = engine->server.core->hash(keys[ii].key, keys[ii].nkey, 0);
+        assoc_prefetch(engine, hv[ii]);
+        done[ii] = false;
+    }
+
+    if (engine->config.verbose <= 2) {
+        token = epoch_enter(&engine->epoch, hv[0]);
+        for (ii = 0; ii < nkeys; ++ii) {
+            done[ii] = do_item_get_lockfree(engine, keys[ii].key,
+                                            keys[ii].nkey, hv[ii],
+                                            current_time, &items[ii]);
+        }
+        epoch_exit(&engine->epoch, token);
+    }
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        if (!done[ii]) {
+            item_lock(engine, hv[ii]);
+            items[ii] = do_item_get(engine, keys[ii].key, keys[ii].nkey,
+                                    hv[ii]);
+            item_unlock(engine, hv[ii]);
+        }
+        found[ii] = items[ii] != NULL;
+    }
+}
+
 /*
  * Decrements the reference count on an item and adds it to the freelist if
  * needed.
  */
 void item_release(struct default_engine *engine, hash_item *item) {
-    cb_mutex_enter(&engine->cache_lock);
+    uint32_t hv = item_hash(engine, item);
+    item_lock(engine, hv);
     do_item_release(engine, item);
-    cb_mutex_exit(&engine->cache_lock);
+    item_unlock(engine, hv);
 }
 
 /*
  * Unlinks an item from the LRU and hashtable.
  */
 void item_unlink(struct default_engine *engine, hash_item *item) {
-    cb_mutex_enter(&engine->cache_lock);
+    uint32_t hv = item_hash(engine, item);
+    item_lock(engine, hv);
     do_item_unlink(engine, item);
-    cb_mutex_exit(&engine->cache_lock);
+    item_unlock(engine, hv);
+}
+
+uint64_t item_delete(struct default_engine *engine, hash_item *item) {
+    uint32_t hv = item_hash(engine, item);
+    uint64_t seqno = 0;
+
+    item_lock(engine, hv);
+    if ((item->iflag & ITEM_LINKED) != 0) {
+        do_item_unlink(engine, item);
+        if (item->iflag & ITEM_WITH_SEQNO) {
+            seqno = seqnos_delete(engine,
+                                  SEQNO_TAG_VBUCKET(item_get_seqno_tag(item)),
+                                  item_get_key(item), item->nkey,
+                                  item_get_cas(item));
+        }
+    }
+    item_unlock(engine, hv);
+    return seqno;
+}
+
+/*
+ * The item can't be freed while the caller holds the lock of the vBucket
+ * (an unlinked item is cleared from the log first), but it may be about to
+ * be unlinked: it is only pinned if it is still the item in the hash table
+ * for its key once we hold its item lock.
+ */
+ENGINE_ERROR_CODE item_pin_seqno(struct default_engine *engine,
+                                 hash_item *it, uint64_t tag) {
+    rel_time_t current_time = engine->server.core->get_current_time();
+    rel_time_t oldest_live = engine->config.oldest_live;
+    ENGINE_ERROR_CODE ret = ENGINE_KEY_ENOENT;
+    uint32_t hv;
+
+    if ((it->iflag & (ITEM_LINKED|ITEM_SLABBED)) != ITEM_LINKED ||
+        item_get_seqno_tag(it) != tag) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    hv = item_hash(engine, it);
+    if (!item_trylock(engine, hv)) {
+        return ENGINE_TMPFAIL;
+    }
+
+    /* Make sure it is the item the hash table has for its key */
+    if ((it->iflag & ITEM_LINKED) != 0 && item_get_seqno_tag(it) == tag &&
+        assoc_find(engine, hv, item_get_key(it), it->nkey) == it &&
+        (oldest_live == 0 || oldest_live > current_time ||
+         it->time > oldest_live) &&
+        (it->exptime == 0 || it->exptime > current_time) &&
+        item_try_pin(it)) {
+        ret = ENGINE_SUCCESS;
+    }
+    item_unlock(engine, hv);
+
+    return ret;
 }
 
 static ENGINE_ERROR_CODE do_arithmetic(struct default_engine *engine,
@@ -820,9 +1526,11 @@ static ENGINE_ERROR_CODE do_arithmetic(struct default_engine *engine,
                                        const rel_time_t exptime,
                                        item **result_item,
                                        uint8_t datatype,
-                                       uint64_t *result)
+                                       uint64_t *result,
+                                       uint16_t vbucket,
+                                       uint32_t hash)
 {
-   hash_item *item = do_item_get(engine, key, nkey);
+   hash_item *item = do_item_get(engine, key, nkey, hash);
    ENGINE_ERROR_CODE ret;
 
    if (item == NULL) {
@@ -839,6 +1547,9 @@ static ENGINE_ERROR_CODE do_arithmetic(struct default_engine *engine,
             return ENGINE_ENOMEM;
          }
          memcpy((void*)item_get_data(item), buffer, len);
+         if (item->iflag & ITEM_WITH_SEQNO) {
+            item_set_seqno_tag(item, SEQNO_TAG(vbucket, 0));
+         }
          if ((ret = do_store_item(engine, item, OPERATION_ADD, cookie,
                                   (hash_item**)result_item)) == ENGINE_SUCCESS) {
              *result = initial;
@@ -865,15 +1576,17 @@ ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              const rel_time_t exptime,
                              item **item,
                              uint8_t datatype,
-                             uint64_t *result)
+                             uint64_t *result,
+                             uint16_t vbucket)
 {
     ENGINE_ERROR_CODE ret;
+    uint32_t hv = engine->server.core->hash(key, nkey, 0);
 
-    cb_mutex_enter(&engine->cache_lock);
+    item_lock(engine, hv);
     ret = do_arithmetic(engine, cookie, key, nkey, increment,
                         create, delta, initial, exptime, item,
-                        datatype, result);
-    cb_mutex_exit(&engine->cache_lock);
+                        datatype, result, vbucket, hv);
+    item_unlock(engine, hv);
     return ret;
 }
 
@@ -886,127 +1599,406 @@ ENGINE_ERROR_CODE store_item(struct default_engine *engine,
                              const void *cookie) {
     ENGINE_ERROR_CODE ret;
     hash_item* stored_item = NULL;
+    uint32_t hv = item_hash(engine, item);
+
+    item_lock(engine, hv);
+    ret = do_store_item(engine, item, operation, cookie, &stored_item);
+    if (ret == ENGINE_SUCCESS) {
+        *cas = item_get_cas(stored_item);
+    }
+    item_unlock(engine, hv);
+    return ret;
+}
+
+static hash_item *do_touch_item(struct default_engine *engine,
+                                     const void *key,
+                                     uint16_t nkey,
+                                     uint32_t exptime,
+                                     uint32_t hash)
+{
+   hash_item *item = do_item_get(engine, key, nkey, hash);
+   if (item != NULL) {
+       item->exptime = exptime;
+   }
+   return item;
+}
+
+hash_item *touch_item(struct default_engine *engine,
+                           const void *key,
+                           uint16_t nkey,
+                           uint32_t exptime)
+{
+    hash_item *ret;
+    uint32_t hv = engine->server.core->hash(key, nkey, 0);
+
+    item_lock(engine, hv);
+    ret = do_touch_item(engine, key, nkey, exptime, hv);
+    item_unlock(engine, hv);
+    return ret;
+}
+
+/*
+ * Flushes expired items after a flush_all call
+ */
+void item_flush_expired(struct default_engine *engine, time_t when) {
+    int i, lru;
+    hash_item *iter, *next;
+    rel_time_t current_time;
+
+    /* flush_all is rare enough that we may simply stop the world */
+    item_lock_all(engine);
+
+    current_time = engine->server.core->get_current_time();
+    if (when == 0) {
+        engine->config.oldest_live = current_time - 1;
+    } else {
+        engine->config.oldest_live = engine->server.core->realtime(when) - 1;
+    }
+
+    /*
+     * The oldest_live checking will auto-expire the items older than the
+     * oldest_live time, so we only need to unlink the newer ones. A hit
+     * updates the item's timestamp without moving it in the LRU, so they
+     * may be anywhere in the segments. There aren't any (yet) if the
+     * flush is scheduled for the future.
+     */
+    if (engine->config.oldest_live != 0 &&
+        engine->config.oldest_live <= current_time) {
+        for (i = 0; i < POWER_LARGEST; i++) {
+            cb_mutex_enter(&engine->items.lock[i]);
+            for (lru = 0; lru < LRU_SEGMENTS; ++lru) {
+                for (iter = engine->items.heads[i][lru]; iter != NULL;
+                     iter = next) {
+                    next = item_next(engine, iter);
+                    if (iter->time >= engine->config.oldest_live &&
+                        !item_is_cursor(iter) &&
+                        (iter->iflag & ITEM_SLABBED) == 0) {
+                        do_item_unlink_nolock(engine, iter);
+                    }
+                }
+            }
+            cb_mutex_exit(&engine->items.lock[i]);
+        }
+    }
+    item_unlock_all(engine);
+}
+
+/*
+ * Dumps part of the cache
+ */
+char *item_cachedump(struct default_engine *engine,
+                     const unsigned int slabs_clsid,
+                     const unsigned int limit,
+                     unsigned int *bytes) {
+    char *ret;
+
+    cb_mutex_enter(&engine->items.lock[slabs_clsid]);
+    ret = do_item_cachedump(slabs_clsid, limit, bytes);
+    cb_mutex_exit(&engine->items.lock[slabs_clsid]);
+    return ret;
+}
+
+void item_stats(struct default_engine *engine,
+                   ADD_STAT add_stat, const void *cookie)
+{
+    do_item_stats(engine, add_stat, cookie);
+}
+
+
+void item_stats_sizes(struct default_engine *engine,
+                      ADD_STAT add_stat, const void *cookie)
+{
+    do_item_stats_sizes(engine, add_stat, cookie);
+}
+
+/*
+ * Move the items in the tail of a segment out of it until the segment is
+ * within its limit. Active items are moved to the head of the warm
+ * segment, the others to the head of the cold segment. Must be called with
+ * the LRU lock held.
+ * @return the number of items moved
+ */
+static int do_item_lru_shrink(struct default_engine *engine, unsigned int id,
+                              int lru, unsigned int limit) {
+    hash_item *search = engine->items.tails[id][lru];
+    int tries = LRU_MAINTAINER_BATCH;
+    int moved = 0;
+
+    while (search != NULL && tries-- > 0 &&
+           engine->items.sizes[id][lru] > limit) {
+        hash_item *prev = item_prev(engine, search);
+        uint32_t hv;
+        if (item_is_cursor(search)) {
+            search = prev;
+            continue;
+        }
+        hv = item_hash(engine, search);
+        if (!item_trylock(engine, hv)) {
+            search = prev;
+            continue;
+        }
+        if ((search->iflag & ITEM_ACTIVE) != 0) {
+            if (lru == LRU_WARM) {
+                engine->items.itemstats[id].moves_within_lru++;
+            } else {
+                engine->items.itemstats[id].moves_to_warm++;
+            }
+            do_item_lru_move(engine, search, LRU_WARM);
+        } else {
+            engine->items.itemstats[id].moves_to_cold++;
+            do_item_lru_move(engine, search, LRU_COLD);
+        }
+        item_unlock(engine, hv);
+        ++moved;
+        search = prev;
+    }
+    return moved;
+}
+
+/*
+ * Give the active items in the tail of the cold segment another chance in
+ * the warm segment before they're evicted. Must be called with the LRU
+ * lock held.
+ * @return the number of items moved
+ */
+static int do_item_lru_rescue(struct default_engine *engine, unsigned int id) {
+    hash_item *search = engine->items.tails[id][LRU_COLD];
+    int tries = search_items;
+    int moved = 0;
+
+    for (; search != NULL && tries > 0; --tries) {
+        hash_item *prev = item_prev(engine, search);
+        uint32_t hv;
+        if (!item_is_cursor(search) &&
+            (search->iflag & ITEM_ACTIVE) != 0 &&
+            item_trylock(engine, hv = item_hash(engine, search))) {
+            if ((search->iflag & ITEM_ACTIVE) != 0) {
+                engine->items.itemstats[id].moves_to_warm++;
+                do_item_lru_move(engine, search, LRU_WARM);
+                ++moved;
+            }
+            item_unlock(engine, hv);
+        }
+        search = prev;
+    }
+    return moved;
+}
+
+/*
+ * Keep the hot and warm segments of a slab class within their share of
+ * the items.
+ * @return the number of items moved
+ */
+static int item_lru_juggle(struct default_engine *engine, unsigned int id) {
+    int moved = 0;
+
+    cb_mutex_enter(&engine->items.lock[id]);
+    if (!item_lru_frozen(engine, id)) {
+        const unsigned int *sizes = engine->items.sizes[id];
+        const size_t total = sizes[LRU_HOT] + sizes[LRU_WARM] + sizes[LRU_COLD];
+
+        moved += do_item_lru_shrink(engine, id, LRU_HOT,
+                                    total * engine->config.hot_lru_pct / 100);
+        moved += do_item_lru_shrink(engine, id, LRU_WARM,
+                                    total * engine->config.warm_lru_pct / 100);
+        moved += do_item_lru_rescue(engine, id);
+    }
+    cb_mutex_exit(&engine->items.lock[id]);
+
+    return moved;
+}
+
+static void item_lru_maintainer_main(void *arg) {
+    struct default_engine *engine = arg;
+    unsigned int sleeptime = LRU_MAINTAINER_MIN_SLEEP;
+
+    cb_mutex_enter(&engine->items.maintainer.lock);
+    while (!engine->items.maintainer.shutdown) {
+        int moved = 0;
+        int id;
+
+        engine->items.maintainer.reclaim = false;
+        cb_mutex_exit(&engine->items.maintainer.lock);
+
+        /* Everything retired since the last pass */
+        item_reclaim(engine);
+
+        for (id = POWER_SMALLEST; id < POWER_LARGEST; ++id) {
+            moved += item_lru_juggle(engine, id);
+        }
 
-    cb_mutex_enter(&engine->cache_lock);
-    ret = do_store_item(engine, item, operation, cookie, &stored_item);
-    if (ret == ENGINE_SUCCESS) {
-        *cas = item_get_cas(stored_item);
+        /* Back off while there's nothing to do */
+        if (moved != 0) {
+            sleeptime = LRU_MAINTAINER_MIN_SLEEP;
+        } else if (sleeptime < LRU_MAINTAINER_MAX_SLEEP) {
+            sleeptime *= 2;
+        }
+
+        cb_mutex_enter(&engine->items.maintainer.lock);
+        if (!engine->items.maintainer.shutdown &&
+            !engine->items.maintainer.reclaim) {
+            cb_cond_timedwait(&engine->items.maintainer.cond,
+                              &engine->items.maintainer.lock, sleeptime);
+        }
     }
-    cb_mutex_exit(&engine->cache_lock);
-    return ret;
+    cb_mutex_exit(&engine->items.maintainer.lock);
 }
 
-static hash_item *do_touch_item(struct default_engine *engine,
-                                     const void *key,
-                                     uint16_t nkey,
-                                     uint32_t exptime)
-{
-   hash_item *item = do_item_get(engine, key, nkey);
-   if (item != NULL) {
-       item->exptime = exptime;
-   }
-   return item;
+int item_start_lru_maintainer(struct default_engine *engine) {
+    int ret;
+
+    cb_mutex_enter(&engine->items.maintainer.lock);
+    engine->items.maintainer.shutdown = false;
+    ret = cb_create_thread(&engine->items.maintainer.tid,
+                           item_lru_maintainer_main, engine, 0);
+    engine->items.maintainer.started = (ret == 0);
+    cb_mutex_exit(&engine->items.maintainer.lock);
+
+    if (ret != 0) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Can't create thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
 }
 
-hash_item *touch_item(struct default_engine *engine,
-                           const void *key,
-                           uint16_t nkey,
-                           uint32_t exptime)
-{
-    hash_item *ret;
+void item_stop_lru_maintainer(struct default_engine *engine) {
+    bool started;
 
-    cb_mutex_enter(&engine->cache_lock);
-    ret = do_touch_item(engine, key, nkey, exptime);
-    cb_mutex_exit(&engine->cache_lock);
-    return ret;
+    cb_mutex_enter(&engine->items.maintainer.lock);
+    started = engine->items.maintainer.started;
+    engine->items.maintainer.shutdown = true;
+    engine->items.maintainer.started = false;
+    cb_cond_signal(&engine->items.maintainer.cond);
+    cb_mutex_exit(&engine->items.maintainer.lock);
+
+    if (started) {
+        cb_join_thread(engine->items.maintainer.tid);
+    }
 }
 
 /*
- * Flushes expired items after a flush_all call
+ * Give the cursor one of the handles reserved for the cursors, so that
+ * the items in the compact layout can link to it.
  */
-void item_flush_expired(struct default_engine *engine, time_t when) {
-    int i;
-    hash_item *iter, *next;
-
-    cb_mutex_enter(&engine->cache_lock);
+static bool item_register_cursor(struct default_engine *engine,
+                                 hash_item *cursor)
+{
+    bool ret = false;
+    unsigned int ii;
 
-    if (when == 0) {
-        engine->config.oldest_live = engine->server.core->get_current_time() - 1;
-    } else {
-        engine->config.oldest_live = engine->server.core->realtime(when) - 1;
+    if (!engine->config.compact_items) {
+        return true;
     }
 
-    if (engine->config.oldest_live != 0) {
-        for (i = 0; i < POWER_LARGEST; i++) {
-            /*
-             * The LRU is sorted in decreasing time order, and an item's
-             * timestamp is never newer than its last access time, so we
-             * only need to walk back until we hit an item older than the
-             * oldest_live time.
-             * The oldest_live checking will auto-expire the remaining items.
-             */
-            for (iter = engine->items.heads[i]; iter != NULL; iter = next) {
-                if (iter->time >= engine->config.oldest_live) {
-                    next = iter->next;
-                    if ((iter->iflag & ITEM_SLABBED) == 0) {
-                        do_item_unlink(engine, iter);
-                    }
-                } else {
-                    /* We've hit the first old item. Continue to the next queue. */
-                    break;
-                }
+    cb_mutex_enter(&engine->items.cursor_handles.lock);
+    if (engine->items.cursor_handles.slots == NULL) {
+        engine->items.cursor_handles.slots = calloc(ITEM_CURSOR_HANDLES,
+                                                    sizeof(hash_item*));
+    }
+    if (engine->items.cursor_handles.slots != NULL) {
+        for (ii = 0; ii < ITEM_CURSOR_HANDLES && !ret; ++ii) {
+            unsigned int slot = (engine->items.cursor_handles.hint + ii) %
+                ITEM_CURSOR_HANDLES;
+            if (engine->items.cursor_handles.slots[slot] == NULL) {
+                engine->items.cursor_handles.slots[slot] = cursor;
+                engine->items.cursor_handles.hint = slot + 1;
+                cursor->flags = ITEM_CURSOR_HANDLE_BASE + slot;
+                ret = true;
             }
         }
     }
-    cb_mutex_exit(&engine->cache_lock);
-}
-
-/*
- * Dumps part of the cache
- */
-char *item_cachedump(struct default_engine *engine,
-                     const unsigned int slabs_clsid,
-                     const unsigned int limit,
-                     unsigned int *bytes) {
-    char *ret;
-
-    cb_mutex_enter(&engine->cache_lock);
-    ret = do_item_cachedump(slabs_clsid, limit, bytes);
-    cb_mutex_exit(&engine->cache_lock);
+    cb_mutex_exit(&engine->items.cursor_handles.lock);
     return ret;
 }
 
-void item_stats(struct default_engine *engine,
-                   ADD_STAT add_stat, const void *cookie)
+static void item_unregister_cursor(struct default_engine *engine,
+                                   hash_item *cursor)
 {
-    cb_mutex_enter(&engine->cache_lock);
-    do_item_stats(engine, add_stat, cookie);
-    cb_mutex_exit(&engine->cache_lock);
+    if (engine->config.compact_items) {
+        cb_mutex_enter(&engine->items.cursor_handles.lock);
+        engine->items.cursor_handles.slots[cursor->flags -
+                                           ITEM_CURSOR_HANDLE_BASE] = NULL;
+        cb_mutex_exit(&engine->items.cursor_handles.lock);
+        cursor->flags = 0;
+    }
 }
 
+static bool do_item_link_cursor(struct default_engine *engine,
+                                hash_item *cursor, int id)
+{
+    const int ii = id / LRU_SEGMENTS;
+    const int lru = id % LRU_SEGMENTS;
+    if (!item_register_cursor(engine, cursor)) {
+        return false;
+    }
+    cursor->slabs_clsid = (uint8_t)ii;
+    item_set_lru(cursor, lru);
+    item_set_next(engine, cursor, NULL);
+    item_set_prev(engine, cursor, engine->items.tails[ii][lru]);
+    item_set_next(engine, engine->items.tails[ii][lru], cursor);
+    engine->items.tails[ii][lru] = cursor;
+    engine->items.sizes[ii][lru]++;
+    if (cursor->iflag & ITEM_WALKER) {
+        engine->items.cursors[ii]++;
+    }
+    return true;
+}
 
-void item_stats_sizes(struct default_engine *engine,
-                      ADD_STAT add_stat, const void *cookie)
+static void do_item_unlink_cursor(struct default_engine *engine,
+                                  hash_item *cursor)
 {
-    cb_mutex_enter(&engine->cache_lock);
-    do_item_stats_sizes(engine, add_stat, cookie);
-    cb_mutex_exit(&engine->cache_lock);
+    item_unlink_q(engine, cursor);
+    item_set_next(engine, cursor, NULL);
+    item_set_prev(engine, cursor, NULL);
+    if (cursor->iflag & ITEM_WALKER) {
+        engine->items.cursors[cursor->slabs_clsid]--;
+    }
+    item_unregister_cursor(engine, cursor);
 }
 
-static void do_item_link_cursor(struct default_engine *engine,
-                                hash_item *cursor, int ii)
+/*
+ * Link the cursor at the tail of the first non-empty LRU segment starting
+ * at the segment numbered id (see item_lru_id()).
+ */
+static bool item_link_cursor(struct default_engine *engine,
+                             hash_item *cursor, int id)
 {
-    cursor->slabs_clsid = (uint8_t)ii;
-    cursor->next = NULL;
-    cursor->prev = engine->items.tails[ii];
-    engine->items.tails[ii]->next = cursor;
-    engine->items.tails[ii] = cursor;
-    engine->items.sizes[ii]++;
+    bool linked = false;
+    bool failed = false;
+    for (; id < POWER_LARGEST * LRU_SEGMENTS && !linked && !failed; ++id) {
+        const int ii = id / LRU_SEGMENTS;
+        cb_mutex_enter(&engine->items.lock[ii]);
+        if (engine->items.heads[ii][id % LRU_SEGMENTS] != NULL) {
+            /* add the item at the tail */
+            linked = do_item_link_cursor(engine, cursor, id);
+            failed = !linked;
+        }
+        cb_mutex_exit(&engine->items.lock[ii]);
+    }
+
+    if (failed) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Too many cursors in the LRUs\n");
+    }
+    return linked;
 }
 
 typedef ENGINE_ERROR_CODE (*ITERFUNC)(struct default_engine *engine,
                                       hash_item *item, void *cookie);
 
+/*
+ * Move the cursor towards the head of the LRU segment and call itemfunc
+ * for each item it passes (with the item lock held). Must be called with
+ * the LRU lock for the cursor's slab class held. If the item lock for the
+ * next item can't be acquired the cursor is left where it is and
+ * ENGINE_TMPFAIL is returned so that the caller may drop the LRU lock
+ * and retry. The cursor is unlinked once it reaches the head.
+ */
 static bool do_item_walk_cursor(struct default_engine *engine,
                                 hash_item *cursor,
                                 int steplength,
@@ -1014,54 +2006,75 @@ static bool do_item_walk_cursor(struct default_engine *engine,
                                 void* itemdata,
                                 ENGINE_ERROR_CODE *error)
 {
+    hash_item **head = &engine->items.heads[cursor->slabs_clsid][item_lru(cursor)];
     int ii = 0;
     *error = ENGINE_SUCCESS;
 
-    while (cursor->prev != NULL && ii < steplength) {
+    while (item_prev(engine, cursor) != NULL && ii < steplength) {
         /* Move cursor */
-        hash_item *ptr = cursor->prev;
-        bool done = false;
+        hash_item *ptr = item_prev(engine, cursor);
+        hash_item *prev;
+        bool is_cursor = item_is_cursor(ptr);
+        uint32_t hv = 0;
+
+        if (!is_cursor) {
+            hv = item_hash(engine, ptr);
+            if (!item_trylock(engine, hv)) {
+                *error = ENGINE_TMPFAIL;
+                return true;
+            }
+        }
 
         ++ii;
         item_unlink_q(engine, cursor);
-
-        if (ptr == engine->items.heads[cursor->slabs_clsid]) {
-            done = true;
-            cursor->prev = NULL;
+        prev = item_prev(engine, ptr);
+        item_set_next(engine, cursor, ptr);
+        item_set_prev(engine, cursor, prev);
+        if (prev != NULL) {
+            item_set_next(engine, prev, cursor);
         } else {
-            cursor->next = ptr;
-            cursor->prev = ptr->prev;
-            cursor->prev->next = cursor;
-            ptr->prev = cursor;
+            *head = cursor;
         }
+        item_set_prev(engine, ptr, cursor);
+        engine->items.sizes[cursor->slabs_clsid][item_lru(cursor)]++;
 
         /* Ignore cursors */
-        if (ptr->nkey == 0 && ptr->nbytes == 0) {
+        if (is_cursor) {
             --ii;
         } else {
             *error = itemfunc(engine, ptr, itemdata);
+            item_unlock(engine, hv);
             if (*error != ENGINE_SUCCESS) {
                 return false;
             }
         }
-
-        if (done) {
-            return false;
-        }
     }
 
-    return (cursor->prev != NULL);
+    if (item_prev(engine, cursor) != NULL) {
+        return true;
+    }
+    if (*head == cursor) {
+        do_item_unlink_cursor(engine, cursor);
+    }
+    return false;
 }
 
 static ENGINE_ERROR_CODE item_scrub(struct default_engine *engine,
                                     hash_item *item,
                                     void *cookie) {
     rel_time_t current_time = engine->server.core->get_current_time();
+    rel_time_t oldest_live = engine->config.oldest_live;
     (void)cookie;
     engine->scrubber.visited++;
-    if (item->refcount == 0 &&
-        (item->exptime != 0 && item->exptime < current_time)) {
-        do_item_unlink(engine, item);
+    /*
+     * Items dead by flush_all are removed as well, so that the hash table
+     * may shrink after a flush.
+     */
+    if (item_refcount(item) == 0 &&
+        ((item->exptime != 0 && item->exptime < current_time) ||
+         (oldest_live != 0 && oldest_live <= current_time &&
+          item->time <= oldest_live))) {
+        do_item_unlink_nolock(engine, item);
         engine->scrubber.cleaned++;
     }
     return ENGINE_SUCCESS;
@@ -1073,10 +2086,10 @@ static void item_scrub_class(struct default_engine *engine,
     ENGINE_ERROR_CODE ret;
     bool more;
     do {
-        cb_mutex_enter(&engine->cache_lock);
+        cb_mutex_enter(&engine->items.lock[cursor->slabs_clsid]);
         more = do_item_walk_cursor(engine, cursor, 200, item_scrub, NULL, &ret);
-        cb_mutex_exit(&engine->cache_lock);
-        if (ret != ENGINE_SUCCESS) {
+        cb_mutex_exit(&engine->items.lock[cursor->slabs_clsid]);
+        if (ret != ENGINE_SUCCESS && ret != ENGINE_TMPFAIL) {
             break;
         }
     } while (more);
@@ -1086,24 +2099,13 @@ static void item_scubber_main(void *arg)
 {
     struct default_engine *engine = arg;
     hash_item cursor;
-    int ii;
+    int id = 0;
 
     memset(&cursor, 0, sizeof(cursor));
     cursor.refcount = 1;
-    for (ii = 0; ii < POWER_LARGEST; ++ii) {
-        bool skip = false;
-        cb_mutex_enter(&engine->cache_lock);
-        if (engine->items.heads[ii] == NULL) {
-            skip = true;
-        } else {
-            /* add the item at the tail */
-            do_item_link_cursor(engine, &cursor, ii);
-        }
-        cb_mutex_exit(&engine->cache_lock);
-
-        if (!skip) {
-            item_scrub_class(engine, &cursor);
-        }
+    while (item_link_cursor(engine, &cursor, id)) {
+        item_scrub_class(engine, &cursor);
+        id = item_lru_id(&cursor) + 1;
     }
 
     cb_mutex_enter(&engine->scrubber.lock);
@@ -1137,6 +2139,274 @@ bool item_start_scrub(struct default_engine *engine)
     return ret;
 }
 
+struct crawler_step {
+    uint64_t visited;
+    uint64_t reclaimed;
+};
+
+static ENGINE_ERROR_CODE item_crawl(struct default_engine *engine,
+                                    hash_item *item,
+                                    void *cookie) {
+    struct crawler_step *step = cookie;
+    rel_time_t current_time = engine->server.core->get_current_time();
+    rel_time_t oldest_live = engine->config.oldest_live;
+
+    step->visited++;
+    if (item_refcount(item) == 0 &&
+        ((item->exptime != 0 && item->exptime < current_time) ||
+         (oldest_live != 0 && oldest_live <= current_time &&
+          item->time <= oldest_live))) {
+        engine->items.itemstats[item->slabs_clsid].crawler_reclaimed++;
+        do_item_unlink_nolock(engine, item);
+        step->reclaimed++;
+    }
+    return ENGINE_SUCCESS;
+}
+
+static bool item_lru_crawler_stopping(struct default_engine *engine) {
+    bool ret;
+    cb_mutex_enter(&engine->items.crawler.lock);
+    ret = engine->items.crawler.shutdown || !engine->config.lru_crawler;
+    cb_mutex_exit(&engine->items.crawler.lock);
+    return ret;
+}
+
+/*
+ * Walk the cursor through a single LRU segment, LRU_CRAWLER_STEP items at
+ * a time. The LRU lock is released between the steps.
+ */
+static void item_crawl_lru(struct default_engine *engine, hash_item *cursor) {
+    const unsigned int clsid = cursor->slabs_clsid;
+    size_t tocrawl = engine->config.lru_crawler_tocrawl;
+    bool more;
+
+    do {
+        struct crawler_step step = { 0, 0 };
+        int steplength = LRU_CRAWLER_STEP;
+        ENGINE_ERROR_CODE ret;
+
+        if (tocrawl != 0 && tocrawl < (size_t)steplength) {
+            steplength = (int)tocrawl;
+        }
+
+        cb_mutex_enter(&engine->items.lock[clsid]);
+        more = do_item_walk_cursor(engine, cursor, steplength, item_crawl,
+                                   &step, &ret);
+        if (tocrawl != 0) {
+            tocrawl -= (size_t)step.visited;
+            if (tocrawl == 0 && more) {
+                do_item_unlink_cursor(engine, cursor);
+                more = false;
+            }
+        }
+        cb_mutex_exit(&engine->items.lock[clsid]);
+
+        cb_mutex_enter(&engine->items.crawler.lock);
+        engine->items.crawler.visited += step.visited;
+        engine->items.crawler.reclaimed += step.reclaimed;
+        cb_mutex_exit(&engine->items.crawler.lock);
+
+        if (more && item_lru_crawler_stopping(engine)) {
+            cb_mutex_enter(&engine->items.lock[clsid]);
+            do_item_unlink_cursor(engine, cursor);
+            cb_mutex_exit(&engine->items.lock[clsid]);
+            more = false;
+        }
+
+        if (more && engine->config.lru_crawler_sleep != 0) {
+#ifdef WIN32
+            Sleep((DWORD)(engine->config.lru_crawler_sleep / 1000));
+#else
+            usleep((useconds_t)engine->config.lru_crawler_sleep);
+#endif
+        }
+    } while (more);
+}
+
+static void item_lru_crawler_main(void *arg) {
+    struct default_engine *engine = arg;
+
+    cb_mutex_enter(&engine->items.crawler.lock);
+    while (!engine->items.crawler.shutdown) {
+        const time_t now = time(NULL);
+
+        if (!engine->config.lru_crawler) {
+            cb_cond_wait(&engine->items.crawler.cond,
+                         &engine->items.crawler.lock);
+        } else if (now < engine->items.crawler.next_run) {
+            cb_cond_timedwait(&engine->items.crawler.cond,
+                              &engine->items.crawler.lock,
+                              (unsigned int)(engine->items.crawler.next_run - now) * 1000);
+        } else {
+            hash_item cursor;
+            int id = 0;
+
+            engine->items.crawler.running = true;
+            cb_mutex_exit(&engine->items.crawler.lock);
+
+            memset(&cursor, 0, sizeof(cursor));
+            cursor.refcount = 1;
+            while (!item_lru_crawler_stopping(engine) &&
+                   item_link_cursor(engine, &cursor, id)) {
+                item_crawl_lru(engine, &cursor);
+                id = item_lru_id(&cursor) + 1;
+            }
+
+            cb_mutex_enter(&engine->items.crawler.lock);
+            engine->items.crawler.running = false;
+            engine->items.crawler.runs++;
+            engine->items.crawler.next_run = time(NULL) +
+                (time_t)engine->config.lru_crawler_interval;
+        }
+    }
+    cb_mutex_exit(&engine->items.crawler.lock);
+}
+
+int item_start_lru_crawler(struct default_engine *engine) {
+    int ret;
+
+    cb_mutex_enter(&engine->items.crawler.lock);
+    engine->items.crawler.shutdown = false;
+    engine->items.crawler.next_run = time(NULL) +
+        (time_t)engine->config.lru_crawler_interval;
+    ret = cb_create_thread(&engine->items.crawler.tid,
+                           item_lru_crawler_main, engine, 0);
+    engine->items.crawler.started = (ret == 0);
+    cb_mutex_exit(&engine->items.crawler.lock);
+
+    if (ret != 0) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Can't create thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void item_stop_lru_crawler(struct default_engine *engine) {
+    bool started;
+
+    cb_mutex_enter(&engine->items.crawler.lock);
+    started = engine->items.crawler.started;
+    engine->items.crawler.shutdown = true;
+    engine->items.crawler.started = false;
+    cb_cond_signal(&engine->items.crawler.cond);
+    cb_mutex_exit(&engine->items.crawler.lock);
+
+    if (started) {
+        cb_join_thread(engine->items.crawler.tid);
+    }
+}
+
+void item_lru_crawler_reschedule(struct default_engine *engine) {
+    cb_mutex_enter(&engine->items.crawler.lock);
+    if (!engine->items.crawler.running) {
+        engine->items.crawler.next_run = time(NULL) +
+            (time_t)engine->config.lru_crawler_interval;
+    }
+    cb_cond_signal(&engine->items.crawler.cond);
+    cb_mutex_exit(&engine->items.crawler.lock);
+}
+
+void item_lru_crawler_stats(struct default_engine *engine,
+                            ADD_STAT add_stat, const void *cookie) {
+    const char *prefix = "lru_crawler";
+    cb_mutex_enter(&engine->items.crawler.lock);
+    if (engine->items.crawler.running) {
+        add_statistics(cookie, add_stat, prefix, -1, "status", "running");
+    } else if (engine->config.lru_crawler) {
+        add_statistics(cookie, add_stat, prefix, -1, "status", "sleeping");
+    } else {
+        add_statistics(cookie, add_stat, prefix, -1, "status", "disabled");
+    }
+    add_statistics(cookie, add_stat, prefix, -1, "runs", "%"PRIu64,
+                   engine->items.crawler.runs);
+    add_statistics(cookie, add_stat, prefix, -1, "visited", "%"PRIu64,
+                   engine->items.crawler.visited);
+    add_statistics(cookie, add_stat, prefix, -1, "reclaimed", "%"PRIu64,
+                   engine->items.crawler.reclaimed);
+    cb_mutex_exit(&engine->items.crawler.lock);
+}
+
+/*
+ * The chunks in the page are looked at without any locks, so anything we
+ * read may be stale (or garbage if the chunk was never used). An item is
+ * only unlinked once the item lock for the hash of its key is held, and
+ * it is still linked with that hash.
+ */
+unsigned int item_evict_page(struct default_engine *engine, char *page,
+                             unsigned int size, unsigned int perslab) {
+    unsigned int evicted = 0;
+    unsigned int ii;
+
+    for (ii = 0; ii < perslab; ++ii) {
+        hash_item *it = (hash_item*)(page + ii * size);
+        uint32_t hv;
+
+        if ((it->iflag & (ITEM_LINKED|ITEM_SLABBED)) != ITEM_LINKED ||
+            it->nkey == 0 || ITEM_ntotal(engine, it) > size) {
+            continue;
+        }
+
+        hv = item_hash(engine, it);
+        item_lock(engine, hv);
+        if ((it->iflag & ITEM_LINKED) != 0 && item_hash(engine, it) == hv) {
+            do_item_unlink(engine, it);
+            ++evicted;
+        }
+        item_unlock(engine, hv);
+    }
+
+    /*
+     * Hand the unreferenced items back to the slab allocator right away,
+     * so the page can be reassigned (we're on the rebalancer thread, and
+     * don't hold any locks)
+     */
+    item_reclaim(engine);
+    return evicted;
+}
+
+unsigned int item_evictions(struct default_engine *engine, unsigned int id) {
+    unsigned int ret;
+    cb_mutex_enter(&engine->items.lock[id]);
+    ret = engine->items.itemstats[id].evicted;
+    cb_mutex_exit(&engine->items.lock[id]);
+    return ret;
+}
+
+/*
+ * Step the cursor until itemfunc has picked up an item or we've walked
+ * through all of the LRU segments of all of the slab classes. A cursor that isn't linked into any
+ * LRU has a NULL prev pointer.
+ */
+static void item_walk_cursor_step(struct default_engine *engine,
+                                  hash_item *cursor,
+                                  ITERFUNC itemfunc,
+                                  void *itemdata,
+                                  hash_item **it)
+{
+    ENGINE_ERROR_CODE r;
+
+    while (*it == NULL) {
+        bool more;
+        cb_mutex_enter(&engine->items.lock[cursor->slabs_clsid]);
+        more = do_item_walk_cursor(engine, cursor, 1, itemfunc, itemdata, &r);
+        cb_mutex_exit(&engine->items.lock[cursor->slabs_clsid]);
+
+        if (r == ENGINE_TMPFAIL) {
+            continue;
+        }
+
+        if (!more && *it == NULL) {
+            /* find next LRU segment to look at.. */
+            if (!item_link_cursor(engine, cursor, item_lru_id(cursor) + 1)) {
+                break;
+            }
+        }
+    }
+}
+
 struct tap_client {
     hash_item cursor;
     hash_item *it;
@@ -1147,17 +2417,17 @@ static ENGINE_ERROR_CODE item_tap_iterfunc(struct default_engine *engine,
                                     void *cookie) {
     struct tap_client *client = cookie;
     client->it = item;
-    ++client->it->refcount;
+    atomic_fetch_add_uint16(&client->it->refcount, 1);
     return ENGINE_SUCCESS;
 }
 
-static tap_event_t do_item_tap_walker(struct default_engine *engine,
-                                         const void *cookie, item **itm,
-                                         void **es, uint16_t *nes, uint8_t *ttl,
-                                         uint16_t *flags, uint32_t *seqno,
-                                         uint16_t *vbucket)
+tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
+                            const void *cookie, item **itm,
+                            void **es, uint16_t *nes, uint8_t *ttl,
+                            uint16_t *flags, uint32_t *seqno,
+                            uint16_t *vbucket)
 {
-    ENGINE_ERROR_CODE r;
+    struct default_engine *engine = (struct default_engine*)handle;
     struct tap_client *client = engine->server.cookie->get_engine_specific(cookie);
     if (client == NULL) {
         return TAP_DISCONNECT;
@@ -1171,160 +2441,26 @@ static tap_event_t do_item_tap_walker(struct default_engine *engine,
     *vbucket = 0;
     client->it = NULL;
 
-    do {
-        if (!do_item_walk_cursor(engine, &client->cursor, 1, item_tap_iterfunc, client, &r)) {
-            /* find next slab class to look at.. */
-            bool linked = false;
-            int ii;
-            for (ii = client->cursor.slabs_clsid + 1; ii < POWER_LARGEST && !linked;  ++ii) {
-                if (engine->items.heads[ii] != NULL) {
-                    /* add the item at the tail */
-                    do_item_link_cursor(engine, &client->cursor, ii);
-                    linked = true;
-                }
-            }
-            if (!linked) {
-                break;
-            }
-        }
-    } while (client->it == NULL);
+    item_walk_cursor_step(engine, &client->cursor, item_tap_iterfunc,
+                          client, &client->it);
     *itm = client->it;
 
     return (*itm == NULL) ? TAP_DISCONNECT : TAP_MUTATION;
 }
 
-tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
-                            const void *cookie, item **itm,
-                            void **es, uint16_t *nes, uint8_t *ttl,
-                            uint16_t *flags, uint32_t *seqno,
-                            uint16_t *vbucket)
-{
-    tap_event_t ret;
-    struct default_engine *engine = (struct default_engine*)handle;
-    cb_mutex_enter(&engine->cache_lock);
-    ret = do_item_tap_walker(engine, cookie, itm, es, nes, ttl, flags, seqno, vbucket);
-    cb_mutex_exit(&engine->cache_lock);
-
-    return ret;
-}
-
 bool initialize_item_tap_walker(struct default_engine *engine,
                                 const void* cookie)
 {
-    bool linked = false;
-    int ii;
     struct tap_client *client = calloc(1, sizeof(*client));
     if (client == NULL) {
         return false;
     }
     client->cursor.refcount = 1;
+    client->cursor.iflag = ITEM_WALKER;
 
     /* Link the cursor! */
-    for (ii = 0; ii < POWER_LARGEST && !linked; ++ii) {
-        cb_mutex_enter(&engine->cache_lock);
-        if (engine->items.heads[ii] != NULL) {
-            /* add the item at the tail */
-            do_item_link_cursor(engine, &client->cursor, ii);
-            linked = true;
-        }
-        cb_mutex_exit(&engine->cache_lock);
-    }
+    item_link_cursor(engine, &client->cursor, 0);
 
     engine->server.cookie->store_engine_specific(cookie, client);
     return true;
 }
-
-void link_dcp_walker(struct default_engine *engine,
-                     struct dcp_connection *connection)
-{
-    bool linked = false;
-    int ii;
-    connection->cursor.refcount = 1;
-
-    /* Link the cursor! */
-    for (ii = 0; ii < POWER_LARGEST && !linked; ++ii) {
-        cb_mutex_enter(&engine->cache_lock);
-        if (engine->items.heads[ii] != NULL) {
-            /* add the item at the tail */
-            do_item_link_cursor(engine, &connection->cursor, ii);
-            linked = true;
-        }
-        cb_mutex_exit(&engine->cache_lock);
-    }
-}
-
-static ENGINE_ERROR_CODE item_dcp_iterfunc(struct default_engine *engine,
-                                           hash_item *item,
-                                           void *cookie) {
-    struct dcp_connection *connection = cookie;
-    connection->it = item;
-    ++connection->it->refcount;
-    return ENGINE_SUCCESS;
-}
-
-static ENGINE_ERROR_CODE do_item_dcp_step(struct default_engine *engine,
-                                          struct dcp_connection *connection,
-                                          const void *cookie,
-                                          struct dcp_message_producers *producers)
-{
-    ENGINE_ERROR_CODE ret = ENGINE_DISCONNECT;
-
-    while (connection->it == NULL) {
-        if (!do_item_walk_cursor(engine, &connection->cursor, 1,
-                                 item_dcp_iterfunc, connection, &ret)) {
-            /* find next slab class to look at.. */
-            bool linked = false;
-            int ii;
-            for (ii = connection->cursor.slabs_clsid + 1; ii < POWER_LARGEST && !linked;  ++ii) {
-                if (engine->items.heads[ii] != NULL) {
-                    /* add the item at the tail */
-                    do_item_link_cursor(engine, &connection->cursor, ii);
-                    linked = true;
-                }
-            }
-            if (!linked) {
-                break;
-            }
-        }
-    }
-
-    if (connection->it != NULL) {
-        rel_time_t current_time = engine->server.core->get_current_time();
-        rel_time_t exptime = connection->it->exptime;
-
-        if (exptime != 0 && exptime < current_time) {
-            ret = producers->expiration(cookie, connection->opaque,
-                                        item_get_key(connection->it),
-                                        connection->it->nkey,
-                                        item_get_cas(connection->it),
-                                        0, 0, 0, NULL, 0);
-            if (ret == ENGINE_SUCCESS) {
-                do_item_unlink(engine, connection->it);
-                do_item_release(engine, connection->it);
-            }
-        } else {
-            ret = producers->mutation(cookie, connection->opaque,
-                                      connection->it, 0, 0, 0, 0, NULL, 0, 0);
-        }
-
-        if (ret == ENGINE_SUCCESS) {
-            connection->it = NULL;
-        }
-    } else {
-        return ENGINE_DISCONNECT;
-    }
-
-    return ret;
-}
-
-ENGINE_ERROR_CODE item_dcp_step(struct default_engine *engine,
-                                struct dcp_connection *connection,
-                                const void *cookie,
-                                struct dcp_message_producers *producers)
-{
-    ENGINE_ERROR_CODE ret;
-    cb_mutex_enter(&engine->cache_lock);
-    ret = do_item_dcp_step(engine, connection, cookie, producers);
-    cb_mutex_exit(&engine->cache_lock);
-    return ret;
-}
@@ -6,9 +6,6 @@
  * functions.
  */
 typedef struct _hash_item {
-    struct _hash_item *next;
-    struct _hash_item *prev;
-    struct _hash_item *h_next; /* hash chain next */
     rel_time_t time;  /* least recent access */
     rel_time_t exptime; /**< When the item will expire (relative to process
                          * startup) */
@@ -18,11 +15,39 @@ typedef struct _hash_item {
     uint16_t iflag; /**< Intermal flags. lower 8 bit is reserved for the core
                      * server, the upper 8 bits is reserved for engine
                      * implementation. */
-    unsigned short refcount;
+    uint16_t refcount; /**< Must be modified with atomic operations, as
+                        * item_get() doesn't hold the item lock */
     uint8_t slabs_clsid;/* which slab class we're in */
     uint8_t datatype;/* to identify the type of the data */
+    /**
+     * The LRU links. They must only be accessed through item_next() and
+     * friends, as the items in the compact layout (ITEM_COMPACT) only
+     * have room for the 32 bit handles.
+     */
+    union {
+        struct {
+            struct _hash_item *next;
+            struct _hash_item *prev;
+        } full;
+        struct {
+            uint32_t next;
+            uint32_t prev;
+        } compact;
+    } lru;
 } hash_item;
 
+/** The size of the header of an item in the compact layout */
+#define ITEM_COMPACT_HEADER_SIZE (offsetof(hash_item, lru) + 2 * sizeof(uint32_t))
+
+/**
+ * The handles used for the LRU links in the compact layout are offsets
+ * into the slab arena (plus one, so that zero is NULL). The cursors
+ * aren't in the arena, so they borrow one of the handles from
+ * ITEM_CURSOR_HANDLE_BASE and up while they're linked into an LRU.
+ */
+#define ITEM_CURSOR_HANDLES 65536
+#define ITEM_CURSOR_HANDLE_BASE ((uint32_t)(0 - ITEM_CURSOR_HANDLES))
+
 typedef struct {
     unsigned int evicted;
     unsigned int evicted_nonzero;
@@ -30,15 +55,138 @@ typedef struct {
     unsigned int outofmemory;
     unsigned int tailrepairs;
     unsigned int reclaimed;
+    unsigned int moves_to_cold;
+    unsigned int moves_to_warm;
+    unsigned int moves_within_lru;
+    unsigned int crawler_reclaimed;
 } itemstats_t;
 
+/*
+ * The LRU of each slab class is split into three segments. New items go
+ * into the hot segment. A hit only marks the item as active, and the LRU
+ * maintainer moves the items between the segments: inactive items in the
+ * tail of the hot and warm segments are moved to the cold segment, and
+ * active items are moved to (or within) the warm segment. Items are
+ * evicted from the tail of the cold segment.
+ *
+ * The cursors walk the segments of a slab class in this order.
+ */
+#define LRU_COLD 0
+#define LRU_WARM 1
+#define LRU_HOT 2
+#define LRU_SEGMENTS 3
+
 struct items {
-   hash_item *heads[POWER_LARGEST];
-   hash_item *tails[POWER_LARGEST];
+   hash_item *heads[POWER_LARGEST][LRU_SEGMENTS];
+   hash_item *tails[POWER_LARGEST][LRU_SEGMENTS];
    itemstats_t itemstats[POWER_LARGEST];
-   unsigned int sizes[POWER_LARGEST];
+   unsigned int sizes[POWER_LARGEST][LRU_SEGMENTS];
+   /**
+    * Each LRU (all of its segments, and its itemstats) is protected by
+    * its own lock
+    */
+   cb_mutex_t lock[POWER_LARGEST];
+   /** The number of cursors linked into the LRU of each slab class */
+   unsigned int cursors[POWER_LARGEST];
+
+   /**
+    * The LRU maintainer thread moving items between the segments (and
+    * reclaiming the retired items)
+    */
+   struct {
+      cb_thread_t tid;
+      cb_mutex_t lock;
+      cb_cond_t cond;
+      bool started;
+      bool shutdown;
+      /* A batch of retired items is waiting to be reclaimed */
+      bool reclaim;
+   } maintainer;
+
+   /**
+    * The LRU crawler thread walking the LRUs to reclaim expired items.
+    * The counters are protected by the lock.
+    */
+   struct {
+      cb_thread_t tid;
+      cb_mutex_t lock;
+      cb_cond_t cond;
+      bool started;
+      bool shutdown;
+      bool running;
+      time_t next_run;
+      uint64_t runs;
+      uint64_t visited;
+      uint64_t reclaimed;
+   } crawler;
+
+   /**
+    * Items that have been unlinked and released, but which may still be
+    * looked at by readers in item_get(). They're handed back to the
+    * slab allocator once those readers have left their epoch.
+    */
+   struct {
+      cb_mutex_t lock;
+      hash_item *head;
+      unsigned int count;
+      size_t bytes;
+   } retired;
+
+   /**
+    * The cursors linked into an LRU in the compact item layout (see
+    * ITEM_CURSOR_HANDLE_BASE). A slot is only read with the LRU lock
+    * the cursor is linked under held.
+    */
+   struct {
+      cb_mutex_t lock;
+      hash_item **slots;
+      unsigned int hint;
+   } cursor_handles;
 };
 
+/**
+ * Initialize the item and LRU locks
+ * @param engine handle to the storage engine
+ */
+void item_locks_init(struct default_engine *engine);
+
+/**
+ * Release the resources used by the item and LRU locks
+ * @param engine handle to the storage engine
+ */
+void item_locks_destroy(struct default_engine *engine);
+
+/**
+ * The size of the item header (not counting the CAS) in the item layout
+ * the engine is configured with
+ * @param engine handle to the storage engine
+ */
+size_t item_header_size(struct default_engine *engine);
+
+/**
+ * Lock the item lock protecting the hash chain (and the items in it) for
+ * a given key hash.
+ * @param engine handle to the storage engine
+ * @param hash the hash value of the key
+ */
+void item_lock(struct default_engine *engine, uint32_t hash);
+
+/**
+ * Try to lock the item lock for a given key hash. This is used by
+ * the code walking the LRU lists as they already hold the LRU lock.
+ * @return true if the lock was acquired
+ */
+bool item_trylock(struct default_engine *engine, uint32_t hash);
+
+void item_unlock(struct default_engine *engine, uint32_t hash);
+
+/**
+ * Lock (and unlock) all of the item locks in order. Used when the
+ * hash table itself is swapped out, or for flush_all.
+ */
+void item_lock_all(struct default_engine *engine);
+void item_unlock_all(struct default_engine *engine);
+
 
 /**
  * Allocate and initialize a new item structure
@@ -66,6 +214,21 @@ hash_item *item_alloc(struct default_engine *engine,
 hash_item *item_get(struct default_engine *engine,
                     const void *key, const size_t nkey);
 
+/* How many keys item_get_multi() looks up in one go */
+#define ITEM_GET_MULTI_MAX 16
+
+/**
+ * Get a number of items from the cache
+ *
+ * @param engine handle to the storage engine
+ * @param keys the keys of the items to get (the vbuckets are ignored)
+ * @param nkeys the number of keys (at most ITEM_GET_MULTI_MAX)
+ * @param items receives the items (NULL for the ones that don't exist)
+ * @param found receives whether each item exists
+ */
+void item_get_multi(struct default_engine *engine, const item_key *keys,
+                    int nkeys, hash_item **items, bool *found);
+
 /**
  * Reset the item statistics
  * @param engine handle to the storage engine
@@ -129,6 +292,28 @@ void item_release(struct default_engine *engine, hash_item *it);
  */
 void item_unlink(struct default_engine *engine, hash_item *it);
 
+/**
+ * Unlink the item, and log its deletion in its vBucket (with seqnos=true)
+ * @param engine handle to the storage engine
+ * @param it the item to delete
+ * @return the seqno of the deletion (0 if it isn't logged)
+ */
+uint64_t item_delete(struct default_engine *engine, hash_item *it);
+
+/**
+ * Take a reference to the item of a seqno log entry, if it is still the
+ * item logged with the tag (and hasn't expired). Must be called with the
+ * lock of the vBucket held, which keeps the item of the entry from being
+ * unlinked and freed (see seqnos_unlink()).
+ * @param engine handle to the storage engine
+ * @param it the item of the entry
+ * @param tag the seqno tag of the entry
+ * @return ENGINE_SUCCESS if we've got a reference, ENGINE_TMPFAIL if the
+ *         item lock is busy, ENGINE_KEY_ENOENT if the entry is stale
+ */
+ENGINE_ERROR_CODE item_pin_seqno(struct default_engine *engine,
+                                 hash_item *it, uint64_t tag);
+
 /**
  * Set the expiration time for an object
  * @param engine handle to the storage engine
@@ -170,8 +355,61 @@ ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              const rel_time_t exptime,
                              item **item,
                              uint8_t datatype,
-                             uint64_t *result);
+                             uint64_t *result,
+                             uint16_t vbucket);
+
+
+/**
+ * Start (and stop) the LRU maintainer thread
+ * @param engine handle to the storage engine
+ * @return 0 on success
+ */
+int item_start_lru_maintainer(struct default_engine *engine);
+void item_stop_lru_maintainer(struct default_engine *engine);
+
+/**
+ * Start (and stop) the LRU crawler thread
+ * @param engine handle to the storage engine
+ * @return 0 on success
+ */
+int item_start_lru_crawler(struct default_engine *engine);
+void item_stop_lru_crawler(struct default_engine *engine);
+
+/**
+ * Let the LRU crawler pick up a change in its configuration
+ * @param engine handle to the storage engine
+ */
+void item_lru_crawler_reschedule(struct default_engine *engine);
+
+/**
+ * Get the LRU crawler statistics
+ * @param engine handle to the storage engine
+ * @param add_stat callback provided by the core used to
+ *                 push statistics into the response
+ * @param cookie cookie provided by the core to identify the client
+ */
+void item_lru_crawler_stats(struct default_engine *engine,
+                            ADD_STAT add_stat, const void *cookie);
+
+/**
+ * Unlink all of the items in a slab page so that their memory is handed
+ * back to the slab allocator once they're released (see
+ * slabs_start_rebalancer()).
+ * @param engine handle to the storage engine
+ * @param page the start of the page
+ * @param size the size of the chunks in the page
+ * @param perslab the number of chunks in the page
+ * @return the number of items unlinked
+ */
+unsigned int item_evict_page(struct default_engine *engine, char *page,
+                             unsigned int size, unsigned int perslab);
 
+/**
+ * Get the number of items evicted from a slab class
+ * @param engine handle to the storage engine
+ * @param id the slab class
+ */
+unsigned int item_evictions(struct default_engine *engine, unsigned int id);
 
 /**
  * Start the item scrubber
@@ -191,27 +429,4 @@ tap_event_t item_tap_walker(ENGINE_HANDLE* handle,
 bool initialize_item_tap_walker(struct default_engine *engine,
                                 const void* cookie);
 
-
-struct dcp_connection {
-    void *gid;
-    size_t ngid;
-    uint32_t flags;
-    uint32_t opaque;
-    uint16_t vbucket;
-    uint64_t start_seqno;
-    uint64_t end_seqno;
-    uint64_t vbucket_uuid;
-    uint64_t snap_start_seqno;
-    uint64_t snap_end_seqno;
-    hash_item cursor;
-    hash_item *it;
-};
-
-void link_dcp_walker(struct default_engine *engine,
-                     struct dcp_connection *connection);
-ENGINE_ERROR_CODE item_dcp_step(struct default_engine *engine,
-                                struct dcp_connection *connection,
-                                const void *cookie,
-                                struct dcp_message_producers *producers);
-
 #endif
@@ -0,0 +1,322 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * The per vBucket sequence numbers and seqno logs (see seqnos.h)
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <platform/platform.h>
+
+#include "default_engine_internal.h"
+#include "atomics.h"
+
+static uint64_t seqnos_new_uuid(uint16_t vbucket) {
+    uint64_t uuid = (uint64_t)gethrtime() ^ ((uint64_t)time(NULL) << 32) ^
+        vbucket;
+    return uuid != 0 ? uuid : 1;
+}
+
+static void seqnos_log_warning(struct default_engine *engine,
+                               const char *msg, uint16_t vbucket) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+    logger->log(EXTENSION_LOG_WARNING, NULL, "vb %u: %s\n", vbucket, msg);
+}
+
+ENGINE_ERROR_CODE seqnos_init(struct default_engine *engine) {
+    if (engine->config.seqnos) {
+        engine->seqnos.vbuckets = calloc(NUM_VBUCKETS,
+                                         sizeof(*engine->seqnos.vbuckets));
+        if (engine->seqnos.vbuckets == NULL) {
+            return ENGINE_ENOMEM;
+        }
+    }
+    return ENGINE_SUCCESS;
+}
+
+static void vbucket_log_clear(struct vbucket_seqnos *vb) {
+    size_t ii;
+    for (ii = 0; ii < vb->nlog; ++ii) {
+        if (vb->log[ii].seqno & SEQNO_ENTRY_DELETION) {
+            free(vb->log[ii].u.tombstone);
+        }
+    }
+    vb->nlog = 0;
+    vb->ntombstones = 0;
+}
+
+void seqnos_destroy(struct default_engine *engine) {
+    int ii;
+
+    if (engine->seqnos.vbuckets == NULL) {
+        return;
+    }
+
+    for (ii = 0; ii < NUM_VBUCKETS; ++ii) {
+        struct vbucket_seqnos *vb = engine->seqnos.vbuckets[ii];
+        if (vb != NULL) {
+            vbucket_log_clear(vb);
+            free(vb->log);
+            cb_mutex_destroy(&vb->lock);
+            free(vb);
+        }
+    }
+    free(engine->seqnos.vbuckets);
+    engine->seqnos.vbuckets = NULL;
+}
+
+struct vbucket_seqnos *seqnos_vbucket(struct default_engine *engine,
+                                      uint16_t vbucket, bool create) {
+    struct vbucket_seqnos *vb;
+
+    if (engine->seqnos.vbuckets == NULL) {
+        return NULL;
+    }
+
+    vb = atomic_load_ptr((void**)&engine->seqnos.vbuckets[vbucket]);
+    if (vb != NULL || !create) {
+        return vb;
+    }
+
+    cb_mutex_enter(&engine->seqnos.lock);
+    vb = engine->seqnos.vbuckets[vbucket];
+    if (vb == NULL && (vb = calloc(1, sizeof(*vb))) != NULL) {
+        cb_mutex_initialize(&vb->lock);
+        vb->id = vbucket;
+        vb->uuid = seqnos_new_uuid(vbucket);
+        atomic_store_ptr((void**)&engine->seqnos.vbuckets[vbucket], vb);
+    }
+    cb_mutex_exit(&engine->seqnos.lock);
+    return vb;
+}
+
+size_t seqnos_log_find(const struct vbucket_seqnos *vb, uint64_t seqno) {
+    size_t low = 0, high = vb->nlog;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if ((vb->log[mid].seqno & ~SEQNO_ENTRY_DELETION) <= seqno) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * Is the item of the entry still the one we logged? The entry is cleared
+ * when its item is unlinked (see seqnos_unlink()), so the item is still
+ * in the hash table while we hold the lock of the vBucket. An item changed
+ * in place (by incr/decr) has a new seqno and is logged again.
+ */
+static bool seqno_entry_live(const struct vbucket_seqnos *vb,
+                             const struct seqno_entry *entry) {
+    const hash_item *it = entry->u.item;
+    return it != NULL &&
+        item_get_seqno_tag(it) == SEQNO_TAG(vb->id, entry->seqno);
+}
+
+/*
+ * Drop the stale entries from the log, and purge the oldest deletions if
+ * we remember too many of them.
+ */
+static void vbucket_log_compact(struct vbucket_seqnos *vb) {
+    size_t ii, nlog = 0;
+
+    for (ii = 0; ii < vb->nlog; ++ii) {
+        struct seqno_entry *entry = &vb->log[ii];
+        if (entry->seqno & SEQNO_ENTRY_DELETION) {
+            if (vb->ntombstones > SEQNO_TOMBSTONES_MAX) {
+                vb->purge_seqno = entry->seqno & ~SEQNO_ENTRY_DELETION;
+                free(entry->u.tombstone);
+                --vb->ntombstones;
+                continue;
+            }
+        } else if (!seqno_entry_live(vb, entry)) {
+            continue;
+        }
+        vb->log[nlog++] = *entry;
+    }
+    vb->nlog = nlog;
+}
+
+static bool vbucket_log_append(struct vbucket_seqnos *vb,
+                               const struct seqno_entry *entry) {
+    if (vb->nlog == vb->size) {
+        vbucket_log_compact(vb);
+        /* Grow it unless it's mostly stale entries */
+        if (vb->nlog > vb->size / 2) {
+            size_t size = vb->size == 0 ? SEQNO_LOG_INITIAL : vb->size * 2;
+            void *ptr = realloc(vb->log, size * sizeof(*vb->log));
+            if (ptr != NULL) {
+                vb->log = ptr;
+                vb->size = size;
+            } else if (vb->nlog == vb->size) {
+                return false;
+            }
+        }
+    }
+
+    vb->log[vb->nlog++] = *entry;
+    return true;
+}
+
+/* Clear the entry of the item for the seqno, if it has one */
+static void vbucket_log_unlink(struct vbucket_seqnos *vb, uint64_t seqno,
+                               const hash_item *it) {
+    size_t ii;
+
+    if (seqno == 0) {
+        return;
+    }
+
+    ii = seqnos_log_find(vb, seqno - 1);
+    if (ii < vb->nlog && vb->log[ii].seqno == seqno &&
+        vb->log[ii].u.item == it) {
+        vb->log[ii].u.item = NULL;
+    }
+}
+
+void seqnos_link(struct default_engine *engine, hash_item *it) {
+    const uint64_t tag = item_get_seqno_tag(it);
+    const uint16_t vbucket = SEQNO_TAG_VBUCKET(tag);
+    struct vbucket_seqnos *vb = seqnos_vbucket(engine, vbucket, true);
+    struct seqno_entry entry;
+    bool logged;
+
+    if (vb == NULL) {
+        item_set_seqno_tag(it, SEQNO_TAG(vbucket, 0));
+        seqnos_log_warning(engine, "Failed to log a mutation", vbucket);
+        return;
+    }
+
+    cb_mutex_enter(&vb->lock);
+    /* An item changed in place leaves its old entry behind */
+    vbucket_log_unlink(vb, SEQNO_TAG_SEQNO(tag), it);
+    entry.seqno = ++vb->high_seqno;
+    entry.u.item = it;
+    item_set_seqno_tag(it, SEQNO_TAG(vbucket, entry.seqno));
+    logged = vbucket_log_append(vb, &entry);
+    cb_mutex_exit(&vb->lock);
+
+    if (!logged) {
+        seqnos_log_warning(engine, "Failed to log a mutation", vbucket);
+    }
+    dcp_notify(engine, vbucket);
+}
+
+void seqnos_unlink(struct default_engine *engine, const hash_item *it) {
+    const uint64_t tag = item_get_seqno_tag(it);
+    struct vbucket_seqnos *vb;
+
+    if (SEQNO_TAG_SEQNO(tag) == 0 ||
+        (vb = seqnos_vbucket(engine, SEQNO_TAG_VBUCKET(tag), false)) == NULL) {
+        return;
+    }
+
+    cb_mutex_enter(&vb->lock);
+    vbucket_log_unlink(vb, SEQNO_TAG_SEQNO(tag), it);
+    cb_mutex_exit(&vb->lock);
+}
+
+uint64_t seqnos_delete(struct default_engine *engine, uint16_t vbucket,
+                       const void *key, uint16_t nkey, uint64_t cas) {
+    struct vbucket_seqnos *vb = seqnos_vbucket(engine, vbucket, true);
+    struct seqno_tombstone *tombstone;
+    struct seqno_entry entry;
+    uint64_t seqno;
+
+    if (vb == NULL) {
+        seqnos_log_warning(engine, "Failed to log a deletion", vbucket);
+        return 0;
+    }
+
+    if ((tombstone = malloc(sizeof(*tombstone) + nkey)) != NULL) {
+        tombstone->cas = cas;
+        tombstone->nkey = nkey;
+        memcpy(tombstone->key, key, nkey);
+    }
+
+    cb_mutex_enter(&vb->lock);
+    seqno = ++vb->high_seqno;
+    entry.seqno = seqno | SEQNO_ENTRY_DELETION;
+    entry.u.tombstone = tombstone;
+    if (tombstone != NULL && vbucket_log_append(vb, &entry)) {
+        ++vb->ntombstones;
+    } else {
+        /* The consumers older than this have to start over */
+        free(tombstone);
+        vb->purge_seqno = seqno;
+    }
+    cb_mutex_exit(&vb->lock);
+
+    dcp_notify(engine, vbucket);
+    return seqno;
+}
+
+void seqnos_flush(struct default_engine *engine) {
+    int ii;
+
+    if (engine->seqnos.vbuckets == NULL) {
+        return;
+    }
+
+    for (ii = 0; ii < NUM_VBUCKETS; ++ii) {
+        struct vbucket_seqnos *vb = seqnos_vbucket(engine, (uint16_t)ii,
+                                                   false);
+        if (vb == NULL) {
+            continue;
+        }
+
+        cb_mutex_enter(&vb->lock);
+        vbucket_log_clear(vb);
+        vb->purge_seqno = vb->high_seqno;
+        vb->uuid = seqnos_new_uuid(vb->id);
+        vb->uuid_seqno = vb->high_seqno;
+        cb_mutex_exit(&vb->lock);
+
+        /* Let the streams of the vBucket know they're done */
+        dcp_notify(engine, vb->id);
+    }
+}
+
+void seqnos_stats(struct default_engine *engine,
+                  ADD_STAT add_stats, const void *cookie) {
+    int ii;
+
+    if (engine->seqnos.vbuckets == NULL) {
+        return;
+    }
+
+    for (ii = 0; ii < NUM_VBUCKETS; ++ii) {
+        struct vbucket_seqnos *vb = seqnos_vbucket(engine, (uint16_t)ii,
+                                                   false);
+        uint64_t uuid, high_seqno, purge_seqno;
+        size_t nlog, ntombstones;
+
+        if (vb == NULL) {
+            continue;
+        }
+
+        cb_mutex_enter(&vb->lock);
+        uuid = vb->uuid;
+        high_seqno = vb->high_seqno;
+        purge_seqno = vb->purge_seqno;
+        nlog = vb->nlog;
+        ntombstones = vb->ntombstones;
+        cb_mutex_exit(&vb->lock);
+
+        add_statistics(cookie, add_stats, "vb", ii, "uuid", "%"PRIu64, uuid);
+        add_statistics(cookie, add_stats, "vb", ii, "high_seqno", "%"PRIu64,
+                       high_seqno);
+        add_statistics(cookie, add_stats, "vb", ii, "purge_seqno",
+                       "%"PRIu64, purge_seqno);
+        add_statistics(cookie, add_stats, "vb", ii, "log_entries", "%"PRIu64,
+                       (uint64_t)nlog);
+        add_statistics(cookie, add_stats, "vb", ii, "tombstones", "%"PRIu64,
+                       (uint64_t)ntombstones);
+    }
+}
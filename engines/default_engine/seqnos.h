@@ -0,0 +1,119 @@
+#ifndef SEQNOS_H
+#define SEQNOS_H
+
+/*
+ * The sequence numbers of the vBuckets (with seqnos=true).
+ *
+ * Every item stored in a vBucket is given the next sequence number of the
+ * vBucket when it is linked, and each vBucket keeps a log of the entries
+ * for its mutations (and deletions) in seqno order. The DCP streams read
+ * the log from the seqno the consumer already has, so a consumer catching
+ * up only gets what changed since.
+ *
+ * An entry points to its item, which is tagged with the vBucket and the
+ * seqno (stored after the CAS, see item_get_seqno_tag()). The entry is
+ * stale once the item is replaced, deleted, evicted or expired: the item
+ * is cleared from the entry when it is unlinked, before its memory may be
+ * freed or reused, and the stale entries are dropped when the log is full. Evictions and expiries are
+ * not logged; deletions are, until SEQNO_TOMBSTONES_MAX of them are
+ * remembered, after which the oldest are purged (and a consumer with a
+ * seqno older than the purge seqno has to start over).
+ */
+
+/* The seqno tag of an item, the vBucket is in the top 16 bits */
+#define SEQNO_BITS 48
+#define SEQNO_MASK ((UINT64_C(1) << SEQNO_BITS) - 1)
+#define SEQNO_TAG(vbucket, seqno) (((uint64_t)(vbucket) << SEQNO_BITS) | (seqno))
+#define SEQNO_TAG_VBUCKET(tag) ((uint16_t)((tag) >> SEQNO_BITS))
+#define SEQNO_TAG_SEQNO(tag) ((tag) & SEQNO_MASK)
+
+/* The seqno of a log entry for a deletion has this bit set */
+#define SEQNO_ENTRY_DELETION (UINT64_C(1) << 63)
+
+/* The most deletions we remember in each vBucket */
+#define SEQNO_TOMBSTONES_MAX 4096
+
+/* The initial number of entries in the log of a vBucket */
+#define SEQNO_LOG_INITIAL 1024
+
+struct seqno_tombstone {
+    uint64_t cas;
+    uint16_t nkey;
+    char key[1];
+};
+
+struct seqno_entry {
+    uint64_t seqno;
+    union {
+        hash_item *item;
+        struct seqno_tombstone *tombstone;
+    } u;
+};
+
+struct vbucket_seqnos {
+    /* Ranks below the item locks, see struct default_engine */
+    cb_mutex_t lock;
+    uint16_t id;
+    /* Changes when the history of the vBucket is lost (by a flush) */
+    uint64_t uuid;
+    /* The high seqno when we picked the uuid */
+    uint64_t uuid_seqno;
+    uint64_t high_seqno;
+    /* The deletions up to this seqno are forgotten */
+    uint64_t purge_seqno;
+    struct seqno_entry *log;
+    size_t nlog;
+    size_t size;
+    size_t ntombstones;
+};
+
+struct seqnos {
+    /* Created on first use, and kept until the engine is destroyed */
+    struct vbucket_seqnos **vbuckets;
+    cb_mutex_t lock;
+};
+
+ENGINE_ERROR_CODE seqnos_init(struct default_engine *engine);
+void seqnos_destroy(struct default_engine *engine);
+
+/*
+ * Get the seqnos of the vBucket, or NULL if it hasn't been used yet (and
+ * create is false) or we're out of memory.
+ */
+struct vbucket_seqnos *seqnos_vbucket(struct default_engine *engine,
+                                      uint16_t vbucket, bool create);
+
+/*
+ * Give the item (tagged with its vBucket) the next seqno of the vBucket
+ * and log it. Must be called with the item lock held, once the item is
+ * linked (or changed in place).
+ */
+void seqnos_link(struct default_engine *engine, hash_item *it);
+
+/*
+ * Clear the entry of the item from the log when it is unlinked, with the
+ * item lock held, so that nobody follows the entry to the item once it
+ * may be freed.
+ */
+void seqnos_unlink(struct default_engine *engine, const hash_item *it);
+
+/* The index of the first entry in the log after the seqno */
+size_t seqnos_log_find(const struct vbucket_seqnos *vb, uint64_t seqno);
+
+/*
+ * Log the deletion of the key, with the item lock held. Returns the seqno
+ * of the deletion (0 if we're out of memory).
+ */
+uint64_t seqnos_delete(struct default_engine *engine, uint16_t vbucket,
+                       const void *key, uint16_t nkey, uint64_t cas);
+
+/*
+ * Forget the history of all of the vBuckets after a flush. They get a new
+ * uuid, and the consumers have to start over.
+ */
+void seqnos_flush(struct default_engine *engine);
+
+void seqnos_stats(struct default_engine *engine,
+                  ADD_STAT add_stats, const void *cookie);
+
+#endif
@@ -16,8 +16,13 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stdarg.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #include "default_engine_internal.h"
+#include "atomics.h"
 
 /*
  * Forward Declarations
@@ -75,6 +80,187 @@ static void *my_allocate(struct default_engine *e, size_t size) {
     return ptr;
 }
 
+#define SLAB_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define SLAB_MAX_NUMA_NODES 1024
+
+#ifdef __linux__
+/* From <numaif.h>, which we don't want to pull in libnuma for */
+#define SLAB_MPOL_BIND 2
+#define SLAB_MPOL_INTERLEAVE 3
+
+/*
+ * Parse a list of NUMA nodes in the format used by sysfs ("0-3,6") into
+ * a bitmask.
+ * @return the number of nodes in the list, or -1 if it is invalid
+ */
+static int slabs_parse_nodes(const char *str, unsigned long *mask) {
+    int count = 0;
+
+    memset(mask, 0, SLAB_MAX_NUMA_NODES / 8);
+    while (*str != '\0' && *str != '\n') {
+        char *end;
+        unsigned long first, last, node;
+
+        first = last = strtoul(str, &end, 10);
+        if (end == str) {
+            return -1;
+        }
+        if (*end == '-') {
+            str = end + 1;
+            last = strtoul(str, &end, 10);
+            if (end == str) {
+                return -1;
+            }
+        }
+        if (first > last || last >= SLAB_MAX_NUMA_NODES) {
+            return -1;
+        }
+        for (node = first; node <= last; ++node) {
+            unsigned long bit = 1UL << (node % (8 * sizeof(long)));
+            if ((mask[node / (8 * sizeof(long))] & bit) == 0) {
+                mask[node / (8 * sizeof(long))] |= bit;
+                ++count;
+            }
+        }
+        str = end;
+        if (*str == ',') {
+            ++str;
+        }
+    }
+    return count;
+}
+
+/*
+ * Apply the NUMA policy to the arena before any of its pages are touched.
+ * @return the number of nodes the arena is spread over, or 0 if the
+ *         policy couldn't be applied
+ */
+static int slabs_arena_numa(struct default_engine *engine,
+                            void *base, size_t size) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    unsigned long mask[SLAB_MAX_NUMA_NODES / (8 * sizeof(long))];
+    const char *nodes = engine->config.numa_nodes;
+    char online[256];
+    int mode, count;
+
+    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+    mode = strcmp(engine->config.numa_policy, "bind") == 0 ?
+        SLAB_MPOL_BIND : SLAB_MPOL_INTERLEAVE;
+
+    if (nodes == NULL) {
+        FILE *fp = fopen("/sys/devices/system/node/online", "r");
+        if (fp == NULL || fgets(online, sizeof(online), fp) == NULL) {
+            logger->log(EXTENSION_LOG_WARNING, NULL,
+                        "Failed to read the online NUMA nodes\n");
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            return 0;
+        }
+        fclose(fp);
+        nodes = online;
+    }
+
+    count = slabs_parse_nodes(nodes, mask);
+    if (count <= 0) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Invalid list of NUMA nodes: \"%s\"\n", nodes);
+        return 0;
+    }
+
+    if (syscall(SYS_mbind, base, size, mode, mask,
+                (unsigned long)SLAB_MAX_NUMA_NODES + 1, 0) != 0) {
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Failed to set the NUMA policy of the slab arena: %s\n",
+                    strerror(errno));
+        return 0;
+    }
+    return count;
+}
+#endif
+
+/*
+ * Reserve the memory for all of the slab pages up front. On Linux the
+ * arena is mapped with explicit huge pages if we're asked to use them and
+ * the kernel has enough of them, and is otherwise eligible for
+ * transparent huge pages. Its pages are faulted in before we return, so
+ * that we know we really got the memory (and where it ended up).
+ */
+static void *slabs_arena_allocate(struct default_engine *engine, size_t size) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+
+#ifdef __linux__
+    {
+        size_t len = (size + SLAB_HUGE_PAGE_SIZE - 1) & ~((size_t)SLAB_HUGE_PAGE_SIZE - 1);
+        const char *backing = "pages";
+        void *base = MAP_FAILED;
+        size_t ii;
+
+        if (engine->config.hugepages) {
+            base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base != MAP_FAILED) {
+                backing = "hugetlb";
+            } else {
+                logger->log(EXTENSION_LOG_WARNING, NULL,
+                            "Failed to map %"PRIu64" bytes of huge pages "
+                            "(%s), trying transparent huge pages\n",
+                            (uint64_t)len, strerror(errno));
+            }
+        }
+
+        if (base == MAP_FAILED) {
+            base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                logger->log(EXTENSION_LOG_WARNING, NULL,
+                            "Failed to map the slab arena: %s\n",
+                            strerror(errno));
+                return NULL;
+            }
+#ifdef MADV_HUGEPAGE
+            if (engine->config.hugepages &&
+                madvise(base, len, MADV_HUGEPAGE) == 0) {
+                backing = "thp";
+            }
+#endif
+        }
+
+        if (engine->config.numa_policy != NULL &&
+            strcmp(engine->config.numa_policy, "none") != 0) {
+            engine->slabs.arena.numa_nodes =
+                (unsigned int)slabs_arena_numa(engine, base, len);
+        }
+
+        for (ii = 0; ii < len; ii += 4096) {
+            ((volatile char*)base)[ii] = 0;
+        }
+
+        engine->slabs.arena.base = base;
+        engine->slabs.arena.size = len;
+        engine->slabs.arena.backing = backing;
+    }
+#else
+    engine->slabs.arena.base = my_allocate(engine, size);
+    if (engine->slabs.arena.base == NULL) {
+        return NULL;
+    }
+    engine->slabs.arena.size = size;
+    engine->slabs.arena.backing = "malloc";
+#endif
+
+    logger->log(EXTENSION_LOG_INFO, NULL,
+                "Slab arena: %"PRIu64" bytes backed by %s, NUMA policy "
+                "%s over %u nodes\n",
+                (uint64_t)engine->slabs.arena.size,
+                engine->slabs.arena.backing,
+                engine->slabs.arena.numa_nodes != 0 ?
+                    engine->config.numa_policy : "default",
+                engine->slabs.arena.numa_nodes);
+    return engine->slabs.arena.base;
+}
+
 /**
  * Determines the chunk sizes and initializes the slab class descriptors
  * accordingly.
@@ -84,13 +270,31 @@ ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
                              const double factor,
                              const bool prealloc) {
     int i = POWER_SMALLEST - 1;
-    unsigned int size = sizeof(hash_item) + (unsigned int)engine->config.chunk_size;
+    unsigned int size = (unsigned int)item_header_size(engine) +
+        (unsigned int)engine->config.chunk_size;
+    size_t align;
 
     engine->slabs.mem_limit = limit;
 
+    /*
+     * The compact items link to each other by their offset in the arena
+     * in units of the chunk alignment, so large arenas need coarser
+     * alignment.
+     */
+    engine->slabs.item_shift = 3;
+    if (engine->config.compact_items) {
+        while (((uint64_t)limit >> engine->slabs.item_shift) >=
+               ITEM_CURSOR_HANDLE_BASE - 1) {
+            engine->slabs.item_shift++;
+        }
+    }
+    cb_assert(((size_t)1 << engine->slabs.item_shift) >= CHUNK_ALIGN_BYTES);
+    align = (size_t)1 << engine->slabs.item_shift;
+
     if (prealloc) {
-        /* Allocate everything in a big chunk with malloc */
-        engine->slabs.mem_base = my_allocate(engine, engine->slabs.mem_limit);
+        /* Allocate everything in a big chunk */
+        engine->slabs.mem_base = slabs_arena_allocate(engine,
+                                                      engine->slabs.mem_limit);
         if (engine->slabs.mem_base != NULL) {
             engine->slabs.mem_current = engine->slabs.mem_base;
             engine->slabs.mem_avail = engine->slabs.mem_limit;
@@ -103,8 +307,8 @@ ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
 
     while (++i < POWER_LARGEST && size <= engine->config.item_size_max / factor) {
         /* Make sure items are always n-byte aligned */
-        if (size % CHUNK_ALIGN_BYTES)
-            size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+        if (size % align)
+            size += (unsigned int)(align - (size % align));
 
         engine->slabs.slabclass[i].size = size;
         engine->slabs.slabclass[i].perslab = (unsigned int)engine->config.item_size_max / engine->slabs.slabclass[i].size;
@@ -131,6 +335,28 @@ ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
                     engine->slabs.slabclass[i].perslab);
     }
 
+    /* Don't keep the large chunks in the slab caches */
+    for (i = POWER_SMALLEST; i <= (int)engine->slabs.power_largest; ++i) {
+        slabclass_t *p = &engine->slabs.slabclass[i];
+        unsigned int n = SLAB_MAGAZINE_BYTES / p->size;
+#ifdef USE_SYSTEM_MALLOC
+        n = 0;
+#endif
+        if (n > SLAB_MAGAZINE_SIZE) {
+            n = SLAB_MAGAZINE_SIZE;
+        }
+        p->magazine_size = (n >= 2) ? n : 0;
+    }
+
+    for (i = 0; i < SLAB_CACHE_COUNT; ++i) {
+        struct slab_cache *cache = &engine->slabs.caches[i];
+        cache->magazines = calloc(engine->slabs.power_largest + 1,
+                                  sizeof(slab_magazine_t));
+        if (cache->magazines == NULL) {
+            return ENGINE_ENOMEM;
+        }
+    }
+
     /* for the test suite:  faking of how much we've already malloc'd */
     {
         char *t_initial_malloc = getenv("T_MEMD_INITIAL_MALLOC");
@@ -185,9 +411,13 @@ static int grow_slab_list (struct default_engine *engine, const unsigned int id)
     return 1;
 }
 
+/*
+ * All of the pages are item_size_max bytes (rather than size * perslab) so
+ * that the slab rebalancer may hand a page over to any other slab class.
+ */
 static int do_slabs_newslab(struct default_engine *engine, const unsigned int id) {
     slabclass_t *p = &engine->slabs.slabclass[id];
-    int len = p->size * p->perslab;
+    int len = (int)engine->config.item_size_max;
     char *ptr;
 
     if ((engine->slabs.mem_limit && engine->slabs.mem_malloced + len > engine->slabs.mem_limit && p->slabs > 0) ||
@@ -209,6 +439,38 @@ static int do_slabs_newslab(struct default_engine *engine, const unsigned int id
     return 1;
 }
 
+/*
+ * Grab a chunk off the freelist or the end of the last page. A new page
+ * is only allocated if grow is set.
+ */
+static void *do_slabs_alloc_chunk(struct default_engine *engine,
+                                  unsigned int id, bool grow) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    void *ret;
+
+    /* fail unless we have space at the end of a recently allocated page,
+       we have something on our freelist, or we could allocate a new page */
+    if (! (p->end_page_ptr != 0 || p->sl_curr != 0 ||
+           (grow && do_slabs_newslab(engine, id) != 0))) {
+        /* We don't have more memory available */
+        ret = NULL;
+    } else if (p->sl_curr != 0) {
+        /* return off our freelist */
+        ret = p->slots[--p->sl_curr];
+    } else {
+        /* if we recently allocated a whole page, return from that */
+        cb_assert(p->end_page_ptr != NULL);
+        ret = p->end_page_ptr;
+        if (--p->end_page_free != 0) {
+            p->end_page_ptr = ((unsigned char *)p->end_page_ptr) + p->size;
+        } else {
+            p->end_page_ptr = 0;
+        }
+    }
+
+    return ret;
+}
+
 /*@null@*/
 static void *do_slabs_alloc(struct default_engine *engine, const size_t size, unsigned int id) {
     slabclass_t *p;
@@ -232,26 +494,7 @@ static void *do_slabs_alloc(struct default_engine *engine, const size_t size, un
     return ret;
 #endif
 
-    /* fail unless we have space at the end of a recently allocated page,
-       we have something on our freelist, or we could allocate a new page */
-    if (! (p->end_page_ptr != 0 || p->sl_curr != 0 ||
-           do_slabs_newslab(engine, id) != 0)) {
-        /* We don't have more memory available */
-        ret = NULL;
-    } else if (p->sl_curr != 0) {
-        /* return off our freelist */
-        ret = p->slots[--p->sl_curr];
-    } else {
-        /* if we recently allocated a whole page, return from that */
-        cb_assert(p->end_page_ptr != NULL);
-        ret = p->end_page_ptr;
-        if (--p->end_page_free != 0) {
-            p->end_page_ptr = ((unsigned char *)p->end_page_ptr) + p->size;
-        } else {
-            p->end_page_ptr = 0;
-        }
-    }
-
+    ret = do_slabs_alloc_chunk(engine, id, true);
     if (ret) {
         p->requested += size;
         MEMCACHED_SLABS_ALLOCATE(size, id, p->size, ret);
@@ -262,6 +505,59 @@ static void *do_slabs_alloc(struct default_engine *engine, const size_t size, un
     return ret;
 }
 
+static int grow_slots(slabclass_t *p, const unsigned int count) {
+    if (p->sl_curr + count > p->sl_total) { /* need more space on the free list */
+        unsigned int new_size = (p->sl_total != 0) ? p->sl_total * 2 : 16;  /* 16 is arbitrary */
+        void **new_slots;
+        while (new_size < p->sl_curr + count) {
+            new_size *= 2;
+        }
+        new_slots = realloc(p->slots, new_size * sizeof(void *));
+        if (new_slots == 0)
+            return 0;
+        p->slots = new_slots;
+        p->sl_total = new_size;
+    }
+    return 1;
+}
+
+static bool slabs_in_page(struct default_engine *engine, const char *page,
+                          const void *ptr) {
+    return (const char*)ptr >= page &&
+        (const char*)ptr < page + engine->config.item_size_max;
+}
+
+/*
+ * A chunk in the page being moved by the rebalancer doesn't go back on the
+ * freelist once it is freed, it is kept aside until we own all of the
+ * chunks in the page.
+ */
+static void do_slabs_capture(struct default_engine *engine, void *ptr) {
+    slabclass_t *p = &engine->slabs.slabclass[engine->slabs.rebalance.src];
+    unsigned int idx;
+
+    idx = (unsigned int)(((char*)ptr - engine->slabs.rebalance.page) / p->size);
+    cb_assert(idx < p->perslab);
+    cb_assert((engine->slabs.rebalance.captured_map[idx / 8] & (1 << (idx % 8))) == 0);
+    engine->slabs.rebalance.captured_map[idx / 8] |= (unsigned char)(1 << (idx % 8));
+    engine->slabs.rebalance.captured++;
+}
+
+static void do_slabs_free_chunk(struct default_engine *engine, void *ptr,
+                                unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+
+    if (id == engine->slabs.rebalance.src &&
+        slabs_in_page(engine, engine->slabs.rebalance.page, ptr)) {
+        do_slabs_capture(engine, ptr);
+        return;
+    }
+
+    if (grow_slots(p, 1) == 0)
+        return;
+    p->slots[p->sl_curr++] = ptr;
+}
+
 static void do_slabs_free(struct default_engine *engine, void *ptr, const size_t size, unsigned int id) {
     slabclass_t *p;
 
@@ -277,19 +573,180 @@ static void do_slabs_free(struct default_engine *engine, void *ptr, const size_t
     return;
 #endif
 
-    if (p->sl_curr == p->sl_total) { /* need more space on the free list */
-        int new_size = (p->sl_total != 0) ? p->sl_total * 2 : 16;  /* 16 is arbitrary */
-        void **new_slots = realloc(p->slots, new_size * sizeof(void *));
-        if (new_slots == 0)
-            return;
-        p->slots = new_slots;
-        p->sl_total = new_size;
-    }
-    p->slots[p->sl_curr++] = ptr;
+    do_slabs_free_chunk(engine, ptr, id);
     p->requested -= size;
     return;
 }
 
+/*
+ * The bytes requested from a magazine are only added to the slab class
+ * when the slabs lock is held anyway.
+ */
+static void do_slabs_magazine_sync(struct default_engine *engine,
+                                   slab_magazine_t *m, unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    p->requested = (size_t)((int64_t)p->requested + m->requested);
+    m->requested = 0;
+}
+
+/* Fill up half of the magazine, allocating at most one new page */
+static void do_slabs_magazine_refill(struct default_engine *engine,
+                                     slab_magazine_t *m, unsigned int id) {
+    slabclass_t *p = &engine->slabs.slabclass[id];
+    unsigned int want = p->magazine_size / 2;
+
+    do_slabs_magazine_sync(engine, m, id);
+    while (m->count < want) {
+        void *ptr = do_slabs_alloc_chunk(engine, id, m->count == 0);
+        if (ptr == NULL) {
+            break;
+        }
+        m->chunks[m->count++] = ptr;
+    }
+}
+
+/* Give count chunks from the magazine back to the slab class */
+static void do_slabs_magazine_drain(struct default_engine *engine,
+                                    slab_magazine_t *m, unsigned int id,
+                                    unsigned int count) {
+    do_slabs_magazine_sync(engine, m, id);
+    while (count-- > 0 && m->count > 0) {
+        do_slabs_free_chunk(engine, m->chunks[--m->count], id);
+    }
+}
+
+/*
+ * Start moving a page from one slab class to another. We take the oldest
+ * page of the source class, and grab the free chunks in it. The chunks
+ * still in use are captured by do_slabs_free() as the items in them are
+ * evicted (see item_evict_page()).
+ */
+static bool do_slabs_reassign_start(struct default_engine *engine,
+                                    const unsigned int src,
+                                    const unsigned int dst) {
+#ifdef USE_SYSTEM_MALLOC
+    (void)engine;
+    (void)src;
+    (void)dst;
+    return false;
+#else
+    slabclass_t *p;
+    unsigned int ii, jj;
+
+    if (engine->slabs.rebalance.src != 0 || src == dst ||
+        src < POWER_SMALLEST || src > engine->slabs.power_largest ||
+        dst < POWER_SMALLEST || dst > engine->slabs.power_largest) {
+        return false;
+    }
+
+    p = &engine->slabs.slabclass[src];
+    if (p->slabs < 2) {
+        return false;
+    }
+
+    engine->slabs.rebalance.captured_map = calloc((p->perslab + 7) / 8, 1);
+    if (engine->slabs.rebalance.captured_map == NULL) {
+        return false;
+    }
+
+    /* The caller holds all of the slab cache locks */
+    for (ii = 0; ii < SLAB_CACHE_COUNT; ++ii) {
+        slab_magazine_t *m = &engine->slabs.caches[ii].magazines[src];
+        do_slabs_magazine_drain(engine, m, src, m->count);
+    }
+
+    atomic_store_uint32(&engine->slabs.rebalance.src, src);
+    engine->slabs.rebalance.dst = dst;
+    engine->slabs.rebalance.page = p->slab_list[0];
+    engine->slabs.rebalance.captured = 0;
+    p->killing = 1;
+
+    for (ii = 0, jj = 0; ii < p->sl_curr; ++ii) {
+        if (slabs_in_page(engine, engine->slabs.rebalance.page, p->slots[ii])) {
+            do_slabs_capture(engine, p->slots[ii]);
+        } else {
+            p->slots[jj++] = p->slots[ii];
+        }
+    }
+    p->sl_curr = jj;
+
+    if (p->end_page_ptr != NULL &&
+        slabs_in_page(engine, engine->slabs.rebalance.page, p->end_page_ptr)) {
+        char *ptr = p->end_page_ptr;
+        for (ii = 0; ii < p->end_page_free; ++ii) {
+            do_slabs_capture(engine, ptr + ii * p->size);
+        }
+        p->end_page_ptr = NULL;
+        p->end_page_free = 0;
+    }
+
+    return true;
+#endif
+}
+
+static void do_slabs_reassign_done(struct default_engine *engine) {
+    slabclass_t *p = &engine->slabs.slabclass[engine->slabs.rebalance.src];
+    p->killing = 0;
+    free(engine->slabs.rebalance.captured_map);
+    engine->slabs.rebalance.captured_map = NULL;
+    engine->slabs.rebalance.page = NULL;
+    engine->slabs.rebalance.captured = 0;
+    atomic_store_uint32(&engine->slabs.rebalance.src, 0);
+    engine->slabs.rebalance.dst = 0;
+}
+
+/*
+ * Hand the page over to the destination class once all of its chunks
+ * have been captured.
+ * @return true if the page was moved
+ */
+static bool do_slabs_reassign_finish(struct default_engine *engine) {
+    slabclass_t *s = &engine->slabs.slabclass[engine->slabs.rebalance.src];
+    slabclass_t *d = &engine->slabs.slabclass[engine->slabs.rebalance.dst];
+    char *page = engine->slabs.rebalance.page;
+    unsigned int ii;
+
+    if (engine->slabs.rebalance.captured < s->perslab ||
+        grow_slab_list(engine, engine->slabs.rebalance.dst) == 0 ||
+        grow_slots(d, d->perslab) == 0) {
+        return false;
+    }
+
+    s->slab_list[s->killing - 1] = s->slab_list[--s->slabs];
+    s->pages_moved_out++;
+
+    memset(page, 0, engine->config.item_size_max);
+    for (ii = 0; ii < d->perslab; ++ii) {
+        d->slots[d->sl_curr++] = page + ii * d->size;
+    }
+    d->slab_list[d->slabs++] = page;
+    d->pages_moved_in++;
+
+    engine->slabs.rebalance.moved++;
+    do_slabs_reassign_done(engine);
+    return true;
+}
+
+/* Give the captured chunks back to the source class */
+static void do_slabs_reassign_abort(struct default_engine *engine) {
+    slabclass_t *p = &engine->slabs.slabclass[engine->slabs.rebalance.src];
+    char *page = engine->slabs.rebalance.page;
+    unsigned int ii;
+
+    /* We can't fail here, as the chunks would be lost */
+    if (grow_slots(p, engine->slabs.rebalance.captured) == 0) {
+        abort();
+    }
+    for (ii = 0; ii < p->perslab; ++ii) {
+        if (engine->slabs.rebalance.captured_map[ii / 8] & (1 << (ii % 8))) {
+            p->slots[p->sl_curr++] = page + ii * p->size;
+        }
+    }
+
+    engine->slabs.rebalance.aborted++;
+    do_slabs_reassign_done(engine);
+}
+
 void add_statistics(const void *cookie, ADD_STAT add_stats,
                     const char* prefix, int num, const char *key,
                     const char *fmt, ...) {
@@ -332,7 +789,20 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
     for(i = POWER_SMALLEST; i <= engine->slabs.power_largest; i++) {
         slabclass_t *p = &engine->slabs.slabclass[i];
         if (p->slabs != 0) {
-            uint32_t perslab, slabs;
+            uint32_t perslab, slabs, cached = 0;
+            uint64_t hits = 0, misses = 0;
+            int64_t requested = (int64_t)p->requested;
+            int jj;
+
+            /* The caller holds all of the slab cache locks */
+            for (jj = 0; jj < SLAB_CACHE_COUNT; ++jj) {
+                slab_magazine_t *m = &engine->slabs.caches[jj].magazines[i];
+                cached += m->count;
+                hits += m->hits;
+                misses += m->misses;
+                requested += m->requested;
+            }
+
             slabs = p->slabs;
             perslab = p->perslab;
 
@@ -345,13 +815,23 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
             add_statistics(cookie, add_stats, NULL, i, "total_chunks", "%u",
                            slabs * perslab);
             add_statistics(cookie, add_stats, NULL, i, "used_chunks", "%u",
-                           slabs*perslab - p->sl_curr - p->end_page_free);
+                           slabs*perslab - p->sl_curr - p->end_page_free - cached);
             add_statistics(cookie, add_stats, NULL, i, "free_chunks", "%u",
                            p->sl_curr);
             add_statistics(cookie, add_stats, NULL, i, "free_chunks_end", "%u",
                            p->end_page_free);
+            add_statistics(cookie, add_stats, NULL, i, "free_chunks_cached", "%u",
+                           cached);
             add_statistics(cookie, add_stats, NULL, i, "mem_requested", "%"PRIu64,
-                           (uint64_t)p->requested);
+                           (uint64_t)requested);
+            add_statistics(cookie, add_stats, NULL, i, "magazine_hits", "%"PRIu64,
+                           hits);
+            add_statistics(cookie, add_stats, NULL, i, "magazine_misses", "%"PRIu64,
+                           misses);
+            add_statistics(cookie, add_stats, NULL, i, "pages_moved_in", "%u",
+                           p->pages_moved_in);
+            add_statistics(cookie, add_stats, NULL, i, "pages_moved_out", "%u",
+                           p->pages_moved_out);
 #ifdef FUTURE
             add_statistics(cookie, add_stats, NULL, i, "get_hits", "%"PRIu64,
                            thread_stats.slab_stats[i].get_hits);
@@ -373,9 +853,30 @@ static void do_slabs_stats(struct default_engine *engine, ADD_STAT add_stats, co
     add_statistics(cookie, add_stats, NULL, -1, "active_slabs", "%d", total);
     add_statistics(cookie, add_stats, NULL, -1, "total_malloced", "%"PRIu64,
                    (uint64_t)engine->slabs.mem_malloced);
+    add_statistics(cookie, add_stats, NULL, -1, "item_header_size", "%u",
+                   (unsigned int)item_header_size(engine));
+    add_statistics(cookie, add_stats, NULL, -1, "item_layout", "%s",
+                   engine->config.compact_items ? "compact" : "full");
+    if (engine->slabs.arena.base != NULL) {
+        add_statistics(cookie, add_stats, NULL, -1, "arena_bytes", "%"PRIu64,
+                       (uint64_t)engine->slabs.arena.size);
+        add_statistics(cookie, add_stats, NULL, -1, "arena_backing", "%s",
+                       engine->slabs.arena.backing);
+        add_statistics(cookie, add_stats, NULL, -1, "arena_numa_nodes", "%u",
+                       engine->slabs.arena.numa_nodes);
+    }
+    add_statistics(cookie, add_stats, NULL, -1, "slabs_moved", "%"PRIu64,
+                   engine->slabs.rebalance.moved);
+    add_statistics(cookie, add_stats, NULL, -1, "slab_reassign_evictions",
+                   "%"PRIu64, engine->slabs.rebalance.evicted);
+    add_statistics(cookie, add_stats, NULL, -1, "slab_reassign_aborted",
+                   "%"PRIu64, engine->slabs.rebalance.aborted);
+    add_statistics(cookie, add_stats, NULL, -1, "slab_reassign_running", "%s",
+                   engine->slabs.rebalance.src != 0 ? "true" : "false");
 }
 
 static void *memory_allocate(struct default_engine *engine, size_t size) {
+    const size_t align = (size_t)1 << engine->slabs.item_shift;
     void *ret;
 
     if (engine->slabs.mem_base == NULL) {
@@ -389,8 +890,8 @@ static void *memory_allocate(struct default_engine *engine, size_t size) {
         }
 
         /* mem_current pointer _must_ be aligned!!! */
-        if (size % CHUNK_ALIGN_BYTES) {
-            size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+        if (size % align) {
+            size += align - (size % align);
         }
 
         engine->slabs.mem_current = ((char*)engine->slabs.mem_current) + size;
@@ -404,25 +905,128 @@ static void *memory_allocate(struct default_engine *engine, size_t size) {
     return ret;
 }
 
+#ifdef _MSC_VER
+#define SLABS_THREAD_LOCAL __declspec(thread)
+#else
+#define SLABS_THREAD_LOCAL __thread
+#endif
+
+/* The next slab cache to hand out, and the one of the calling thread */
+static uint32_t slabs_next_cache;
+static SLABS_THREAD_LOCAL int slabs_thread_cache = -1;
+
+/*
+ * The slab caches are handed out to the threads in turn the first time
+ * they use one, so that the worker threads don't share them (unless there
+ * are more threads than caches).
+ */
+static struct slab_cache *slabs_cache(struct default_engine *engine) {
+    if (slabs_thread_cache == -1) {
+        slabs_thread_cache = (int)(atomic_fetch_add_uint32(&slabs_next_cache, 1)
+                                   % SLAB_CACHE_COUNT);
+    }
+    return &engine->slabs.caches[slabs_thread_cache];
+}
+
+static void slabs_lock_caches(struct default_engine *engine) {
+    int ii;
+    for (ii = 0; ii < SLAB_CACHE_COUNT; ++ii) {
+        cb_mutex_enter(&engine->slabs.caches[ii].lock);
+    }
+}
+
+static void slabs_unlock_caches(struct default_engine *engine) {
+    int ii;
+    for (ii = SLAB_CACHE_COUNT - 1; ii >= 0; --ii) {
+        cb_mutex_exit(&engine->slabs.caches[ii].lock);
+    }
+}
+
 void *slabs_alloc(struct default_engine *engine, size_t size, unsigned int id) {
-    void *ret;
+    struct slab_cache *cache;
+    slab_magazine_t *m;
+    void *ret = NULL;
 
-    cb_mutex_enter(&engine->slabs.lock);
-    ret = do_slabs_alloc(engine, size, id);
-    cb_mutex_exit(&engine->slabs.lock);
+    if (id < POWER_SMALLEST || id > engine->slabs.power_largest ||
+        engine->slabs.slabclass[id].magazine_size == 0) {
+        cb_mutex_enter(&engine->slabs.lock);
+        ret = do_slabs_alloc(engine, size, id);
+        cb_mutex_exit(&engine->slabs.lock);
+        return ret;
+    }
+
+    cache = slabs_cache(engine);
+    m = &cache->magazines[id];
+    cb_mutex_enter(&cache->lock);
+    if (m->count == 0) {
+        m->misses++;
+        cb_mutex_enter(&engine->slabs.lock);
+        do_slabs_magazine_refill(engine, m, id);
+        cb_mutex_exit(&engine->slabs.lock);
+    } else {
+        m->hits++;
+    }
+
+    if (m->count != 0) {
+        ret = m->chunks[--m->count];
+        m->requested += size;
+        MEMCACHED_SLABS_ALLOCATE(size, id, engine->slabs.slabclass[id].size,
+                                 ret);
+    } else {
+        MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
+    }
+    cb_mutex_exit(&cache->lock);
     return ret;
 }
 
 void slabs_free(struct default_engine *engine, void *ptr, size_t size, unsigned int id) {
-    cb_mutex_enter(&engine->slabs.lock);
-    do_slabs_free(engine, ptr, size, id);
-    cb_mutex_exit(&engine->slabs.lock);
+    struct slab_cache *cache;
+    slab_magazine_t *m;
+    unsigned int magazine_size;
+
+    if (id < POWER_SMALLEST || id > engine->slabs.power_largest ||
+        engine->slabs.slabclass[id].magazine_size == 0) {
+        cb_mutex_enter(&engine->slabs.lock);
+        do_slabs_free(engine, ptr, size, id);
+        cb_mutex_exit(&engine->slabs.lock);
+        return;
+    }
+
+    cache = slabs_cache(engine);
+    m = &cache->magazines[id];
+    magazine_size = engine->slabs.slabclass[id].magazine_size;
+    cb_mutex_enter(&cache->lock);
+    /*
+     * The rebalancer holds all of the slab cache locks when it picks the
+     * class to move a page from, so it can't start behind our back. While
+     * it runs the chunks of the class have to be checked by do_slabs_free().
+     */
+    if (atomic_load_uint32(&engine->slabs.rebalance.src) == id) {
+        cb_mutex_enter(&engine->slabs.lock);
+        do_slabs_free(engine, ptr, size, id);
+        cb_mutex_exit(&engine->slabs.lock);
+    } else {
+        if (m->count == magazine_size) {
+            m->misses++;
+            cb_mutex_enter(&engine->slabs.lock);
+            do_slabs_magazine_drain(engine, m, id, magazine_size / 2);
+            cb_mutex_exit(&engine->slabs.lock);
+        } else {
+            m->hits++;
+        }
+        MEMCACHED_SLABS_FREE(size, id, ptr);
+        m->chunks[m->count++] = ptr;
+        m->requested -= size;
+    }
+    cb_mutex_exit(&cache->lock);
 }
 
 void slabs_stats(struct default_engine *engine, ADD_STAT add_stats, const void *c) {
+    slabs_lock_caches(engine);
     cb_mutex_enter(&engine->slabs.lock);
     do_slabs_stats(engine, add_stats, c);
     cb_mutex_exit(&engine->slabs.lock);
+    slabs_unlock_caches(engine);
 }
 
 void slabs_adjust_mem_requested(struct default_engine *engine, unsigned int id, size_t old, size_t ntotal)
@@ -453,6 +1057,16 @@ void slabs_destroy(struct default_engine *e)
     }
     free(e->slabs.allocs.ptrs);
 
+#ifdef __linux__
+    if (e->slabs.arena.base != NULL) {
+        munmap(e->slabs.arena.base, e->slabs.arena.size);
+    }
+#endif
+
+    for (ii = 0; ii < SLAB_CACHE_COUNT; ++ii) {
+        free(e->slabs.caches[ii].magazines);
+    }
+
     /* Release the freelists */
     for (jj = POWER_SMALLEST; jj <= e->slabs.power_largest; jj++) {
         slabclass_t *p = &e->slabs.slabclass[jj];
@@ -460,3 +1074,208 @@ void slabs_destroy(struct default_engine *e)
         free(p->slab_list);
     }
 }
+
+/*
+ * The slab rebalancer looks at the evictions in each slab class over
+ * windows of slab_automove_interval seconds. Once the same class has had
+ * the most evictions for SLAB_AUTOMOVE_WINDOWS windows in a row, a page is
+ * moved to it from a class which hasn't evicted anything over that time
+ * (and has a page to spare).
+ */
+#define SLAB_AUTOMOVE_WINDOWS 3
+
+/* Give up on moving a page if its chunks are still in use after this many
+   passes over it (about a second) */
+#define SLAB_REBALANCE_MAX_PASSES 1000
+
+struct slabs_automove {
+    unsigned int evicted[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int idle_windows[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int dst;
+    unsigned int dst_windows;
+};
+
+static bool slabs_automove_decide(struct default_engine *engine,
+                                  struct slabs_automove *am,
+                                  unsigned int *src, unsigned int *dst) {
+    unsigned int id, best = 0, best_evicted = 0, most_free = 0;
+
+    for (id = POWER_SMALLEST;
+         id <= engine->slabs.power_largest && id < POWER_LARGEST; ++id) {
+        unsigned int evicted = item_evictions(engine, id);
+        /* The counter goes back to 0 when the stats are reset */
+        unsigned int delta = evicted >= am->evicted[id] ?
+            evicted - am->evicted[id] : evicted;
+        am->evicted[id] = evicted;
+
+        if (delta == 0) {
+            am->idle_windows[id]++;
+        } else {
+            am->idle_windows[id] = 0;
+            if (delta > best_evicted) {
+                best_evicted = delta;
+                best = id;
+            }
+        }
+    }
+
+    if (best != 0 && best == am->dst) {
+        am->dst_windows++;
+    } else {
+        am->dst = best;
+        am->dst_windows = (best != 0) ? 1 : 0;
+    }
+
+    if (am->dst_windows < SLAB_AUTOMOVE_WINDOWS) {
+        return false;
+    }
+
+    *src = 0;
+    cb_mutex_enter(&engine->slabs.lock);
+    for (id = POWER_SMALLEST;
+         id <= engine->slabs.power_largest && id < POWER_LARGEST; ++id) {
+        slabclass_t *p = &engine->slabs.slabclass[id];
+        unsigned int nfree = p->sl_curr + p->end_page_free;
+        if (id != am->dst && am->idle_windows[id] >= SLAB_AUTOMOVE_WINDOWS &&
+            p->slabs > 2 && (*src == 0 || nfree > most_free)) {
+            *src = id;
+            most_free = nfree;
+        }
+    }
+    cb_mutex_exit(&engine->slabs.lock);
+
+    if (*src == 0) {
+        return false;
+    }
+
+    *dst = am->dst;
+    am->dst_windows = 0;
+    return true;
+}
+
+static bool slabs_rebalancer_stopping(struct default_engine *engine) {
+    bool ret;
+    cb_mutex_enter(&engine->slabs.rebalance.lock);
+    ret = engine->slabs.rebalance.shutdown;
+    cb_mutex_exit(&engine->slabs.rebalance.lock);
+    return ret;
+}
+
+/*
+ * Evict the items in the page until all of its chunks are freed. Items
+ * which are still referenced are freed once they are released.
+ */
+static bool slabs_move_page(struct default_engine *engine,
+                            unsigned int src, unsigned int dst) {
+    slabclass_t *p = &engine->slabs.slabclass[src];
+    char *page;
+    int pass;
+    bool ret;
+
+    slabs_lock_caches(engine);
+    cb_mutex_enter(&engine->slabs.lock);
+    ret = do_slabs_reassign_start(engine, src, dst);
+    page = engine->slabs.rebalance.page;
+    cb_mutex_exit(&engine->slabs.lock);
+    slabs_unlock_caches(engine);
+    if (!ret) {
+        return false;
+    }
+
+    for (pass = 0; ; ++pass) {
+        unsigned int evicted = item_evict_page(engine, page, p->size,
+                                               p->perslab);
+        bool give_up = pass >= SLAB_REBALANCE_MAX_PASSES ||
+            slabs_rebalancer_stopping(engine);
+        bool done = false;
+
+        cb_mutex_enter(&engine->slabs.lock);
+        engine->slabs.rebalance.evicted += evicted;
+        if (do_slabs_reassign_finish(engine)) {
+            done = true;
+        } else if (give_up) {
+            do_slabs_reassign_abort(engine);
+            ret = false;
+            done = true;
+        }
+        cb_mutex_exit(&engine->slabs.lock);
+
+        if (done) {
+            break;
+        }
+#ifdef WIN32
+        Sleep(1);
+#else
+        usleep(1000);
+#endif
+    }
+
+    if (engine->config.verbose > 1) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_INFO, NULL,
+                    "%s a page from slab class %u to %u\n",
+                    ret ? "Moved" : "Failed to move", src, dst);
+    }
+    return ret;
+}
+
+static void slabs_rebalancer_main(void *arg) {
+    struct default_engine *engine = arg;
+    struct slabs_automove automove;
+
+    memset(&automove, 0, sizeof(automove));
+    cb_mutex_enter(&engine->slabs.rebalance.lock);
+    while (!engine->slabs.rebalance.shutdown) {
+        unsigned int src, dst;
+
+        cb_cond_timedwait(&engine->slabs.rebalance.cond,
+                          &engine->slabs.rebalance.lock,
+                          (unsigned int)engine->config.slab_automove_interval * 1000);
+        if (engine->slabs.rebalance.shutdown || !engine->config.slab_automove) {
+            continue;
+        }
+
+        cb_mutex_exit(&engine->slabs.rebalance.lock);
+        if (slabs_automove_decide(engine, &automove, &src, &dst)) {
+            slabs_move_page(engine, src, dst);
+        }
+        cb_mutex_enter(&engine->slabs.rebalance.lock);
+    }
+    cb_mutex_exit(&engine->slabs.rebalance.lock);
+}
+
+int slabs_start_rebalancer(struct default_engine *engine) {
+    int ret;
+
+    cb_mutex_enter(&engine->slabs.rebalance.lock);
+    engine->slabs.rebalance.shutdown = false;
+    ret = cb_create_thread(&engine->slabs.rebalance.tid,
+                           slabs_rebalancer_main, engine, 0);
+    engine->slabs.rebalance.started = (ret == 0);
+    cb_mutex_exit(&engine->slabs.rebalance.lock);
+
+    if (ret != 0) {
+        EXTENSION_LOGGER_DESCRIPTOR *logger;
+        logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        logger->log(EXTENSION_LOG_WARNING, NULL,
+                    "Can't create thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+void slabs_stop_rebalancer(struct default_engine *engine) {
+    bool started;
+
+    cb_mutex_enter(&engine->slabs.rebalance.lock);
+    started = engine->slabs.rebalance.started;
+    engine->slabs.rebalance.shutdown = true;
+    engine->slabs.rebalance.started = false;
+    cb_cond_signal(&engine->slabs.rebalance.cond);
+    cb_mutex_exit(&engine->slabs.rebalance.lock);
+
+    if (started) {
+        cb_join_thread(engine->slabs.rebalance.tid);
+    }
+}
@@ -24,8 +24,42 @@ typedef struct {
 
     unsigned int killing;  /* index+1 of dying slab, or zero if none */
     size_t requested; /* The number of requested bytes */
+
+    unsigned int pages_moved_in;  /* pages given to us by the rebalancer */
+    unsigned int pages_moved_out; /* pages taken from us by the rebalancer */
+
+    unsigned int magazine_size; /* chunks kept in each slab cache, or zero */
 } slabclass_t;
 
+/*
+ * Each thread allocates chunks from (and frees chunks to) one of the
+ * SLAB_CACHE_COUNT slab caches. The caches are handed out to the threads
+ * in turn, so up to SLAB_CACHE_COUNT threads each have a cache of their
+ * own. A slab cache keeps a magazine of free chunks for each slab class
+ * which is refilled from and drained to the slab class in batches, so that
+ * the slabs lock is only taken every so often. The lock of a cache is only
+ * contended by the rebalancer and the stats, which look at all of them.
+ */
+#define SLAB_CACHE_COUNT 16
+#define SLAB_MAGAZINE_SIZE 32
+/* The most memory held in a single magazine */
+#define SLAB_MAGAZINE_BYTES (64 * 1024)
+
+typedef struct {
+    unsigned int count;
+    int64_t requested; /* bytes requested since the magazine was drained */
+    uint64_t hits;     /* allocations and frees done without the slabs lock */
+    uint64_t misses;
+    void *chunks[SLAB_MAGAZINE_SIZE];
+} slab_magazine_t;
+
+struct slab_cache {
+   cb_mutex_t lock;
+   slab_magazine_t *magazines; /* one for each slab class */
+   /* Keep the locks of the caches on cache lines of their own */
+   char pad[128 - sizeof(cb_mutex_t) - sizeof(slab_magazine_t *)];
+};
+
 struct slabs {
    slabclass_t slabclass[MAX_NUMBER_OF_SLAB_CLASSES];
    size_t mem_limit;
@@ -35,6 +69,8 @@ struct slabs {
    void *mem_base;
    void *mem_current;
    size_t mem_avail;
+   /* log2 of the alignment of the chunks (see ITEM_CURSOR_HANDLE_BASE) */
+   unsigned int item_shift;
 
    struct {
       void **ptrs;
@@ -42,10 +78,49 @@ struct slabs {
       size_t size;
    } allocs;
 
+   /**
+    * The memory preallocated for the slab pages (see slabs_init())
+    */
+   struct {
+      void *base;
+      size_t size;
+      const char *backing;     /* "hugetlb", "thp", "pages" or "malloc" */
+      unsigned int numa_nodes; /* nodes the pages are spread over, or 0 */
+   } arena;
+
    /**
     * Access to the slab allocator is protected by this lock
     */
    cb_mutex_t lock;
+
+   /**
+    * The slab caches. The lock of a slab cache must be taken before the
+    * slabs lock.
+    */
+   struct slab_cache caches[SLAB_CACHE_COUNT];
+
+   /**
+    * The slab rebalancer moving pages from one slab class to another.
+    * The page being moved (and the counters) are protected by the slabs
+    * lock, and the state of the thread by the rebalancer's own lock.
+    */
+   struct {
+      cb_thread_t tid;
+      cb_mutex_t lock;
+      cb_cond_t cond;
+      bool started;
+      bool shutdown;
+
+      uint32_t src;      /* 0 unless a page is being moved */
+      unsigned int dst;
+      char *page;
+      unsigned char *captured_map; /* the chunks in the page we own */
+      unsigned int captured;
+
+      uint64_t moved;
+      uint64_t evicted;
+      uint64_t aborted;
+   } rebalance;
 };
 
 
@@ -55,7 +130,9 @@ struct slabs {
     0 if no limit. 2nd argument is the growth factor; each slab will use a chunk
     size equal to the previous slab's chunk size times this factor.
     3rd argument specifies if the slab allocator should allocate all memory
-    up front (if true), or allocate memory in chunks as it is needed (if false)
+    up front (if true), or allocate memory in chunks as it is needed (if false).
+    The memory allocated up front may be backed by huge pages and spread over
+    NUMA nodes (see the hugepages and numa_policy settings).
 */
 ENGINE_ERROR_CODE slabs_init(struct default_engine *engine,
                              const size_t limit,
@@ -80,6 +157,14 @@ void slabs_free(struct default_engine *engine, void *ptr, size_t size, unsigned
 /** Adjust the stats for memory requested */
 void slabs_adjust_mem_requested(struct default_engine *engine, unsigned int id, size_t old, size_t ntotal);
 
+/**
+ * Start (and stop) the slab rebalancer thread
+ * @param engine handle to the storage engine
+ * @return 0 on success
+ */
+int slabs_start_rebalancer(struct default_engine *engine);
+void slabs_stop_rebalancer(struct default_engine *engine);
+
 /** Fill buffer with stats */ /*@null@*/
 void slabs_stats(struct default_engine *engine, ADD_STAT add_stats, const void *c);
 
@@ -842,6 +842,7 @@ private:
 
 struct EngineGlue {
     EngineGlue(SERVER_HANDLE_V1 *api): me(api) {
+        memset(&interface, 0, sizeof(interface));
         interface.interface.interface = 1;
         interface.get_info = get_info;
         interface.initialize = initialize;
@@ -184,6 +184,15 @@ extern "C" {
         feature_info features[1];
     } engine_info;
 
+    /**
+     * A key to look up with get_multi()
+     */
+    typedef struct {
+        const void *key;
+        uint16_t nkey;
+        uint16_t vbucket;
+    } item_key;
+
     /**
      * Definition of the first version of the engine interface
      */
@@ -561,6 +570,33 @@ extern "C" {
                                                engine_get_vb_map_cb callback);
 
         struct dcp_interface dcp;
+
+        /**
+         * Retrieve a number of items at once. This is optional (may be
+         * NULL); the core uses it for a burst of pipelined gets so that
+         * the engine may look them up as a batch.
+         *
+         * The result of each lookup is reported in status the way get()
+         * would have returned it. The core retries any key not reported
+         * as ENGINE_SUCCESS or ENGINE_KEY_ENOENT with get(), so the
+         * engine must not start any background work (or notify the
+         * cookie) for such keys.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param keys the keys to look up
+         * @param nkeys the number of keys
+         * @param items output array receiving the located items
+         * @param status output array receiving the result of each lookup
+         *
+         * @return ENGINE_SUCCESS if the keys were looked up
+         */
+        ENGINE_ERROR_CODE (*get_multi)(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       const item_key *keys,
+                                       int nkeys,
+                                       item** items,
+                                       ENGINE_ERROR_CODE *status);
     } ENGINE_HANDLE_V1;
 
     /**
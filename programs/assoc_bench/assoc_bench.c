@@ -0,0 +1,283 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * assoc_bench compares lookups in the bucketized hash table used by the
+ * default engine (see engines/default_engine/assoc_bucket.h) with the
+ * chained hash table it replaced, where every item has a pointer to the
+ * next item in its bucket. It builds both tables over the same items and
+ * reports the time per lookup for keys which are in the table (hits) and
+ * keys which aren't (misses).
+ *
+ * Each table is sized the way the engine sizes it: the chained table
+ * grew at 1.5 items per bucket, and the bucketized table grows at 3
+ * items per bucket.
+ */
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/platform.h>
+#include "engines/default_engine/assoc_bucket.h"
+
+/* Mimics the size of an item in the default engine with a small value */
+typedef struct _hash_item {
+    struct _hash_item *next;
+    struct _hash_item *prev;
+    struct _hash_item *h_next;
+    uint32_t meta[4];
+    uint16_t nkey;
+    uint16_t iflag;
+    uint16_t refcount;
+    uint8_t slabs_clsid;
+    uint8_t datatype;
+    uint64_t cas;
+    char key[16];
+    char value[24];
+} hash_item;
+
+struct lookup {
+    const char *key;
+    uint32_t hash;
+    uint16_t nkey;
+};
+
+#define hashsize(n) ((size_t)1<<(n))
+#define hashmask(n) (hashsize(n)-1)
+
+static uint32_t bench_hash(const void *key, size_t length) {
+    const uint8_t *ptr = key;
+    uint32_t hv = 2166136261U;
+    size_t ii;
+
+    for (ii = 0; ii < length; ++ii) {
+        hv ^= ptr[ii];
+        hv *= 16777619U;
+    }
+    return hv;
+}
+
+static uint64_t next_random(uint64_t *seed) {
+    /* xorshift64* */
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 2685821657736338717ULL;
+}
+
+static uint32_t power_for(size_t keys, double load) {
+    uint32_t power = 1;
+    while ((double)hashsize(power) * load < (double)keys) {
+        ++power;
+    }
+    return power;
+}
+
+static hash_item *chained_find(hash_item **table, uint32_t power,
+                               const struct lookup *l) {
+    hash_item *it = table[l->hash & hashmask(power)];
+    while (it != NULL) {
+        if (l->nkey == it->nkey && memcmp(l->key, it->key, l->nkey) == 0) {
+            return it;
+        }
+        it = it->h_next;
+    }
+    return NULL;
+}
+
+static hash_item *bucket_find(struct assoc_bucket *table, uint32_t power,
+                              const struct lookup *l) {
+    const uint8_t tag = assoc_bucket_tag(l->hash);
+    struct assoc_bucket *b;
+
+    for (b = &table[l->hash & hashmask(power)]; b != NULL; b = b->next) {
+        uint64_t match = assoc_bucket_match(b->tags, tag);
+        while (match != 0) {
+            hash_item *it = b->slots[assoc_bucket_slot(match)];
+            match &= match - 1;
+            if (it != NULL && l->nkey == it->nkey &&
+                memcmp(l->key, it->key, l->nkey) == 0) {
+                return it;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void bucket_insert(struct assoc_bucket *b, uint8_t tag,
+                          hash_item *it, size_t *overflow) {
+    for (;;) {
+        uint64_t empty = assoc_bucket_match(b->tags, 0);
+        if (empty != 0) {
+            int slot = assoc_bucket_slot(empty);
+            b->slots[slot] = it;
+            b->tags |= (uint64_t)tag << (slot * 8);
+            return;
+        }
+        if (b->next == NULL) {
+            cb_assert(posix_memalign((void**)&b->next, ASSOC_BUCKET_ALIGN,
+                                     sizeof(*b)) == 0);
+            memset(b->next, 0, sizeof(*b));
+            ++*overflow;
+        }
+        b = b->next;
+    }
+}
+
+static void make_lookups(struct lookup *lookups, char *keys, size_t num,
+                         size_t range, const char *prefix, uint64_t seed) {
+    size_t ii;
+    for (ii = 0; ii < num; ++ii) {
+        char *key = keys + ii * 16;
+        unsigned long idx = (unsigned long)(next_random(&seed) % range);
+        lookups[ii].key = key;
+        lookups[ii].nkey = (uint16_t)snprintf(key, 16, "%s%lu", prefix, idx);
+        lookups[ii].hash = bench_hash(key, lookups[ii].nkey);
+    }
+}
+
+static void report(const char *name, const char *kind, size_t num,
+                   size_t found, hrtime_t start, hrtime_t stop) {
+    fprintf(stdout, "  %-8s %-5s %8.1f ns/lookup %12lu found\n", name, kind,
+            (double)(stop - start) / (double)num, (unsigned long)found);
+    fflush(stdout);
+}
+
+static void run(size_t nkeys, size_t nlookups) {
+    const uint32_t cpower = power_for(nkeys, 1.5);
+    const uint32_t bpower = power_for(nkeys, 3);
+    hash_item *items = calloc(nkeys, sizeof(hash_item));
+    hash_item **ctable = calloc(hashsize(cpower), sizeof(hash_item*));
+    struct assoc_bucket *btable;
+    struct lookup *lookups = calloc(nlookups, sizeof(struct lookup));
+    char *keys = malloc(nlookups * 16);
+    size_t overflow = 0;
+    size_t found;
+    hrtime_t start, stop;
+    size_t ii;
+    int pass;
+
+    cb_assert(posix_memalign((void**)&btable, ASSOC_BUCKET_ALIGN,
+                             hashsize(bpower) * sizeof(*btable)) == 0);
+    memset(btable, 0, hashsize(bpower) * sizeof(*btable));
+    if (items == NULL || ctable == NULL || lookups == NULL || keys == NULL) {
+        fprintf(stderr, "Failed to allocate memory for %lu keys\n",
+                (unsigned long)nkeys);
+        exit(EXIT_FAILURE);
+    }
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        hash_item *it = items + ii;
+        uint32_t hash;
+        it->nkey = (uint16_t)snprintf(it->key, sizeof(it->key), "key_%lu",
+                                      (unsigned long)ii);
+        hash = bench_hash(it->key, it->nkey);
+        it->h_next = ctable[hash & hashmask(cpower)];
+        ctable[hash & hashmask(cpower)] = it;
+        bucket_insert(&btable[hash & hashmask(bpower)],
+                      assoc_bucket_tag(hash), it, &overflow);
+    }
+
+    fprintf(stdout, "%lu keys, %lu lookups\n", (unsigned long)nkeys,
+            (unsigned long)nlookups);
+    fprintf(stdout, "  chained: 2^%u buckets, %lu MB\n", cpower,
+            (unsigned long)((hashsize(cpower) * sizeof(hash_item*)) >> 20));
+    fprintf(stdout, "  bucket:  2^%u buckets + %lu overflow, %lu MB\n", bpower,
+            (unsigned long)overflow,
+            (unsigned long)(((hashsize(bpower) + overflow) *
+                             sizeof(struct assoc_bucket)) >> 20));
+
+    for (pass = 0; pass < 2; ++pass) {
+        const char *kind = pass == 0 ? "hit" : "miss";
+        make_lookups(lookups, keys, nlookups, nkeys,
+                     pass == 0 ? "key_" : "miss_", 0x9E3779B97F4A7C15ULL);
+
+        found = 0;
+        start = gethrtime();
+        for (ii = 0; ii < nlookups; ++ii) {
+            found += (chained_find(ctable, cpower, lookups + ii) != NULL);
+        }
+        stop = gethrtime();
+        report("chained", kind, nlookups, found, start, stop);
+
+        found = 0;
+        start = gethrtime();
+        for (ii = 0; ii < nlookups; ++ii) {
+            found += (bucket_find(btable, bpower, lookups + ii) != NULL);
+        }
+        stop = gethrtime();
+        report("bucket", kind, nlookups, found, start, stop);
+    }
+
+    for (ii = 0; ii < hashsize(bpower); ++ii) {
+        struct assoc_bucket *next = btable[ii].next;
+        while (next != NULL) {
+            struct assoc_bucket *b = next;
+            next = b->next;
+            free(b);
+        }
+    }
+    free(btable);
+    free(ctable);
+    free(items);
+    free(lookups);
+    free(keys);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: assoc_bench [-l lookups] [keys ...]\n"
+            "       (default: 10000000 and 100000000 keys)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    size_t nlookups = 5000000;
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "l:")) != EOF) {
+        switch (cmd) {
+        case 'l':
+            nlookups = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (nlookups == 0) {
+        usage();
+    }
+
+    if (optind == argc) {
+        run(10000000, nlookups);
+        run(100000000, nlookups);
+    } else {
+        for (; optind < argc; ++optind) {
+            size_t nkeys = strtoul(argv[optind], NULL, 10);
+            if (nkeys == 0) {
+                usage();
+            }
+            run(nkeys, nlookups);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
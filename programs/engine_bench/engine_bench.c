@@ -0,0 +1,270 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * engine_bench measures how the throughput of an engine scales with the
+ * number of worker threads calling into it. It runs a get/set mix from
+ * 1, 2, 4 ... up to the requested number of threads (the equivalent of
+ * the memcached "threads" setting) and reports the number of operations
+ * per second for each step.
+ */
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <platform/platform.h>
+#include <memcached/engine.h>
+#include <memcached/extension_loggers.h>
+#include <memcached/protocol_binary.h>
+#include "utilities/engine_loader.h"
+#include "programs/engine_testapp/mock_server.h"
+
+static ENGINE_HANDLE *handle;
+static ENGINE_HANDLE_V1 *handle_v1;
+static time_t started;
+static volatile bool running;
+
+static struct {
+    size_t keys;
+    size_t value_size;
+    int get_ratio;
+} workload = { 100000, 32, 90 };
+
+struct worker {
+    cb_thread_t tid;
+    uint64_t seed;
+    uint64_t ops;
+    uint64_t failed;
+};
+
+/*
+ * The mock server maps all keys to the same hash bucket and protects its
+ * clock with a mutex, which would hide any scaling in the engine.
+ */
+static uint32_t bench_hash(const void *key, size_t length,
+                           const uint32_t initval) {
+    const uint8_t *ptr = key;
+    uint32_t hv = 2166136261U ^ initval;
+    size_t ii;
+
+    for (ii = 0; ii < length; ++ii) {
+        hv ^= ptr[ii];
+        hv *= 16777619U;
+    }
+    return hv;
+}
+
+static rel_time_t bench_get_current_time(void) {
+    return (rel_time_t)(time(NULL) - started);
+}
+
+static uint64_t next_random(uint64_t *seed) {
+    /* xorshift64* */
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 2685821657736338717ULL;
+}
+
+static ENGINE_ERROR_CODE store_key(const void *cookie, const char *key,
+                                   size_t nkey) {
+    item *it;
+    uint64_t cas = 0;
+    ENGINE_ERROR_CODE ret;
+
+    ret = handle_v1->allocate(handle, cookie, &it, key, nkey,
+                              workload.value_size, 0, 0,
+                              PROTOCOL_BINARY_RAW_BYTES);
+    if (ret == ENGINE_SUCCESS) {
+        ret = handle_v1->store(handle, cookie, it, &cas, OPERATION_SET, 0);
+        handle_v1->release(handle, cookie, it);
+    }
+    return ret;
+}
+
+static void worker_main(void *arg) {
+    struct worker *w = arg;
+    const void *cookie = create_mock_cookie();
+    char key[32];
+
+    while (running) {
+        uint64_t rnd = next_random(&w->seed);
+        size_t nkey = snprintf(key, sizeof(key), "key_%lu",
+                               (unsigned long)((rnd >> 8) % workload.keys));
+        ENGINE_ERROR_CODE ret;
+
+        if ((int)(rnd % 100) < workload.get_ratio) {
+            item *it;
+            ret = handle_v1->get(handle, cookie, &it, key, (int)nkey, 0);
+            if (ret == ENGINE_SUCCESS) {
+                handle_v1->release(handle, cookie, it);
+            }
+        } else {
+            ret = store_key(cookie, key, nkey);
+        }
+
+        if (ret != ENGINE_SUCCESS) {
+            w->failed++;
+        }
+        w->ops++;
+    }
+
+    destroy_mock_cookie(cookie);
+}
+
+static void run_step(int num_threads, int duration) {
+    struct worker *workers = calloc(num_threads, sizeof(struct worker));
+    uint64_t ops = 0;
+    uint64_t failed = 0;
+    hrtime_t start, stop;
+    int ii;
+
+    cb_assert(workers != NULL);
+    running = true;
+    start = gethrtime();
+    for (ii = 0; ii < num_threads; ++ii) {
+        workers[ii].seed = 0x9E3779B97F4A7C15ULL * (ii + 1);
+        cb_assert(cb_create_thread(&workers[ii].tid, worker_main,
+                                   &workers[ii], 0) == 0);
+    }
+
+    sleep(duration);
+    running = false;
+
+    for (ii = 0; ii < num_threads; ++ii) {
+        cb_assert(cb_join_thread(workers[ii].tid) == 0);
+        ops += workers[ii].ops;
+        failed += workers[ii].failed;
+    }
+    stop = gethrtime();
+
+    fprintf(stdout, "%7d %15.0f %12lu\n", num_threads,
+            (double)ops * 1000000000.0 / (double)(stop - start),
+            (unsigned long)failed);
+    fflush(stdout);
+    free(workers);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: engine_bench [-E engine] [-e config] [-t max threads]\n"
+            "                    [-d seconds per step] [-k keys]\n"
+            "                    [-s value size] [-g get percentage]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    const char *engine = "default_engine.so";
+    const char *cfg = "cache_size=268435456";
+    EXTENSION_LOGGER_DESCRIPTOR *logger;
+    SERVER_HANDLE_V1 *api;
+    int max_threads = 32;
+    int duration = 5;
+    int num_threads;
+    const void *cookie;
+    size_t ii;
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "E:e:t:d:k:s:g:")) != EOF) {
+        switch (cmd) {
+        case 'E':
+            engine = optarg;
+            break;
+        case 'e':
+            cfg = optarg;
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'k':
+            workload.keys = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            workload.value_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            workload.get_ratio = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (max_threads < 1 || duration < 1 || workload.keys == 0 ||
+        workload.get_ratio < 0 || workload.get_ratio > 100) {
+        usage();
+    }
+
+    /*
+     * The default engine takes the item lock to mark every item it hits
+     * as active during the first minute of uptime, so pretend we've been
+     * running for a while.
+     */
+    started = time(NULL) - 3600;
+    logger = get_null_logger();
+    api = get_mock_server_api();
+    api->core->hash = bench_hash;
+    api->core->get_current_time = bench_get_current_time;
+    init_mock_server(handle);
+
+    if (!load_engine(engine, get_mock_server_api, logger, &handle)) {
+        fprintf(stderr, "Failed to load engine %s.\n", engine);
+        return EXIT_FAILURE;
+    }
+
+    if (!init_engine(handle, cfg, logger)) {
+        fprintf(stderr, "Failed to init engine %s with config %s.\n",
+                engine, cfg);
+        return EXIT_FAILURE;
+    }
+    handle_v1 = (ENGINE_HANDLE_V1*)handle;
+
+    /* Populate the cache so that the gets have something to hit */
+    cookie = create_mock_cookie();
+    for (ii = 0; ii < workload.keys; ++ii) {
+        char key[32];
+        size_t nkey = snprintf(key, sizeof(key), "key_%lu",
+                               (unsigned long)ii);
+        if (store_key(cookie, key, nkey) != ENGINE_SUCCESS) {
+            fprintf(stderr, "Failed to populate the cache\n");
+            return EXIT_FAILURE;
+        }
+    }
+    destroy_mock_cookie(cookie);
+
+    fprintf(stdout, "%s: %lu keys, %lu byte values, %d%% gets\n", engine,
+            (unsigned long)workload.keys, (unsigned long)workload.value_size,
+            workload.get_ratio);
+    fprintf(stdout, "threads         ops/sec       failed\n");
+    for (num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+        run_step(num_threads, duration);
+    }
+    run_step(max_threads, duration);
+
+    handle_v1->destroy(handle, false);
+    unload_engine();
+    destroy_mock_event_callbacks();
+
+    return EXIT_SUCCESS;
+}
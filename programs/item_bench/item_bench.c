@@ -0,0 +1,238 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * item_bench compares the memory efficiency of the full and the compact
+ * (compact_items=true) item layouts of the default engine. For each value
+ * size it stores the same keys with both layouts, and reports the size of
+ * the item header and the slab memory used per item (in the same format
+ * as memcached_sizes).
+ */
+#include "config.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/platform.h>
+#include <memcached/engine.h>
+#include <memcached/extension_loggers.h>
+#include <memcached/protocol_binary.h>
+#include "utilities/engine_loader.h"
+#include "programs/engine_testapp/mock_server.h"
+
+struct footprint {
+    uint64_t header_size;
+    uint64_t chunk_bytes;
+    uint64_t requested;
+    uint64_t items;
+};
+
+/*
+ * The mock server maps all keys to the same hash bucket, which would make
+ * filling the cache rather slow.
+ */
+static uint32_t bench_hash(const void *key, size_t length,
+                           const uint32_t initval) {
+    const uint8_t *ptr = key;
+    uint32_t hv = 2166136261U ^ initval;
+    size_t ii;
+
+    for (ii = 0; ii < length; ++ii) {
+        hv ^= ptr[ii];
+        hv *= 16777619U;
+    }
+    return hv;
+}
+
+/* The chunk size of the slab class we got the last time */
+static uint64_t chunk_size;
+
+static void slab_stats_handler(const char *key, const uint16_t klen,
+                               const char *val, const uint32_t vlen,
+                               const void *cookie) {
+    struct footprint *footprint = (void*)cookie;
+    char name[1024];
+    char buffer[1024];
+    const char *stat;
+
+    memcpy(name, key, klen);
+    name[klen] = '\0';
+    memcpy(buffer, val, vlen);
+    buffer[vlen] = '\0';
+
+    /* The per class stats are named <slab class>:<stat> */
+    stat = strrchr(name, ':');
+    stat = (stat == NULL) ? name : stat + 1;
+    if (strcmp(stat, "item_header_size") == 0) {
+        footprint->header_size = strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "chunk_size") == 0) {
+        chunk_size = strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "used_chunks") == 0) {
+        footprint->chunk_bytes += chunk_size * strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "mem_requested") == 0) {
+        footprint->requested += strtoull(buffer, NULL, 10);
+    }
+}
+
+static bool measure(const char *engine, const char *cfg, bool compact,
+                    size_t keys, size_t value_size, struct footprint *footprint) {
+    EXTENSION_LOGGER_DESCRIPTOR *logger = get_null_logger();
+    ENGINE_HANDLE *handle;
+    ENGINE_HANDLE_V1 *handle_v1;
+    const void *cookie;
+    char config[1024];
+    bool ret = true;
+    size_t ii;
+
+    snprintf(config, sizeof(config), "%s;eviction=false;compact_items=%s",
+             cfg, compact ? "true" : "false");
+
+    if (!load_engine(engine, get_mock_server_api, logger, &handle)) {
+        fprintf(stderr, "Failed to load engine %s.\n", engine);
+        return false;
+    }
+    init_mock_server(handle);
+    if (!init_engine(handle, config, logger)) {
+        fprintf(stderr, "Failed to init engine %s with config %s.\n",
+                engine, config);
+        unload_engine();
+        return false;
+    }
+    handle_v1 = (ENGINE_HANDLE_V1*)handle;
+
+    cookie = create_mock_cookie();
+    for (ii = 0; ii < keys && ret; ++ii) {
+        char key[32];
+        size_t nkey = snprintf(key, sizeof(key), "key_%08lu",
+                               (unsigned long)ii);
+        uint64_t cas = 0;
+        item *it;
+
+        if (handle_v1->allocate(handle, cookie, &it, key, nkey, value_size,
+                                0, 0, PROTOCOL_BINARY_RAW_BYTES) != ENGINE_SUCCESS) {
+            fprintf(stderr, "Ran out of memory after %lu items\n",
+                    (unsigned long)ii);
+            ret = false;
+        } else {
+            if (handle_v1->store(handle, cookie, it, &cas, OPERATION_SET,
+                                 0) != ENGINE_SUCCESS) {
+                ret = false;
+            }
+            handle_v1->release(handle, cookie, it);
+        }
+    }
+
+    destroy_mock_cookie(cookie);
+
+    /* The stats are added to the footprint passed as the cookie */
+    memset(footprint, 0, sizeof(*footprint));
+    footprint->items = ii;
+    if (handle_v1->get_stats(handle, footprint, "slabs", 5,
+                             slab_stats_handler) != ENGINE_SUCCESS) {
+        ret = false;
+    }
+
+    handle_v1->destroy(handle, false);
+    unload_engine();
+    destroy_mock_event_callbacks();
+    return ret;
+}
+
+static void display(const char *name, uint64_t value) {
+    printf("%s\t%lu\n", name, (unsigned long)value);
+}
+
+static void report(const char *layout, size_t value_size,
+                   const struct footprint *footprint) {
+    char name[80];
+
+    printf("%s layout, %lu byte values\n", layout, (unsigned long)value_size);
+    display("Item header\t", footprint->header_size);
+    display("Slab bytes per item", footprint->chunk_bytes / footprint->items);
+    display("Requested per item", footprint->requested / footprint->items);
+    snprintf(name, sizeof(name), "Slab bytes for %lu items",
+             (unsigned long)footprint->items);
+    display(name, footprint->chunk_bytes);
+    printf("----------------------------------------\n");
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: item_bench [-E engine] [-e config] [-k keys]\n"
+            "                  [-s value size[,value size...]]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    const char *engine = "default_engine.so";
+    const char *cfg = "cache_size=268435456";
+    const char *sizes = "16,32,64,100,256";
+    size_t keys = 100000;
+    SERVER_HANDLE_V1 *api;
+    const char *ptr;
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "E:e:k:s:")) != EOF) {
+        switch (cmd) {
+        case 'E':
+            engine = optarg;
+            break;
+        case 'e':
+            cfg = optarg;
+            break;
+        case 'k':
+            keys = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (keys == 0) {
+        usage();
+    }
+
+    api = get_mock_server_api();
+    api->core->hash = bench_hash;
+
+    for (ptr = sizes; *ptr != '\0'; ) {
+        struct footprint full, compact;
+        char *end;
+        size_t value_size = strtoul(ptr, &end, 10);
+
+        if (end == ptr || !measure(engine, cfg, false, keys, value_size, &full) ||
+            !measure(engine, cfg, true, keys, value_size, &compact)) {
+            return EXIT_FAILURE;
+        }
+
+        report("Full", value_size, &full);
+        report("Compact", value_size, &compact);
+        printf("Compact layout saves %.1f%% of the slab memory\n",
+               100.0 * ((double)full.chunk_bytes - (double)compact.chunk_bytes) /
+               (double)full.chunk_bytes);
+        printf("========================================\n");
+
+        ptr = (*end == ',') ? end + 1 : end;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <memcached/protocol_binary.h>
+#include <memcached/openssl.h>
 
 #include <getopt.h>
 #include <cstdlib>
@@ -330,6 +331,229 @@ static void set_test(const std::string &host, const std::string &port, int durat
     }
 }
 
+/*
+ * A blocking connection used by the get test. It sends a window of
+ * pipelined gets and waits for all of the responses before it sends the
+ * next one, over a plain socket or over SSL.
+ */
+class GetClient {
+public:
+    GetClient(const std::string &_host, const std::string &_port,
+              SSL_CTX *_ctx) :
+        host(_host), port(_port), ctx(_ctx), ssl(NULL), sock(INVALID_SOCKET)
+    {
+    }
+
+    ~GetClient() {
+        if (ssl != NULL) {
+            SSL_free(ssl);
+        }
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
+        }
+    }
+
+    bool connect(void) {
+        struct addrinfo *ai = NULL;
+        struct addrinfo hints;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+            return false;
+        }
+
+        for (struct addrinfo *e = ai; e != NULL; e = e->ai_next) {
+            if ((sock = socket(e->ai_family, e->ai_socktype,
+                               e->ai_protocol)) != -1) {
+                if (::connect(sock, e->ai_addr, e->ai_addrlen) == 0) {
+                    break;
+                }
+                close(sock);
+                sock = -1;
+            }
+        }
+        freeaddrinfo(ai);
+
+        if (sock == -1) {
+            return false;
+        }
+
+        if (ctx != NULL) {
+            ssl = SSL_new(ctx);
+            if (ssl == NULL || !SSL_set_fd(ssl, sock) ||
+                SSL_connect(ssl) != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Store a value of the given size for the key the gets ask for */
+    bool set(size_t size) {
+        protocol_binary_request_set req;
+        memset(&req, 0, sizeof(req));
+        req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_SET;
+        req.message.header.request.keylen = htons(3);
+        req.message.header.request.extlen = 8;
+        req.message.header.request.bodylen = htonl(11 + size);
+
+        std::vector<uint8_t> message(req.bytes, req.bytes + sizeof(req.bytes));
+        message.push_back('f');
+        message.push_back('o');
+        message.push_back('o');
+        message.resize(message.size() + size, ' ');
+
+        return sendAll(message.data(), message.size()) && recvResponse();
+    }
+
+    /* Run gets for the given number of seconds, and return how many */
+    size_t run(int duration, int window) {
+        std::vector<uint8_t> message;
+        for (int ii = 0; ii < window; ++ii) {
+            protocol_binary_request_get req;
+            memset(&req, 0, sizeof(req));
+            req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+            req.message.header.request.opcode = PROTOCOL_BINARY_CMD_GET;
+            req.message.header.request.keylen = htons(3);
+            req.message.header.request.bodylen = htonl(3);
+            message.insert(message.end(), req.bytes,
+                           req.bytes + sizeof(req.bytes));
+            message.push_back('f');
+            message.push_back('o');
+            message.push_back('o');
+        }
+
+        size_t ops = 0;
+        time_t end = time(NULL) + duration;
+        while (time(NULL) < end) {
+            if (!sendAll(message.data(), message.size())) {
+                return ops;
+            }
+            for (int ii = 0; ii < window; ++ii) {
+                if (!recvResponse()) {
+                    return ops;
+                }
+            }
+            ops += window;
+        }
+        return ops;
+    }
+
+protected:
+    bool sendAll(const uint8_t *buf, size_t len) {
+        while (len > 0) {
+            ssize_t nw;
+            if (ssl != NULL) {
+                nw = SSL_write(ssl, buf, (int)len);
+            } else {
+                nw = send(sock, buf, len, 0);
+            }
+            if (nw <= 0) {
+                return false;
+            }
+            buf += nw;
+            len -= nw;
+        }
+        return true;
+    }
+
+    bool recvAll(uint8_t *buf, size_t len) {
+        while (len > 0) {
+            ssize_t nr;
+            if (ssl != NULL) {
+                nr = SSL_read(ssl, buf, (int)len);
+            } else {
+                nr = recv(sock, buf, len, 0);
+            }
+            if (nr <= 0) {
+                return false;
+            }
+            buf += nr;
+            len -= nr;
+        }
+        return true;
+    }
+
+    bool recvResponse(void) {
+        protocol_binary_response_no_extras res;
+        if (!recvAll(res.bytes, sizeof(res.bytes))) {
+            return false;
+        }
+        assert(res.message.header.response.magic == PROTOCOL_BINARY_RES);
+        uint32_t bodylen = ntohl(res.message.header.response.bodylen);
+        recvBuffer.resize(bodylen);
+        return bodylen == 0 || recvAll(recvBuffer.data(), bodylen);
+    }
+
+    const std::string host;
+    const std::string port;
+    SSL_CTX *ctx;
+    SSL *ssl;
+    int sock;
+    std::vector<uint8_t> recvBuffer;
+};
+
+/* Get throughput for the given value size over one connection, or 0 */
+static size_t get_rate(const std::string &host, const std::string &port,
+                       SSL_CTX *ctx, size_t size, int duration) {
+    GetClient c(host, port, ctx);
+    if (!c.connect() || !c.set(size)) {
+        std::cerr << "Failed to connect to " << host << ":" << port
+                  << std::endl;
+        return 0;
+    }
+    return c.run(duration, 32) / duration;
+}
+
+/*
+ * Compare the get throughput of the plain interface with the one of the
+ * SSL interface (if we got one) for a few value sizes
+ */
+static void get_test(const std::string &host, const std::string &port,
+                     const std::string &sslport, int duration) {
+    SSL_CTX *ctx = NULL;
+    std::list<int> sizes;
+    sizes.push_back(32);
+    sizes.push_back(256);
+    sizes.push_back(1 * 1024);
+    sizes.push_back(4 * 1024);
+    sizes.push_back(16 * 1024);
+    sizes.push_back(128 * 1024);
+    sizes.push_back(512 * 1024);
+
+    if (!sslport.empty()) {
+        SSL_library_init();
+        SSL_load_error_strings();
+        ctx = SSL_CTX_new(SSLv23_client_method());
+        if (ctx == NULL) {
+            std::cerr << "Failed to create the SSL context" << std::endl;
+            return;
+        }
+    }
+
+    for (auto iter = sizes.begin(); iter != sizes.end(); ++iter) {
+        size_t plain = get_rate(host, port, NULL, *iter, duration);
+        std::cout << *iter << " bytes: plain " << plain << " get/sec";
+        if (ctx != NULL) {
+            size_t ssl = get_rate(host, sslport, ctx, *iter, duration);
+            std::cout << ", ssl " << ssl << " get/sec";
+            if (plain > 0) {
+                std::cout << " (" << (ssl * 100) / plain << "%)";
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    if (ctx != NULL) {
+        SSL_CTX_free(ctx);
+    }
+}
+
 /**
  * Program entry point.
  *
@@ -342,13 +566,15 @@ int main(int argc, char **argv)
     int cmd;
     std::string host("localhost");
     std::string port("12000");
+    std::string sslport;
+    std::string test("set");
     int duration = 60;
     char *ptr;
 
     /* Initialize the socket subsystem */
     cb_initialize_sockets();
 
-    while ((cmd = getopt(argc, argv, "h:p:d:")) != EOF) {
+    while ((cmd = getopt(argc, argv, "h:p:s:d:T:")) != EOF) {
         switch (cmd) {
         case 'h' :
             ptr = strchr(optarg, ':');
@@ -361,17 +587,31 @@ int main(int argc, char **argv)
         case 'p' :
             port.assign(optarg);
             break;
+        case 's' :
+            sslport.assign(optarg);
+            break;
         case 'd':
             duration = atoi(optarg);
             break;
+        case 'T':
+            test.assign(optarg);
+            if (test == "set" || test == "get") {
+                break;
+            }
+            /* FALLTHROUGH */
         default:
             fprintf(stderr,
-                    "Usage mcbench [-h host[:port]] [-p port] [-d duration]\n");
+                    "Usage mcbench [-h host[:port]] [-p port] [-s sslport] "
+                    "[-d duration] [-T set|get]\n");
             return 1;
         }
     }
 
-    set_test(host, port, duration);
+    if (test == "get") {
+        get_test(host, port, sslport, duration);
+    } else {
+        set_test(host, port, duration);
+    }
 
     return 0;
 }
@@ -118,6 +118,10 @@ void initialize_breakpad(const breakpad_settings_t* settings) {
     /* do nothing */
 }
 
+bool ssl_context_set_files(int idx, const char *cert, const char *key) {
+    return true;
+}
+
 /* settings, as used by config_parse.c */
 struct settings settings;
 struct conn *listen_conn = NULL;
@@ -175,6 +179,10 @@ static cJSON* get_baseline_settings(const char* temp_file)
     }
     cJSON_AddTrueToObject(baseline, "require_sasl");
     cJSON_AddFalseToObject(baseline, "require_init");
+    cJSON_AddFalseToObject(baseline, "reuseport");
+    cJSON_AddFalseToObject(baseline, "io_uring");
+    cJSON_AddNumberToObject(baseline, "io_uring_entries", 1024);
+    cJSON_AddNumberToObject(baseline, "zerocopy_threshold", 0);
     cJSON_AddNumberToObject(baseline, "default_reqs_per_event", 1);
     cJSON_AddNumberToObject(baseline, "reqs_per_event_low_priority", 5);
     cJSON_AddNumberToObject(baseline, "reqs_per_event_med_priority", 10);
@@ -556,6 +564,28 @@ static void test_dynamic_require_init(struct test_ctx *ctx) {
     cb_assert(cJSON_GetArraySize(ctx->errors) == 1);
 }
 
+static void test_dynamic_reuseport(struct test_ctx *ctx) {
+    /* Cannot change reuseport */
+    cJSON_ReplaceItemInObject(ctx->dynamic, "reuseport", cJSON_CreateTrue());
+    cb_assert(validate_dynamic_JSON_changes(ctx) == false);
+    cb_assert(cJSON_GetArraySize(ctx->errors) == 1);
+}
+
+static void test_dynamic_io_uring(struct test_ctx *ctx) {
+    /* Cannot change io_uring */
+    cJSON_ReplaceItemInObject(ctx->dynamic, "io_uring", cJSON_CreateTrue());
+    cb_assert(validate_dynamic_JSON_changes(ctx) == false);
+    cb_assert(cJSON_GetArraySize(ctx->errors) == 1);
+}
+
+static void test_dynamic_io_uring_entries(struct test_ctx *ctx) {
+    /* Cannot change io_uring_entries */
+    cJSON_ReplaceItemInObject(ctx->dynamic, "io_uring_entries",
+                              cJSON_CreateNumber(16));
+    cb_assert(validate_dynamic_JSON_changes(ctx) == false);
+    cb_assert(cJSON_GetArraySize(ctx->errors) == 1);
+}
+
 static void test_dynamic_reqs_per_event(struct test_ctx *ctx) {
     /* CAN change reqs_per_event */
     cJSON_ReplaceItemInObject(ctx->dynamic, "reqs_per_event", cJSON_CreateNumber(2));
@@ -568,6 +598,13 @@ static void test_dynamic_verbosity(struct test_ctx *ctx) {
     cb_assert(validate_dynamic_JSON_changes(ctx));
 }
 
+static void test_dynamic_zerocopy_threshold(struct test_ctx *ctx) {
+    /* CAN change zerocopy_threshold */
+    cJSON_ReplaceItemInObject(ctx->dynamic, "zerocopy_threshold",
+                              cJSON_CreateNumber(262144));
+    cb_assert(validate_dynamic_JSON_changes(ctx));
+}
+
 static void test_dynamic_bio_drain_buffer_sz(struct test_ctx *ctx) {
     /* Cannot change dynamic_bio_drain_buffer_sz */
     cJSON_ReplaceItemInObject(ctx->dynamic, "bio_drain_buffer_sz",
@@ -701,8 +738,12 @@ int main(void)
         { "dynamic_engine_config", setup_dynamic, test_dynamic_engine_config, teardown_dynamic },
         { "dynamic_require_sasl", setup_dynamic, test_dynamic_require_sasl, teardown_dynamic },
         { "dynamic_require_init", setup_dynamic, test_dynamic_require_init, teardown_dynamic },
+        { "dynamic_reuseport", setup_dynamic, test_dynamic_reuseport, teardown_dynamic },
+        { "dynamic_io_uring", setup_dynamic, test_dynamic_io_uring, teardown_dynamic },
+        { "dynamic_io_uring_entries", setup_dynamic, test_dynamic_io_uring_entries, teardown_dynamic },
         { "dynamic_reqs_per_event", setup_dynamic, test_dynamic_reqs_per_event, teardown_dynamic },
         { "dynamic_verbosity", setup_dynamic, test_dynamic_verbosity, teardown_dynamic },
+        { "dynamic_zerocopy_threshold", setup_dynamic, test_dynamic_zerocopy_threshold, teardown_dynamic },
         { "dynamic_bio_drain_buffer_sz", setup_dynamic, test_dynamic_bio_drain_buffer_sz, teardown_dynamic },
         { "dynamic_datatype", setup_dynamic, test_dynamic_datatype, teardown_dynamic },
         { "root", setup_dynamic, test_dynamic_root, teardown_dynamic },
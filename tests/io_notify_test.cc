@@ -0,0 +1,173 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Stress test of the io notification queue (daemon/io_notify.cc): a
+ * number of threads push the same connections as fast as they can while
+ * a single consumer drains the queue whenever it is woken up, like the
+ * worker threads in the daemon do.
+ */
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ATOMIC
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
+#include <platform/platform.h>
+#include <platform/cbassert.h>
+
+#include "daemon/io_notify.h"
+
+#define NUM_PUSHERS 4
+#define NUM_CONNS 64
+#define NUM_ROUNDS 100000
+
+/* Stands in for a connection, the queue only passes the pointer around */
+struct test_conn {
+    IO_NOTIFY_NODE *node;
+    /* The clock when a pusher last pushed it */
+    std::atomic<uint64_t> pushed;
+    /* The clock when the consumer last got it (only used by the consumer) */
+    uint64_t delivered;
+    /* The drain it was last delivered in (only used by the consumer) */
+    uint64_t drain;
+};
+
+static IO_NOTIFY_QUEUE *queue;
+static test_conn conns[NUM_CONNS];
+
+/* Orders the pushes and the deliveries */
+static std::atomic<uint64_t> clock_ticks(1);
+/* The number of pushes which added the connection to the queue */
+static std::atomic<uint64_t> queued(0);
+/* Stands in for the notification channel of the consumer */
+static std::atomic<uint64_t> signals(0);
+/* Set once the consumer runs, and once all of the pushers are done */
+static std::atomic<bool> consumer_running(false);
+static std::atomic<bool> pushers_done(false);
+
+static uint64_t drains;
+static uint64_t delivered;
+
+static void deliver(struct conn *c, ENGINE_ERROR_CODE status, void *arg) {
+    test_conn *conn = reinterpret_cast<test_conn *>(c);
+
+    (void)arg;
+    cb_assert(status == ENGINE_SUCCESS || status == ENGINE_TMPFAIL);
+    /* A connection is never queued twice */
+    cb_assert(conn->drain != drains);
+    conn->drain = drains;
+    conn->delivered = clock_ticks.load();
+    ++delivered;
+}
+
+/* Let the other threads run (there may be fewer cores than threads) */
+static void pause_briefly(void) {
+#ifdef WIN32
+    Sleep(0);
+#else
+    usleep(1);
+#endif
+}
+
+static void pusher(void *arg) {
+    const long id = reinterpret_cast<long>(arg);
+
+    /* Make sure that the pushes race with the drains */
+    while (!consumer_running.load()) {
+        pause_briefly();
+    }
+
+    for (int round = 0; round < NUM_ROUNDS; ++round) {
+        test_conn *conn = &conns[(round * 7 + id) % NUM_CONNS];
+        ENGINE_ERROR_CODE status = (round & 1) ? ENGINE_SUCCESS : ENGINE_TMPFAIL;
+
+        if (round % 100 == 0) {
+            pause_briefly();
+        }
+
+        conn->pushed.store(clock_ticks.fetch_add(1));
+        if (io_notify_push(queue, conn->node, status)) {
+            queued.fetch_add(1);
+            /* As notify_thread() does */
+            if (io_notify_arm(queue)) {
+                signals.fetch_add(1);
+            }
+        }
+    }
+}
+
+static void consumer(void *arg) {
+    (void)arg;
+
+    consumer_running.store(true);
+    while (true) {
+        /* Look at this first, so we see the signals of the last pushes */
+        bool done = pushers_done.load();
+
+        if (signals.exchange(0) > 0) {
+            /* As thread_libevent_process() does */
+            io_notify_disarm(queue);
+            ++drains;
+            io_notify_drain(queue, deliver, NULL);
+        } else if (done) {
+            break;
+        } else {
+            pause_briefly();
+        }
+    }
+}
+
+int main(void) {
+    cb_thread_t pushers[NUM_PUSHERS];
+    cb_thread_t drainer;
+    uint64_t before;
+    long ii;
+
+    queue = io_notify_queue_create();
+    for (ii = 0; ii < NUM_CONNS; ++ii) {
+        conns[ii].node =
+            io_notify_node_create(reinterpret_cast<struct conn *>(&conns[ii]));
+        conns[ii].pushed.store(0);
+        conns[ii].delivered = 0;
+        conns[ii].drain = 0;
+    }
+
+    cb_assert(cb_create_thread(&drainer, consumer, NULL, 0) == 0);
+    for (ii = 0; ii < NUM_PUSHERS; ++ii) {
+        cb_assert(cb_create_thread(&pushers[ii], pusher,
+                                   reinterpret_cast<void *>(ii), 0) == 0);
+    }
+    for (ii = 0; ii < NUM_PUSHERS; ++ii) {
+        cb_assert(cb_join_thread(pushers[ii]) == 0);
+    }
+    pushers_done.store(true);
+    cb_assert(cb_join_thread(drainer) == 0);
+
+    /*
+     * Every connection added to the queue came out once, and nothing is
+     * left behind without the consumer being woken up for it
+     */
+    cb_assert(delivered == queued.load());
+    before = delivered;
+    io_notify_drain(queue, deliver, NULL);
+    cb_assert(delivered == before);
+
+    /* Every push was followed by a delivery */
+    for (ii = 0; ii < NUM_CONNS; ++ii) {
+        cb_assert(conns[ii].delivered > conns[ii].pushed.load());
+        io_notify_node_destroy(conns[ii].node);
+    }
+    io_notify_queue_destroy(queue);
+
+    printf("%llu pushes queued %llu connections in %llu drains\n",
+           (unsigned long long)(NUM_PUSHERS * NUM_ROUNDS),
+           (unsigned long long)delivered, (unsigned long long)drains);
+    return EXIT_SUCCESS;
+}
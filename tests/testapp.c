@@ -73,6 +73,7 @@ static BIO *ssl_bio_r = NULL;
 static BIO *ssl_bio_w = NULL;
 
 static void set_mutation_seqno_feature(bool enable);
+static enum test_return store_object(const char *key, char *value);
 
 /* Returns true if the specified test phase is enabled. */
 static bool phase_enabled(int phase) {
@@ -1112,9 +1113,7 @@ static enum test_return test_connect_to_server(void) {
     return TEST_PASS;
 }
 
-static enum test_return stop_memcached_server(void) {
-    closesocket(sock);
-    sock = INVALID_SOCKET;
+static void kill_memcached_server(void) {
 #ifdef WIN32
     TerminateProcess(server_pid, 0);
 #else
@@ -1126,6 +1125,12 @@ static enum test_return stop_memcached_server(void) {
         }
     }
 #endif
+}
+
+static enum test_return stop_memcached_server(void) {
+    closesocket(sock);
+    sock = INVALID_SOCKET;
+    kill_memcached_server();
 
     remove(config_file);
     remove(isasl_file);
@@ -1135,6 +1140,32 @@ static enum test_return stop_memcached_server(void) {
     return TEST_PASS;
 }
 
+/*
+ * Restart the server with another config (for the settings which can't be
+ * changed on the fly), and connect to it again. The rbac and isasl files
+ * are kept.
+ */
+static void restart_memcached_server(cJSON *config) {
+    char *config_text = cJSON_Print(config);
+
+    kill_memcached_server();
+    cb_assert(write_config_to_file(config_text, config_file) == 0);
+    cJSON_Free(config_text);
+
+    server_start_time = time(0);
+    server_pid = start_server(&port, &ssl_port, false, 600);
+    reconnect_to_server(false);
+}
+
+/* Give the server a moment to get something done in the background */
+static void sleep_briefly(void) {
+#ifdef WIN32
+    Sleep(10);
+#else
+    usleep(10000);
+#endif
+}
+
 static ssize_t phase_send(const void *buf, size_t len) {
     ssize_t rv = 0, send_rv = 0;
     if (current_phase == phase_ssl) {
@@ -2357,6 +2388,365 @@ static enum test_return test_stat_connections(void) {
     return TEST_PASS;
 }
 
+/*
+ * The stats of the first connection (see get_connection_stats() in the
+ * server) which has the member, with the given string value unless value
+ * is NULL. Returns NULL if there is no such connection, the caller frees
+ * the stats with cJSON_Delete().
+ */
+static cJSON *find_connection_stats(const char *member, const char *value) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[16384];
+    } buffer;
+    cJSON *found = NULL;
+
+    size_t len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                             PROTOCOL_BINARY_CMD_STAT,
+                             "connections", strlen("connections"), NULL, 0);
+
+    safe_send(buffer.bytes, len, false);
+    while (true) {
+        uint16_t keylen;
+        uint32_t bodylen;
+        cJSON *stats, *item;
+
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes) - 1);
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_STAT,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        keylen = buffer.response.message.header.response.keylen;
+        bodylen = buffer.response.message.header.response.bodylen;
+        if (keylen == 0) {
+            break;
+        }
+        if (found != NULL) {
+            continue;
+        }
+
+        buffer.bytes[sizeof(buffer.response) + bodylen] = '\0';
+        stats = cJSON_Parse(buffer.bytes + sizeof(buffer.response) + keylen);
+        cb_assert(stats != NULL);
+        item = cJSON_GetObjectItem(stats, member);
+        if (item != NULL && (value == NULL ||
+                             (item->type == cJSON_String &&
+                              strcmp(item->valuestring, value) == 0))) {
+            found = stats;
+        } else {
+            cJSON_Delete(stats);
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Add up the stats of the group (NULL for the general stats) with the
+ * name, or with a name ending with ":name" (like the stats of each thread
+ * or slab class).
+ */
+static uint64_t sum_stats(const char *group, const char *name) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    const size_t namelen = strlen(name);
+    uint64_t sum = 0;
+
+    size_t len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                             PROTOCOL_BINARY_CMD_STAT,
+                             group, group ? strlen(group) : 0, NULL, 0);
+
+    safe_send(buffer.bytes, len, false);
+    while (true) {
+        const char *key = buffer.bytes + sizeof(buffer.response);
+        uint16_t keylen;
+        uint32_t vallen;
+        char value[32];
+
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_STAT,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        keylen = buffer.response.message.header.response.keylen;
+        if (keylen == 0) {
+            break;
+        }
+        vallen = buffer.response.message.header.response.bodylen - keylen;
+
+        if (keylen < namelen || vallen >= sizeof(value) ||
+            memcmp(key + keylen - namelen, name, namelen) != 0 ||
+            (keylen > namelen && key[keylen - namelen - 1] != ':')) {
+            continue;
+        }
+        memcpy(value, key + keylen, vallen);
+        value[vallen] = '\0';
+        sum += strtoull(value, NULL, 10);
+    }
+
+    return sum;
+}
+
+/*
+ * Get the value of the stat of the group (NULL for the general stats) with
+ * the name. Returns false if there is no such stat.
+ */
+static bool get_stat(const char *group, const char *name,
+                     char *value, size_t size) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    const size_t namelen = strlen(name);
+    bool found = false;
+
+    size_t len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                             PROTOCOL_BINARY_CMD_STAT,
+                             group, group ? strlen(group) : 0, NULL, 0);
+
+    safe_send(buffer.bytes, len, false);
+    while (true) {
+        const char *key = buffer.bytes + sizeof(buffer.response);
+        uint16_t keylen;
+        uint32_t vallen;
+
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_STAT,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        keylen = buffer.response.message.header.response.keylen;
+        if (keylen == 0) {
+            break;
+        }
+        vallen = buffer.response.message.header.response.bodylen - keylen;
+
+        if (found || keylen != namelen || vallen >= size ||
+            memcmp(key, name, namelen) != 0) {
+            continue;
+        }
+        memcpy(value, key + keylen, vallen);
+        value[vallen] = '\0';
+        found = true;
+    }
+
+    return found;
+}
+
+static enum test_return test_stat_threads(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    uint64_t ops = sum_stats("threads", "ops");
+    uint64_t busy_ms = sum_stats("threads", "busy_ms");
+    int ii;
+
+    /* We're connected, and have been running commands */
+    cb_assert(sum_stats("threads", "conns") >= 1);
+    cb_assert(ops >= 1);
+
+    for (ii = 0; ii < 10; ++ii) {
+        size_t len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                 PROTOCOL_BINARY_CMD_NOOP,
+                                 NULL, 0, NULL, 0);
+
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_NOOP,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    /* The stats commands count too */
+    cb_assert(sum_stats("threads", "ops") >= ops + 10);
+    cb_assert(sum_stats("threads", "busy_ms") >= busy_ms);
+
+    return TEST_PASS;
+}
+
+/*
+ * The connections are spread over the worker threads, which count their
+ * commands and bytes without locking. Run a mix of commands on a number
+ * of them at once, and check that the totals add up exactly.
+ */
+static enum test_return test_stat_totals(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    SOCKET clients[8];
+    const int nclients = sizeof(clients) / sizeof(clients[0]);
+    const int nsets = 200;
+    const int nmisses = 50;
+    const SOCKET admin = sock;
+    uint64_t hits, sets, misses, bytes;
+    char *pipelines[sizeof(clients) / sizeof(clients[0])];
+    size_t lengths[sizeof(clients) / sizeof(clients[0])];
+    size_t sent = 0;
+    size_t stat_len;
+    int ii, jj;
+
+    for (ii = 0; ii < nclients; ++ii) {
+        const size_t size = (nsets * 2 + nmisses) * 128;
+        size_t len = 0;
+
+        pipelines[ii] = malloc(size);
+        cb_assert(pipelines[ii] != NULL);
+        for (jj = 0; jj < nsets; ++jj) {
+            char key[32];
+            snprintf(key, sizeof(key), "stat_totals_%d_%d", ii, jj);
+            len += storage_command(pipelines[ii] + len, size - len,
+                                   PROTOCOL_BINARY_CMD_SET, key, strlen(key),
+                                   "value", 5, 0, 0);
+        }
+        for (jj = 0; jj < nsets; ++jj) {
+            char key[32];
+            snprintf(key, sizeof(key), "stat_totals_%d_%d", ii, jj);
+            len += raw_command(pipelines[ii] + len, size - len,
+                               PROTOCOL_BINARY_CMD_GET, key, strlen(key),
+                               NULL, 0);
+        }
+        for (jj = 0; jj < nmisses; ++jj) {
+            char key[32];
+            snprintf(key, sizeof(key), "stat_totals_missing_%d_%d", ii, jj);
+            len += raw_command(pipelines[ii] + len, size - len,
+                               PROTOCOL_BINARY_CMD_GET, key, strlen(key),
+                               NULL, 0);
+        }
+        lengths[ii] = len;
+        sent += len;
+
+        clients[ii] = create_connect_plain_socket("127.0.0.1", port, false);
+        cb_assert(clients[ii] != INVALID_SOCKET);
+    }
+
+    hits = sum_stats(NULL, "get_hits");
+    sets = sum_stats(NULL, "cmd_set");
+    misses = sum_stats(NULL, "get_misses");
+    /* Last, so that only the next stat request is counted in between */
+    bytes = sum_stats(NULL, "bytes_read");
+    stat_len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                           PROTOCOL_BINARY_CMD_STAT, NULL, 0, NULL, 0);
+
+    for (ii = 0; ii < nclients; ++ii) {
+        sock = clients[ii];
+        safe_send(pipelines[ii], lengths[ii], false);
+    }
+    for (ii = 0; ii < nclients; ++ii) {
+        sock = clients[ii];
+        for (jj = 0; jj < nsets * 2 + nmisses; ++jj) {
+            safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+            if (jj < nsets) {
+                validate_response_header(&buffer.response,
+                                         PROTOCOL_BINARY_CMD_SET,
+                                         PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            } else if (jj < nsets * 2) {
+                validate_response_header(&buffer.response,
+                                         PROTOCOL_BINARY_CMD_GET,
+                                         PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            } else {
+                validate_response_header(&buffer.response,
+                                         PROTOCOL_BINARY_CMD_GET,
+                                         PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+            }
+        }
+        closesocket(clients[ii]);
+        free(pipelines[ii]);
+    }
+    sock = admin;
+
+    cb_assert(sum_stats(NULL, "bytes_read") == bytes + sent + stat_len);
+    cb_assert(sum_stats(NULL, "get_hits") == hits + nclients * nsets);
+    cb_assert(sum_stats(NULL, "cmd_set") == sets + nclients * nsets);
+    cb_assert(sum_stats(NULL, "get_misses") == misses + nclients * nmisses);
+
+    return TEST_PASS;
+}
+
+/*
+ * With reuseport every worker thread accepts its own clients. Check that
+ * they're all accepted (and served) by the workers, and that the kernel
+ * spreads them over more than one of them.
+ */
+static enum test_return test_reuseport(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    SOCKET clients[32];
+    const int nclients = sizeof(clients) / sizeof(clients[0]);
+    cJSON *config = generate_config();
+    uint64_t accepted, conns;
+    char value[32];
+    int ii, threads;
+    size_t len;
+
+    cJSON_AddTrueToObject(config, "reuseport");
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+    if (!get_stat("settings", "reuseport", value, sizeof(value)) ||
+        strcmp(value, "true") != 0) {
+        config = generate_config();
+        restart_memcached_server(config);
+        cJSON_Delete(config);
+        return TEST_SKIP;
+    }
+
+    accepted = sum_stats("threads", "accepted");
+    conns = sum_stats("threads", "conns");
+    cb_assert(accepted >= 1);
+
+    for (ii = 0; ii < nclients; ++ii) {
+        const SOCKET admin = sock;
+        char key[32];
+
+        clients[ii] = create_connect_plain_socket("127.0.0.1", port, false);
+        cb_assert(clients[ii] != INVALID_SOCKET);
+        sock = clients[ii];
+        snprintf(key, sizeof(key), "reuseport_%d", ii);
+        store_object(key, "value");
+
+        len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                          PROTOCOL_BINARY_CMD_DELETE, key, strlen(key),
+                          NULL, 0);
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_DELETE,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        sock = admin;
+    }
+
+    cb_assert(sum_stats("threads", "accepted") == accepted + nclients);
+    cb_assert(sum_stats("threads", "conns") == conns + nclients);
+
+    /* The chance of them all ending up on one thread is negligible */
+    for (ii = 0, threads = 0; ; ++ii) {
+        char key[32];
+
+        snprintf(key, sizeof(key), "thread_%d:accepted", ii);
+        if (!get_stat("threads", key, value, sizeof(value))) {
+            break;
+        }
+        if (strtoull(value, NULL, 10) > 0) {
+            ++threads;
+        }
+    }
+    cb_assert(ii >= 1);
+    cb_assert(ii == 1 || threads > 1);
+
+    for (ii = 0; ii < nclients; ++ii) {
+        closesocket(clients[ii]);
+    }
+
+    config = generate_config();
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+
+    return TEST_PASS;
+}
+
 static enum test_return test_scrub(void) {
     union {
         protocol_binary_request_no_extras request;
@@ -2652,6 +3042,129 @@ static enum test_return test_ioctl_set(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_ioctl_migrate_connection(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    char cmd[] = "migrate_connection";
+    struct {
+        const char *value;
+        uint16_t status;
+    } cases[] = {
+        /* The value must be "<fd> <worker thread>" */
+        { "", PROTOCOL_BINARY_RESPONSE_EINVAL },
+        { "12", PROTOCOL_BINARY_RESPONSE_EINVAL },
+        { "12 -1", PROTOCOL_BINARY_RESPONSE_EINVAL },
+        { "12 100000", PROTOCOL_BINARY_RESPONSE_EINVAL },
+        /* There is no such connection */
+        { "-1 0", PROTOCOL_BINARY_RESPONSE_KEY_ENOENT }
+    };
+    size_t ii;
+
+    for (ii = 0; ii < sizeof(cases) / sizeof(cases[0]); ++ii) {
+        size_t len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                 PROTOCOL_BINARY_CMD_IOCTL_SET, cmd, strlen(cmd),
+                                 cases[ii].value, strlen(cases[ii].value));
+
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                 cases[ii].status);
+    }
+
+    return TEST_PASS;
+}
+
+/*
+ * Migrate a second connection to each of the worker threads in turn, and
+ * check that it keeps working and that the threads count it.
+ */
+static enum test_return test_ioctl_migrate_connection_success(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    char cmd[] = "migrate_connection";
+    const SOCKET admin = sock;
+    SOCKET client;
+    cJSON *stats;
+    uint64_t conns;
+    int fd, thread;
+    size_t len;
+
+    connect_to_server_plain(port, false);
+    client = sock;
+
+    /* The opaque of its last command tells us which connection it is */
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_NOOP, NULL, 0, NULL, 0);
+    buffer.request.message.header.request.opaque = 0x0badf00d;
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    cb_assert(buffer.response.message.header.response.status ==
+              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    sock = admin;
+    stats = find_connection_stats("opaque", "0xbadf00d");
+    cb_assert(stats != NULL);
+    fd = cJSON_GetObjectItem(stats, "socket")->valueint;
+    cJSON_Delete(stats);
+    conns = sum_stats("threads", "conns");
+
+    /* Until we run out of threads */
+    for (thread = 0; ; ++thread) {
+        char value[32];
+        char key[32];
+        uint64_t thread_conns;
+        int tries;
+
+        snprintf(key, sizeof(key), "thread_%d:conns", thread);
+        thread_conns = sum_stats("threads", key);
+
+        snprintf(value, sizeof(value), "%d %d", fd, thread);
+        len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                          PROTOCOL_BINARY_CMD_IOCTL_SET, cmd, strlen(cmd),
+                          value, strlen(value));
+
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        if (buffer.response.message.header.response.status ==
+            PROTOCOL_BINARY_RESPONSE_EINVAL) {
+            break;
+        }
+        validate_response_header(&buffer.response,
+                                 PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+        sock = client;
+        store_object("migrate_connection", value);
+        sock = admin;
+
+        /*
+         * The old thread lets go of the connection once it is idle, and
+         * the new one picks it up in the background. We don't know where
+         * it started, but from then on it comes from the thread before.
+         */
+        if (thread > 0) {
+            for (tries = 0;
+                 sum_stats("threads", key) != thread_conns + 1;
+                 ++tries) {
+                cb_assert(tries < 500);
+                sleep_briefly();
+            }
+            cb_assert(sum_stats("threads", "conns") == conns);
+        }
+    }
+    cb_assert(thread > 0);
+
+    closesocket(client);
+
+    return TEST_PASS;
+}
+
 #if defined(HAVE_TCMALLOC)
 static enum test_return test_ioctl_tcmalloc_aggr_decommit(void) {
     union {
@@ -3730,31 +4243,295 @@ static enum test_return test_dcp_control(void) {
     return TEST_PASS;
 }
 
-static enum test_return test_isasl_refresh(void) {
+static enum test_return test_dcp_flow_control(void) {
     union {
-        protocol_binary_request_no_extras request;
-        protocol_binary_response_no_extras response;
+        protocol_binary_request_dcp_control request;
+        protocol_binary_response_dcp_control response;
         char bytes[1024];
     } buffer;
 
     size_t len;
 
     len = raw_command(buffer.bytes, sizeof(buffer.bytes),
-                      PROTOCOL_BINARY_CMD_ISASL_REFRESH,
-                      NULL, 0, NULL, 0);
+                      PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                      "connection_buffer_size", 22, "lots", 4);
 
     safe_send(buffer.bytes, len, false);
     safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
     validate_response_header(&buffer.response,
-                             PROTOCOL_BINARY_CMD_ISASL_REFRESH,
+                             PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                             PROTOCOL_BINARY_RESPONSE_EINVAL);
+
+    /* The daemon does the flow control, even if the engine don't do DCP */
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                      "connection_buffer_size", 22, "1024", 4);
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_DCP_CONTROL,
                              PROTOCOL_BINARY_RESPONSE_SUCCESS);
 
-    return TEST_PASS;
-}
+    /* The acknowledgement isn't answered, so the noop response is next */
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_BUFFER_ACKNOWLEDGEMENT,
+                      NULL, 0, "\0\0\0\x10", 4);
+    buffer.request.message.header.request.extlen = 4;
+    len += raw_command(buffer.bytes + len, sizeof(buffer.bytes) - len,
+                       PROTOCOL_BINARY_CMD_NOOP, NULL, 0, NULL, 0);
 
-/*
-    Using a memcached protocol extesnsion, shift the time
-*/
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_NOOP,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    /* Turn it off again, the acknowledgements go to the engine */
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                      "connection_buffer_size", 22, "0", 1);
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_BUFFER_ACKNOWLEDGEMENT,
+                      NULL, 0, "\0\0\0\x10", 4);
+    buffer.request.message.header.request.extlen = 4;
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_DCP_BUFFER_ACKNOWLEDGEMENT,
+                             PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+
+    return TEST_PASS;
+}
+
+/*
+ * Read the DCP messages of the stream until we got at least nbytes worth
+ * of them. Returns the number of bytes we got.
+ */
+static uint32_t recv_dcp_messages(uint32_t nbytes) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    uint32_t received = 0;
+
+    while (received < nbytes) {
+        uint8_t opcode;
+
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        opcode = buffer.request.message.header.request.opcode;
+        cb_assert(buffer.request.message.header.request.magic ==
+                  PROTOCOL_BINARY_REQ);
+        cb_assert(opcode == PROTOCOL_BINARY_CMD_DCP_SNAPSHOT_MARKER ||
+                  opcode == PROTOCOL_BINARY_CMD_DCP_MUTATION);
+        received += sizeof(buffer.response) +
+            buffer.response.message.header.response.bodylen;
+    }
+
+    return received;
+}
+
+/*
+ * Wait for the producer to notice that the window of the consumer is
+ * full, and check its flow control stats.
+ */
+static void validate_dcp_flow_paused(uint32_t window, uint32_t unacked,
+                                     uint32_t acked, uint32_t pauses) {
+    cJSON *stats;
+    cJSON *flow;
+    int tries;
+
+    for (tries = 0; ; ++tries) {
+        stats = find_connection_stats("dcp_flow", NULL);
+        cb_assert(stats != NULL);
+        flow = cJSON_GetObjectItem(stats, "dcp_flow");
+        if (cJSON_GetObjectItem(flow, "paused")->type == cJSON_True) {
+            break;
+        }
+        cJSON_Delete(stats);
+        cb_assert(tries < 500);
+        sleep_briefly();
+    }
+
+    cb_assert(cJSON_GetObjectItem(flow, "window")->valueint == window);
+    cb_assert(cJSON_GetObjectItem(flow, "unacked_bytes")->valueint == unacked);
+    cb_assert(cJSON_GetObjectItem(flow, "sent_bytes")->valueint ==
+              unacked + acked);
+    cb_assert(cJSON_GetObjectItem(flow, "acked_bytes")->valueint == acked);
+    cb_assert(cJSON_GetObjectItem(flow, "pauses")->valueint == pauses);
+    cJSON_Delete(stats);
+}
+
+/*
+ * Stream the mutations of a vBucket from the default engine (which keeps
+ * the seqnos it takes if told to) with a small flow control window, and
+ * check that we stop sending when the window is full until the consumer
+ * acknowledges what it got.
+ */
+static enum test_return test_dcp_flow_control_producer(void) {
+    union {
+        protocol_binary_request_dcp_open open;
+        protocol_binary_request_dcp_stream_req stream_req;
+        protocol_binary_request_dcp_buffer_acknowledgement ack;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    const uint32_t window = 1024;
+    cJSON *config = generate_config();
+    cJSON *engine = cJSON_CreateObject();
+    SOCKET admin, producer;
+    char key[32];
+    char value[65];
+    uint32_t first, second, nbytes;
+    size_t len;
+    int ii;
+
+    cJSON_AddStringToObject(engine, "module", "default_engine.so");
+    cJSON_AddStringToObject(engine, "config", "seqnos=true");
+    cJSON_ReplaceItemInObject(config, "engine", engine);
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+
+    /* Some 12k worth of mutations, so the window fills up a few times */
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    for (ii = 0; ii < 100; ++ii) {
+        snprintf(key, sizeof(key), "dcp_flow_%d", ii);
+        store_object(key, value);
+    }
+
+    admin = sock;
+    connect_to_server_plain(port, false);
+    producer = sock;
+
+    memset(buffer.bytes, 0, sizeof(buffer.bytes));
+    buffer.open.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    buffer.open.message.header.request.opcode = PROTOCOL_BINARY_CMD_DCP_OPEN;
+    buffer.open.message.header.request.keylen = htons(4);
+    buffer.open.message.header.request.extlen = 8;
+    buffer.open.message.header.request.bodylen = htonl(8 + 4);
+    buffer.open.message.header.request.opaque = 0xdeadbeef;
+    buffer.open.message.body.flags = htonl(DCP_OPEN_PRODUCER);
+    memcpy(buffer.bytes + sizeof(buffer.open.bytes), "flow", 4);
+
+    safe_send(buffer.bytes, sizeof(buffer.open.bytes) + 4, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_DCP_OPEN,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    snprintf(value, sizeof(value), "%u", window);
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                      "connection_buffer_size", 22, value, strlen(value));
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_DCP_CONTROL,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    /* Everything in vBucket 0 from the start, and whatever comes later */
+    memset(buffer.bytes, 0, sizeof(buffer.bytes));
+    buffer.stream_req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    buffer.stream_req.message.header.request.opcode =
+        PROTOCOL_BINARY_CMD_DCP_STREAM_REQ;
+    buffer.stream_req.message.header.request.extlen = 48;
+    buffer.stream_req.message.header.request.bodylen = htonl(48);
+    buffer.stream_req.message.header.request.opaque = 0xdeadbeef;
+    buffer.stream_req.message.body.end_seqno = htonll(UINT64_MAX);
+
+    safe_send(buffer.bytes, sizeof(buffer.stream_req.bytes), false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_DCP_STREAM_REQ,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    /* The producer stops once it sent a window full... */
+    first = recv_dcp_messages(window);
+    sock = admin;
+    validate_dcp_flow_paused(window, first, 0, 1);
+
+    /* ...and goes on when we acknowledge it (which isn't answered) */
+    sock = producer;
+    nbytes = htonl(first);
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_DCP_BUFFER_ACKNOWLEDGEMENT,
+                      NULL, 0, &nbytes, sizeof(nbytes));
+    buffer.ack.message.header.request.extlen = 4;
+    safe_send(buffer.bytes, len, false);
+
+    second = recv_dcp_messages(window);
+    sock = admin;
+    validate_dcp_flow_paused(window, second, first, 2);
+
+    closesocket(producer);
+    config = generate_config();
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+
+    return TEST_PASS;
+}
+
+static enum test_return test_isasl_refresh(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+
+    size_t len;
+
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_ISASL_REFRESH,
+                      NULL, 0, NULL, 0);
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_ISASL_REFRESH,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    return TEST_PASS;
+}
+
+/*
+ * Reload the SSL certificates, and check that we may still connect (to
+ * the SSL port in the SSL phase) afterwards
+ */
+static enum test_return test_ssl_certs_refresh(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+
+    size_t len;
+
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_SSL_CERTS_REFRESH,
+                      NULL, 0, NULL, 0);
+
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response,
+                             PROTOCOL_BINARY_CMD_SSL_CERTS_REFRESH,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    reconnect_to_server(false);
+    return test_noop();
+}
+
+/*
+    Using a memcached protocol extesnsion, shift the time
+*/
 static void adjust_memcached_clock(uint64_t clock_shift) {
     union {
         protocol_binary_adjust_time request;
@@ -4068,6 +4845,240 @@ static enum test_return test_pipeline_set_get_del(void) {
     return rv;
 }
 
+/* Values this big are read straight into the item */
+static enum test_return test_pipeline_set_get_del_big(void) {
+    char* key_root = "key_set_get_del_big";
+    enum test_return rv;
+
+    rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_SET,
+                                PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                key_root, 50, 100 * 1024);
+
+    if (rv == TEST_PASS) {
+        rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_GET,
+                                    PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                     key_root, 50, 100 * 1024);
+        if (rv == TEST_PASS) {
+            rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_DELETE,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                               key_root, 50, 100 * 1024);
+        }
+    }
+    return rv;
+}
+
+/*
+ * Packets too big for the default read buffer are read into a buffer of a
+ * bigger size class from the pool of the thread, which the connection
+ * keeps while the rest of the packet trickles in. Append values which need
+ * each of the bigger classes, twice, and check that the second time the
+ * buffers all come from the pools.
+ */
+static enum test_return test_read_buffer_pool(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    /* The item (which gets them all twice) must stay below 1MB */
+    const size_t sizes[] = { 10 * 1024, 100 * 1024, 300 * 1024 };
+    const size_t maxsize = 300 * 1024;
+    const int nchunks = 8;
+    const char *key = "read_buffer_pool";
+    const SOCKET admin = sock;
+    char *packet = malloc(maxsize + 1024);
+    char *value = malloc(maxsize);
+    protocol_binary_response_no_extras *response;
+    size_t total = 1;
+    SOCKET client;
+    int ii, round;
+
+    cb_assert(packet != NULL && value != NULL);
+    memset(value, 'a', maxsize);
+
+    client = create_connect_plain_socket("127.0.0.1", port, false);
+    cb_assert(client != INVALID_SOCKET);
+    sock = client;
+    store_object(key, "a");
+
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        size_t len = raw_command(packet, maxsize + 1024,
+                                 PROTOCOL_BINARY_CMD_APPEND, key, strlen(key),
+                                 value, sizes[ii]);
+        size_t chunk = len / nchunks + 1;
+
+        for (round = 0; round < 2; ++round) {
+            uint64_t allocated, existing;
+            size_t offset;
+
+            sock = admin;
+            allocated = sum_stats(NULL, "rbufs_allocated");
+            existing = sum_stats(NULL, "rbufs_existing");
+
+            sock = client;
+            for (offset = 0; offset < len; offset += chunk) {
+                safe_send(packet + offset,
+                          len - offset < chunk ? len - offset : chunk, false);
+                sleep_briefly();
+            }
+            safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+            validate_response_header(&buffer.response,
+                                     PROTOCOL_BINARY_CMD_APPEND,
+                                     PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            total += sizes[ii];
+
+            sock = admin;
+            /* It held on to the partial packet between the sends */
+            cb_assert(sum_stats(NULL, "rbufs_existing") > existing);
+            if (round > 0) {
+                cb_assert(sum_stats(NULL, "rbufs_allocated") == allocated);
+            }
+        }
+    }
+
+    /* All of it made it into the item */
+    sock = client;
+    free(packet);
+    packet = malloc(total + 1024);
+    cb_assert(packet != NULL);
+    safe_send(buffer.bytes,
+              raw_command(buffer.bytes, sizeof(buffer.bytes),
+                          PROTOCOL_BINARY_CMD_GET, key, strlen(key), NULL, 0),
+              false);
+    safe_recv_packet(packet, total + 1024);
+    response = (void*)packet;
+    validate_response_header(response, PROTOCOL_BINARY_CMD_GET,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    cb_assert(response->message.header.response.bodylen == 4 + total);
+    cb_assert(memcmp(packet + sizeof(*response) + 4, value, maxsize) == 0);
+
+    closesocket(client);
+    sock = admin;
+    free(packet);
+    free(value);
+
+    return TEST_PASS;
+}
+
+/*
+ * Send a burst of quiet gets for a mix of existing and missing keys
+ * followed by a noop, and check that we get the hits back in order
+ */
+static enum test_return test_pipeline_getkq(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    char *buffer = malloc(64 * 1024);
+    char key[32];
+    size_t len = 0;
+    int ii;
+
+    cb_assert(buffer != NULL);
+    for (ii = 0; ii < 100; ii += 2) {
+        snprintf(key, sizeof(key), "getkq_%d", ii);
+        len = storage_command(receive.bytes, sizeof(receive.bytes),
+                              PROTOCOL_BINARY_CMD_SET, key, strlen(key),
+                              key, strlen(key), 0, 0);
+        safe_send(receive.bytes, len, false);
+        safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+        validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_SET,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    len = 0;
+    for (ii = 0; ii < 100; ++ii) {
+        snprintf(key, sizeof(key), "getkq_%d", ii);
+        len += raw_command(buffer + len, 1024, PROTOCOL_BINARY_CMD_GETKQ,
+                           key, strlen(key), NULL, 0);
+    }
+    len += raw_command(buffer + len, 1024, PROTOCOL_BINARY_CMD_NOOP,
+                       NULL, 0, NULL, 0);
+    safe_send(buffer, len, false);
+
+    for (ii = 0; ii < 100; ii += 2) {
+        uint16_t nkey;
+        safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+        validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_GETKQ,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        snprintf(key, sizeof(key), "getkq_%d", ii);
+        nkey = receive.response.message.header.response.keylen;
+        cb_assert(nkey == strlen(key));
+        cb_assert(memcmp(receive.bytes + sizeof(protocol_binary_response_get),
+                         key, nkey) == 0);
+    }
+
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_NOOP,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    free(buffer);
+    return TEST_PASS;
+}
+
+/*
+ * Send a mix of commands in one go, and check that the responses (which
+ * the server sends together) come back complete and in order
+ */
+static enum test_return test_pipeline_mixed(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        protocol_binary_response_incr incr;
+        char bytes[1024];
+    } receive;
+    static const uint8_t expected[] = {
+        PROTOCOL_BINARY_CMD_SET, PROTOCOL_BINARY_CMD_GET,
+        PROTOCOL_BINARY_CMD_INCREMENT, PROTOCOL_BINARY_CMD_INCREMENT,
+        PROTOCOL_BINARY_CMD_DELETE, PROTOCOL_BINARY_CMD_DELETE,
+        PROTOCOL_BINARY_CMD_GET, PROTOCOL_BINARY_CMD_NOOP
+    };
+    char buffer[4096];
+    size_t len = 0;
+    int ii;
+
+    len += storage_command(buffer + len, sizeof(buffer) - len,
+                           PROTOCOL_BINARY_CMD_SET, "mixed", 5,
+                           "value", 5, 0, 0);
+    len += raw_command(buffer + len, sizeof(buffer) - len,
+                       PROTOCOL_BINARY_CMD_GET, "mixed", 5, NULL, 0);
+    len += arithmetic_command(buffer + len, sizeof(buffer) - len,
+                              PROTOCOL_BINARY_CMD_INCREMENT,
+                              "mixed_counter", 13, 1, 10, 0);
+    len += arithmetic_command(buffer + len, sizeof(buffer) - len,
+                              PROTOCOL_BINARY_CMD_INCREMENT,
+                              "mixed_counter", 13, 1, 10, 0);
+    len += raw_command(buffer + len, sizeof(buffer) - len,
+                       PROTOCOL_BINARY_CMD_DELETE, "mixed", 5, NULL, 0);
+    len += raw_command(buffer + len, sizeof(buffer) - len,
+                       PROTOCOL_BINARY_CMD_DELETE, "mixed_counter", 13,
+                       NULL, 0);
+    len += raw_command(buffer + len, sizeof(buffer) - len,
+                       PROTOCOL_BINARY_CMD_GET, "mixed", 5, NULL, 0);
+    len += raw_command(buffer + len, sizeof(buffer) - len,
+                       PROTOCOL_BINARY_CMD_NOOP, NULL, 0, NULL, 0);
+    safe_send(buffer, len, false);
+
+    for (ii = 0; ii < (int)sizeof(expected); ++ii) {
+        uint16_t status = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+        if (ii == 6) {
+            status = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+        }
+        safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+        validate_response_header(&receive.response, expected[ii], status);
+        if (ii == 1) {
+            cb_assert(memcmp(receive.bytes +
+                             sizeof(protocol_binary_response_get),
+                             "value", 5) == 0);
+        } else if (ii == 3) {
+            validate_arithmetic(&receive.incr, 11);
+        }
+    }
+
+    return TEST_PASS;
+}
+
 static enum test_return test_pipeline_set_del(void) {
     enum test_return rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_SET,
                                 PROTOCOL_BINARY_RESPONSE_SUCCESS,
@@ -4082,6 +5093,199 @@ static enum test_return test_pipeline_set_del(void) {
     return rv;
 }
 
+/* The server falls back to normal sends if the kernel can't do io_uring */
+static bool io_uring_enabled(void) {
+    char value[32];
+
+    return get_stat("settings", "io_uring", value, sizeof(value)) &&
+        strcmp(value, "true") == 0;
+}
+
+/*
+ * Run the pipeline tests getting small and big values (and a mix of
+ * commands) against a server started with the config, and check that all of the items are freed
+ * once they're deleted and the connection we got them on is gone. The
+ * test is skipped if the config asks for io_uring and we can't have it.
+ */
+static enum test_return test_pipeline_with_config(cJSON *config) {
+    cJSON *defaults;
+    cJSON *uring = cJSON_GetObjectItem(config, "io_uring");
+    enum test_return rv;
+    int tries;
+
+    restart_memcached_server(config);
+    if (uring != NULL && uring->type == cJSON_True && !io_uring_enabled()) {
+        defaults = generate_config();
+        restart_memcached_server(defaults);
+        cJSON_Delete(defaults);
+        return TEST_SKIP;
+    }
+
+    rv = test_pipeline_set_get_del();
+    if (rv == TEST_PASS) {
+        rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_SET,
+                                PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                "key_with_config", 50, 100 * 1024);
+    }
+    if (rv == TEST_PASS) {
+        rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_GET,
+                                PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                "key_with_config", 50, 100 * 1024);
+    }
+    if (rv == TEST_PASS) {
+        rv = test_pipeline_impl(PROTOCOL_BINARY_CMD_DELETE,
+                                PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                "key_with_config", 50, 100 * 1024);
+    }
+    if (rv == TEST_PASS) {
+        rv = test_pipeline_mixed();
+    }
+
+    reconnect_to_server(false);
+    cb_assert(sum_stats(NULL, "curr_items") == 0);
+    /* The deleted items are handed back to the slabs in the background */
+    for (tries = 0; sum_stats("slabs", "used_chunks") != 0; ++tries) {
+        cb_assert(tries < 500);
+        sleep_briefly();
+    }
+
+    defaults = generate_config();
+    restart_memcached_server(defaults);
+    cJSON_Delete(defaults);
+
+    return rv;
+}
+
+/* The responses are sent with io_uring (if the kernel has it) */
+static enum test_return test_pipeline_io_uring(void) {
+    cJSON *config = generate_config();
+    enum test_return rv;
+
+    cJSON_AddTrueToObject(config, "io_uring");
+    rv = test_pipeline_with_config(config);
+    cJSON_Delete(config);
+
+    return rv;
+}
+
+/*
+ * Pipeline gets on more connections than fit on a ring at once, so that
+ * some of the responses are sent directly (see transmit() in the server)
+ */
+static enum test_return test_pipeline_io_uring_full(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[8192];
+    } buffer;
+    const char *key = "pipeline_io_uring_full";
+    const size_t keylen = strlen(key);
+    const size_t vallen = 4096;
+    const int gets = 50;
+    SOCKET clients[16];
+    cJSON *config = generate_config();
+    char *pipeline;
+    size_t len;
+    int ii, jj, round;
+
+    cJSON_AddTrueToObject(config, "io_uring");
+    cJSON_AddNumberToObject(config, "io_uring_entries", 1);
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+    if (!io_uring_enabled()) {
+        config = generate_config();
+        restart_memcached_server(config);
+        cJSON_Delete(config);
+        return TEST_SKIP;
+    }
+
+    memset(buffer.bytes, 0xaf, sizeof(buffer.bytes));
+    len = storage_command(buffer.bytes, sizeof(buffer.bytes),
+                          PROTOCOL_BINARY_CMD_SET, key, keylen,
+                          buffer.bytes + sizeof(buffer.bytes) - vallen,
+                          vallen, 0, 0);
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    validate_response_header(&buffer.response, PROTOCOL_BINARY_CMD_SET,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    len = raw_command(buffer.bytes, sizeof(buffer.bytes),
+                      PROTOCOL_BINARY_CMD_GET, key, keylen, NULL, 0);
+    pipeline = malloc(len * gets);
+    cb_assert(pipeline != NULL);
+    for (ii = 0; ii < gets; ++ii) {
+        memcpy(pipeline + ii * len, buffer.bytes, len);
+    }
+
+    for (ii = 0; ii < sizeof(clients) / sizeof(clients[0]); ++ii) {
+        clients[ii] = create_connect_plain_socket("127.0.0.1", port, false);
+        cb_assert(clients[ii] != INVALID_SOCKET);
+    }
+
+    /* Whether they fit depends on how the requests arrive, keep at it */
+    for (round = 0; sum_stats("threads", "uring_full") == 0; ++round) {
+        const SOCKET admin = sock;
+
+        cb_assert(round < 100);
+        for (ii = 0; ii < sizeof(clients) / sizeof(clients[0]); ++ii) {
+            sock = clients[ii];
+            safe_send(pipeline, len * gets, false);
+        }
+        for (ii = 0; ii < sizeof(clients) / sizeof(clients[0]); ++ii) {
+            sock = clients[ii];
+            for (jj = 0; jj < gets; ++jj) {
+                const uint8_t *value = (const uint8_t *)buffer.bytes +
+                    sizeof(buffer.response) + 4;
+                size_t kk;
+
+                safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+                validate_response_header(&buffer.response,
+                                         PROTOCOL_BINARY_CMD_GET,
+                                         PROTOCOL_BINARY_RESPONSE_SUCCESS);
+                cb_assert(buffer.response.message.header.response.bodylen ==
+                          4 + vallen);
+                for (kk = 0; kk < vallen; ++kk) {
+                    cb_assert(value[kk] == 0xaf);
+                }
+            }
+        }
+        sock = admin;
+    }
+
+    for (ii = 0; ii < sizeof(clients) / sizeof(clients[0]); ++ii) {
+        closesocket(clients[ii]);
+    }
+    free(pipeline);
+
+    config = generate_config();
+    restart_memcached_server(config);
+    cJSON_Delete(config);
+
+    return TEST_PASS;
+}
+
+/*
+ * The 100k values are sent with MSG_ZEROCOPY (over loopback the kernel
+ * copies them anyway, but we still hold on to the items until it says
+ * it's done with them)
+ */
+static enum test_return test_pipeline_zerocopy(void) {
+    cJSON *config = generate_config();
+    enum test_return rv;
+
+    cJSON_AddNumberToObject(config, "zerocopy_threshold", 16 * 1024);
+    rv = test_pipeline_with_config(config);
+    if (rv == TEST_PASS) {
+        cJSON_AddTrueToObject(config, "io_uring");
+        if (test_pipeline_with_config(config) == TEST_FAIL) {
+            rv = TEST_FAIL;
+        }
+    }
+    cJSON_Delete(config);
+
+    return rv;
+}
+
 /* Send one character to the SSL port, then check memcached correctly closes
  * the connection (and doesn't hold it open for ever trying to read) more bytes
  * which will never come.
@@ -4407,6 +5611,9 @@ struct testcase testcases[] = {
     TESTCASE_PLAIN_AND_SSL("prependq", test_prependq),
     TESTCASE_PLAIN_AND_SSL("stat", test_stat),
     TESTCASE_PLAIN_AND_SSL("stat_connections", test_stat_connections),
+    TESTCASE_PLAIN_AND_SSL("stat_threads", test_stat_threads),
+    TESTCASE_PLAIN("stat_totals", test_stat_totals),
+    TESTCASE_PLAIN("reuseport", test_reuseport),
     TESTCASE_PLAIN_AND_SSL("roles", test_roles),
     TESTCASE_PLAIN_AND_SSL("scrub", test_scrub),
     TESTCASE_PLAIN_AND_SSL("verbosity", test_verbosity),
@@ -4417,10 +5624,18 @@ struct testcase testcases[] = {
     TESTCASE_PLAIN_AND_SSL("dcp_noop", test_dcp_noop),
     TESTCASE_PLAIN_AND_SSL("dcp_buffer_acknowledgment", test_dcp_buffer_ack),
     TESTCASE_PLAIN_AND_SSL("dcp_control", test_dcp_control),
+    TESTCASE_PLAIN_AND_SSL("dcp_flow_control", test_dcp_flow_control),
+    TESTCASE_PLAIN("dcp_flow_control_producer",
+                   test_dcp_flow_control_producer),
     TESTCASE_PLAIN_AND_SSL("hello", test_hello),
     TESTCASE_PLAIN_AND_SSL("isasl_refresh", test_isasl_refresh),
+    TESTCASE_PLAIN_AND_SSL("ssl_certs_refresh", test_ssl_certs_refresh),
     TESTCASE_PLAIN_AND_SSL("ioctl_get", test_ioctl_get),
     TESTCASE_PLAIN_AND_SSL("ioctl_set", test_ioctl_set),
+    TESTCASE_PLAIN_AND_SSL("ioctl_migrate_connection",
+                           test_ioctl_migrate_connection),
+    TESTCASE_PLAIN("ioctl_migrate_connection_success",
+                   test_ioctl_migrate_connection_success),
 #if defined(HAVE_TCMALLOC)
     TESTCASE_PLAIN_AND_SSL("ioctl_tcmalloc_aggr_decommit",
                            test_ioctl_tcmalloc_aggr_decommit),
@@ -4445,6 +5660,13 @@ struct testcase testcases[] = {
     TESTCASE_SSL("pipeline_mb-11203",test_pipeline_set),
     TESTCASE_PLAIN_AND_SSL("pipeline_1", test_pipeline_set_get_del),
     TESTCASE_PLAIN_AND_SSL("pipeline_2", test_pipeline_set_del),
+    TESTCASE_PLAIN_AND_SSL("pipeline_big", test_pipeline_set_get_del_big),
+    TESTCASE_PLAIN("read_buffer_pool", test_read_buffer_pool),
+    TESTCASE_PLAIN_AND_SSL("pipeline_getkq", test_pipeline_getkq),
+    TESTCASE_PLAIN_AND_SSL("pipeline_mixed", test_pipeline_mixed),
+    TESTCASE_PLAIN("pipeline_io_uring", test_pipeline_io_uring),
+    TESTCASE_PLAIN("pipeline_io_uring_full", test_pipeline_io_uring_full),
+    TESTCASE_PLAIN("pipeline_zerocopy", test_pipeline_zerocopy),
     TESTCASE_PLAIN("exceed_max_packet_size", test_exceed_max_packet_size),
     TESTCASE_CLEANUP("stop_server", stop_memcached_server),
     TESTCASE_PLAIN(NULL, NULL)
@@ -377,6 +377,138 @@ static enum test_result mt_incr_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+static void store_test_main(void *arg) {
+    ENGINE_HANDLE *h = arg;
+    ENGINE_HANDLE_V1 *h1 = arg;
+    char key[64];
+    item *test_item;
+    uint64_t cas;
+    int ii;
+
+    for (ii = 0; ii < 500; ++ii) {
+        /* the stack address of the key is unique for each thread */
+        size_t keylen = snprintf(key, sizeof(key), "mt_store_%p_%d",
+                                 (void*)key, ii);
+        item_info info;
+        info.nvalue = 1;
+
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 8, 0, 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+
+        cb_assert(h1->get(h, NULL, &test_item, key, (int)keylen,
+                          0) == ENGINE_SUCCESS);
+        cb_assert(h1->get_item_info(h, NULL, test_item, &info));
+        cb_assert(info.nkey == keylen);
+        cb_assert(memcmp(info.key, key, keylen) == 0);
+        cb_assert(info.cas == cas);
+        h1->release(h, NULL, test_item);
+
+        if (ii % 2 == 0) {
+            mutation_descr_t mut_info;
+            cas = 0;
+            cb_assert(h1->remove(h, NULL, key, keylen, &cas, 0,
+                                 &mut_info) == ENGINE_SUCCESS);
+        }
+    }
+}
+
+/*
+ * Make sure that concurrent stores, gets and removes of different keys
+ * don't step on each other
+ */
+static enum test_result mt_store_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    cb_thread_t tid[max_threads];
+    int ii;
+
+    for (ii = 0; ii < max_threads; ++ii) {
+        cb_assert(cb_create_thread(&tid[ii], store_test_main, h, 0) == 0);
+    }
+
+    for (ii = 0; ii < max_threads; ++ii) {
+        cb_assert(cb_join_thread(tid[ii]) == 0);
+    }
+
+    return SUCCESS;
+}
+
+struct get_test_thread {
+    ENGINE_HANDLE *h;
+    cb_thread_t tid;
+    bool writer;
+};
+
+static void get_test_main(void *arg) {
+    struct get_test_thread *thr = arg;
+    ENGINE_HANDLE *h = thr->h;
+    ENGINE_HANDLE_V1 *h1 = (ENGINE_HANDLE_V1*)thr->h;
+    int ii;
+
+    for (ii = 0; ii < 2000; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "mt_get_%d", ii % 16);
+        item *test_item;
+        uint64_t cas = 0;
+
+        if (thr->writer) {
+            if (ii % 5 == 0) {
+                mutation_descr_t mut_info;
+                h1->remove(h, NULL, key, keylen, &cas, 0, &mut_info);
+            } else {
+                item_info info;
+                info.nvalue = 1;
+                cb_assert(h1->allocate(h, NULL, &test_item, key, keylen,
+                                       keylen, 0, 0,
+                                       PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+                cb_assert(h1->get_item_info(h, NULL, test_item, &info));
+                memcpy(info.value[0].iov_base, key, keylen);
+                cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                                    0) == ENGINE_SUCCESS);
+                h1->release(h, NULL, test_item);
+            }
+        } else if (h1->get(h, NULL, &test_item, key, (int)keylen,
+                           0) == ENGINE_SUCCESS) {
+            /* The value of each item is its key */
+            item_info info;
+            info.nvalue = 1;
+            cb_assert(h1->get_item_info(h, NULL, test_item, &info));
+            cb_assert(info.nkey == keylen);
+            cb_assert(memcmp(info.key, key, keylen) == 0);
+            cb_assert(info.value[0].iov_len == keylen);
+            cb_assert(memcmp(info.value[0].iov_base, key, keylen) == 0);
+            h1->release(h, NULL, test_item);
+        }
+    }
+}
+
+/*
+ * Make sure that the gets (which don't take the item lock) never see an
+ * item that is being freed or reused while other threads keep replacing
+ * and removing the same keys
+ */
+static enum test_result mt_get_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    struct get_test_thread threads[max_threads];
+    int ii;
+
+    /* Move past the first minute, where every get bumps the LRU */
+    test_harness.time_travel(3600);
+
+    for (ii = 0; ii < max_threads; ++ii) {
+        threads[ii].h = h;
+        threads[ii].writer = (ii % 3 == 0);
+        cb_assert(cb_create_thread(&threads[ii].tid, get_test_main,
+                                   &threads[ii], 0) == 0);
+    }
+
+    for (ii = 0; ii < max_threads; ++ii) {
+        cb_assert(cb_join_thread(threads[ii].tid) == 0);
+    }
+
+    return SUCCESS;
+}
+
 /*
  * Make sure we can arithmetic operations to set the initial value of a key and
  * to then later decrement that value
@@ -535,6 +667,406 @@ static enum test_result lru_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+struct lru_stats {
+    int number_hot;
+    int number_warm;
+    int number_cold;
+    int moves_to_cold;
+    int moves_to_warm;
+    int crawler_reclaimed;
+} lru_stats;
+
+static void lru_stats_handler(const char *key, const uint16_t klen,
+                              const char *val, const uint32_t vlen,
+                              const void *cookie) {
+    char name[1024];
+    char buffer[1024];
+    const char *stat;
+    int value;
+
+    memcpy(name, key, klen);
+    name[klen] = '\0';
+    memcpy(buffer, val, vlen);
+    buffer[vlen] = '\0';
+    value = atoi(buffer);
+
+    /* The stats are named items:<slab class>:<stat> */
+    stat = strrchr(name, ':');
+    if (stat == NULL) {
+        return;
+    }
+    ++stat;
+    if (strcmp(stat, "number_hot") == 0) {
+        lru_stats.number_hot += value;
+    } else if (strcmp(stat, "number_warm") == 0) {
+        lru_stats.number_warm += value;
+    } else if (strcmp(stat, "number_cold") == 0) {
+        lru_stats.number_cold += value;
+    } else if (strcmp(stat, "moves_to_cold") == 0) {
+        lru_stats.moves_to_cold += value;
+    } else if (strcmp(stat, "moves_to_warm") == 0) {
+        lru_stats.moves_to_warm += value;
+    } else if (strcmp(stat, "crawler_reclaimed") == 0) {
+        lru_stats.crawler_reclaimed += value;
+    }
+}
+
+/*
+ * Make sure that the LRU maintainer moves the new items out of the hot
+ * LRU, and that an item which has been hit ends up in the warm LRU.
+ */
+static enum test_result lru_segments_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const int nkeys = 100;
+    item *test_item;
+    uint64_t cas = 0;
+    int ii;
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "lru_segments_%d", ii);
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 1, 0, 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+    }
+
+    cb_assert(h1->get(h, NULL, &test_item, "lru_segments_0", 14,
+                      0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+
+    for (ii = 0; ii < 1000; ++ii) {
+        memset(&lru_stats, 0, sizeof(lru_stats));
+        cb_assert(h1->get_stats(h, NULL, "items", 5,
+                                lru_stats_handler) == ENGINE_SUCCESS);
+        cb_assert(lru_stats.number_hot + lru_stats.number_warm +
+                  lru_stats.number_cold == nkeys);
+        if (lru_stats.number_hot <= nkeys * 20 / 100 &&
+            lru_stats.moves_to_warm > 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    cb_assert(ii < 1000);
+    cb_assert(lru_stats.number_warm > 0);
+    cb_assert(lru_stats.moves_to_cold > 0);
+
+    cb_assert(h1->get(h, NULL, &test_item, "lru_segments_0", 14,
+                      0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+    return SUCCESS;
+}
+
+struct slab_stats {
+    int total_pages;
+    int slabs_moved;
+    uint64_t total_malloced;
+    uint64_t magazine_hits;
+    uint64_t magazine_misses;
+    uint64_t arena_bytes;
+    char arena_backing[32];
+    int item_header_size;
+} slab_stats;
+
+static void slab_stats_handler(const char *key, const uint16_t klen,
+                               const char *val, const uint32_t vlen,
+                               const void *cookie) {
+    char name[1024];
+    char buffer[1024];
+    const char *stat;
+
+    memcpy(name, key, klen);
+    name[klen] = '\0';
+    memcpy(buffer, val, vlen);
+    buffer[vlen] = '\0';
+
+    /* The per class stats are named <slab class>:<stat> */
+    stat = strrchr(name, ':');
+    stat = (stat == NULL) ? name : stat + 1;
+    if (strcmp(stat, "total_pages") == 0) {
+        slab_stats.total_pages += atoi(buffer);
+    } else if (strcmp(stat, "slabs_moved") == 0) {
+        slab_stats.slabs_moved = atoi(buffer);
+    } else if (strcmp(stat, "total_malloced") == 0) {
+        slab_stats.total_malloced = strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "magazine_hits") == 0) {
+        slab_stats.magazine_hits += strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "magazine_misses") == 0) {
+        slab_stats.magazine_misses += strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "arena_bytes") == 0) {
+        slab_stats.arena_bytes = strtoull(buffer, NULL, 10);
+    } else if (strcmp(stat, "item_header_size") == 0) {
+        slab_stats.item_header_size = atoi(buffer);
+    } else if (strcmp(stat, "arena_backing") == 0) {
+        strncpy(slab_stats.arena_backing, buffer,
+                sizeof(slab_stats.arena_backing) - 1);
+    }
+}
+
+static void get_slab_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    memset(&slab_stats, 0, sizeof(slab_stats));
+    cb_assert(h1->get_stats(h, NULL, "slabs", 5,
+                            slab_stats_handler) == ENGINE_SUCCESS);
+}
+
+/*
+ * Fill three pages with small items, and then keep storing large items
+ * until the memory runs out. The slab rebalancer should move one of the
+ * pages of the small items (which aren't evicted) to the large items
+ * (which are) without allocating any more memory.
+ */
+static enum test_result slab_rebalance_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *test_item;
+    uint64_t cas = 0;
+    uint64_t malloced;
+    int nsmall = 0;
+    int ii;
+
+    do {
+        for (ii = 0; ii < 1000; ++ii, ++nsmall) {
+            char key[32];
+            size_t keylen = snprintf(key, sizeof(key), "small_%d", nsmall);
+            cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 1, 0, 0,
+                                   PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+            cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                                0) == ENGINE_SUCCESS);
+            h1->release(h, NULL, test_item);
+        }
+        get_slab_stats(h, h1);
+    } while (slab_stats.total_pages < 3);
+
+    for (ii = 0; ii < nsmall; ii += 2) {
+        mutation_descr_t mut_info;
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "small_%d", ii);
+        cas = 0;
+        cb_assert(h1->remove(h, NULL, key, keylen, &cas, 0,
+                             &mut_info) == ENGINE_SUCCESS);
+    }
+
+    malloced = 0;
+    for (ii = 0; ii < 1000; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "large_%d", ii);
+        /* The items to evict may be locked by the engine's threads */
+        ENGINE_ERROR_CODE ret = h1->allocate(h, NULL, &test_item, key, keylen,
+                                             200000, 0, 0,
+                                             PROTOCOL_BINARY_RAW_BYTES);
+        cb_assert(ret == ENGINE_SUCCESS || ret == ENGINE_ENOMEM);
+        if (ret == ENGINE_SUCCESS) {
+            cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                                0) == ENGINE_SUCCESS);
+            h1->release(h, NULL, test_item);
+        }
+
+        get_slab_stats(h, h1);
+        if (malloced == 0 && ii > 10) {
+            malloced = slab_stats.total_malloced;
+        }
+        if (slab_stats.slabs_moved > 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    cb_assert(ii < 1000);
+    cb_assert(malloced == 0 || slab_stats.total_malloced == malloced);
+
+    cb_assert(h1->get(h, NULL, &test_item, "large_0", 7,
+                      0) == ENGINE_KEY_ENOENT);
+    cb_assert(h1->get(h, NULL, &test_item, "large_1", 7,
+                      0) == ENGINE_KEY_ENOENT);
+    return SUCCESS;
+}
+
+/*
+ * Storing and removing small items over and over should mostly be served
+ * from the slab cache of the thread, without going to the slab class.
+ */
+static enum test_result slab_magazine_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *test_item;
+    uint64_t cas = 0;
+    int ii;
+
+    for (ii = 0; ii < 1000; ++ii) {
+        mutation_descr_t mut_info;
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "magazine_%d", ii % 10);
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 1, 0, 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+        if (ii % 3 == 0) {
+            cas = 0;
+            cb_assert(h1->remove(h, NULL, key, keylen, &cas, 0,
+                                 &mut_info) == ENGINE_SUCCESS);
+        }
+    }
+
+    get_slab_stats(h, h1);
+    cb_assert(slab_stats.magazine_hits > 0);
+    cb_assert(slab_stats.magazine_hits > slab_stats.magazine_misses);
+    return SUCCESS;
+}
+
+/*
+ * The whole cache should be reserved up front. Whether we get huge pages
+ * depends on the machine, but we should fall back to normal pages.
+ */
+static enum test_result slab_arena_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *test_item;
+    uint64_t cas = 0;
+
+    get_slab_stats(h, h1);
+    cb_assert(slab_stats.arena_bytes >= 4194304);
+    cb_assert(strcmp(slab_stats.arena_backing, "hugetlb") == 0 ||
+              strcmp(slab_stats.arena_backing, "thp") == 0 ||
+              strcmp(slab_stats.arena_backing, "pages") == 0 ||
+              strcmp(slab_stats.arena_backing, "malloc") == 0);
+
+    cb_assert(h1->allocate(h, NULL, &test_item, "arena", 5, 1, 0, 0,
+                           PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                        0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+    cb_assert(h1->get(h, NULL, &test_item, "arena", 5, 0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+    return SUCCESS;
+}
+
+/*
+ * The items in the compact layout should have a smaller header, and
+ * still keep their key, value and CAS.
+ */
+static enum test_result compact_items_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *test_item;
+    item_info info;
+    int ii;
+
+    get_slab_stats(h, h1);
+    /* 24 bytes of fields and two 32 bit LRU links */
+    cb_assert(slab_stats.item_header_size == 32);
+
+    for (ii = 0; ii < 1000; ++ii) {
+        char key[32];
+        uint64_t cas = 0;
+        size_t keylen = snprintf(key, sizeof(key), "compact_%d", ii);
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, sizeof(ii),
+                               0, 0, PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        memset(&info, 0, sizeof(info));
+        info.nvalue = 1;
+        cb_assert(h1->get_item_info(h, NULL, test_item, &info) == true);
+        memcpy(info.value[0].iov_base, &ii, sizeof(ii));
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        cb_assert(cas != 0);
+        h1->release(h, NULL, test_item);
+    }
+
+    for (ii = 0; ii < 1000; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "compact_%d", ii);
+        cb_assert(h1->get(h, NULL, &test_item, key, (int)keylen,
+                          0) == ENGINE_SUCCESS);
+        memset(&info, 0, sizeof(info));
+        info.nvalue = 1;
+        cb_assert(h1->get_item_info(h, NULL, test_item, &info) == true);
+        cb_assert(info.nkey == keylen);
+        cb_assert(memcmp(info.key, key, keylen) == 0);
+        cb_assert(memcmp(info.value[0].iov_base, &ii, sizeof(ii)) == 0);
+        cb_assert(info.cas != 0);
+        h1->release(h, NULL, test_item);
+    }
+    return SUCCESS;
+}
+
+struct hash_stats {
+    char status[32];
+    int power_level;
+    int expansions;
+    int shrinks;
+} hash_stats;
+
+static void hash_stats_handler(const char *key, const uint16_t klen,
+                               const char *val, const uint32_t vlen,
+                               const void *cookie) {
+    char buffer[1024];
+    memcpy(buffer, val, vlen);
+    buffer[vlen] = '\0';
+
+    if (klen == 11 && memcmp(key, "hash:status", klen) == 0) {
+        strncpy(hash_stats.status, buffer, sizeof(hash_stats.status) - 1);
+    } else if (klen == 16 && memcmp(key, "hash:power_level", klen) == 0) {
+        hash_stats.power_level = atoi(buffer);
+    } else if (klen == 15 && memcmp(key, "hash:expansions", klen) == 0) {
+        hash_stats.expansions = atoi(buffer);
+    } else if (klen == 12 && memcmp(key, "hash:shrinks", klen) == 0) {
+        hash_stats.shrinks = atoi(buffer);
+    }
+}
+
+static void wait_for_hash_resize(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                 int expansions, int shrinks) {
+    int ii;
+    for (ii = 0; ii < 1000; ++ii) {
+        cb_assert(h1->get_stats(h, NULL, "hash", 4,
+                                hash_stats_handler) == ENGINE_SUCCESS);
+        if (hash_stats.expansions == expansions &&
+            hash_stats.shrinks == shrinks &&
+            strcmp(hash_stats.status, "idle") == 0) {
+            return;
+        }
+        usleep(10000);
+    }
+    cb_assert(false);
+}
+
+/*
+ * Make sure that the hash table grows as items are added, shrinks back
+ * once they're gone, and that no keys are lost while the buckets are
+ * moved around.
+ */
+static enum test_result hash_resize_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const int nkeys = 30000;
+    item *test_item;
+    uint64_t cas = 0;
+    int ii;
+
+    cb_assert(h1->get_stats(h, NULL, "hash", 4,
+                            hash_stats_handler) == ENGINE_SUCCESS);
+    cb_assert(hash_stats.power_level == 13);
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "hash_resize_%d", ii);
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 1, 0, 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+    }
+
+    wait_for_hash_resize(h, h1, 1, 0);
+    cb_assert(hash_stats.power_level == 14);
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "hash_resize_%d", ii);
+        mutation_descr_t mut_info;
+        cb_assert(h1->get(h, NULL, &test_item, key, (int)keylen,
+                          0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+        cas = 0;
+        cb_assert(h1->remove(h, NULL, key, keylen, &cas, 0,
+                             &mut_info) == ENGINE_SUCCESS);
+    }
+
+    wait_for_hash_resize(h, h1, 1, 1);
+    cb_assert(hash_stats.power_level == 13);
+
+    return SUCCESS;
+}
+
 static enum test_result get_stats_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return PENDING;
 }
@@ -593,6 +1125,82 @@ static bool response_handler(const void *key, uint16_t keylen,
     return true;
 }
 
+static protocol_binary_response_status set_param(ENGINE_HANDLE *h,
+                                                 ENGINE_HANDLE_V1 *h1,
+                                                 const char *name,
+                                                 const char *value) {
+    union request {
+        protocol_binary_request_set_param param;
+        char buffer[512];
+    } r;
+    size_t nkey = strlen(name);
+    size_t nval = strlen(value);
+    protocol_binary_response_status status;
+
+    memset(r.buffer, 0, sizeof(r));
+    r.param.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    r.param.message.header.request.opcode = PROTOCOL_BINARY_CMD_SET_PARAM;
+    r.param.message.header.request.keylen = htons((uint16_t)nkey);
+    r.param.message.header.request.extlen = sizeof(r.param.message.body);
+    r.param.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    r.param.message.header.request.bodylen =
+        htonl((uint32_t)(sizeof(r.param.message.body) + nkey + nval));
+    memcpy(r.buffer + sizeof(r.param.bytes), name, nkey);
+    memcpy(r.buffer + sizeof(r.param.bytes) + nkey, value, nval);
+
+    cb_assert(h1->unknown_command(h, NULL, &r.param.message.header,
+                                  response_handler) == ENGINE_SUCCESS);
+    cb_assert(last_response != NULL);
+    status = ntohs(last_response->response.status);
+    release_last_response();
+    return status;
+}
+
+/*
+ * Make sure that the LRU crawler reclaims the expired items without
+ * anyone asking for them, once it is told to run every second.
+ */
+static enum test_result lru_crawler_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const int nkeys = 100;
+    item *test_item;
+    uint64_t cas = 0;
+    int ii;
+
+    for (ii = 0; ii < nkeys; ++ii) {
+        char key[32];
+        size_t keylen = snprintf(key, sizeof(key), "lru_crawler_%d", ii);
+        cb_assert(h1->allocate(h, NULL, &test_item, key, keylen, 1, 0,
+                               ii % 2 ? 10 : 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+        cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                            0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, test_item);
+    }
+    test_harness.time_travel(11);
+
+    cb_assert(set_param(h, h1, "lru_crawler_bogus", "1") ==
+              PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+    cb_assert(set_param(h, h1, "lru_crawler_interval", "0") ==
+              PROTOCOL_BINARY_RESPONSE_EINVAL);
+    cb_assert(set_param(h, h1, "lru_crawler_interval", "1") ==
+              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    for (ii = 0; ii < 1000; ++ii) {
+        memset(&lru_stats, 0, sizeof(lru_stats));
+        cb_assert(h1->get_stats(h, NULL, "items", 5,
+                                lru_stats_handler) == ENGINE_SUCCESS);
+        if (lru_stats.crawler_reclaimed == nkeys / 2) {
+            break;
+        }
+        cb_assert(lru_stats.crawler_reclaimed < nkeys / 2);
+        usleep(10000);
+    }
+    cb_assert(ii < 1000);
+    cb_assert(lru_stats.number_hot + lru_stats.number_warm +
+              lru_stats.number_cold == nkeys / 2);
+    return SUCCESS;
+}
+
 static enum test_result touch_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     ENGINE_ERROR_CODE ret;
     union request {
@@ -833,6 +1441,211 @@ static enum test_result test_datatype(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+static ENGINE_HANDLE *dcp_h;
+static ENGINE_HANDLE_V1 *dcp_h1;
+
+struct dcp_log {
+    int markers;
+    uint64_t snap_start;
+    uint64_t snap_end;
+    int mutations;
+    int deletions;
+    uint64_t last_seqno;
+    char last_key[32];
+    int stream_ends;
+    uint32_t end_flags;
+} dcp_log;
+
+static uint64_t dcp_uuid;
+
+static ENGINE_ERROR_CODE dcp_failover_log(vbucket_failover_t *entries,
+                                          size_t nentries,
+                                          const void *cookie) {
+    cb_assert(nentries == 1);
+    dcp_uuid = entries[0].uuid;
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE dcp_marker(const void *cookie, uint32_t opaque,
+                                    uint16_t vbucket, uint64_t start_seqno,
+                                    uint64_t end_seqno, uint32_t flags) {
+    cb_assert(start_seqno == dcp_log.last_seqno + 1);
+    cb_assert(end_seqno >= start_seqno);
+    ++dcp_log.markers;
+    dcp_log.snap_start = start_seqno;
+    dcp_log.snap_end = end_seqno;
+    return ENGINE_SUCCESS;
+}
+
+static void dcp_seqno(uint64_t seqno, const void *key, uint16_t nkey) {
+    cb_assert(seqno > dcp_log.last_seqno);
+    cb_assert(seqno >= dcp_log.snap_start && seqno <= dcp_log.snap_end);
+    cb_assert(nkey < sizeof(dcp_log.last_key));
+    dcp_log.last_seqno = seqno;
+    memcpy(dcp_log.last_key, key, nkey);
+    dcp_log.last_key[nkey] = '\0';
+}
+
+static ENGINE_ERROR_CODE dcp_mutation(const void* cookie, uint32_t opaque,
+                                      item *itm, uint16_t vbucket,
+                                      uint64_t by_seqno, uint64_t rev_seqno,
+                                      uint32_t lock_time, const void *meta,
+                                      uint16_t nmeta, uint8_t nru) {
+    item_info info;
+    memset(&info, 0, sizeof(info));
+    info.nvalue = 1;
+    cb_assert(dcp_h1->get_item_info(dcp_h, cookie, itm, &info) == true);
+    dcp_seqno(by_seqno, info.key, info.nkey);
+    ++dcp_log.mutations;
+    dcp_h1->release(dcp_h, cookie, itm);
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE dcp_deletion(const void* cookie, uint32_t opaque,
+                                      const void *key, uint16_t nkey,
+                                      uint64_t cas, uint16_t vbucket,
+                                      uint64_t by_seqno, uint64_t rev_seqno,
+                                      const void *meta, uint16_t nmeta) {
+    dcp_seqno(by_seqno, key, nkey);
+    ++dcp_log.deletions;
+    return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE dcp_stream_end(const void *cookie, uint32_t opaque,
+                                        uint16_t vbucket, uint32_t flags) {
+    ++dcp_log.stream_ends;
+    dcp_log.end_flags = flags;
+    return ENGINE_SUCCESS;
+}
+
+/* Step the producer until it has nothing more for us */
+static void dcp_drain(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                      const void *cookie) {
+    struct dcp_message_producers producers;
+    ENGINE_ERROR_CODE ret;
+    int ii;
+
+    memset(&producers, 0, sizeof(producers));
+    producers.marker = dcp_marker;
+    producers.mutation = dcp_mutation;
+    producers.deletion = dcp_deletion;
+    producers.stream_end = dcp_stream_end;
+
+    for (ii = 0; ii < 10000; ++ii) {
+        ret = h1->dcp.step(h, cookie, &producers);
+        if (ret != ENGINE_WANT_MORE) {
+            break;
+        }
+    }
+    cb_assert(ret == ENGINE_SUCCESS);
+}
+
+static void seqno_store(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                        const char *key) {
+    item *test_item;
+    uint64_t cas = 0;
+    cb_assert(h1->allocate(h, NULL, &test_item, key, strlen(key), 1, 0, 0,
+                           PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                        0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+}
+
+/*
+ * Make sure that the mutations get increasing seqnos, and that a stream
+ * sends the ones after the seqno the consumer has in snapshots (skipping
+ * the items replaced since).
+ */
+static enum test_result seqno_stream_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const void *cookie = test_harness.create_cookie();
+    mutation_descr_t mut_info;
+    uint64_t rollback = 0;
+    uint64_t cas = 0;
+    char key[32];
+    int ii;
+
+    dcp_h = h;
+    dcp_h1 = h1;
+
+    /* Seqnos 1-100, then 101-110 replace the first 10 keys */
+    for (ii = 0; ii < 100; ++ii) {
+        snprintf(key, sizeof(key), "seqno_%d", ii);
+        seqno_store(h, h1, key);
+    }
+    for (ii = 0; ii < 10; ++ii) {
+        snprintf(key, sizeof(key), "seqno_%d", ii);
+        seqno_store(h, h1, key);
+    }
+    cb_assert(h1->remove(h, NULL, "seqno_99", 8, &cas, 0,
+                         &mut_info) == ENGINE_SUCCESS);
+    cb_assert(mut_info.seqno == 111);
+    cb_assert(mut_info.vbucket_uuid != 0);
+
+    cb_assert(h1->dcp.open(h, cookie, 0, 0, DCP_OPEN_PRODUCER,
+                           "seqno", 5) == ENGINE_SUCCESS);
+    cb_assert(h1->dcp.stream_req(h, cookie, 0, 1, 0, 0, UINT64_MAX, 0, 0, 0,
+                                 &rollback,
+                                 dcp_failover_log) == ENGINE_SUCCESS);
+    cb_assert(dcp_uuid == mut_info.vbucket_uuid);
+
+    memset(&dcp_log, 0, sizeof(dcp_log));
+    dcp_drain(h, h1, cookie);
+    cb_assert(dcp_log.markers == 1);
+    cb_assert(dcp_log.snap_start == 1 && dcp_log.snap_end == 111);
+    cb_assert(dcp_log.mutations == 99);
+    cb_assert(dcp_log.deletions == 1);
+    cb_assert(dcp_log.last_seqno == 111);
+    cb_assert(strcmp(dcp_log.last_key, "seqno_99") == 0);
+
+    /* The stream picks up the new mutations */
+    for (ii = 200; ii < 205; ++ii) {
+        snprintf(key, sizeof(key), "seqno_%d", ii);
+        seqno_store(h, h1, key);
+    }
+    memset(&dcp_log, 0, sizeof(dcp_log));
+    dcp_log.last_seqno = 111;
+    dcp_drain(h, h1, cookie);
+    cb_assert(dcp_log.markers == 1);
+    cb_assert(dcp_log.snap_start == 112 && dcp_log.snap_end == 116);
+    cb_assert(dcp_log.mutations == 5 && dcp_log.deletions == 0);
+    cb_assert(h1->dcp.close_stream(h, cookie, 0, 0) == ENGINE_SUCCESS);
+    cb_assert(h1->dcp.close_stream(h, cookie, 0, 0) == ENGINE_KEY_ENOENT);
+
+    /* A consumer which is up to date gets nothing */
+    cb_assert(h1->dcp.stream_req(h, cookie, 0, 1, 0, 116, UINT64_MAX,
+                                 dcp_uuid, 116, 116, &rollback,
+                                 dcp_failover_log) == ENGINE_SUCCESS);
+    memset(&dcp_log, 0, sizeof(dcp_log));
+    dcp_log.last_seqno = 116;
+    dcp_drain(h, h1, cookie);
+    cb_assert(dcp_log.markers == 0 && dcp_log.mutations == 0);
+    cb_assert(h1->dcp.close_stream(h, cookie, 0, 0) == ENGINE_SUCCESS);
+
+    /* A consumer with a history we don't know has to roll back */
+    cb_assert(h1->dcp.stream_req(h, cookie, 0, 1, 0, 200, UINT64_MAX,
+                                 dcp_uuid, 200, 200, &rollback,
+                                 dcp_failover_log) == ENGINE_ROLLBACK);
+    cb_assert(rollback == 116);
+    cb_assert(h1->dcp.stream_req(h, cookie, 0, 1, 0, 50, UINT64_MAX,
+                                 dcp_uuid + 1, 50, 50, &rollback,
+                                 dcp_failover_log) == ENGINE_ROLLBACK);
+    cb_assert(rollback == 0);
+
+    /* A stream with an end seqno ends once it got there */
+    cb_assert(h1->dcp.stream_req(h, cookie, 0, 1, 0, 0, 50, 0, 0, 0,
+                                 &rollback,
+                                 dcp_failover_log) == ENGINE_SUCCESS);
+    memset(&dcp_log, 0, sizeof(dcp_log));
+    dcp_drain(h, h1, cookie);
+    cb_assert(dcp_log.markers == 1 && dcp_log.snap_end == 50);
+    cb_assert(dcp_log.mutations == 40 && dcp_log.last_seqno == 50);
+    cb_assert(dcp_log.stream_ends == 1 && dcp_log.end_flags == 0);
+    cb_assert(h1->dcp.close_stream(h, cookie, 0, 0) == ENGINE_KEY_ENOENT);
+
+    test_harness.destroy_cookie(cookie);
+    return SUCCESS;
+}
+
 MEMCACHED_PUBLIC_API
 engine_test_t* get_tests(void) {
     static engine_test_t tests[]  = {
@@ -852,11 +1665,28 @@ engine_test_t* get_tests(void) {
         {"release test", release_test, NULL, NULL, NULL},
         {"incr test", incr_test, NULL, NULL, NULL},
         {"mt incr test", mt_incr_test, NULL, NULL, NULL},
+        {"mt store test", mt_store_test, NULL, NULL, NULL},
+        {"mt get test", mt_get_test, NULL, NULL, NULL},
         {"decr test", decr_test, NULL, NULL, NULL},
         {"flush test", flush_test, NULL, NULL, NULL},
         {"get item info test", get_item_info_test, NULL, NULL, NULL},
         {"set cas test", item_set_cas_test, NULL, NULL, NULL},
         {"LRU test", lru_test, NULL, NULL, "cache_size=48"},
+        {"LRU segments test", lru_segments_test, NULL, NULL, NULL},
+        {"LRU crawler test", lru_crawler_test, NULL, NULL, NULL},
+        {"slab rebalance test", slab_rebalance_test, NULL, NULL,
+         "cache_size=4194304;slab_automove_interval=1"},
+        {"slab magazine test", slab_magazine_test, NULL, NULL, NULL},
+        {"slab arena test", slab_arena_test, NULL, NULL,
+         "cache_size=4194304;hugepages=true"},
+        {"compact items test", compact_items_test, NULL, NULL,
+         "compact_items=true"},
+        {"LRU segments test (compact items)", lru_segments_test, NULL, NULL,
+         "compact_items=true"},
+        {"LRU crawler test (compact items)", lru_crawler_test, NULL, NULL,
+         "compact_items=true"},
+        {"hash resize test", hash_resize_test, NULL, NULL,
+         "hashpower=13;hash_bulk_move=64"},
         {"get stats test", get_stats_test, NULL, NULL, NULL},
         {"reset stats test", reset_stats_test, NULL, NULL, NULL},
         {"get stats struct test", get_stats_struct_test, NULL, NULL, NULL},
@@ -865,6 +1695,7 @@ engine_test_t* get_tests(void) {
         {"Get And Touch", gat_test, NULL, NULL, NULL},
         {"Get And Touch Quiet", gatq_test, NULL, NULL, NULL},
         {"Test datatype", test_datatype, NULL, NULL, NULL},
+        {"seqno stream test", seqno_stream_test, NULL, NULL, "seqnos=true"},
         {NULL, NULL, NULL, NULL, NULL}
     };
     return tests;